@@ -13,6 +13,18 @@ extern "C" {
 struct _PyCancelObject; /* Avoid including cancelobject.h */
 
 struct _PyBranchObject;
+struct _PyBranchMap;
+
+/* Returned by branch.addresult().  The child fills it in as it finishes,
+ * so the result can be used before the branch exits. */
+typedef struct _PyBranchFutureObject {
+    PyObject_HEAD
+    PyThread_type_lock *lock;
+    int done;
+    PyObject *result;
+    PyObject *exception;
+    PyLinkedList selectors;     /* PySelectWaiters waiting for done */
+} PyBranchFutureObject;
 
 typedef struct _PyBranchChild {
     PyState *pystate;
@@ -25,6 +37,9 @@ typedef struct _PyBranchChild {
     PyObject *result;
     PyObject *exception;
     PyThread_type_flag *dead;
+    double queued_at; /* When it was handed to the worker pool */
+    struct _PyBranchMap *map; /* Set if this is a chunk of branch.map() */
+    PyBranchFutureObject *future; /* Set if added by branch.addresult() */
     PyLinkedListNode children_links;
     PyLinkedListNode alive_links; /* Also used by deletable */
     PyWaitFor waitfor;
@@ -54,11 +69,31 @@ PyAPI_DATA(PyTypeObject) PyBranch_Type;
 #define PyBranch_Check(op) PyObject_TypeCheck(op, &PyBranch_Type)
 #define PyBranch_CheckExact(op) (Py_TYPE(op) == &PyBranch_Type)
 
+PyAPI_DATA(PyTypeObject) PyBranchFuture_Type;
+PyAPI_DATA(PyTypeObject) PyBranchCompletion_Type;
+PyAPI_DATA(PyObject *) PyExc_FutureTimeout;
+
+#define PyBranchFuture_Check(op) (Py_TYPE(op) == &PyBranchFuture_Type)
+
+/* For threadtools.select().  Adding returns 1 if the future is already
+ * done, in which case the waiter may not be woken. */
+PyAPI_FUNC(int) _PyBranchFuture_AddSelector(PyBranchFutureObject *,
+    PySelectWaiter *);
+PyAPI_FUNC(void) _PyBranchFuture_RemoveSelector(PyBranchFutureObject *,
+    PySelectWaiter *);
+
 #define BRANCH_NEW      1
 #define BRANCH_ALIVE    2
 #define BRANCH_DYING    3
 #define BRANCH_DEAD     4
 
+/* Finished children leave their thread parked in a process-wide pool for
+ * reuse by later branch.add() calls.  The pool size is the number of idle
+ * threads kept; 0 gives every child a fresh thread. */
+PyAPI_FUNC(void) PyBranch_SetPoolSize(Py_ssize_t);
+PyAPI_FUNC(Py_ssize_t) PyBranch_GetPoolSize(void);
+PyAPI_FUNC(PyObject *) PyBranch_GetPoolStats(void);
+
 
 #ifdef __cplusplus
 }
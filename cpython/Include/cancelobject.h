@@ -38,6 +38,8 @@ PyAPI_FUNC(PyCancelObject *) PyCancel_New(
     void *, PyState *);
 PyAPI_FUNC(void) PyCancel_Push(PyCancelObject *);
 PyAPI_FUNC(void) PyCancel_Pop(PyCancelObject *);
+/* Returns 1 with Cancelled set if the current scope is cancelled, else 0 */
+PyAPI_FUNC(int) PyCancel_CheckCancelled(void);
 
 /* Cancel marks a given PyCancelObject as cancelled, notifying children 
  * of this.  This childrens' callbacks are not called until Finish. */
@@ -45,6 +47,15 @@ PyAPI_FUNC(void) PyCancelQueue_Init(PyCancelQueue *);
 PyAPI_FUNC(void) PyCancelQueue_Cancel(PyCancelQueue *, PyCancelObject *);
 PyAPI_FUNC(void) PyCancelQueue_Finish(PyCancelQueue *);
 
+/* Waits until fd has one of events (POLLIN, POLLOUT, ...) ready.
+ * Returns 0, or -1 with an exception set if cancelled or poll fails. */
+PyAPI_FUNC(int) PyCancel_Poll(int fd, short events);
+
+/* Sleep for secs, or until cancelled.  Return 0, or -1 with Cancelled
+ * set.  SleepForever only ever returns -1. */
+PyAPI_FUNC(int) PyCancel_Sleep(double secs);
+PyAPI_FUNC(int) PyCancel_SleepForever(void);
+
 
 #ifdef __cplusplus
 }
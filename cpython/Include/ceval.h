@@ -71,6 +71,14 @@ PyAPI_FUNC(const char *) PyEval_GetFuncName(PyObject *);
 PyAPI_FUNC(const char *) PyEval_GetFuncDesc(PyObject *);
 
 PyAPI_FUNC(PyObject *) PyEval_GetCallStats(PyObject *);
+
+/* The dynamic execution profile behind sys.setdxp() and sys.getdxp() */
+PyAPI_FUNC(int) PyEval_SetDXProfile(int);
+PyAPI_FUNC(PyObject *) PyEval_GetDXProfile(void);
+PyAPI_FUNC(PyObject *) PyEval_GetDXProfileCodes(void);
+PyAPI_FUNC(void) _PyEval_DXProfileInit(void);
+PyAPI_FUNC(void) _PyEval_DXProfileBind(PyState *);
+PyAPI_FUNC(void) _PyEval_DXProfileRetire(PyState *);
 PyAPI_FUNC(PyObject *) PyEval_EvalFrame(struct _frame *);
 PyAPI_FUNC(PyObject *) PyEval_EvalFrameEx(struct _frame *f, int exc);
 
@@ -6,6 +6,16 @@
 extern "C" {
 #endif
 
+struct _PyMarshalMap; /* Private to marshal.c */
+
+/* Where a lazily unmarshalled code object's missing parts are */
+typedef struct _PyCodeLazy {
+    struct _PyMarshalMap *map;	/* the marshal data they're in */
+    Py_ssize_t code;		/* offset of co_code, co_consts and co_names */
+    Py_ssize_t lnotab;		/* offset of co_lnotab */
+    PyObject *doc;		/* co_consts[0] if it's a docstring, else NULL */
+} PyCodeLazy;
+
 /* Bytecode object */
 typedef struct {
     PyObject_HEAD
@@ -26,6 +36,12 @@ typedef struct {
     int co_firstlineno;		/* first source line number */
     PyObject *co_lnotab;	/* string (encoding addr<->lineno mapping) */
     void *co_zombieframe;     /* for optimization only (see frameobject.c) */
+    AO_t co_quickened;		/* specialized copy of co_code, or 0 (see
+				   quicken_code() in ceval.c) */
+    int co_warmup;		/* times entered before being quickened */
+    PyCodeLazy *co_lazy;	/* if unmarshalled lazily, where co_code,
+				   co_consts, co_names and co_lnotab are to be
+				   read from while they're NULL, else NULL */
 } PyCodeObject;
 
 /* Masks for co_flags above */
@@ -73,6 +89,21 @@ PyAPI_FUNC(PyCodeObject *) PyCode_New(
         /* same as struct above */
 PyAPI_FUNC(int) PyCode_Addr2Line(PyCodeObject *, int);
 
+/* Code objects nested in others are unmarshalled lazily from .pyc files
+   when PYTHONLAZYCODE is set, leaving co_code, co_consts, co_names and
+   co_lnotab NULL until the code is first run or they're looked at.
+   PyCode_Load() fills them in if need be; it returns -1 with an exception
+   set if it can't, else 0.  co_lnotab is filled in last. */
+#define PyCode_Load(co) \
+	((co)->co_lazy == NULL || \
+	 AO_load_acquire((AO_t *)&(co)->co_lnotab) != 0 ? 0 : _PyCode_Load(co))
+PyAPI_FUNC(int) _PyCode_Load(PyCodeObject *);
+/* lazy becomes the new code object's, freed along with it, even if
+   creating it fails */
+PyAPI_FUNC(PyCodeObject *) _PyCode_NewLazy(
+	int, int, int, int, int, PyObject *, PyObject *, PyObject *,
+	PyObject *, PyObject *, int, PyCodeLazy *lazy);
+
 /* for internal use only */
 #define _PyCode_GETCODEPTR(co, pp) \
 	((*Py_TYPE((co)->co_code)->tp_as_buffer->bf_getreadbuffer) \
@@ -35,6 +35,13 @@ PyAPI_FUNC(int) _PyImport_IsScript(struct filedescr *);
 PyAPI_FUNC(PyObject *)_PyImport_FindExtension(char *, char *);
 PyAPI_FUNC(PyObject *)_PyImport_FixupExtension(char *, char *);
 
+/* Reads the shared modules image at path (PYTHONSHAREDIMAGE), if it's
+   usable, so that the modules in it are built from it when imported */
+PyAPI_FUNC(void) _PyImport_LoadSharedImage(const char *path);
+PyAPI_FUNC(PyObject *) _PyImport_FindSharedImage(const char *fullname,
+						 const char *pathname);
+PyAPI_FUNC(void) _PyImport_FiniSharedImage(void);
+
 struct _inittab {
     char *name;
     void (*initfunc)(void);
@@ -18,6 +18,27 @@ PyAPI_FUNC(int) PyMarshal_ReadShortFromFile(FILE *);
 PyAPI_FUNC(PyObject *) PyMarshal_ReadObjectFromFile(FILE *);
 PyAPI_FUNC(PyObject *) PyMarshal_ReadLastObjectFromFile(FILE *);
 PyAPI_FUNC(PyObject *) PyMarshal_ReadObjectFromString(char *, Py_ssize_t);
+/* Like PyMarshal_ReadLastObjectFromFile(), but maps the file into memory
+   and leaves the code objects nested in the one read to be unmarshalled
+   from it when they're first needed (see PyCode_Load()) */
+PyAPI_FUNC(PyObject *) PyMarshal_ReadLazyObjectFromFile(FILE *);
+
+/* For shared module images (sharedimage.c): map the whole file fp is open
+   on into memory, and read objects from offsets in it, leaving every code
+   object in them unread until it's needed */
+struct _PyMarshalMap;
+PyAPI_FUNC(struct _PyMarshalMap *) _PyMarshal_MapFile(FILE *);
+PyAPI_FUNC(PyObject *) _PyMarshal_ReadMapped(struct _PyMarshalMap *,
+					     Py_ssize_t offset);
+PyAPI_FUNC(void) _PyMarshal_ReleaseMap(struct _PyMarshalMap *);
+
+/* For codeobject.c: read the parts of a lazily unmarshalled code object
+   left out, returning new references, or free where they were */
+struct _PyCodeLazy;
+PyAPI_FUNC(int) _PyMarshal_ReadLazyCode(struct _PyCodeLazy *,
+	PyObject **code, PyObject **consts, PyObject **names,
+	PyObject **lnotab);
+PyAPI_FUNC(void) _PyMarshal_FreeLazyCode(struct _PyCodeLazy *);
 
 #ifdef __cplusplus
 }
@@ -28,6 +28,8 @@ typedef struct _PyMonitorSpaceObject {
     /* XXX flag (or counter?) used by PyState_StopTheWorld */
     PyLinkedList waiters;
     PyThread_type_cond *idle;
+    /* When the lock profiler saw us acquired, or 0 */
+    PY_LONG_LONG prof_acquired;
 } PyMonitorSpaceObject;
 
 PyAPI_DATA(PyTypeObject) PyMonitorMeta_Type;
@@ -61,6 +63,7 @@ PyAPI_FUNC(double) PyMonitorSpace_GetDeadlockDelay(void);
 PyAPI_FUNC(void) _PyMonitorSpace_WaitForBranchChild(struct _PyBranchChild *);
 PyAPI_FUNC(void) _PyMonitorSpace_BlockOnSelf(PyWaitFor *);
 PyAPI_FUNC(void) _PyMonitorSpace_UnblockOnSelf(PyWaitFor *);
+PyAPI_FUNC(PyObject *) _PyMonitorSpace_Select(PyObject *, double);
 
 PyAPI_FUNC(PyObject *) PyMonitorMethod_New(PyObject *);
 PyAPI_FUNC(PyObject *) PyBoundMonitorMethod_New(PyObject *, PyObject *);
@@ -719,9 +719,41 @@ PyAPI_FUNC(void) _Py_AddToAllObjects(PyObject *, int force);
 PyAPI_FUNC(Py_ssize_t) _Py_RefcntSnoop(PyObject *);
 
 #ifndef WITH_GIL
-PyAPI_FUNC(void) _Py_INCREF(PyObject *, PyState *);
-PyAPI_FUNC(void) _Py_DECREF(PyObject *, PyState *);
+/* The common case, an object whose refowner is the current thread, is
+ * handled inline.  Asynchronous counts, promoting an object owned by
+ * another thread, and a DECREF that deallocates go through the out of
+ * line _SLOW functions in gcmodule.c. */
+PyAPI_FUNC(void) _Py_INCREF_SLOW(PyObject *, PyState *);
+PyAPI_FUNC(void) _Py_DECREF_SLOW(PyObject *, PyState *);
 PyAPI_FUNC(void) _Py_DECREF_ASYNC(PyObject *, PyState *);
+
+static inline void
+_Py_INCREF(PyObject *op, PyState *pystate)
+{
+	assert(pystate != NULL);
+	assert(!pystate->suspended);
+
+	if ((PyState *)AO_load_acquire(&op->ob_refowner) == pystate) {
+		_Py_INC_REFTOTAL();
+		op->ob_refcnt++;
+	} else
+		_Py_INCREF_SLOW(op, pystate);
+}
+
+static inline void
+_Py_DECREF(PyObject *op, PyState *pystate)
+{
+	assert(pystate != NULL);
+	assert(!pystate->suspended);
+
+	if ((PyState *)AO_load_acquire(&op->ob_refowner) == pystate &&
+			op->ob_refcnt > 1) {
+		_Py_DEC_REFTOTAL();
+		op->ob_refcnt--;
+	} else
+		_Py_DECREF_SLOW(op, pystate);
+}
+
 #define Py_INCREF(op) _Py_INCREF((PyObject *)(op), PyState_Get())
 #define Py_DECREF(op) _Py_DECREF((PyObject *)(op), PyState_Get())
 #define Py_DECREF_ASYNC(op) _Py_DECREF_ASYNC((PyObject *)(op), PyState_Get())
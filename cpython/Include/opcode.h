@@ -132,6 +132,33 @@ extern "C" {
 /* Support for opargs more than 16 bits long */
 #define EXTENDED_ARG  143
 
+/* Superinstructions: each runs the instruction it replaces and the one
+   after it, whose opcode is left in place and whose argument it reads.
+   Only the peephole optimizer emits them (see fuse_superinstructions()). */
+#define LOAD_FAST__LOAD_FAST		149
+#define LOAD_FAST__LOAD_CONST		150
+#define LOAD_FAST__LOAD_ATTR		151
+#define STORE_FAST__LOAD_FAST		152
+#define LOAD_CONST__RETURN_VALUE	153
+#define COMPARE_OP__JUMP_IF_FALSE	154
+#define JUMP_IF_FALSE__POP_TOP		155
+
+/* Specialized forms of the opcodes above.  The compiler never emits
+   these; ceval.c writes them into a code object's quickened copy of its
+   bytecode (see quicken_code()), so they never show up in co_code. */
+#define BINARY_ADD_ADAPTIVE	44
+#define BINARY_ADD_INT		45
+#define BINARY_ADD_UNICODE	46
+#define INPLACE_ADD_ADAPTIVE	47
+#define INPLACE_ADD_INT		48
+#define INPLACE_ADD_UNICODE	49
+
+#define COMPARE_OP_ADAPTIVE	144
+#define COMPARE_OP_INT		145
+#define COMPARE_OP_FLOAT	146
+#define CALL_FUNCTION_ADAPTIVE	147
+#define CALL_FUNCTION_PY	148
+
 
 enum cmp_op {PyCmp_LT=Py_LT, PyCmp_LE=Py_LE, PyCmp_EQ=Py_EQ, PyCmp_NE=Py_NE, PyCmp_GT=Py_GT, PyCmp_GE=Py_GE,
 	     PyCmp_IN, PyCmp_NOT_IN, PyCmp_IS, PyCmp_IS_NOT, PyCmp_EXC_MATCH, PyCmp_BAD};
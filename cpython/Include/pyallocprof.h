@@ -0,0 +1,89 @@
+/* Allocation profiler */
+
+#ifndef Py_PYALLOCPROF_H
+#define Py_PYALLOCPROF_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* While allocation profiling is on, each thread counts down the bytes it
+ * allocates through _PyObject_GC_Malloc() and pymemcache_malloc(), and
+ * every time the count runs out it samples the allocation: it records
+ * the Python traceback, size and, for objects, type in a buffer of its
+ * own.  The count is reset to about the sampling rate each time, so an
+ * allocation is sampled about once per rate bytes, and each sample
+ * stands for rate bytes or its own size, whichever is more.
+ *
+ * A sampled block is allocated with room for a pointer to its record in
+ * front of it, and its size class is stored with _PyAllocProf_FLAG
+ * flipped, which takes it out of the range of real size classes.
+ * Whoever frees the block marks its record freed, and the allocating
+ * thread throws freed records away as its buffer grows.  Records hold no
+ * references, as allocations happen inside critical sections, under
+ * PyGC_lock and while suspended.
+ *
+ * obmalloc.c is linked into pgen as well, so pymemcache_malloc() calls
+ * _PyAllocProf_Sample() through pymalloc_sample_hook, set only while
+ * sampling, and marks records with the macros below. */
+
+PyAPI_DATA(Py_ssize_t) _PyAllocProf_Rate;
+
+#define _PyAllocProf_PREFIX 16
+#define _PyAllocProf_FLAG ((Py_ssize_t)1 << (sizeof(Py_ssize_t) * 8 - 2))
+/* Real size classes have their top two bits equal */
+#define _PyAllocProf_IS_SAMPLED(sizeclass) \
+    ((((size_t)(sizeclass) >> 1) ^ (size_t)(sizeclass)) & \
+        (size_t)_PyAllocProf_FLAG)
+#define _PyAllocProf_SIZECLASS(sizeclass) \
+    (_PyAllocProf_IS_SAMPLED(sizeclass) ? \
+        (sizeclass) ^ _PyAllocProf_FLAG : (sizeclass))
+/* The record of a sampled block that starts at mem */
+#define _PyAllocProf_RECORD(mem) \
+    (*(void **)((char *)(mem) - _PyAllocProf_PREFIX))
+
+/* The start of every record, the part anyone may write to */
+typedef struct {
+    AO_t freed;
+    AO_t size;
+} _PyAllocProf_RecordHead;
+
+/* Called with a sampled block's record as it's resized */
+#define _PyAllocProf_Resized(record, newsize) \
+    AO_store_full(&((_PyAllocProf_RecordHead *)(record))->size, (newsize))
+/* Called as a sampled block is freed, or fails to be allocated.  The
+ * record may be gone the moment this is seen. */
+#define _PyAllocProf_Freed(record) \
+    AO_store_release(&((_PyAllocProf_RecordHead *)(record))->freed, 1)
+
+PyAPI_FUNC(void) _PyAllocProf_Init(void);
+
+/* Starts sampling an allocation about every rate bytes, with up to
+ * nframes frames of traceback, and forgets the allocations sampled so
+ * far.  Returns -1 with an exception set if the arguments are bad. */
+PyAPI_FUNC(int) PyAllocProf_Start(Py_ssize_t rate, int nframes);
+/* Stops sampling.  The sampled allocations stay until they're freed. */
+PyAPI_FUNC(void) PyAllocProf_Stop(void);
+/* Returns the sampling rate, or 0 if not sampling */
+PyAPI_FUNC(Py_ssize_t) PyAllocProf_GetRate(void);
+/* Returns a list of (thread, type, size, weight, traceback) for the
+ * sampled allocations still live.  type is the type's name, or None for
+ * memory that isn't an object; weight is the bytes the sample stands
+ * for; and traceback is a tuple of (filename, funcname, lineno),
+ * outermost first. */
+PyAPI_FUNC(PyObject *) PyAllocProf_GetSamples(void);
+
+/* Called while sampling, by the allocators, with the size of the block
+ * they're about to allocate.  Returns a record if it's to be sampled,
+ * else NULL. */
+PyAPI_FUNC(void *) _PyAllocProf_Sample(size_t size);
+/* Tells the record of a sampled block what it turned out to be */
+PyAPI_FUNC(void) _PyAllocProf_SetType(void *record, PyTypeObject *);
+/* Called by an exiting thread, to keep its samples */
+PyAPI_FUNC(void) _PyAllocProf_Retire(PyState *);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* !Py_PYALLOCPROF_H */
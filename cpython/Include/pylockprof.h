@@ -0,0 +1,63 @@
+/* Lock contention profiler */
+
+#ifndef Py_PYLOCKPROF_H
+#define Py_PYLOCKPROF_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* While lock profiling is on, each thread times the locks it waits for
+ * and holds, and counts them per lock and per Python call site in a
+ * table only it writes to.  Call sites are the innermost Python frame
+ * when the lock is acquired or released, so hold times are charged to
+ * the code that let go of the lock.  Uncontended acquisitions are
+ * counted but not timed.
+ *
+ * The hooks run inside critical sections and under PyGC_lock, so they
+ * never touch a reference count and never take a lock that waits for
+ * other threads.  With profiling off each costs a load of
+ * _PyLockProf_Enabled. */
+
+/* What was waited for */
+#define PyLockProf_CRITICAL     1       /* A PyCritical */
+#define PyLockProf_MONITORSPACE 2       /* A MonitorSpace */
+#define PyLockProf_REFOWNER     3       /* Promoting another thread's object */
+#define PyLockProf_WORLD        4       /* PyState_StopTheWorld */
+#define PyLockProf_GC           5       /* PyGC_lock */
+
+/* Times are histogrammed in powers of two nanoseconds, bucket i holding
+ * times of at least 2**i ns (bucket 0 also holding 0) and the last
+ * bucket everything longer */
+#define PyLockProf_BUCKETS 40
+
+PyAPI_DATA(int) _PyLockProf_Enabled;
+
+PyAPI_FUNC(void) _PyLockProf_Init(void);
+
+/* Starts profiling, throwing away any times already counted */
+PyAPI_FUNC(void) PyLockProf_Start(void);
+/* Stops profiling, keeping the times counted */
+PyAPI_FUNC(void) PyLockProf_Stop(void);
+/* Returns a list with a dict per lock and call site, as documented for
+ * sys.getlockprofile() */
+PyAPI_FUNC(PyObject *) PyLockProf_GetStats(void);
+
+/* A monotonic clock in nanoseconds, for timing waits */
+PyAPI_FUNC(PY_LONG_LONG) _PyLockProf_Now(void);
+/* Counts an acquisition of lock, having waited since the given time, or
+ * 0 if it wasn't contended.  Returns the time it was acquired, to be
+ * passed to _PyLockProf_Released().  Only call while profiling. */
+PyAPI_FUNC(PY_LONG_LONG) _PyLockProf_Acquired(int kind, const char *name,
+    void *lock, PY_LONG_LONG waited_since);
+/* Counts the time lock was held, if acquired isn't 0 */
+PyAPI_FUNC(void) _PyLockProf_Released(int kind, const char *name,
+    void *lock, PY_LONG_LONG acquired);
+/* Called by an exiting thread, to keep its times */
+PyAPI_FUNC(void) _PyLockProf_Retire(PyState *);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* !Py_PYLOCKPROF_H */
@@ -0,0 +1,42 @@
+/* Sampling profiler */
+
+#ifndef Py_PYSAMPLER_H
+#define Py_PYSAMPLER_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* While sampling is on, a timer thread of the sampler's own asks every
+ * live thread for a sample every interval seconds.  Each thread answers
+ * at its next tick by walking its own frame chain and counting the stack
+ * it found in a table only it writes to, so no thread is ever stopped on
+ * another's behalf.  A thread that was blocked answers the requests it
+ * missed as it resumes, with the stack it was blocked in. */
+
+PyAPI_FUNC(void) _PySampler_Init(void);
+
+/* Starts sampling every interval seconds, throwing away any samples
+ * already taken.  Returns -1 with an exception set if the timer thread
+ * can't be started. */
+PyAPI_FUNC(int) PySampler_Start(double interval);
+/* Stops sampling, keeping the samples taken */
+PyAPI_FUNC(void) PySampler_Stop(void);
+/* Returns the interval, or 0.0 if sampling is off */
+PyAPI_FUNC(double) PySampler_GetInterval(void);
+/* Returns a list of (thread, stack, count), where thread numbers the
+ * threads in the order they were first sampled and stack is a tuple of
+ * (code, lineno), outermost first */
+PyAPI_FUNC(PyObject *) PySampler_GetSamples(void);
+
+/* Called by PyState_Tick and PyState_MaybeResume when samples have been
+ * asked for */
+PyAPI_FUNC(void) _PySampler_Take(PyState *);
+/* Called by an exiting thread, to keep its samples */
+PyAPI_FUNC(void) _PySampler_Retire(PyState *);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* !Py_PYSAMPLER_H */
@@ -33,6 +33,10 @@ struct _PyState_EnterFrame; /* Forward */
 struct _frame; /* Avoid including frameobject.h */
 struct _PyMonitorSpaceObject; /* Avoid including monitorobject.h */
 struct _PyCancelObject; /* Avoid including cancelobject.h */
+struct _PyDXProfile; /* Private to ceval.c */
+struct _PySampleTable; /* Private to sampler.c */
+struct _PyLockProfTable; /* Private to lockprof.c */
+struct _PyAllocBuffer; /* Private to allocprof.c */
 
 /* Py_tracefunc return -1 when raising an exception, or 0 for success. */
 typedef int (*Py_tracefunc)(PyObject *, struct _frame *, int, PyObject *);
@@ -80,8 +84,18 @@ typedef struct _PyCritical {
     PyThread_type_lock *lock;
     Py_ssize_t depth;
     struct _PyCritical *prev;
+    const char *name;   /* For the lock profiler; may be NULL */
+    PY_LONG_LONG prof_acquired; /* When the lock profiler saw us entered */
 } PyCritical;
 
+/* Links a thread blocked in a condition wait or threadtools.select()
+ * onto the waiter list of something it is waiting for.  Whoever makes
+ * that something ready wakes the thread by setting its condition_flag. */
+typedef struct _PySelectWaiter {
+    PyLinkedListNode links;
+    struct _PyState *pystate;
+} PySelectWaiter;
+
 struct _object;  /* From object.h, which includes us.  Doh! */
 
 typedef struct {
@@ -114,6 +128,25 @@ typedef struct _PyState {
     PyObject *c_profileobj;
     PyObject *c_traceobj;
 
+    /* Nonzero while a trace function or the opcode counters have to see
+       every instruction.  ceval then goes around its loop for each one
+       rather than dispatching straight to the next. */
+    int instr_hooks;
+    /* This thread's opcode counts while sys.setdxp() is on, else NULL */
+    struct _PyDXProfile *dxp;
+
+    /* Samples the sampling profiler has asked for and we have yet to
+     * take, and the stacks we've been sampled in (see pysampler.h) */
+    AO_t sample_pending;
+    struct _PySampleTable *samples;
+    /* The locks we've waited for and held while sys.setlockprofile() is
+     * on (see pylockprof.h) */
+    struct _PyLockProfTable *lockprof;
+    /* Bytes left to allocate before the next sample, and the allocations
+     * sampled while sys.setallocprofile() is on (see pyallocprof.h) */
+    Py_ssize_t alloc_countdown;
+    struct _PyAllocBuffer *allocprof;
+
     PyObject *curexc_type;
     PyObject *curexc_value;
     PyObject *curexc_traceback;
@@ -150,6 +183,10 @@ typedef struct _PyState {
 
     PyLinkedList cancel_stack;
     PyCritical *cancel_crit;
+    /* Cancellation writes to this to wake us from PyCancel_Poll.  Opened
+     * on first use and kept until we're deleted.  Both ends are the same
+     * eventfd where that's available. */
+    int cancel_wakeup[2];
 
     /* Simple lock that doesn't employ deadlock detection */
     PyCritical *critical_section;
@@ -165,8 +202,7 @@ typedef struct _PyState {
     PyLinkedListNode monitorspace_waitinglinks;
     PyThread_type_flag *monitorspace_waitingflag;
 
-    /* The Monitor condition that this thread may be waiting on */
-    PyLinkedListNode condition_links;
+    /* Set to wake us from a condition wait or threadtools.select() */
     PyThread_type_flag *condition_flag;
 
     /* XXX signal handlers should also be here */
@@ -184,6 +220,8 @@ PyAPI_FUNC(PyState *) _PyState_New(void);
 PyAPI_FUNC(void) _PyState_Delete(PyState *);
 
 PyAPI_FUNC(PyState *) _PyState_Get(void);
+/* Like PyState_Get(), but returns NULL if the thread has no PyState */
+PyAPI_FUNC(PyState *) _PyState_Peek(void);
 #if defined(Py_BUILD_CORE) && defined(HAVE_THREAD_LOCAL_VARIABLE)
 PyAPI_DATA(__thread PyState *) _py_local_pystate;
 static inline PyState *
@@ -236,6 +274,10 @@ PyAPI_FUNC(int) _PyState_EnterPreallocated(PyState_EnterFrame *, PyState *);
 PyAPI_FUNC(void) PyState_Exit(PyState_EnterFrame *);
 PyAPI_FUNC(void) _PyState_ExitPreallocated(PyState_EnterFrame *);
 
+/* Reset the outermost frame so a pooled thread can run unrelated code as
+ * though it were freshly entered. */
+PyAPI_FUNC(void) _PyState_Recycle(PyState_EnterFrame *);
+
 typedef struct _frame *(*PyThreadFrameGetter)(PyState *self_);
 
 /* hook for PyEval_GetFrame(), requested for Psyco */
@@ -250,6 +292,14 @@ PyAPI_FUNC(void) PyState_ExitImport(void);
 PyAPI_FUNC(void) PyState_StopTheWorld(void);
 PyAPI_FUNC(void) PyState_StartTheWorld(void);
 
+/* The list of every PyState ever bound, linked through next.  Only safe
+ * to walk while the world is stopped.  Threads that have exited stay on
+ * it with their deleted flag set. */
+PyAPI_FUNC(PyState *) _PyState_Head(void);
+/* Asks every live thread for a sample of its stack.  Called by the
+ * sampler's timer thread, which has no PyState of its own. */
+PyAPI_FUNC(void) _PyState_RequestSamples(void);
+
 
 /* Prefered API for locking if PyState is involved.  Required if
  * Py_INCREF/Py_DECREF are used.  The code is assumed to be a critical
@@ -257,6 +307,8 @@ PyAPI_FUNC(void) PyState_StartTheWorld(void);
  * critical sections is an error.)  PyState_Suspend might be called
  * while entering. */
 PyAPI_FUNC(PyCritical *) PyCritical_Allocate(Py_ssize_t);
+/* The same, named for the lock profiler's reports */
+PyAPI_FUNC(PyCritical *) PyCritical_AllocateNamed(Py_ssize_t, const char *);
 PyAPI_FUNC(void) PyCritical_Free(PyCritical *);
 PyAPI_FUNC(void) PyCritical_Enter(PyCritical *);
 PyAPI_FUNC(void) PyCritical_Exit(PyCritical *);
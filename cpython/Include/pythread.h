@@ -74,6 +74,10 @@ PyAPI_FUNC(void) PyThread_flag_set(PyThread_type_flag *);
 PyAPI_FUNC(void) PyThread_flag_clear(PyThread_type_flag *);
 PyAPI_FUNC(void) PyThread_flag_wait(PyThread_type_flag *);
 PyAPI_FUNC(int) PyThread_flag_timedwait(PyThread_type_flag *, double delay);
+/* Like PyThread_flag_timedwait, but against a deadline that can be
+ * reused across several waits. */
+PyAPI_FUNC(int) PyThread_flag_timeoutwait(PyThread_type_flag *,
+    PyThread_type_timeout *);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,113 @@
+/* Per-thread tables, for the profilers */
+
+#ifndef Py_PYTHREADTABLE_H
+#define Py_PYTHREADTABLE_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Each profiler counts what a thread does in a table of that thread's
+ * own, hung off its PyState, so counting never waits for anyone.  A table
+ * is only ever written by its owner, or by someone else with the world
+ * stopped.  When a thread exits it retires its table into a list kept
+ * under a lock, and the profiler collects every table, living or
+ * retired, with the world stopped.
+ *
+ * Tables are malloc()ed, as their owner may have no use of PyMem when it
+ * is bound or when it exits.
+ *
+ * A table may hold references.  Those are taken by the owner, or with
+ * the world stopped, as stopped threads own nothing another thread might
+ * wait for.  They are only dropped with the world running, since that may
+ * free an object.  Nobody holding the lock touches a reference count at
+ * all: an exiting thread waits for it while it still owns its objects. */
+
+/* The first member of every per-thread table */
+typedef struct _PyThreadTable {
+    struct _PyThreadTable *next;        /* Links retired tables */
+    long thread;        /* Numbers the threads as they start counting */
+} _PyThreadTable;
+
+typedef struct {
+    PyThread_type_lock *lock;
+    _PyThreadTable *retired;            /* Protected by lock */
+    AO_t threads;
+    Py_ssize_t offset;  /* Of the PyState member holding the table */
+    /* If not NULL, adds a retiring table into the retired one, which is
+     * then the only one, rather than keeping it.  Called with the lock
+     * held, so it mustn't touch a reference count. */
+    void (*merge)(_PyThreadTable *retired, _PyThreadTable *table);
+    /* Frees a table, dropping its references */
+    void (*free_table)(_PyThreadTable *table);
+} _PyThreadTables;
+
+/* Returns -1 if out of memory */
+PyAPI_FUNC(int) _PyThreadTables_Init(_PyThreadTables *, Py_ssize_t offset,
+    void (*merge)(_PyThreadTable *, _PyThreadTable *),
+    void (*free_table)(_PyThreadTable *));
+/* Returns a zeroed table of size bytes for the next thread to start
+ * counting, or NULL if out of memory */
+PyAPI_FUNC(void *) _PyThreadTables_New(_PyThreadTables *, size_t size);
+/* Called by an exiting thread, to keep its table */
+PyAPI_FUNC(void) _PyThreadTables_Retire(_PyThreadTables *, PyState *);
+/* Keeps a table taken from a thread, as if the thread had retired it.
+ * Call with the world running if merge may free it. */
+PyAPI_FUNC(void) _PyThreadTables_Add(_PyThreadTables *, _PyThreadTable *);
+/* Takes every living thread's table out of use, and the retired ones too
+ * if retired is nonzero, and starts numbering threads afresh.  Returns
+ * the tables linked by next.  Call with the world stopped. */
+PyAPI_FUNC(_PyThreadTable *) _PyThreadTables_Take(_PyThreadTables *,
+    int retired);
+/* Calls visit on every table, retired then living, until it returns
+ * nonzero, and returns that.  Call with the world stopped. */
+PyAPI_FUNC(int) _PyThreadTables_Visit(_PyThreadTables *,
+    int (*visit)(_PyThreadTable *, void *), void *arg);
+/* Takes the retired tables that drop() is true of out of the list, and
+ * returns them linked by next.  Call with the world stopped. */
+PyAPI_FUNC(_PyThreadTable *) _PyThreadTables_Prune(_PyThreadTables *,
+    int (*drop)(_PyThreadTable *));
+/* Frees tables linked by next, so call it with the world running */
+PyAPI_FUNC(void) _PyThreadTables_FreeList(_PyThreadTables *,
+    _PyThreadTable *);
+
+
+/* An open addressing hash table of fixed size entries, kept at most half
+ * full, which the per-thread tables count in.  Entries are compared by a
+ * match function, given the key being looked up. */
+
+/* The first member of every entry */
+typedef struct {
+    size_t hash;
+    int used;           /* 0 if the entry is free */
+} _PyHashEntry;
+
+typedef struct {
+    Py_ssize_t used;
+    Py_ssize_t size;            /* 0 or a power of 2 */
+    Py_ssize_t entry_size;
+    char *entries;
+} _PyHashTable;
+
+typedef int (*_PyHashTable_Match)(_PyHashEntry *entry, void *key);
+
+#define _PyHashTable_ENTRY(table, i) \
+    ((_PyHashEntry *)((table)->entries + (i) * (table)->entry_size))
+
+PyAPI_FUNC(void) _PyHashTable_Init(_PyHashTable *, Py_ssize_t entry_size);
+/* Frees the entries, which must own nothing still needing freeing */
+PyAPI_FUNC(void) _PyHashTable_Clear(_PyHashTable *);
+/* Returns key's entry, or the free zeroed entry where it would go, making
+ * room for it first.  Returns NULL if out of memory. */
+PyAPI_FUNC(_PyHashEntry *) _PyHashTable_Lookup(_PyHashTable *, size_t hash,
+    _PyHashTable_Match match, void *key);
+/* Marks a free entry returned by _PyHashTable_Lookup(), once filled in,
+ * as used */
+PyAPI_FUNC(void) _PyHashTable_Use(_PyHashTable *, _PyHashEntry *,
+    size_t hash);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* !Py_PYTHREADTABLE_H */
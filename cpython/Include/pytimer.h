@@ -0,0 +1,42 @@
+/* Timer wheel */
+
+#ifndef Py_PYTIMER_H
+#define Py_PYTIMER_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "pythread.h"
+
+
+/* A timeout for a thread sleeping on a flag: when the timer expires it
+ * sets the flag.  Every timer goes in one process-wide hierarchical
+ * timer wheel, so starting or stopping one is O(1), and they're all
+ * served by a single thread sleeping on a single timerfd.  The flag
+ * should be one that only wakes its waiter, such as a PyState's
+ * condition_flag, as the waiter can't tell who set it except by asking
+ * PyTimer_Stop. */
+
+typedef struct _PyTimer {
+    PyLinkedListNode links;
+    unsigned PY_LONG_LONG expires;      /* In ticks */
+    int level;
+    int expired;    /* Only read after waking, or once stopped */
+    PyThread_type_flag *flag;
+} PyTimer;
+
+PyAPI_FUNC(void) _PyTimer_Init(void);
+
+/* Returns -1 with an exception set if the timer thread can't be
+ * started.  A delay <= 0 expires at once. */
+PyAPI_FUNC(int) PyTimer_Start(PyTimer *, PyThread_type_flag *,
+    double delay);
+/* Returns 1 if the timer expired (and set its flag) before being
+ * stopped */
+PyAPI_FUNC(int) PyTimer_Stop(PyTimer *);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* !Py_PYTIMER_H */
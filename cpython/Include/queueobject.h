@@ -0,0 +1,60 @@
+/* Queue object */
+
+#ifndef Py_QUEUEOBJECT_H
+#define Py_QUEUEOBJECT_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "pythread.h"
+
+
+/* A bounded multi-producer, multi-consumer queue of shareable objects.
+ * The ring buffer itself is lock-free: each slot carries a sequence
+ * number telling producers and consumers whose turn it is.  Only
+ * threads that find the queue full or empty touch waitlock, to go to
+ * sleep. */
+
+typedef struct {
+    AO_t seq;
+    PyObject *item;
+} PyQueueSlot;
+
+typedef struct _PyQueueObject {
+    PyObject_HEAD
+    PyQueueSlot *slots;
+    AO_t mask;                  /* Number of slots, less one */
+
+    /* Producers and consumers are kept on separate cache lines */
+    char _pad0[64];
+    AO_t head;                  /* Next slot to put into */
+    char _pad1[64];
+    AO_t tail;                  /* Next slot to get from */
+    char _pad2[64];
+
+    PyThread_type_lock *waitlock;
+    PyThread_type_cond *notempty;
+    PyThread_type_cond *notfull;
+    AO_t getters_waiting;
+    AO_t putters_waiting;
+    PyLinkedList selectors;     /* PySelectWaiters, counted as getters */
+} PyQueueObject;
+
+PyAPI_DATA(PyTypeObject) PyQueue_Type;
+PyAPI_DATA(PyObject *) PyExc_QueueEmpty;
+PyAPI_DATA(PyObject *) PyExc_QueueFull;
+
+#define PyQueue_Check(op) PyObject_TypeCheck(op, &PyQueue_Type)
+
+PyAPI_FUNC(void) _PyQueue_Init(void);
+
+/* For threadtools.select().  Adding returns 1 if an item can already be
+ * got, in which case the waiter may not be woken. */
+PyAPI_FUNC(int) _PyQueue_AddSelector(PyQueueObject *, PySelectWaiter *);
+PyAPI_FUNC(void) _PyQueue_RemoveSelector(PyQueueObject *, PySelectWaiter *);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* !Py_QUEUEOBJECT_H */
@@ -0,0 +1,39 @@
+/* File descriptor watch object and the reactor behind it */
+
+#ifndef Py_REACTOROBJECT_H
+#define Py_REACTOROBJECT_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* What threadtools.readable() and threadtools.writable() return, for
+ * passing to threadtools.select().  Every fd being selected on, by any
+ * thread, is kept in a single epoll set shared by the whole process. */
+
+typedef struct {
+    PyObject_HEAD
+    int fd;
+    short events;               /* POLLIN or POLLOUT */
+} PyFDWatchObject;
+
+PyAPI_DATA(PyTypeObject) PyFDWatch_Type;
+
+#define PyFDWatch_Check(op) (Py_TYPE(op) == &PyFDWatch_Type)
+
+PyAPI_FUNC(PyObject *) PyFDWatch_New(int fd, int writing);
+
+PyAPI_FUNC(void) _PyReactor_Init(void);
+PyAPI_FUNC(void) _PyReactor_Fini(void);
+
+/* For threadtools.select().  Adding returns 1 if the fd is already
+ * ready, in which case the waiter may not be woken. */
+PyAPI_FUNC(int) _PyFDWatch_AddSelector(PyFDWatchObject *, PySelectWaiter *);
+PyAPI_FUNC(void) _PyFDWatch_RemoveSelector(PyFDWatchObject *,
+    PySelectWaiter *);
+
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* !Py_REACTOROBJECT_H */
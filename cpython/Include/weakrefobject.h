@@ -96,12 +96,19 @@ struct _PyDeathQueue {
 
     PyLinkedList live_links;
     PyLinkedList dead_links;
+    PyLinkedList selectors;  /* PySelectWaiters from threadtools.select() */
 };
 
 PyAPI_DATA(PyTypeObject) _PyDeathQueue_Type;
 
 #define PyDeathQueue_Check(op) (Py_TYPE(op) == &_PyDeathQueue_Type)
 
+/* Adding returns 1 if a handle is already dead, in which case the
+ * waiter may not be woken. */
+PyAPI_FUNC(int) _PyDeathQueue_AddSelector(PyDeathQueue *, PySelectWaiter *);
+PyAPI_FUNC(void) _PyDeathQueue_RemoveSelector(PyDeathQueue *,
+    PySelectWaiter *);
+
 
 struct _PyWeakBinding {
     PyObject_HEAD
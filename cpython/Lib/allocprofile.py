@@ -0,0 +1,242 @@
+#! /usr/bin/env python
+
+"""Sampling allocation profiler for all threads, branch children included.
+
+While sampling, every thread counts down the bytes it allocates for
+objects and through PyMem_Malloc(), and each time the count runs out it
+records the allocation it's making: the Python traceback, the size and,
+for objects, the type.  Samples are about rate bytes apart, so each one
+stands for rate bytes (or its own size, if larger) and the totals are
+estimates that get better the smaller the rate.  A sample is forgotten
+as soon as its memory is freed, so a snapshot shows what's live.
+
+Each sample from sys.getallocsamples() is a tuple of:
+
+    thread      threads numbered in the order they first allocated
+    type        the name of the object's type, or None for other memory
+    size        bytes allocated, rounded up to the allocator's size class
+    weight      bytes the sample stands for
+    traceback   tuple of (filename, funcname, lineno), outermost first
+
+Snapshot.statistics() sums the weights of the samples by key:
+
+    site        the innermost (filename, funcname, lineno), or None
+    traceback   the whole traceback
+    type        the type's name, or None
+    thread      the thread number
+"""
+
+__all__ = ["start", "stop", "get_rate", "take_snapshot", "Snapshot",
+           "format_statistics", "format_diff"]
+
+import sys
+
+DEFAULT_RATE = 512 * 1024
+KEYS = ("site", "traceback", "type", "thread")
+
+
+def start(rate=DEFAULT_RATE, nframes=16):
+    """Starts sampling an allocation about every rate bytes, forgetting
+    the allocations sampled so far."""
+    sys.setallocprofile(rate, nframes)
+
+
+def stop():
+    """Stops sampling.  What was sampled stays until it's freed."""
+    sys.setallocprofile(0)
+
+
+def get_rate():
+    """Returns the sampling rate, or 0 if not sampling."""
+    return sys.getallocprofile()
+
+
+def take_snapshot():
+    """Returns a Snapshot of the sampled allocations still live."""
+    return Snapshot(sys.getallocsamples())
+
+
+def _key(sample, key):
+    thread, type, size, weight, traceback = sample
+    if key == "site":
+        return traceback[-1] if traceback else None
+    if key == "traceback":
+        return traceback
+    if key == "type":
+        return type
+    if key == "thread":
+        return thread
+    raise ValueError("unknown key %r" % (key,))
+
+
+class Snapshot:
+    """The allocations sampled and live at one point in time."""
+
+    def __init__(self, samples):
+        self.samples = list(samples)
+
+    def total(self):
+        """Returns the estimated bytes live."""
+        return sum(s[3] for s in self.samples)
+
+    def filter(self, predicate):
+        """Returns a Snapshot of the samples predicate(sample) is true for."""
+        return Snapshot(s for s in self.samples if predicate(s))
+
+    def _group(self, key):
+        groups = {}
+        for sample in self.samples:
+            k = _key(sample, key)
+            size, count = groups.get(k, (0, 0))
+            groups[k] = (size + sample[3], count + 1)
+        return groups
+
+    def statistics(self, key="site"):
+        """Returns a dict of key, size (estimated bytes) and count
+        (samples) for each value of key, largest size first."""
+        stats = [dict(key=k, size=size, count=count)
+                 for k, (size, count) in self._group(key).items()]
+        stats.sort(key=lambda s: s["size"], reverse=True)
+        return stats
+
+    def compare_to(self, old, key="site"):
+        """Returns what statistics() would, plus size_diff and count_diff
+        since the old Snapshot, largest change first."""
+        new_groups = self._group(key)
+        old_groups = old._group(key)
+        diffs = []
+        for k in set(new_groups) | set(old_groups):
+            size, count = new_groups.get(k, (0, 0))
+            old_size, old_count = old_groups.get(k, (0, 0))
+            diffs.append(dict(key=k, size=size, count=count,
+                              size_diff=size - old_size,
+                              count_diff=count - old_count))
+        diffs.sort(key=lambda s: (abs(s["size_diff"]), s["size"]),
+                   reverse=True)
+        return diffs
+
+
+def format_size(size, sign=False):
+    for unit, scale in (("GiB", 1 << 30), ("MiB", 1 << 20),
+                        ("KiB", 1 << 10)):
+        if abs(size) >= scale:
+            return ("%+.1f%s" if sign else "%.1f%s") % (size / scale, unit)
+    return ("%+dB" if sign else "%dB") % size
+
+
+def format_site(site):
+    if site is None:
+        return "-"
+    filename, funcname, lineno = site
+    return "%s:%d(%s)" % (filename, lineno, funcname)
+
+
+def format_key(k, key):
+    if key == "site":
+        return format_site(k)
+    if key == "traceback":
+        return format_site(k[-1] if k else None)
+    if k is None:
+        return "-"
+    return str(k)
+
+
+def _more_frames(stat, key):
+    # The rest of a traceback, innermost first
+    if key != "traceback" or len(stat["key"]) < 2:
+        return []
+    return ["    " + format_site(f) for f in reversed(stat["key"][:-1])]
+
+
+def format_statistics(stats, key="site", limit=None):
+    """Returns statistics() as lines of a table, cut to limit rows if
+    given."""
+    if limit is not None:
+        stats = stats[:limit]
+    lines = ["%10s %8s  %s" % ("size", "samples", key)]
+    for s in stats:
+        lines.append("%10s %8d  %s" % (format_size(s["size"]), s["count"],
+                     format_key(s["key"], key)))
+        lines.extend(_more_frames(s, key))
+    return lines
+
+
+def format_diff(diffs, key="site", limit=None):
+    """Returns compare_to() as lines of a table, cut to limit rows if
+    given."""
+    if limit is not None:
+        diffs = diffs[:limit]
+    lines = ["%10s %10s %8s %8s  %s" % ("size", "change", "samples",
+             "change", key)]
+    for s in diffs:
+        lines.append("%10s %10s %8d %+8d  %s" % (format_size(s["size"]),
+                     format_size(s["size_diff"], True), s["count"],
+                     s["count_diff"], format_key(s["key"], key)))
+        lines.extend(_more_frames(s, key))
+    return lines
+
+
+def run(statement, filename=None, rate=DEFAULT_RATE, nframes=16,
+        key="site", limit=20):
+    """Runs statement in __main__'s namespace while sampling, and prints
+    the allocations live at the end to filename, or to stdout."""
+    import __main__
+    start(rate, nframes)
+    try:
+        exec(statement, __main__.__dict__)
+        snapshot = take_snapshot()
+    finally:
+        stop()
+    lines = format_statistics(snapshot.statistics(key), key, limit)
+    if filename is None:
+        for line in lines:
+            print(line)
+    else:
+        f = open(filename, "w")
+        try:
+            for line in lines:
+                print(line, file=f)
+        finally:
+            f.close()
+    return snapshot
+
+
+def main():
+    import os
+    from optparse import OptionParser
+    usage = ("allocprofile.py [-o output_file_path] [-r rate] [-f frames] "
+             "[-k key] [-n limit] scriptfile [arg] ...")
+    parser = OptionParser(usage=usage)
+    parser.allow_interspersed_args = False
+    parser.add_option('-o', '--outfile', dest="outfile",
+        help="Save stats to <outfile>", default=None)
+    parser.add_option('-r', '--rate', dest="rate", type="int",
+        help="Sample about every <rate> bytes", default=DEFAULT_RATE)
+    parser.add_option('-f', '--frames', dest="nframes", type="int",
+        help="Record up to <frames> frames per sample", default=16)
+    parser.add_option('-k', '--key', dest="key", choices=KEYS,
+        help="Sum by one of %s" % ", ".join(KEYS), default="site")
+    parser.add_option('-n', '--limit', dest="limit", type="int",
+        help="Print at most <limit> rows", default=20)
+
+    if not sys.argv[1:]:
+        parser.print_usage()
+        sys.exit(2)
+
+    (options, args) = parser.parse_args()
+    sys.argv[:] = args
+
+    sys.path.insert(0, os.path.dirname(sys.argv[0]))
+    fp = open(sys.argv[0])
+    try:
+        script = fp.read()
+    finally:
+        fp.close()
+    code = compile(script, sys.argv[0], "exec")
+    run(code, options.outfile, options.rate, options.nframes, options.key,
+        options.limit)
+    return parser
+
+# When invoked as main program, profile a script
+if __name__ == '__main__':
+    main()
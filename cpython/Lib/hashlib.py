@@ -18,6 +18,19 @@ md5(), sha1(), sha224(), sha256(), sha384(), and sha512()
 More algorithms may be available on your platform but the above are
 guaranteed to exist.
 
+To hash many messages at once, each separately, use
+
+hash_many(name, buffers, threads=0) - returns a list of the digests of
+                      the given buffers, hashed several at a time and, for
+                      enough data, across threads.
+
+To hash one large message across threads, use
+
+tree(name, data=b'', leaf_size=1<<20, threads=0) - returns a new tree hash
+                      object.  Its digest is not that of the named hash
+                      function, but the named hash of leaf_size, the length
+                      and the hash of each leaf_size piece of the data.
+
 NOTE: If you want the adler32 or crc32 hash functions they are available in
 the zlib module.
 
@@ -79,6 +92,102 @@ def __get_builtin_constructor(name):
     raise ValueError("unsupported hash type")
 
 
+def _get_builtin_many(name):
+    """Return the constructor, many and leaves functions of our own
+    implementation of the named hash."""
+    new = __get_builtin_constructor(name)
+    module = __import__(new.__module__)
+    name = new.__name__
+    return new, getattr(module, name + '_many'), getattr(module, name + '_leaves')
+
+
+def hash_many(name, buffers, threads=0):
+    """hash_many(name, buffers, threads=0) - Return a list of the digests of
+    buffers, an iterable of bytes, using the named algorithm.
+
+    This is the same as [new(name, b).digest() for b in buffers], but
+    hashes several buffers at once.  threads is how many threads to use;
+    0, the default, means one per CPU when there's enough data to share.
+    """
+    return _get_builtin_many(name)[1](buffers, threads)
+
+
+class tree:
+    """tree(name, data=b'', leaf_size=1<<20, threads=0) - Return a new tree
+    hash object using the named algorithm; optionally initialized with data.
+
+    The data is split into leaf_size pieces, the last one possibly shorter,
+    which are hashed separately, several at once and across threads as
+    hash_many() does.  The digest is the hash of leaf_size and the length
+    of the data, each as 8 bytes big-endian, followed by the digests of the
+    pieces in order.  So it depends on leaf_size, and differs from the
+    plain hash of the data.
+    """
+
+    def __init__(self, name, data=b'', leaf_size=1<<20, threads=0):
+        if leaf_size <= 0:
+            raise ValueError("leaf_size must be positive")
+        self._new, many, self._leaves_func = _get_builtin_many(name)
+        self.name = self._new().name + '_tree'
+        self.leaf_size = leaf_size
+        self.threads = threads
+        self._length = 0
+        self._digests = []
+        self._pending = bytearray()
+        if data:
+            self.update(data)
+
+    @property
+    def digest_size(self):
+        return self._new().digest_size
+
+    @property
+    def block_size(self):
+        return self._new().block_size
+
+    def update(self, data):
+        """Update this hash object's state with the provided bytes."""
+        if isinstance(data, str):
+            raise TypeError("can't hash str")
+        if not isinstance(data, (bytes, bytearray)):
+            data = bytes(data)
+        self._length += len(data)
+        offset = 0
+        if self._pending:
+            offset = min(self.leaf_size - len(self._pending), len(data))
+            self._pending += data[:offset]
+            if len(self._pending) < self.leaf_size:
+                return
+            self._digests.append(self._new(bytes(self._pending)).digest())
+            self._pending = bytearray()
+        digests = self._leaves_func(data, self.leaf_size, offset,
+                                    self.threads)
+        self._digests.extend(digests)
+        self._pending += data[offset + len(digests) * self.leaf_size:]
+
+    def digest(self):
+        """Return the digest value as a bytes object."""
+        import struct
+        root = self._new(struct.pack('>QQ', self.leaf_size, self._length))
+        for digest in self._digests:
+            root.update(digest)
+        if self._pending:
+            root.update(self._new(bytes(self._pending)).digest())
+        return root.digest()
+
+    def hexdigest(self):
+        """Return the digest value as a string of hexadecimal digits."""
+        return ''.join('%02x' % i for i in self.digest())
+
+    def copy(self):
+        """Return a copy of the hash object."""
+        other = tree.__new__(tree)
+        other.__dict__.update(self.__dict__)
+        other._digests = list(self._digests)
+        other._pending = bytearray(self._pending)
+        return other
+
+
 def __py_new(name, data=b''):
     """new(name, data=b'') - Return a new hashing object using the named algorithm;
     optionally initialized with data (which must be bytes).
@@ -1720,6 +1720,33 @@ class TextIOWrapper(TextIOBase):
     def newlines(self):
         return self._decoder.newlines if self._decoder else None
 
+try:
+    import _bufferedio
+except ImportError:
+    pass
+else:
+    # Put C versions of the per-call methods in front of the Python ones.
+    # Rebinding the names means open(), BufferedRWPair and StringIO all
+    # get the fast classes.
+    class BufferedReader(_bufferedio._BufferedReader, BufferedReader):
+        __doc__ = BufferedReader.__doc__
+
+    class BufferedWriter(_bufferedio._BufferedWriter, BufferedWriter):
+        __doc__ = BufferedWriter.__doc__
+
+    class BufferedRandom(_bufferedio._BufferedRandom, BufferedRandom):
+        __doc__ = BufferedRandom.__doc__
+
+    BufferedReader.register(BufferedRandom)
+    BufferedWriter.register(BufferedRandom)
+
+    class IncrementalNewlineDecoder(_bufferedio._IncrementalNewlineDecoder,
+                                    IncrementalNewlineDecoder):
+        __doc__ = IncrementalNewlineDecoder.__doc__
+
+    class TextIOWrapper(_bufferedio._TextIOWrapper, TextIOWrapper):
+        __doc__ = TextIOWrapper.__doc__
+
 class StringIO(TextIOWrapper):
     """StringIO([initial_value[, encoding, [errors, [newline]]]])
 
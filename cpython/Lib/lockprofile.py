@@ -0,0 +1,235 @@
+#! /usr/bin/env python
+
+"""Lock contention profiler for all threads, branch children included.
+
+While enabled every thread times the critical sections, monitor spaces,
+refowner promotions, world stops and PyGC_lock it waits for and holds,
+per lock and per Python call site.  Uncontended acquisitions are counted
+but not timed, so the cost is small until there's contention to find.
+
+Each stat from sys.getlockprofile() is a dict of:
+
+    thread      threads numbered in the order they first took a lock
+    kind        'critical', 'monitorspace', 'refowner', 'world' or 'gc'
+    name        what the lock protects, such as 'shareddict'
+    lock        the lock's address, telling apart locks of the same name
+    site        (filename, funcname, lineno) of the innermost Python
+                frame, or None if there wasn't one
+    acquired    times acquired
+    contended   times acquired after waiting
+    wait        total seconds waited, and wait_max the longest wait
+    held        times released while timed
+    hold        total seconds held, and hold_max the longest hold
+    wait_hist   waits and holds counted in powers of two nanoseconds:
+    hold_hist   item i counts times of at least 2**i ns and under
+                2**(i+1) ns, item 0 counts zero too
+
+Hold times are charged to the site that released the lock.
+"""
+
+__all__ = ["LockProfile", "run", "merge", "by_lock", "by_site",
+           "format_table", "format_histogram"]
+
+import sys
+
+SORT_KEYS = ("wait", "wait_max", "contended", "acquired", "hold",
+             "hold_max", "held")
+
+
+def _add_hist(a, b):
+    if len(a) < len(b):
+        a, b = b, a
+    return tuple(x + y for x, y in zip(a, b + (0,) * (len(a) - len(b))))
+
+
+def merge(stats, key):
+    """Merges the stats with the same key(stat), in first seen order.
+    Each merged stat keeps only the fields its stats agreed on."""
+    merged = {}
+    order = []
+    for stat in stats:
+        k = key(stat)
+        m = merged.get(k)
+        if m is None:
+            merged[k] = dict(stat)
+            order.append(k)
+            continue
+        for field in ("acquired", "contended", "wait", "held", "hold"):
+            m[field] += stat[field]
+        for field in ("wait_max", "hold_max"):
+            m[field] = max(m[field], stat[field])
+        for field in ("wait_hist", "hold_hist"):
+            m[field] = _add_hist(m[field], stat[field])
+        for field in ("thread", "site", "lock"):
+            if m[field] != stat[field]:
+                m[field] = None
+    return [merged[k] for k in order]
+
+
+def by_lock(stats):
+    """Merges the stats of each lock over all threads and call sites."""
+    return merge(stats, lambda s: (s["kind"], s["name"], s["lock"]))
+
+
+def by_site(stats):
+    """Merges the stats of each call site and kind of lock over all
+    threads and lock instances."""
+    return merge(stats, lambda s: (s["kind"], s["name"], s["site"]))
+
+
+def format_time(seconds):
+    for unit, scale in (("s", 1), ("ms", 1e-3), ("us", 1e-6)):
+        if seconds >= scale:
+            return "%.3g%s" % (seconds / scale, unit)
+    return "%dns" % round(seconds * 1e9)
+
+
+def format_site(site):
+    if site is None:
+        return "-"
+    filename, funcname, lineno = site
+    return "%s:%d(%s)" % (filename, lineno, funcname)
+
+
+def format_lock(stat):
+    if stat["lock"] is None:
+        return stat["name"]
+    return "%s %#x" % (stat["name"], stat["lock"])
+
+
+def format_table(stats, sort="wait", limit=None):
+    """Returns the stats as lines of a table, sorted on the given key,
+    largest first, and cut to limit rows if given."""
+    if sort not in SORT_KEYS:
+        raise ValueError("can't sort on %r" % (sort,))
+    stats = sorted(stats, key=lambda s: s[sort], reverse=True)
+    if limit is not None:
+        stats = stats[:limit]
+    lines = ["%9s %9s %9s %9s %9s %9s  %s" % ("acquired", "contended",
+             "wait", "wait max", "hold", "hold max", "lock / site")]
+    for s in stats:
+        where = format_lock(s)
+        if s["site"] is not None:
+            where += " " + format_site(s["site"])
+        lines.append("%9d %9d %9s %9s %9s %9s  %s" % (s["acquired"],
+                     s["contended"], format_time(s["wait"]),
+                     format_time(s["wait_max"]), format_time(s["hold"]),
+                     format_time(s["hold_max"]), where))
+    return lines
+
+
+def format_histogram(hist, width=40):
+    """Returns a wait_hist or hold_hist as lines of a bar chart."""
+    lines = []
+    most = max(hist or (0,))
+    for i, count in enumerate(hist):
+        if not count and not lines:
+            continue
+        bar = "#" * ((count * width + most - 1) // most) if most else ""
+        lines.append("%8s %-*s %d" % (format_time(2 ** i / 1e9), width,
+                     bar, count))
+    return lines
+
+
+class LockProfile:
+    """Times the locks of every thread while enabled.  Also a context
+    manager:
+
+        with lockprofile.LockProfile() as p:
+            ...
+        p.print_stats()
+    """
+
+    def __init__(self):
+        self.stats = []
+
+    def enable(self):
+        sys.setlockprofile(True)
+
+    def disable(self):
+        sys.setlockprofile(False)
+        self.stats = sys.getlockprofile()
+
+    def __enter__(self):
+        self.enable()
+        return self
+
+    def __exit__(self, *exc_info):
+        self.disable()
+
+    def print_stats(self, by="lock", sort="wait", limit=20, file=None,
+                    histograms=False):
+        """Prints a table of the stats merged by "lock", "site" or not at
+        all (None), and if histograms is true the wait and hold times of
+        each row as well."""
+        if file is None:
+            file = sys.stdout
+        stats = {"lock": by_lock, "site": by_site,
+                 None: list}[by](self.stats)
+        lines = format_table(stats, sort, limit)
+        print(lines[0], file=file)
+        stats = sorted(stats, key=lambda s: s[sort], reverse=True)
+        for line, stat in zip(lines[1:], stats):
+            print(line, file=file)
+            if histograms:
+                for field in ("wait_hist", "hold_hist"):
+                    if any(stat[field]):
+                        print("    %s:" % field[:4], file=file)
+                        for l in format_histogram(stat[field]):
+                            print("    " + l, file=file)
+
+
+def run(statement, filename=None, by="lock", sort="wait", limit=20):
+    """Runs statement in __main__'s namespace while timing locks, and
+    prints the stats to filename, or to stdout."""
+    import __main__
+    p = LockProfile()
+    with p:
+        exec(statement, __main__.__dict__)
+    if filename is None:
+        p.print_stats(by, sort, limit)
+    else:
+        f = open(filename, "w")
+        try:
+            p.print_stats(by, sort, limit, f, histograms=True)
+        finally:
+            f.close()
+    return p
+
+
+def main():
+    import os
+    from optparse import OptionParser
+    usage = ("lockprofile.py [-o output_file_path] [-s sort] [-b lock|site] "
+             "[-n limit] scriptfile [arg] ...")
+    parser = OptionParser(usage=usage)
+    parser.allow_interspersed_args = False
+    parser.add_option('-o', '--outfile', dest="outfile",
+        help="Save stats and histograms to <outfile>", default=None)
+    parser.add_option('-s', '--sort', dest="sort", choices=SORT_KEYS,
+        help="Sort by one of %s" % ", ".join(SORT_KEYS), default="wait")
+    parser.add_option('-b', '--by', dest="by", choices=("lock", "site"),
+        help="Merge stats by lock or by call site", default="lock")
+    parser.add_option('-n', '--limit', dest="limit", type="int",
+        help="Print at most <limit> rows", default=20)
+
+    if not sys.argv[1:]:
+        parser.print_usage()
+        sys.exit(2)
+
+    (options, args) = parser.parse_args()
+    sys.argv[:] = args
+
+    sys.path.insert(0, os.path.dirname(sys.argv[0]))
+    fp = open(sys.argv[0])
+    try:
+        script = fp.read()
+    finally:
+        fp.close()
+    code = compile(script, sys.argv[0], "exec")
+    run(code, options.outfile, options.by, options.sort, options.limit)
+    return parser
+
+# When invoked as main program, profile a script
+if __name__ == '__main__':
+    main()
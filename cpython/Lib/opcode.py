@@ -168,4 +168,20 @@ def_op('CALL_FUNCTION_VAR_KW', 142)  # #args + (#kwargs << 8)
 def_op('EXTENDED_ARG', 143)
 EXTENDED_ARG = 143
 
+# Superinstructions.  The peephole optimizer writes one over the first
+# instruction of a pair; the second is left in place to supply its argument.
+def_op('LOAD_FAST__LOAD_FAST', 149)
+haslocal.append(149)
+def_op('LOAD_FAST__LOAD_CONST', 150)
+haslocal.append(150)
+def_op('LOAD_FAST__LOAD_ATTR', 151)
+haslocal.append(151)
+def_op('STORE_FAST__LOAD_FAST', 152)
+haslocal.append(152)
+def_op('LOAD_CONST__RETURN_VALUE', 153)
+hasconst.append(153)
+def_op('COMPARE_OP__JUMP_IF_FALSE', 154)
+hascompare.append(154)
+jrel_op('JUMP_IF_FALSE__POP_TOP', 155)
+
 del def_op, name_op, jrel_op, jabs_op
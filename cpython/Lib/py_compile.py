@@ -149,14 +149,23 @@ def compile(file, cfile=None, dfile=None, doraise=False):
             return
     if cfile is None:
         cfile = file + (__debug__ and 'c' or 'o')
-    fc = open(cfile, 'wb')
-    fc.write(b'\0\0\0\0')
-    wr_long(fc, timestamp)
-    marshal.dump(codeobject, fc)
-    fc.flush()
-    fc.seek(0, 0)
-    fc.write(MAGIC)
-    fc.close()
+    # Interpreters running with PYTHONLAZYCODE may have the old file
+    # mapped, so it's replaced rather than written over
+    tmp = cfile + '.tmp'
+    fc = open(tmp, 'wb')
+    try:
+        fc.write(b'\0\0\0\0')
+        wr_long(fc, timestamp)
+        marshal.dump(codeobject, fc)
+        fc.flush()
+        fc.seek(0, 0)
+        fc.write(MAGIC)
+    finally:
+        fc.close()
+    if os.name != 'posix' and os.path.exists(cfile):
+        # rename() won't replace a file here
+        os.remove(cfile)
+    os.rename(tmp, cfile)
     set_creator_type(cfile)
 
 def main(args=None):
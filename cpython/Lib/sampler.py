@@ -0,0 +1,127 @@
+#! /usr/bin/env python
+
+"""Sampling profiler for all threads, branch children included.
+
+Every interval seconds each thread is asked for a sample of its stack,
+which it takes at its next tick, so the cost is a few microseconds per
+thread per sample wherever the threads are.  Samples are written out in
+the collapsed stack format read by flamegraph.pl and speedscope: one
+line per distinct stack, frames outermost first separated by ';', then a
+space and the number of samples.
+"""
+
+__all__ = ["Sampler", "run", "collapse"]
+
+import sys
+
+DEFAULT_INTERVAL = 0.001
+
+
+def frame_label(code, lineno):
+    return "%s (%s:%d)" % (code.co_name, code.co_filename, lineno)
+
+
+def collapse(samples, threads=True):
+    """Returns the collapsed stack lines for samples from sys.getsamples().
+
+    With threads true each stack starts with a frame naming its thread,
+    so that each thread gets its own tower in the flame graph; otherwise
+    the same stack in different threads is counted as one.
+    """
+    counts = {}
+    for thread, stack, count in samples:
+        frames = [frame_label(code, lineno) for code, lineno in stack]
+        if threads:
+            frames.insert(0, "thread-%d" % thread)
+        key = ";".join(frame.replace(";", ":") for frame in frames)
+        counts[key] = counts.get(key, 0) + count
+    return ["%s %d" % (key, count) for key, count in sorted(counts.items())]
+
+
+class Sampler:
+    """Samples every thread while enabled.  Also a context manager:
+
+        with sampler.Sampler() as s:
+            ...
+        s.write(open('out.folded', 'w'))
+    """
+
+    def __init__(self, interval=DEFAULT_INTERVAL):
+        self.interval = interval
+        self.samples = []
+
+    def enable(self):
+        sys.setsampling(self.interval)
+
+    def disable(self):
+        sys.setsampling(0)
+        self.samples = sys.getsamples()
+
+    def __enter__(self):
+        self.enable()
+        return self
+
+    def __exit__(self, *exc_info):
+        self.disable()
+
+    def collapsed(self, threads=True):
+        return collapse(self.samples, threads)
+
+    def write(self, file, threads=True):
+        for line in self.collapsed(threads):
+            file.write(line + "\n")
+
+
+def run(statement, filename=None, interval=DEFAULT_INTERVAL, threads=True):
+    """Runs statement in __main__'s namespace while sampling, and writes
+    the collapsed stacks to filename, or to stdout."""
+    import __main__
+    s = Sampler(interval)
+    with s:
+        exec(statement, __main__.__dict__)
+    if filename is None:
+        s.write(sys.stdout, threads)
+    else:
+        f = open(filename, "w")
+        try:
+            s.write(f, threads)
+        finally:
+            f.close()
+    return s
+
+
+def main():
+    import os
+    from optparse import OptionParser
+    usage = ("sampler.py [-o output_file_path] [-i interval] [-m] "
+             "scriptfile [arg] ...")
+    parser = OptionParser(usage=usage)
+    parser.allow_interspersed_args = False
+    parser.add_option('-o', '--outfile', dest="outfile",
+        help="Save collapsed stacks to <outfile>", default=None)
+    parser.add_option('-i', '--interval', dest="interval", type="float",
+        help="Seconds between samples", default=DEFAULT_INTERVAL)
+    parser.add_option('-m', '--merge-threads', dest="threads",
+        action="store_false", default=True,
+        help="Don't separate the stacks of different threads")
+
+    if not sys.argv[1:]:
+        parser.print_usage()
+        sys.exit(2)
+
+    (options, args) = parser.parse_args()
+    sys.argv[:] = args
+
+    sys.path.insert(0, os.path.dirname(sys.argv[0]))
+    fp = open(sys.argv[0])
+    try:
+        script = fp.read()
+    finally:
+        fp.close()
+    code = compile(script, sys.argv[0], "exec")
+    run(code, options.outfile, options.interval, options.threads)
+    return parser
+
+# When invoked as main program, sample a script
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,398 @@
+#! /usr/bin/env python
+
+"""Images of shared modules, for quicker interpreter startup.
+
+A shared module (one with "from __future__ import shared_module") only
+holds shareable objects, which are immutable or shareddict-backed, so
+what importing it leaves behind can be written down once and rebuilt
+without running it.  write() imports some modules and writes an image of
+the shared modules then loaded: everything their namespaces hold, with
+objects from other modules found again by name.  An interpreter started
+with PYTHONSHAREDIMAGE naming the image maps it in, and when a module in
+it is first imported, rebuilds it from its part of the image, leaving its
+functions' code to be unmarshalled when it's first run.  sys.shared_image lists the
+modules so far imported that way.
+
+Each module is checked as it's imported: the image must be from the same
+version of Python, and the module's source file must be unchanged.  If
+not, or if anything else goes wrong, the module is imported normally;
+python -v says why.
+
+What an import does outside the module's namespace isn't in the image.
+So site, which is imported for what it does to sys, is never put in
+one, and nor are modules in packages, which their package would need
+to know about.
+"""
+
+__all__ = ["write", "verify", "ImageError"]
+
+import imp
+import marshal
+import os
+import struct
+import sys
+
+MAGIC = b"PYSI"
+VERSION = 1
+
+# Record kinds, as in Python/sharedimage.c
+CONST, IMPORT, MODULE, ATTR, TUPLE, FUNCTION, CELL, CLASS, CALL = range(9)
+
+
+class ImageError(Exception):
+    """An object that can't be put in an image."""
+
+
+def _cell():
+    x = None
+    return (lambda: x).__closure__[0]
+
+_ModuleType = type(sys)
+_FunctionType = type(_cell)
+_CellType = type(_cell())
+_CodeType = type(_cell.__code__)
+_CONSTANT_TYPES = (type(None), bool, int, float, complex, str, bytes,
+                   type(Ellipsis), _CodeType)
+# Decorators that wrap one callable, rebuilt by calling them with it
+_WRAPPER_TYPES = (classmethod, staticmethod)
+# Descriptors a class makes for itself
+_GENERATED_TYPES = ("getset_descriptor", "member_descriptor",
+                    "finalizeattr_descriptor")
+
+del _cell
+
+
+def _is_constant(obj):
+    if type(obj) in (tuple, frozenset):
+        for item in obj:
+            if not _is_constant(item):
+                return False
+        return True
+    return type(obj) in _CONSTANT_TYPES
+
+
+def _is_shared(module):
+    return type(module.__dict__) is shareddict
+
+
+class _Writer:
+    """Turns the namespace of a module into records."""
+
+    def __init__(self, name, module, names):
+        import threadtools
+        self.wrapper_types = _WRAPPER_TYPES + (threadtools.monitormethod,
+                                               threadtools.condition)
+        self.name = name
+        self.module = module
+        self.names = names
+        self.records = []
+        self.fixups = []
+        self.imports = set()
+        self.index = {}
+        self.keep = []          # So that no id() is reused
+        self.busy = set()
+        self.cells = []
+
+    def write(self, source):
+        items = []
+        for key, value in sorted(vars(self.module).items()):
+            if key == "__file__":
+                value = source[0]
+            if key != "__builtins__":
+                items.append((key, self.encode(value)))
+        # Cells are filled in at the end, to break cycles
+        while self.cells:
+            i, cell = self.cells.pop(0)
+            try:
+                contents = cell.cell_contents
+            except ValueError:
+                continue
+            self.fixups.append((i, self.encode(contents)))
+        return (self.name, source, tuple(self.records), tuple(items),
+                tuple(self.fixups))
+
+    def encode(self, obj):
+        i = self.index.get(id(obj))
+        if i is not None:
+            return i
+        if id(obj) in self.busy:
+            raise ImageError("%r refers to itself" % (obj,))
+        self.busy.add(id(obj))
+        try:
+            record = self.record(obj)
+        finally:
+            self.busy.discard(id(obj))
+        i = self.index[id(obj)] = len(self.records)
+        self.records.append(record)
+        self.keep.append(obj)
+        if type(obj) is _CellType:
+            self.cells.append((i, obj))
+        return i
+
+    def record(self, obj):
+        t = type(obj)
+        if _is_constant(obj):
+            return (CONST, obj)
+        if t is tuple:
+            return (TUPLE, tuple([self.encode(item) for item in obj]))
+        if t is _ModuleType:
+            if obj is self.module:
+                return (MODULE,)
+            name = self.module_name(obj)
+            self.imports.add(name)
+            return (IMPORT, name)
+        if t is _CellType:
+            return (CELL,)
+        if t is _FunctionType and obj.__globals__ is vars(self.module):
+            return self.function(obj)
+        if isinstance(obj, type) and obj.__module__ == self.name:
+            return self.cls(obj)
+        if t in self.wrapper_types:
+            return (CALL, self.encode(t), self.encode((obj.__func__,)))
+        if t is dict:
+            # Only found in functions, as shared modules can't hold one
+            return (CALL, self.encode(dict),
+                    self.encode((tuple(obj.items()),)))
+        return self.by_name(obj)
+
+    def module_name(self, m):
+        if sys.modules.get(m.__name__) is m:
+            return m.__name__
+        for name, other in sys.modules.items():
+            if other is m:
+                return name
+        raise ImageError("%r isn't in sys.modules" % (m,))
+
+    def by_name(self, obj):
+        name = getattr(obj, "__name__", None)
+        owner = getattr(obj, "__objclass__", None)
+        if isinstance(owner, type) and vars(owner).get(name) is obj:
+            # A method descriptor, as in "__and__ = set.__and__"
+            return (ATTR, self.encode(owner), name)
+        module = sys.modules.get(getattr(obj, "__module__", None))
+        if module is None or module is self.module or \
+           not isinstance(name, str) or getattr(module, name, None) is not obj:
+            module, name = None, None
+            for module, name in self.names.get(id(obj), ()):
+                if module is not self.module:
+                    break
+            else:
+                raise ImageError("can't put %r in an image" % (obj,))
+        return (ATTR, self.encode(module), name)
+
+    def function(self, f):
+        code = f.__code__
+        consts = code.co_consts
+        doc = consts[0] if consts and isinstance(consts[0], str) else None
+        # What PyFunction_New() wouldn't set up by itself
+        attrs = []
+        if f.__name__ != code.co_name:
+            attrs.append(("__name__", f.__name__))
+        if f.__doc__ != doc:
+            attrs.append(("__doc__", f.__doc__))
+        if f.__module__ != self.name:
+            attrs.append(("__module__", f.__module__))
+        for attr in ("__defaults__", "__kwdefaults__", "__annotations__"):
+            value = getattr(f, attr)
+            if value:
+                attrs.append((attr, value))
+        attrs.extend(sorted(vars(f).items()))
+        closure = None
+        if f.__closure__ is not None:
+            closure = tuple([self.encode(cell) for cell in f.__closure__])
+        return (FUNCTION, code, self.encode(self.module), closure,
+                tuple([(k, self.encode(v)) for k, v in attrs]))
+
+    def cls(self, c):
+        meta = type(c)
+        shared = vars(c).get("__shared__", False)
+        try:
+            blank = meta(c.__name__, c.__bases__,
+                         {"__module__": c.__module__, "__shared__": shared})
+            generated = set(vars(blank))
+        except Exception:
+            generated = set(["__dict__", "__weakref__"])
+        generated -= set(["__module__", "__doc__", "__shared__"])
+        items = []
+        for key, value in sorted(vars(c).items()):
+            if key in generated:
+                continue
+            if type(value).__name__ in _GENERATED_TYPES and \
+               getattr(value, "__objclass__", None) is c:
+                continue
+            items.append((key, self.encode(value)))
+        return (CLASS, self.encode(meta), c.__name__,
+                self.encode(c.__bases__), tuple(items))
+
+
+def _source(module):
+    path = getattr(module, "__file__", None)
+    if path is None:
+        return None
+    if path.endswith((".pyc", ".pyo")):
+        path = path[:-1]
+    if not path.endswith(".py") or not os.path.exists(path):
+        return None
+    path = os.path.abspath(path)
+    st = os.stat(path)
+    return (path, int(st.st_mtime), st.st_size)
+
+
+def _names():
+    # Where objects can be found by name: {id: [(module, key), ...]}
+    names = {}
+    for name, m in sorted(sys.modules.items()):
+        if m is None or name == "__main__":
+            continue
+        for key, value in vars(m).items():
+            names.setdefault(id(value), []).append((m, key))
+    return names
+
+
+def _cycles(imports):
+    # The modules that import themselves, through other modules
+    found = set()
+    for name in imports:
+        seen = set()
+        todo = list(imports[name])
+        while todo:
+            other = todo.pop()
+            if other == name:
+                found.add(name)
+                break
+            if other not in seen:
+                seen.add(other)
+                todo.extend(imports.get(other, ()))
+    return found
+
+
+def write(path, names=()):
+    """Imports the modules named, then writes an image of all the shared
+    modules loaded to path.  Returns a list of the modules in it and a
+    dict of the shared modules left out, with why."""
+    for name in names:
+        __import__(name)
+    excluded = {}
+    for name in names:
+        if not _is_shared(sys.modules[name]):
+            excluded[name] = "not a shared module"
+    candidates = []
+    for name, m in sorted(sys.modules.items()):
+        if m is None or not _is_shared(m) or name in excluded:
+            continue
+        if name in ("site", "__main__"):
+            excluded[name] = "imported for what it does"
+        elif "." in name:
+            excluded[name] = "in a package"
+        elif _source(m) is None:
+            excluded[name] = "no source file"
+        else:
+            candidates.append(name)
+
+    # A module that can't be written down is imported normally, and the
+    # others find what they want from it by name
+    index = _names()
+    entries = {}
+    imports = {}
+    for name in candidates:
+        writer = _Writer(name, sys.modules[name], index)
+        try:
+            entries[name] = writer.write(_source(sys.modules[name]))
+        except ImageError as e:
+            excluded[name] = str(e)
+        else:
+            imports[name] = writer.imports
+    # One that imports itself through others couldn't find them built
+    while True:
+        for name in imports:
+            imports[name] = set(imports[name]) & set(entries)
+        cycles = _cycles(imports)
+        if not cycles:
+            break
+        for name in cycles:
+            excluded[name] = "imports itself through %s" % \
+                             ", ".join(sorted(imports[name]))
+            del entries[name], imports[name]
+
+    included = sorted(entries)
+    parts = [marshal.dumps(entries[name]) for name in included]
+    # The index gives where each part is in the file.  Its size doesn't
+    # depend on the offsets, which marshal as four bytes each.
+    header = MAGIC + struct.pack("<l", VERSION) + imp.get_magic()
+    offset = len(header) + len(marshal.dumps(tuple([(name, 0)
+                                                    for name in included])))
+    index = []
+    for name, part in zip(included, parts):
+        index.append((name, offset))
+        offset += len(part)
+    # Interpreters running have the old image mapped, so it's replaced
+    # rather than written over
+    tmp = path + ".tmp"
+    f = open(tmp, "wb")
+    try:
+        f.write(header)
+        f.write(marshal.dumps(tuple(index)))
+        for part in parts:
+            f.write(part)
+    finally:
+        f.close()
+    os.rename(tmp, path)
+    return included, excluded
+
+
+def verify(path, names):
+    """Starts an interpreter with the image at path, imports the modules
+    named, and returns a list of those built from the image."""
+    import tempfile
+    fd, script = tempfile.mkstemp(".py")
+    output = script + ".out"
+    saved = os.environ.get("PYTHONSHAREDIMAGE")
+    try:
+        with open(fd, "w") as f:
+            f.write("import sys\n")
+            for name in names:
+                f.write("import %s\n" % name)
+            f.write("print(' '.join(sys.shared_image))\n")
+        os.environ["PYTHONSHAREDIMAGE"] = path
+        status = os.system("%s %s > %s" % (sys.executable, script, output))
+        if status != 0:
+            raise RuntimeError("interpreter exited with status %d" % status)
+        with open(output) as f:
+            return f.read().split()
+    finally:
+        if saved is None:
+            del os.environ["PYTHONSHAREDIMAGE"]
+        else:
+            os.environ["PYTHONSHAREDIMAGE"] = saved
+        os.remove(script)
+        if os.path.exists(output):
+            os.remove(output)
+
+
+def main():
+    from optparse import OptionParser
+    usage = "sharedimage.py [-o image] [-p path] module ..."
+    parser = OptionParser(usage=usage)
+    parser.add_option('-o', '--outfile', dest="outfile",
+        help="Write the image to <outfile>", default="shared.image")
+    parser.add_option('-p', '--path', dest="path", action="append",
+        help="Add <path> to sys.path first", default=[])
+
+    if not sys.argv[1:]:
+        parser.print_usage()
+        sys.exit(2)
+
+    (options, args) = parser.parse_args()
+    sys.path[:0] = options.path
+    included, excluded = write(options.outfile, args)
+    print("%s: %s" % (options.outfile, " ".join(included)))
+    for name, why in sorted(excluded.items()):
+        print("  left out %s: %s" % (name, why))
+    loaded = verify(options.outfile, included)
+    if sorted(loaded) != included:
+        print("not all built from the image; see python -v")
+        sys.exit(1)
+    return parser
+
+if __name__ == '__main__':
+    main()
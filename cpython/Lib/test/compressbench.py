@@ -0,0 +1,67 @@
+#!/usr/bin/env python
+"""
+Scaling of zlib.compress_parallel() and bz2.compress_parallel() with the
+number of threads, against the single-threaded compress() each one
+replaces.  The input is pseudo-random text, about as compressible as a
+log file.
+
+    >>> from test import compressbench
+    >>> compressbench.main(size=64*1024*1024)
+"""
+
+
+def make_data(size):
+    import random
+    rnd = random.Random(1)
+    words = [bytes(rnd.choice(b"abcdefghijklmnopqrstuvwxyz")
+                   for i in range(rnd.randint(2, 10)))
+             for j in range(5000)]
+    data = bytearray()
+    while len(data) < size:
+        data += b" ".join(rnd.choice(words) for i in range(1000)) + b"\n"
+    return bytes(data[:size])
+
+
+def thread_counts():
+    import os
+    try:
+        cpus = os.sysconf('SC_NPROCESSORS_ONLN')
+    except (AttributeError, ValueError):
+        cpus = 1
+    counts = [1]
+    while counts[-1] * 2 <= cpus:
+        counts.append(counts[-1] * 2)
+    if counts[-1] != cpus:
+        counts.append(cpus)
+    return counts
+
+
+def run(name, compress, compress_parallel, data, level):
+    from time import time
+    mb = len(data) / (1024 * 1024)
+
+    start = time()
+    size = len(compress(data, level))
+    base = time() - start
+    print("%-5s %-22s %7.1f MB/s  ratio %.3f" %
+          (name, "compress()", mb / base, size / len(data)))
+
+    for threads in thread_counts():
+        start = time()
+        size = len(compress_parallel(data, level, threads))
+        elapsed = time() - start
+        print("%-5s %-22s %7.1f MB/s  ratio %.3f  (%.1fx)" %
+              (name, "compress_parallel(%d)" % threads, mb / elapsed,
+               size / len(data), base / elapsed))
+
+
+def main(size=64*1024*1024):
+    import bz2, zlib
+    print("%d MB of text, thread counts %s" %
+          (size // (1024 * 1024), thread_counts()))
+    data = make_data(size)
+    run("zlib", zlib.compress, zlib.compress_parallel, data, 6)
+    run("bz2", bz2.compress, bz2.compress_parallel, data, 9)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,143 @@
+#!/usr/bin/env python
+"""
+Effect of the peephole optimizer's superinstructions.  Each workload is
+timed as compiled and again with every superinstruction in its code split
+back into the pair it replaced, so both runs execute the same instructions
+and differ only in the number of dispatches.  The static counts show how
+many of the workload's instructions were fused.
+
+    >>> from test import dispatchbench
+    >>> dispatchbench.main(repeat=5)
+"""
+
+import opcode
+from types import CodeType, FunctionType
+
+FIRST = dict((op, opcode.opmap[name.split('__')[0]])
+             for name, op in opcode.opmap.items() if '__' in name)
+
+
+def split_code(co):
+    """Returns a copy of co with its superinstructions split into pairs."""
+    code = bytearray(co.co_code)
+    i = 0
+    while i < len(code):
+        op = code[i]
+        code[i] = FIRST.get(op, op)
+        i += 3 if op >= opcode.HAVE_ARGUMENT else 1
+    consts = tuple(split_code(c) if isinstance(c, CodeType) else c
+                   for c in co.co_consts)
+    return CodeType(co.co_argcount, co.co_kwonlyargcount, co.co_nlocals,
+                    co.co_stacksize, co.co_flags, bytes(code), consts,
+                    co.co_names, co.co_varnames, co.co_filename,
+                    co.co_name, co.co_firstlineno, co.co_lnotab,
+                    co.co_freevars, co.co_cellvars)
+
+
+def count(co):
+    """Returns (instructions, fused pairs) in co and the code it contains."""
+    code = co.co_code
+    n = fused = 0
+    i = 0
+    while i < len(code):
+        op = code[i]
+        n += 1
+        fused += op in FIRST
+        i += 3 if op >= opcode.HAVE_ARGUMENT else 1
+    for c in co.co_consts:
+        if isinstance(c, CodeType):
+            cn, cf = count(c)
+            n += cn
+            fused += cf
+    return n, fused
+
+
+def functions(namespace):
+    """Yields the functions in a module or class namespace, and methods."""
+    for value in list(namespace.values()):
+        if isinstance(value, FunctionType):
+            yield value
+        elif isinstance(value, type):
+            for f in functions(value.__dict__):
+                yield f
+
+
+def loops(n):
+    total = 0
+    i = 0
+    while i < n:
+        if i < n // 2:
+            total = total + i
+        else:
+            total = total - i
+        i += 1
+    return total
+
+
+class Point:
+    def __init__(self, x, y):
+        self.x = x
+        self.y = y
+
+    def dot(self, other):
+        return self.x * other.x + self.y * other.y
+
+
+def attributes(n):
+    p = Point(1, 2)
+    q = Point(3, 4)
+    total = 0
+    for i in range(n):
+        total = total + p.dot(q)
+    return total
+
+
+def run_pystone():
+    from test import pystone
+    pystone.pystones(50000)
+
+
+def timed(func):
+    from time import time
+    start = time()
+    func()
+    return time() - start
+
+
+def run(name, funcs, workload, repeat):
+    n = fused = 0
+    for f in funcs:
+        cn, cf = count(f.__code__)
+        n += cn
+        fused += cf
+    fused_codes = [f.__code__ for f in funcs]
+    split_codes = [split_code(co) for co in fused_codes]
+
+    # Interleave the runs so that drift in machine load hits both alike
+    split_times = []
+    fused_times = []
+    for i in range(repeat):
+        for f, co in zip(funcs, split_codes):
+            f.__code__ = co
+        split_times.append(timed(workload))
+        for f, co in zip(funcs, fused_codes):
+            f.__code__ = co
+        fused_times.append(timed(workload))
+    split_time = min(split_times)
+    fused_time = min(fused_times)
+
+    print("%-10s %5d instructions, %4d fused (%4.1f%%)  "
+          "split %.3fs  fused %.3fs  (%.2fx)" %
+          (name, n, fused, 100.0 * fused / n, split_time, fused_time,
+           split_time / fused_time))
+
+
+def main(repeat=5):
+    from test import pystone
+    run("loops", [loops], lambda: loops(1000000), repeat)
+    run("attributes", [attributes, Point.__init__, Point.dot],
+        lambda: attributes(300000), repeat)
+    run("pystone", list(functions(pystone.__dict__)), run_pystone, repeat)
+
+if __name__ == '__main__':
+    main()
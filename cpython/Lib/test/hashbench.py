@@ -0,0 +1,60 @@
+#!/usr/bin/env python
+"""
+Throughput of hashlib.hash_many() on many small messages, against hashing
+them one at a time, and of hashlib.tree() on one large message, against
+the plain hash of it.
+
+    >>> from test import hashbench
+    >>> hashbench.main(count=100000, size=64*1024*1024)
+"""
+
+NAMES = ('md5', 'sha1', 'sha256', 'sha512')
+
+
+def small(name, buffers):
+    import hashlib
+    from time import time
+    mb = sum(map(len, buffers)) / (1024 * 1024)
+    new = getattr(hashlib, name)
+
+    start = time()
+    for b in buffers:
+        new(b).digest()
+    base = time() - start
+
+    start = time()
+    hashlib.hash_many(name, buffers)
+    elapsed = time() - start
+    print("%-7s %d x %d bytes  loop %7.1f MB/s  hash_many %7.1f MB/s  (%.1fx)"
+          % (name, len(buffers), len(buffers[0]), mb / base, mb / elapsed,
+             base / elapsed))
+
+
+def large(name, data):
+    import hashlib
+    from time import time
+    mb = len(data) / (1024 * 1024)
+
+    start = time()
+    getattr(hashlib, name)(data).digest()
+    base = time() - start
+
+    start = time()
+    hashlib.tree(name, data).digest()
+    elapsed = time() - start
+    print("%-7s %d MB  %s() %7.1f MB/s  tree %7.1f MB/s  (%.1fx)"
+          % (name, mb, name, mb / base, mb / elapsed, base / elapsed))
+
+
+def main(count=100000, size=64*1024*1024):
+    import os
+    for length in (64, 1024):
+        buffers = [os.urandom(length) for i in range(count)]
+        for name in NAMES:
+            small(name, buffers)
+    data = os.urandom(size)
+    for name in NAMES:
+        large(name, data)
+
+if __name__ == '__main__':
+    main()
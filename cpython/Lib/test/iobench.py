@@ -0,0 +1,92 @@
+#!/usr/bin/env python
+"""
+Throughput of io's buffered and text layers with the _bufferedio
+accelerator, against the pure Python classes it sits in front of (loaded
+from a second copy of io.py that can't see _bufferedio).
+
+    >>> from test import iobench
+    >>> iobench.main(lines=200000)
+"""
+
+LINE = "The quick brown fox jumps over the lazy dog, %d times\n"
+
+
+def pure_io():
+    import imp, io, sys
+    saved = sys.modules.get('_bufferedio')
+    sys.modules['_bufferedio'] = None  # Makes the import fail
+    try:
+        return imp.load_source('_pure_io', io.__file__.replace('.pyc', '.py'))
+    finally:
+        if saved is None:
+            del sys.modules['_bufferedio']
+        else:
+            sys.modules['_bufferedio'] = saved
+
+
+def write_lines(io, path, lines):
+    with io.open(path, 'w', encoding='utf-8') as f:
+        for i in range(lines):
+            f.write(LINE % i)
+
+def readline_lines(io, path, lines):
+    with io.open(path, 'r', encoding='utf-8') as f:
+        while f.readline():
+            pass
+
+def iterate_lines(io, path, lines):
+    with io.open(path, 'r', encoding='utf-8') as f:
+        for line in f:
+            pass
+
+def read_chars(io, path, lines):
+    with io.open(path, 'r', encoding='utf-8') as f:
+        while f.read(100):
+            pass
+
+def readline_bytes(io, path, lines):
+    with io.open(path, 'rb') as f:
+        while f.readline():
+            pass
+
+def write_bytes(io, path, lines):
+    data = b"x" * 50
+    with io.open(path, 'wb') as f:
+        for i in range(lines):
+            f.write(data)
+
+
+def main(lines=200000):
+    import gc, io, os, tempfile
+    from time import time
+    print(lines, "lines of", len(LINE % 0), "characters")
+
+    pure = pure_io()
+    fd, path = tempfile.mkstemp()
+    os.close(fd)
+    try:
+        # Like timeit, keep collections out of the timings
+        gc.disable()
+        try:
+            for name, func in [("text write()", write_lines),
+                               ("text readline()", readline_lines),
+                               ("text iteration", iterate_lines),
+                               ("text read(100)", read_chars),
+                               ("binary readline()", readline_bytes),
+                               ("binary write()", write_bytes)]:
+                times = []
+                for module in pure, io:
+                    if func is not write_lines and func is not write_bytes:
+                        write_lines(io, path, lines)
+                    start = time()
+                    func(module, path, lines)
+                    times.append(time() - start)
+                print("%-20s %8.3f sec Python %8.3f sec C  (%.1fx)" %
+                      (name, times[0], times[1], times[0] / times[1]))
+        finally:
+            gc.enable()
+    finally:
+        os.remove(path)
+
+if __name__ == '__main__':
+    main()
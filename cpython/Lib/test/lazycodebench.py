@@ -0,0 +1,72 @@
+#!/usr/bin/env python
+"""
+Startup time and memory of importing a batch of library modules from
+their .pyc files, with and without PYTHONLAZYCODE, which leaves the
+functions in them unmarshalled until they're first run.  Each run is a
+fresh interpreter; the time includes its startup and the memory is its
+peak resident set.
+
+    >>> from test import lazycodebench
+    >>> lazycodebench.main(runs=10)
+"""
+
+MODULES = ["os", "re", "optparse", "inspect", "pydoc", "difflib",
+           "decimal", "tarfile", "zipfile", "email.parser", "urllib",
+           "xml.dom.minidom", "logging", "pickle", "calendar", "textwrap",
+           "csv", "ftplib", "smtplib", "doctest", "unittest", "pdb"]
+
+CHILD = """\
+import sys, resource
+for name in %r:
+    try:
+        __import__(name)
+    except ImportError:
+        pass
+print(resource.getrusage(resource.RUSAGE_SELF).ru_maxrss)
+"""
+
+
+def run(script, output, lazy):
+    import os, sys
+    from time import time
+    start = time()
+    status = os.system("%s %s %s > %s" % ("PYTHONLAZYCODE=1" if lazy else "",
+                                          sys.executable, script, output))
+    elapsed = time() - start
+    assert status == 0
+    with open(output) as f:
+        return elapsed, int(f.read())
+
+
+def main(runs=10):
+    import os, tempfile
+    # Writes the .pyc files the children read
+    for name in MODULES:
+        try:
+            __import__(name)
+        except ImportError:
+            pass
+
+    fd, script = tempfile.mkstemp(".py")
+    output = script + ".out"
+    try:
+        with open(fd, 'w') as f:
+            f.write(CHILD % (MODULES,))
+        run(script, output, False)  # Warm the page cache
+        for lazy in (False, True):
+            times = []
+            rss = []
+            for i in range(runs):
+                elapsed, maxrss = run(script, output, lazy)
+                times.append(elapsed)
+                rss.append(maxrss)
+            print("%-8s best %6.1f ms, mean %6.1f ms, peak RSS %6d KB" %
+                  ("lazy" if lazy else "eager", min(times) * 1000,
+                   sum(times) / runs * 1000, min(rss)))
+    finally:
+        os.remove(script)
+        if os.path.exists(output):
+            os.remove(output)
+
+if __name__ == '__main__':
+    raise RuntimeError("lazycodebench must not be the __main__ module")
@@ -0,0 +1,94 @@
+#!/usr/bin/env python
+"""
+Parallel scan throughput of a shareable mmap, counting lines with branch
+children that each take a part of the map.  The baseline is what a shared
+module has to do with an ordinary mmap: keep it in a Monitor, which lets
+one child at a time in.  Also the single-threaded speed of find().
+
+    >>> from test import mmapbench
+    >>> mmapbench.main(size=256*1024*1024)
+"""
+
+from __future__ import shared_module
+from threadtools import Monitor, monitormethod, branch
+
+
+class MonitorMap(Monitor):
+    __shared__ = True
+
+    def __init__(self, path):
+        import mmap
+        with open(path, 'rb') as f:
+            self.map = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+    @monitormethod
+    def count(self, sub, start, end):
+        return self.map.count(sub, start, end)
+
+    @monitormethod
+    def size(self):
+        return len(self.map)
+
+
+def thread_counts():
+    import os
+    try:
+        cpus = os.sysconf('SC_NPROCESSORS_ONLN')
+    except (AttributeError, ValueError):
+        cpus = 1
+    counts = [1]
+    while counts[-1] * 2 <= cpus:
+        counts.append(counts[-1] * 2)
+    if counts[-1] != cpus:
+        counts.append(cpus)
+    return counts
+
+
+def scan(name, m, size, threads, lines):
+    from time import time  # Not shareable, so not a module global
+    step = -(-size // (threads * 4))
+    start = time()
+    with branch() as children:
+        for offset in range(0, size, step):
+            children.addresult(m.count, b'\n', offset, offset + step)
+    elapsed = time() - start
+    assert sum(children.getresults()) == lines
+    print("%-22s %2d threads %8.1f MB/s" %
+          (name, threads, size / (1024 * 1024) / elapsed))
+
+
+def main(size=256*1024*1024):
+    import mmap, os, tempfile
+    from time import time
+    line = b"The quick brown fox jumps over the lazy dog\n"
+    lines = size // len(line)
+    size = lines * len(line)
+    print(size // (1024 * 1024), "MB,", lines, "lines")
+
+    fd, path = tempfile.mkstemp()
+    try:
+        with open(fd, 'wb') as f:
+            chunk = line * (1024 * 1024 // len(line))
+            for i in range(lines // (len(chunk) // len(line))):
+                f.write(chunk)
+            f.write(line * (lines % (len(chunk) // len(line))))
+        with open(path, 'rb') as f:
+            shared = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ,
+                               shareable=True)
+        if hasattr(shared, 'madvise'):
+            shared.madvise(mmap.MADV_WILLNEED)
+
+        start = time()
+        shared.find(b'no such line\n')
+        print("%-22s %8.1f MB/s" % ("find(), missing", size /
+              (1024 * 1024) / (time() - start)))
+
+        monitor = MonitorMap(path)
+        for threads in thread_counts():
+            scan("mmap in a Monitor", monitor, size, threads, lines)
+            scan("shareable mmap", shared, size, threads, lines)
+    finally:
+        os.remove(path)
+
+if __name__ == '__main__':
+    raise RuntimeError("mmapbench must not be the __main__ module")
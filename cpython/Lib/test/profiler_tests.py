@@ -0,0 +1,86 @@
+"""
+Tests common to the sampling, lock contention and allocation profilers
+"""
+
+import unittest
+import threadtools
+
+
+def records(fields=None, **defaults):
+    """Returns a function making made-up results for the format tests:
+    defaults, with any given as keywords replaced, as a dict, or as a
+    tuple in the order of fields if that's given."""
+    def record(**values):
+        for name in values:
+            if name not in defaults:
+                raise TypeError("unknown field %r" % name)
+        result = dict(defaults)
+        result.update(values)
+        if fields is None:
+            return result
+        return tuple(result[name] for name in fields)
+    return record
+
+
+class CommonTest(unittest.TestCase):
+    # The profiler's sys functions, and the arguments that start and stop
+    # it; subclasses set these
+    setprofile = None
+    getprofile = None
+    start_args = ()
+    stop_args = ()
+    nchildren = 4
+
+    def work(self):
+        """Does what the profiler is to find, returning anything that has
+        to live until it's checked."""
+        raise NotImplementedError
+
+    def check(self, results):
+        """Checks what the profiler found of work()."""
+        raise NotImplementedError
+
+    def child(self):
+        """Returns what each child runs, a shared function and its
+        arguments."""
+        raise NotImplementedError
+
+    def check_children(self, results, childresults):
+        """Checks what the profiler found of the children."""
+        raise NotImplementedError
+
+    def start(self):
+        self.setprofile(*self.start_args)
+
+    def stop(self):
+        self.setprofile(*self.stop_args)
+
+    def tearDown(self):
+        self.stop()
+
+    def test_no_arguments(self):
+        self.assertRaises(TypeError, self.setprofile)
+
+    def test_kept(self):
+        # What's found is kept after profiling stops, and thrown away when
+        # it starts again
+        self.start()
+        keep = self.work()
+        self.stop()
+        results = self.getprofile()
+        self.assert_(results)
+        self.check(results)
+        self.assertEqual(len(self.getprofile()), len(results))
+        self.start()
+        self.stop()
+        self.assert_(len(self.getprofile()) < len(results))
+
+    def test_children(self):
+        # Children are profiled on their own, and what's found of them is
+        # kept after they exit
+        self.start()
+        with threadtools.branch() as children:
+            for i in range(self.nchildren):
+                children.addresult(*self.child())
+        self.stop()
+        self.check_children(self.getprofile(), children.getresults())
@@ -0,0 +1,95 @@
+#!/usr/bin/env python
+"""
+Multi-producer, multi-consumer throughput of threadtools.Queue
+
+Queue.Queue can't be handed to a branch (it isn't shareable), so the
+baseline is Queue.py's algorithm on a Monitor, which is what a shared
+module has to use today.  collections.deque isn't shareable either, so
+it keeps a plain list.
+
+    >>> from test import queuebench
+    >>> queuebench.main(producers=4, consumers=4)
+"""
+
+from __future__ import shared_module
+from threadtools import Monitor, monitormethod, condition, wait, branch, Queue
+
+
+class MonitorQueue(Monitor):
+    __shared__ = True
+
+    def __init__(self, maxsize):
+        self.maxsize = maxsize
+        self.queue = []
+
+    @condition
+    def not_empty(self):
+        return len(self.queue)
+
+    @condition
+    def not_full(self):
+        return len(self.queue) < self.maxsize
+
+    @monitormethod
+    def put(self, item):
+        wait(self.not_full)
+        self.queue.append(item)
+
+    @monitormethod
+    def get(self):
+        wait(self.not_empty)
+        return self.queue.pop(0)
+
+
+def produce(queue, count):
+    for i in range(count):
+        queue.put(i)
+
+def consume(queue, count):
+    for i in range(count):
+        queue.get()
+
+def produce_many(queue, count, batch):
+    for start in range(0, count, batch):
+        queue.put_many(range(start, min(start + batch, count)))
+
+def consume_many(queue, count, batch):
+    while count:
+        count -= len(queue.get_many(min(batch, count)))
+
+
+def run(name, queue, producers, consumers, total, batch=None):
+    from time import time  # Not shareable, so not a module global
+    per_producer = total // producers
+    per_consumer = per_producer * producers // consumers
+    start = time()
+    with branch() as children:
+        for i in range(producers):
+            if batch:
+                children.add(produce_many, queue, per_producer, batch)
+            else:
+                children.add(produce, queue, per_producer)
+        for i in range(consumers):
+            if batch:
+                children.add(consume_many, queue, per_consumer, batch)
+            else:
+                children.add(consume, queue, per_consumer)
+    elapsed = time() - start
+    print("%-28s %8.0f items/sec" % (name, per_producer * producers / elapsed))
+
+def main(producers=4, consumers=4, total=10**5, maxsize=1024, batch=64):
+    import gc
+    print(producers, "producers,", consumers, "consumers,", total, "items")
+    # Like timeit, keep collections out of the timings
+    gc.disable()
+    try:
+        run("Queue.py on a Monitor", MonitorQueue(maxsize), producers,
+            consumers, total)
+        run("threadtools.Queue", Queue(maxsize), producers, consumers, total)
+        run("threadtools.Queue, batch %d" % batch, Queue(maxsize), producers,
+            consumers, total, batch)
+    finally:
+        gc.enable()
+
+if __name__ == '__main__':
+    raise RuntimeError("queuebench must not be the __main__ module")
@@ -0,0 +1,106 @@
+#!/usr/bin/env python
+"""
+Throughput of socket.sendfile() and socket.splice_to() against the
+loops they replace: read() and sendall() from a file, and recv() and
+sendall() from one socket to another.  The far end of each connection
+is drained (or fed) by a branch child using os.read() (or os.write()).
+
+    >>> from test import sendfilebench
+    >>> sendfilebench.main(size=64*1024*1024)
+"""
+
+from __future__ import shared_module
+from threadtools import branch
+
+CHUNK = 64 * 1024
+
+
+def drain(fd, count):
+    from os import read
+    while count:
+        data = read(fd, CHUNK)
+        if not data:
+            break
+        count -= len(data)
+
+def feed(fd, count):
+    from os import write
+    data = bytes(CHUNK)
+    while count:
+        count -= write(fd, data[:min(CHUNK, count)])
+
+
+def copy_file(f, sock, size):
+    while True:
+        data = f.read(CHUNK)
+        if not data:
+            break
+        sock.sendall(data)
+
+def sendfile_file(f, sock, size):
+    sock.sendfile(f)
+
+def copy_sock(src, dst, size):
+    while size:
+        data = src.recv(min(CHUNK, size))
+        if not data:
+            break
+        dst.sendall(data)
+        size -= len(data)
+
+def splice_sock(src, dst, size):
+    while size:
+        n = src.splice_to(dst, size)
+        if not n:
+            break
+        size -= n
+
+
+def run(name, func, src, dst, size, source_fd=None, sink_fd=None):
+    from time import time  # Not shareable, so not a module global
+    start = time()
+    with branch() as children:
+        if source_fd is not None:
+            children.add(feed, source_fd, size)
+        children.add(drain, sink_fd, size)
+        func(src, dst, size)
+    elapsed = time() - start
+    print("%-24s %8.1f MB/sec" % (name, size / elapsed / (1024 * 1024)))
+
+def main(size=64*1024*1024):
+    import gc, os, socket, tempfile
+    print(size // (1024 * 1024), "MB through a socketpair")
+
+    fd, path = tempfile.mkstemp()
+    try:
+        with os.fdopen(fd, 'wb') as f:
+            block = bytes(CHUNK)
+            for i in range(0, size, CHUNK):
+                f.write(block[:min(CHUNK, size - i)])
+
+        # Like timeit, keep collections out of the timings
+        gc.disable()
+        try:
+            for name, func in [("read/sendall loop", copy_file),
+                               ("sendfile()", sendfile_file)]:
+                out, sink = socket.socketpair()
+                with open(path, 'rb', buffering=0) as f:
+                    run(name, func, f, out, size, sink_fd=sink.fileno())
+                out.close()
+                sink.close()
+
+            for name, func in [("recv/sendall relay", copy_sock),
+                               ("splice_to()", splice_sock)]:
+                source, src = socket.socketpair()
+                out, sink = socket.socketpair()
+                run(name, func, src, out, size, source.fileno(),
+                    sink.fileno())
+                for s in source, src, out, sink:
+                    s.close()
+        finally:
+            gc.enable()
+    finally:
+        os.remove(path)
+
+if __name__ == '__main__':
+    raise RuntimeError("sendfilebench must not be the __main__ module")
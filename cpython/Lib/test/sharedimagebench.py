@@ -0,0 +1,125 @@
+#!/usr/bin/env python
+"""
+Startup time and memory of importing a batch of shared modules from
+their .pyc files, with and without PYTHONLAZYCODE, and from a shared
+image (see sharedimage) made of them.  The modules are made up, each
+with some constants, functions and classes, and written to a temporary
+directory put at the end of sys.path, as site-packages would be.  Each
+run is a fresh interpreter; the time includes its startup and the
+memory is its peak resident set.
+
+    >>> from test import sharedimagebench
+    >>> sharedimagebench.main(runs=10)
+"""
+
+MODULES = 40
+
+MODULE = """\
+# Made up by sharedimagebench
+from __future__ import shared_module
+from threadtools import Monitor, monitormethod
+%(imports)s
+NAMES = %(names)r
+"""
+
+FUNCTION = """
+def func%(i)d(x, y=%(i)d):
+    total = 0
+    for n in range(x):
+        if n %% 3 == 0:
+            total += n * y
+        else:
+            total -= n
+    return total, NAMES[%(i)d %% len(NAMES)]
+"""
+
+CLASS = """
+class Class%(i)d(Monitor):
+    __shared__ = True
+    limit = %(i)d
+    def __init__(self):
+        self.count = 0
+    @monitormethod
+    def tick(self):
+        self.count += 1
+        return self.count < self.limit
+    @classmethod
+    def make(cls):
+        return cls()
+    def __repr__(self):
+        return 'Class%(i)d(%%d)' %% self.count
+"""
+
+CHILD = """\
+import sys, resource
+sys.path.append(%r)
+for i in range(%d):
+    __import__('benchmod%%d' %% i)
+print(resource.getrusage(resource.RUSAGE_SELF).ru_maxrss)
+"""
+
+
+def make_modules(dir):
+    import os
+    for m in range(MODULES):
+        parts = [MODULE % {"imports": "import benchmod%d" % (m - 1) if m else "",
+                           "names": tuple("name%d_%d" % (m, i)
+                                          for i in range(20))}]
+        for i in range(30):
+            parts.append(FUNCTION % {"i": i})
+        for i in range(10):
+            parts.append(CLASS % {"i": i})
+        with open(os.path.join(dir, "benchmod%d.py" % m), "w") as f:
+            f.write("".join(parts))
+
+
+def run(script, output, env):
+    import os, sys
+    from time import time
+    start = time()
+    status = os.system("%s %s %s > %s" % (env, sys.executable, script,
+                                          output))
+    elapsed = time() - start
+    assert status == 0
+    with open(output) as f:
+        return elapsed, int(f.read())
+
+
+def main(runs=10):
+    import os, sys, tempfile, sharedimage
+    from test import test_support
+
+    dir = tempfile.mkdtemp()
+    image = os.path.join(dir, "bench.image")
+    script = os.path.join(dir, "child.py")
+    output = os.path.join(dir, "output")
+    try:
+        make_modules(dir)
+        # Writes the .pyc files the children read, and the image
+        sys.path.insert(0, dir)
+        try:
+            included, excluded = sharedimage.write(
+                image, ["benchmod%d" % (MODULES - 1)])
+        finally:
+            sys.path.remove(dir)
+        assert len([n for n in included if n.startswith("benchmod")]) == \
+               MODULES, excluded
+        with open(script, "w") as f:
+            f.write(CHILD % (dir, MODULES))
+        run(script, output, "")  # Warm the page cache
+        for name, env in ((".pyc", ""), ("lazy", "PYTHONLAZYCODE=1"),
+                          ("image", "PYTHONSHAREDIMAGE=" + image)):
+            times = []
+            rss = []
+            for i in range(runs):
+                elapsed, maxrss = run(script, output, env)
+                times.append(elapsed)
+                rss.append(maxrss)
+            print("%-8s best %6.1f ms, mean %6.1f ms, peak RSS %6d KB" %
+                  (name, min(times) * 1000, sum(times) / runs * 1000,
+                   min(rss)))
+    finally:
+        test_support.rmtree(dir)
+
+if __name__ == '__main__':
+    raise RuntimeError("sharedimagebench must not be the __main__ module")
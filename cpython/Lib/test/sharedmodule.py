@@ -1,7 +1,7 @@
 # WTF.  If my __future__ import is on the first line it gets ignored?!
 from __future__ import shared_module
 
-from threadtools import monitormethod, Monitor, branch, condition, wait
+from threadtools import monitormethod, Monitor, branch, condition, wait, select
 from operator import isShareable
 from time import sleep
 a = 42
@@ -12,6 +12,87 @@ def safesharedfunc():
 def sharedfunc():
     raise ValueError('moo')
 
+def square(x):
+    if x == 13:
+        raise ValueError('unlucky')
+    return x * x
+
+def produce(queue, start, count):
+    for i in range(start, start + count):
+        queue.put(i)
+
+def consume(queue, count):
+    total = 0
+    for i in range(count):
+        total += queue.get()
+    return total
+
+def sleep_ms(ms):
+    # Returns microseconds slept, as floats aren't shareable
+    from time import time
+    start = time()
+    sleep(ms / 1000)
+    return int((time() - start) * 1000000)
+
+def put_later(queue, item):
+    sleep(0.1)
+    queue.put(item)
+
+def write_later(fd, data):
+    from os import write
+    sleep(0.1)
+    write(fd, data)
+
+def read_when_ready(fd):
+    from os import read
+    from threadtools import readable
+    select([readable(fd)])
+    return read(fd, 1)
+
+def splice_fds(fd, other_fd, nbytes):
+    from socket import fromfd, AF_UNIX, SOCK_STREAM
+    sock = fromfd(fd, AF_UNIX, SOCK_STREAM)
+    other = fromfd(other_fd, AF_UNIX, SOCK_STREAM)
+    try:
+        return sock.splice_to(other, nbytes)
+    finally:
+        sock.close()
+        other.close()
+
+def submit_and_wait(fd):
+    from os import dup
+    with open(dup(fd), 'rb', buffering=0) as f:
+        buf = bytearray(1)
+        f.submit_read(0, buf)
+        return f.wait_completions(), buf
+
+def readfd(fd):
+    from os import dup
+    with open(dup(fd), 'rb', buffering=0) as f:
+        return f.read(1)
+
+def spin(n):
+    # Loops without making a single call; returns the time it finished
+    # in microseconds
+    from time import time
+    i = 0
+    while i < n:
+        i += 1
+    return int(time() * 1000000)
+
+def total(start, item, n):
+    t = start
+    for i in range(n):
+        t = t + item
+    return t
+
+def tick(counter, n):
+    for i in range(n):
+        counter.tick()
+
+def strings(n, size):
+    return tuple([bytes(size) for i in range(n)])
+
 def readloop():
     with open('/dev/zero', 'rb') as f:
         while f.read(1024):
@@ -99,6 +180,12 @@ class Checkpoint(Monitor):
     def wait(self):
         wait(self.finished)
 
+    @monitormethod
+    def select(self, queue):
+        if select([queue, self.finished]) is queue:
+            return queue.get()
+        return 'finished'
+
 
 class Finalizable(Monitor):
     __shared__ = True
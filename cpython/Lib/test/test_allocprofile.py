@@ -0,0 +1,133 @@
+"""Test suite for the allocation profiler."""
+
+import sys
+from test import test_support
+from test import sharedmodule
+from test import profiler_tests
+import allocprofile
+
+
+sample = profiler_tests.records(
+    ("thread", "type", "size", "weight", "traceback"),
+    thread=1, type="bytes", size=64, weight=1024,
+    traceback=(("f.py", "<module>", 1), ("f.py", "f", 3)))
+
+
+def allocate(n, size):
+    return [bytearray(size) for i in range(n)]
+
+
+class AllocProfileTests(profiler_tests.CommonTest):
+    setprofile = staticmethod(sys.setallocprofile)
+    getprofile = staticmethod(sys.getallocsamples)
+    start_args = (1024, 4)
+    stop_args = (0,)
+
+    def work(self):
+        return allocate(1000, 1000)
+
+    def check(self, samples):
+        for thread, type, size, weight, traceback in samples:
+            self.assert_(type is None or isinstance(type, str))
+            self.assert_(size > 0)
+            self.assertEqual(weight, max(size, 1024))
+            self.assert_(len(traceback) <= 4)
+        # About a megabyte, sampled a kilobyte at a time
+        total = sum(s[3] for s in samples)
+        self.assert_(500000 < total < 2000000, total)
+
+    def child(self):
+        return sharedmodule.strings, 500, 500
+
+    def check_children(self, samples, results):
+        # The children's samples outlive them, as long as their memory
+        # does
+        self.assertEqual(len(results), self.nchildren)
+        snapshot = allocprofile.Snapshot(samples)
+        stats = snapshot.filter(lambda s: s[4] and
+                                s[4][-1][1] == "<listcomp>" and
+                                s[4][-2][1] == "strings").statistics()
+        self.assertEqual(len(stats), 1)
+        self.assert_(500000 < stats[0]["size"] < 2000000, stats[0])
+        by_thread = snapshot.statistics("thread")
+        self.assert_(len(by_thread) >= 2, by_thread)
+
+    def test_setallocprofile(self):
+        self.assertRaises(ValueError, sys.setallocprofile, -1)
+        self.assertRaises(ValueError, sys.setallocprofile, 1024, 0)
+        sys.setallocprofile(1024, 4)
+        self.assertEqual(sys.getallocprofile(), 1024)
+        sys.setallocprofile(0)
+        self.assertEqual(sys.getallocprofile(), 0)
+
+    def test_freed(self):
+        # Samples are forgotten as their memory is freed, and all
+        # forgotten when sampling starts again, even if still live
+        sys.setallocprofile(1024, 4)
+        keep = allocate(1000, 1000)
+        sys.setallocprofile(0)
+        samples = sys.getallocsamples()
+        del keep
+        self.assert_(len(sys.getallocsamples()) < len(samples))
+        keep = allocate(1000, 1000)
+        sys.setallocprofile(1024)
+        sys.setallocprofile(0)
+        self.assert_(len(sys.getallocsamples()) < 10)
+
+    def test_traceback(self):
+        allocprofile.start(512)
+        keep = allocate(200, 100)
+        snapshot = allocprofile.take_snapshot()
+        allocprofile.stop()
+        code = allocate.__code__
+        for thread, type, size, weight, traceback in snapshot.samples:
+            if type == "bytearray" and traceback[-1][1] == "<listcomp>":
+                self.assertEqual(traceback[-1][0], code.co_filename)
+                self.assertEqual(traceback[-2][1], code.co_name)
+                self.assertEqual(traceback[-3][1], "test_traceback")
+                break
+        else:
+            self.fail("no bytearray sampled in allocate()")
+
+    def test_statistics(self):
+        snapshot = allocprofile.Snapshot([
+            sample(), sample(thread=2, type=None, weight=2048),
+            sample(traceback=(("f.py", "g", 5),))])
+        self.assertEqual(snapshot.total(), 4096)
+        stats = snapshot.statistics("site")
+        self.assertEqual([(s["key"], s["size"], s["count"]) for s in stats],
+                         [(("f.py", "f", 3), 3072, 2),
+                          (("f.py", "g", 5), 1024, 1)])
+        self.assertEqual(len(snapshot.statistics("traceback")), 2)
+        self.assertEqual(snapshot.statistics("type")[0]["key"], None)
+        self.assertEqual(len(snapshot.statistics("thread")), 2)
+        self.assertRaises(ValueError, snapshot.statistics, "bogus")
+
+        newer = allocprofile.Snapshot([sample(), sample(type="str"),
+                                       sample(type="str")])
+        diffs = newer.compare_to(snapshot, "type")
+        self.assertEqual([(d["key"], d["size_diff"], d["count_diff"])
+                          for d in diffs],
+                         [("str", 2048, 2), (None, -2048, -1),
+                          ("bytes", -1024, -1)])
+
+    def test_format(self):
+        snapshot = allocprofile.Snapshot([sample(weight=5 << 20), sample()])
+        lines = allocprofile.format_statistics(snapshot.statistics())
+        self.assertEqual(len(lines), 2)
+        self.assert_("5.0MiB" in lines[1] and "f.py:3(f)" in lines[1], lines)
+        lines = allocprofile.format_statistics(
+            snapshot.statistics("traceback"), "traceback")
+        self.assertEqual(len(lines), 3)
+        self.assert_(lines[2].strip() == "f.py:1(<module>)", lines)
+        diffs = snapshot.compare_to(allocprofile.Snapshot([]))
+        lines = allocprofile.format_diff(diffs, limit=1)
+        self.assertEqual(len(lines), 2)
+        self.assert_("+5.0MiB" in lines[1], lines)
+
+
+def test_main():
+    test_support.run_unittest(AllocProfileTests)
+
+if __name__ == "__main__":
+    test_main()
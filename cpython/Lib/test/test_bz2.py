@@ -332,6 +332,27 @@ class FuncTest(BaseTest):
         # "Test decompress() function with incomplete data"
         self.assertRaises(ValueError, bz2.decompress, self.DATA[:-10])
 
+    def testDecompressMultiStream(self):
+        # "Test decompress() function with concatenated streams"
+        text = bz2.decompress(self.DATA * 3)
+        self.assertEqual(text, self.TEXT * 3)
+        # Anything else after a stream is still ignored
+        text = bz2.decompress(self.DATA + b"garbage")
+        self.assertEqual(text, self.TEXT)
+
+    def testCompressParallel(self):
+        # "Test compress_parallel() function"
+        text = self.TEXT * 400  # Several blocks at compresslevel 1
+        for threads in 1, 2, 5, 0:
+            data = bz2.compress_parallel(text, 1, threads)
+            self.assertEqual(self.decompress(data), text)
+        data = bz2.compress_parallel(self.TEXT, threads=4)
+        self.assertEqual(data, bz2.compress(self.TEXT))
+        self.assertEqual(bz2.decompress(bz2.compress_parallel(b"")), b"")
+        self.assertRaises(ValueError, bz2.compress_parallel, text, 0)
+        self.assertRaises(ValueError, bz2.compress_parallel, text, 9, -1)
+        self.assertRaises(TypeError, bz2.compress_parallel, "text")
+
 def test_main():
     test_support.run_unittest(
         BZ2FileTest,
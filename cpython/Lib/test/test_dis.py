@@ -17,7 +17,7 @@ dis_f = """\
               6 CALL_FUNCTION            1
               9 POP_TOP
 
- %-4d        10 LOAD_CONST               1 (1)
+ %-4d        10 LOAD_CONST__RETURN_VALUE     1 (1)
              13 RETURN_VALUE
 """%(_f.__code__.co_firstlineno + 1,
      _f.__code__.co_firstlineno + 2)
@@ -41,7 +41,7 @@ dis_bug708901 = """\
 
  %-4d        22 JUMP_ABSOLUTE           16
         >>   25 POP_BLOCK
-        >>   26 LOAD_CONST               0 (None)
+        >>   26 LOAD_CONST__RETURN_VALUE     0 (None)
              29 RETURN_VALUE
 """%(bug708901.__code__.co_firstlineno + 1,
      bug708901.__code__.co_firstlineno + 2,
@@ -91,11 +91,11 @@ _BIG_LINENO_FORMAT = """\
 
 dis_module_expected_results = """\
 Disassembly of f:
-  4           0 LOAD_CONST               0 (None)
+  4           0 LOAD_CONST__RETURN_VALUE     0 (None)
               3 RETURN_VALUE
 
 Disassembly of g:
-  5           0 LOAD_CONST               0 (None)
+  5           0 LOAD_CONST__RETURN_VALUE     0 (None)
               3 RETURN_VALUE
 
 """
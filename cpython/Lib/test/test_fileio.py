@@ -85,6 +85,51 @@ class AutoFileTests(unittest.TestCase):
         f.close()
         self.assert_(f.closed)
 
+    def testSubmit(self):
+        if not hasattr(self.f, 'submit_write'):
+            return
+        self.f.close()
+        self.f = _fileio._FileIO(TESTFN, 'w+')
+        blocks = {}
+        for i in range(100):
+            tag = self.f.submit_write(i * 10, bytes([i]) * 10)
+            blocks[tag] = i
+        done = []
+        while len(done) < 100:
+            done += self.f.wait_completions(100)
+        self.assertEquals(sorted(tag for tag, n in done), sorted(blocks))
+        self.assertEquals(set(n for tag, n in done), {10})
+        self.assertEquals(self.f.wait_completions(), [])
+
+        bufs = {}
+        for i in reversed(range(100)):
+            buf = bytearray(10)
+            bufs[self.f.submit_read(i * 10, buf)] = (i, buf)
+        bufs[self.f.submit_read(1000, bytearray(10))] = (None, None)
+        done = []
+        while len(done) < 101:
+            done += self.f.wait_completions()
+        for tag, n in done:
+            i, buf = bufs.pop(tag)
+            if i is None:
+                self.assertEquals(n, 0)  # EOF
+            else:
+                self.assertEquals(n, 10)
+                self.assertEquals(buf, bytes([i]) * 10)
+        self.assertEquals(bufs, {})
+
+        self.assertRaises(ValueError, self.f.submit_read, -1, bytearray(1))
+        self.assertRaises(TypeError, self.f.submit_read, 0, "abc")
+        # Closing with I/O in flight waits it out
+        self.f.submit_read(0, bytearray(10))
+        self.f.close()
+        self.assertRaises(ValueError, self.f.submit_read, 0, bytearray(1))
+        self.assertRaises(ValueError, self.f.submit_write, 0, b"x")
+        self.assertRaises(ValueError, self.f.wait_completions)
+
+        self.f = _fileio._FileIO(TESTFN, 'r')
+        self.assertRaises(ValueError, self.f.submit_write, 0, b"x")
+
     def testMethods(self):
         methods = ['fileno', 'isatty', 'read', 'readinto',
                    'seek', 'tell', 'truncate', 'write', 'seekable',
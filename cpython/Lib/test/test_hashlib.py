@@ -185,6 +185,60 @@ class HashLibTestCase(unittest.TestCase):
           "de0ff244877ea60a4cb0432ce577c31beb009c5c2c49aa2e4eadb217ad8cc09b")
 
 
+    # Lengths either side of where the padding spills into another block
+    many_lengths = (0, 1, 55, 56, 63, 64, 65, 111, 112, 119, 120, 127, 128,
+                    129, 239, 240, 1000, 3000)
+
+    def test_hash_many(self):
+        buffers = [bytes(i * 7 % 256 for i in range(n))
+                   for n in self.many_lengths]
+        for name in self.supported_hash_names:
+            expected = [hashlib.new(name, b).digest() for b in buffers]
+            for threads in (0, 1, 3):
+                self.assertEqual(hashlib.hash_many(name, buffers, threads),
+                                 expected)
+            self.assertEqual(hashlib.hash_many(name, map(bytearray, buffers)),
+                             expected)
+        self.assertEqual(hashlib.hash_many('md5', []), [])
+        self.assertRaises(TypeError, hashlib.hash_many, 'md5', ['abc'])
+        self.assertRaises(ValueError, hashlib.hash_many, 'md5', [], -1)
+        self.assertRaises(ValueError, hashlib.hash_many, 'spam', [])
+
+    def test_tree(self):
+        data = bytes(i * 7 % 256 for i in range(10000))
+        for name in self.supported_hash_names:
+            h = hashlib.new(name)
+            t = hashlib.tree(name, data, leaf_size=1000)
+            self.assertEqual(t.digest_size, h.digest_size)
+            self.assertEqual(t.hexdigest(), hexstr(t.digest()))
+            # Nothing but the leaf size and the data matters
+            for step in (1, 999, 1000, 1001, 4096):
+                t2 = hashlib.tree(name, leaf_size=1000, threads=2)
+                for i in range(0, len(data), step):
+                    t2.update(data[i:i+step])
+                self.assertEqual(t2.digest(), t.digest())
+            self.assertNotEqual(hashlib.tree(name, data, 999).digest(),
+                                t.digest())
+
+        leaves = b''.join(hashlib.sha256(data[i:i+4096]).digest()
+                          for i in range(0, len(data), 4096))
+        root = hashlib.sha256(b'\0' * 6 + b'\x10\0' + b'\0' * 6 + b"'\x10" +
+                              leaves)
+        self.assertEqual(hashlib.tree('sha256', data, 4096).digest(),
+                         root.digest())
+        self.assertEqual(hashlib.tree('sha256', data, 4096).name,
+                         'SHA256_tree')
+
+        t = hashlib.tree('sha1', data[:1500], leaf_size=1000)
+        c = t.copy()
+        c.update(data[1500:])
+        self.assertEqual(c.digest(), hashlib.tree('sha1', data, 1000).digest())
+        self.assertEqual(t.digest(),
+                         hashlib.tree('sha1', data[:1500], 1000).digest())
+        self.assertRaises(TypeError, t.update, 'abc')
+        self.assertRaises(ValueError, hashlib.tree, 'sha1', leaf_size=0)
+
+
 def test_main():
     test_support.run_unittest(HashLibTestCase)
 
@@ -379,6 +379,25 @@ class BufferedReaderTest(unittest.TestCase):
 
         self.assertEquals(b"abcdefg", bufio.read())
 
+    def testReadNone(self):
+        rawio = MockRawIO((b"abc", b"d", b"efg"))
+        bufio = io.BufferedReader(rawio)
+
+        self.assertEquals(b"abcdefg", bufio.read(None))
+
+    def testReadlineLimit(self):
+        rawio = MockRawIO((b"abc\nd", b"ef\n", b"ghi"))
+        bufio = io.BufferedReader(rawio)
+
+        # The limit is never overshot, even across raw reads
+        self.assertEquals(b"ab", bufio.readline(2))
+        self.assertEquals(b"c\n", bufio.readline(5))
+        self.assertEquals(b"", bufio.readline(0))
+        self.assertEquals(b"def", bufio.readline(3))
+        self.assertEquals(b"\n", bufio.readline(None))
+        self.assertEquals(b"ghi", bufio.readline(-1))
+        self.assertEquals(b"", bufio.readline())
+
     def testFileno(self):
         rawio = MockRawIO((b"abc", b"d", b"efg"))
         bufio = io.BufferedReader(rawio)
@@ -470,6 +489,12 @@ class BufferedRandomTest(unittest.TestCase):
         self.assertEqual(b"ghjk", rw.read()) # This read forces write flush
         self.assertEquals(b"dddeee", raw._write_stack[0])
 
+    def testReadNone(self):
+        rw = io.BufferedRandom(io.BytesIO(b"asdfghjkl"), 4)
+
+        self.assertEqual(b"as", rw.read(2))
+        self.assertEqual(b"dfghjkl", rw.read(None))
+
     def testSeekAndTell(self):
         raw = io.BytesIO(b"asdfghjkl")
         rw = io.BufferedRandom(raw)
@@ -490,6 +515,16 @@ class BufferedRandomTest(unittest.TestCase):
         self.assertEquals(b"fl", rw.read(11))
         self.assertRaises(TypeError, rw.seek, 0.0)
 
+    def testRelativeSeekAfterReadahead(self):
+        raw = io.BytesIO(b"asdfghjkl")
+        rw = io.BufferedRandom(raw)
+
+        self.assertEquals(b"as", rw.read(2))
+        self.assertEquals(9, raw.tell()) # The rest is read ahead
+        self.assertEquals(4, rw.seek(2, 1))
+        self.assertEquals(b"gh", rw.read(2))
+        self.assertEquals(6, rw.tell())
+
 # To fully exercise seek/tell, the StatefulIncrementalDecoder has these
 # properties:
 #   - A single output character can correspond to many bytes of input.
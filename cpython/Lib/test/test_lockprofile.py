@@ -0,0 +1,109 @@
+"""Test suite for the lock contention profiler."""
+
+import sys
+from test import test_support
+from test import sharedmodule
+from test import profiler_tests
+import lockprofile
+
+
+stat = profiler_tests.records(
+    thread=1, kind="critical", name="shareddict", lock=0x10,
+    site=("f.py", "f", 3), acquired=1, contended=1, wait=1e-6,
+    wait_max=1e-6, wait_hist=(0, 1), held=1, hold=1e-6, hold_max=1e-6,
+    hold_hist=(1,))
+
+
+class LockProfileTests(profiler_tests.CommonTest):
+    setprofile = staticmethod(sys.setlockprofile)
+    getprofile = staticmethod(sys.getlockprofile)
+    start_args = (True,)
+    stop_args = (False,)
+
+    def setUp(self):
+        self.counter = sharedmodule.Counter()
+
+    def work(self):
+        for i in range(100):
+            self.counter.tick()
+
+    def check(self, stats):
+        for s in stats:
+            self.assert_(s["kind"] in ("critical", "monitorspace",
+                                       "refowner", "world", "gc"), s)
+            self.assert_(s["contended"] <= s["acquired"])
+            self.assertEqual(sum(s["wait_hist"]), s["contended"])
+            self.assertEqual(sum(s["hold_hist"]), s["held"])
+            self.assert_(s["wait_max"] <= s["wait"])
+            self.assert_(s["hold_max"] <= s["hold"])
+
+    def child(self):
+        # Children contending for one monitor are counted at the call
+        # site
+        return sharedmodule.tick, self.counter, 500
+
+    def check_children(self, stats, results):
+        self.assertEqual(self.counter.value(), 2000)
+        acquired = held = 0
+        for s in stats:
+            if s["kind"] == "monitorspace" and s["site"] is not None and \
+                    s["site"][1] == "tick":
+                acquired += s["acquired"]
+                held += s["held"]
+        self.assertEqual(acquired, 2000)
+        self.assertEqual(held, 2000)
+        locks = [s for s in lockprofile.by_lock(stats)
+                 if s["kind"] == "monitorspace" and s["acquired"] >= 2000]
+        self.assertEqual(len(locks), 1)
+
+    def test_world(self):
+        import gc
+        with lockprofile.LockProfile() as p:
+            gc.collect()
+        code = self.test_world.__code__
+        for s in p.stats:
+            if s["kind"] == "world" and s["site"] is not None and \
+                    s["site"][1] == code.co_name:
+                self.assert_(s["acquired"] >= 1)
+                self.assert_(s["held"] >= 1)
+                self.assertEqual(s["site"][0], code.co_filename)
+                break
+        else:
+            self.fail("gc.collect() didn't stop the world")
+
+    def test_merge(self):
+        stats = [stat(), stat(thread=2, wait=2e-6, wait_max=2e-6,
+                              wait_hist=(0, 0, 1)),
+                 stat(site=("f.py", "f", 4))]
+        by_lock = lockprofile.by_lock(stats)
+        self.assertEqual(len(by_lock), 1)
+        m = by_lock[0]
+        self.assertEqual(m["acquired"], 3)
+        self.assertEqual(m["wait_max"], 2e-6)
+        self.assertEqual(m["wait_hist"], (0, 2, 1))
+        self.assertEqual(m["thread"], None)
+        self.assertEqual(m["site"], None)
+        self.assertEqual(m["lock"], 0x10)
+        by_site = lockprofile.by_site(stats)
+        self.assertEqual([s["acquired"] for s in by_site], [2, 1])
+
+    def test_format(self):
+        stats = [stat(), stat(lock=0x20, wait=5e-3, wait_max=5e-3)]
+        lines = lockprofile.format_table(stats, sort="wait")
+        self.assertEqual(len(lines), 3)
+        self.assert_("shareddict 0x20 f.py:3(f)" in lines[1], lines)
+        self.assert_("5ms" in lines[1], lines)
+        self.assertEqual(len(lockprofile.format_table(stats, limit=1)), 2)
+        self.assertRaises(ValueError, lockprofile.format_table, stats,
+                          "bogus")
+        hist = lockprofile.format_histogram((0, 0, 4, 0, 2), width=4)
+        self.assertEqual(len(hist), 3)
+        self.assert_(hist[0].split()[1:] == ["####", "4"], hist)
+        self.assert_(hist[2].split()[1:] == ["##", "2"], hist)
+
+
+def test_main():
+    test_support.run_unittest(LockProfileTests)
+
+if __name__ == "__main__":
+    test_main()
@@ -113,6 +113,114 @@ class CodeTestCase(unittest.TestCase):
         new = marshal.loads(marshal.dumps(co))
         self.assertEqual(co, new)
 
+class LazyCodeTestCase(unittest.TestCase):
+    source = """
+def f(x, y=2):
+    "f's doc"
+    def g(z):
+        return [z * y + i for i in range(3)]
+    return g(x)
+
+class C:
+    def m(self, *args, **kwargs):
+        return args, kwargs
+"""
+
+    def test_equal(self):
+        co = compile(self.source, "lazy", "exec")
+        data = marshal.dumps(co)
+        new = marshal.loads(data, True)
+        self.assertEqual(co, new)
+        self.assertEqual(marshal.dumps(new), data)
+
+    def test_run(self):
+        ns = {}
+        exec(marshal.loads(marshal.dumps(compile(self.source, "lazy",
+                                                 "exec")), True), ns)
+        self.assertEqual(ns["f"].__doc__, "f's doc")
+        self.assertEqual(ns["f"](3), [6, 7, 8])
+        self.assertEqual(ns["C"]().m(1, a=2), ((1,), {"a": 2}))
+        self.assertEqual(ns["f"].__code__.co_consts[1].co_names, ("range",))
+
+    def test_left_unread(self):
+        # A nested function's bad data only shows when it's needed
+        co = compile("def f():\n    return 1\n", "lazy", "exec")
+        data = marshal.dumps(co)
+        # f's co_consts, then its co_names as a list instead of a tuple
+        names = b"Ni\x01\x00\x00\x00(\x00\x00\x00\x00"
+        self.assertEqual(data.count(names), 1)
+        data = data.replace(names, names[:6] + b"[" + names[7:])
+        self.assertRaises(Exception, marshal.loads, data)
+        ns = {}
+        exec(marshal.loads(data, True), ns)
+        self.assertEqual(ns["f"].__code__.co_name, "f")
+        self.assertRaises(ValueError, ns["f"])
+        self.assertRaises(ValueError, getattr, ns["f"].__code__, "co_code")
+
+    def test_pyc(self):
+        if os.name != "posix":
+            return
+        import py_compile
+        os.mkdir(test_support.TESTFN)
+        try:
+            source = os.path.join(test_support.TESTFN, "lazymod.py")
+            script = os.path.join(test_support.TESTFN, "script.py")
+            output = os.path.join(test_support.TESTFN, "output")
+            f = open(source, "w")
+            f.write(self.source)
+            f.close()
+            py_compile.compile(source, doraise=True)
+            os.unlink(source)
+            f = open(script, "w")
+            f.write("import sys, lazymod\n"
+                    "print(sys.flags.lazy_code, lazymod.f(3))\n")
+            f.close()
+            status = os.system("PYTHONLAZYCODE=1 %s %s > %s" %
+                               (sys.executable, script, output))
+            self.assertEqual(status, 0)
+            f = open(output)
+            self.assertEqual(f.read(), "1 [6, 7, 8]\n")
+            f.close()
+        finally:
+            test_support.rmtree(test_support.TESTFN)
+
+    def test_recompiled(self):
+        # Recompiling a mapped .pyc leaves the code already imported alone
+        if os.name != "posix":
+            return
+        import py_compile
+        os.mkdir(test_support.TESTFN)
+        try:
+            source = os.path.join(test_support.TESTFN, "lazyrecomp.py")
+            script = os.path.join(test_support.TESTFN, "script.py")
+            output = os.path.join(test_support.TESTFN, "output")
+            old = "def f():\n    return 'old f'\n" \
+                  "def g():\n    return 'old g'\n"
+            f = open(source, "w")
+            f.write(old)
+            f.close()
+            py_compile.compile(source, doraise=True)
+            f = open(script, "w")
+            f.write("import sys, py_compile\n"
+                    "sys.path.insert(0, %r)\n"
+                    "import lazyrecomp\n"
+                    "f = open(%r, 'w')\n"
+                    "f.write(%r)\n"
+                    "f.close()\n"
+                    "py_compile.compile(%r, doraise=True)\n"
+                    "print(lazyrecomp.f(), lazyrecomp.g())\n" %
+                    (test_support.TESTFN, source, old.replace("old", "HAX"),
+                     source))
+            f.close()
+            status = os.system("PYTHONLAZYCODE=1 %s %s > %s" %
+                               (sys.executable, script, output))
+            self.assertEqual(status, 0)
+            f = open(output)
+            self.assertEqual(f.read(), "old f old g\n")
+            f.close()
+        finally:
+            test_support.rmtree(test_support.TESTFN)
+
 class ContainerTestCase(unittest.TestCase, HelperMixin):
     d = {'astring': 'foo@bar.baz.spam',
          'afloat': 7283.43,
@@ -188,6 +296,13 @@ class BugsTestCase(unittest.TestCase):
         last.append([0])
         self.assertRaises(ValueError, marshal.dumps, head)
 
+    def test_many_code_objects(self):
+        # Reading a code object used to leave the depth raised, so more
+        # than the maximum depth of them side by side wouldn't load
+        data = marshal.dumps([compile("1", "many", "eval")] * 2100)
+        self.assertEqual(len(marshal.loads(data)), 2100)
+        self.assertEqual(len(marshal.loads(data, True)), 2100)
+
     def test_exact_type_match(self):
         # Former bug:
         #   >>> class Int(int): pass
@@ -204,6 +319,7 @@ def test_main():
                               FloatTestCase,
                               StringTestCase,
                               CodeTestCase,
+                              LazyCodeTestCase,
                               ContainerTestCase,
                               ExceptionTestCase,
                               BugsTestCase)
@@ -1,7 +1,7 @@
 from test.test_support import TESTFN, run_unittest
 import mmap
 import unittest
-import os, re
+import os, re, sys
 
 PAGESIZE = mmap.PAGESIZE
 
@@ -437,6 +437,74 @@ class MmapTests(unittest.TestCase):
         self.assertRaises(TypeError, m.write, "foo")
         f.close()
 
+    def test_count(self):
+        data = b'one two ones' + b'x' * PAGESIZE + b'one'
+        with open(TESTFN, "wb") as f:
+            f.write(data)
+        f = open(TESTFN, "rb")
+        m = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        f.close()
+        for sub in (b'one', b'o', b'x', b'xx', b'', b'none'):
+            self.assertEqual(m.count(sub), data.count(sub))
+        self.assertEqual(m.count(b'one', 1), 2)
+        self.assertEqual(m.count(b'one', 0, -1), 2)
+        self.assertEqual(m.count(b'one', -3), 1)
+        # Matches touching the end of the map
+        self.assertEqual(m.find(b'xone'), len(data) - 4)
+        self.assertEqual(m.rfind(b'xone'), len(data) - 4)
+        self.assertEqual(m.find(b'onex'), -1)
+        m.close()
+
+    def test_shareable(self):
+        from operator import isShareable
+        data = b'spam\n' * PAGESIZE
+        with open(TESTFN, "wb") as f:
+            f.write(data)
+        f = open(TESTFN, "rb")
+        try:
+            self.assertRaises(ValueError, mmap.mmap, f.fileno(), 0,
+                              shareable=True)
+            m = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+            self.failIf(isShareable(m))
+            m.close()
+            m = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ,
+                          shareable=True)
+        finally:
+            f.close()
+        self.assert_(isShareable(m))
+        self.assertEqual(m[:5], b'spam\n')
+        self.assertEqual(m.find(b'\n', 5), 9)
+        for method, args in (('read', (1,)), ('read_byte', ()),
+                             ('readline', ()), ('seek', (0,)),
+                             ('close', ()), ('write', (b'x',))):
+            self.assertRaises(TypeError, getattr(m, method), *args)
+
+        # Children scan their own part without locking
+        import threadtools
+        step = len(data) // 4
+        with threadtools.branch() as children:
+            for start in range(0, len(data), step):
+                children.addresult(m.count, b'\n', start, start + step)
+        self.assertEqual(sum(children.getresults()), PAGESIZE)
+
+    def test_madvise(self):
+        if not hasattr(mmap.mmap, 'madvise'):
+            return
+        m = mmap.mmap(-1, PAGESIZE * 4, flags=mmap.MAP_PRIVATE)
+        m.madvise(mmap.MADV_SEQUENTIAL)
+        m.madvise(mmap.MADV_WILLNEED, 10, PAGESIZE)
+        m.madvise(mmap.MADV_NORMAL, PAGESIZE * 4)
+        m[0] = 1
+        m.madvise(mmap.MADV_DONTNEED)
+        if sys.platform.startswith('linux'):
+            # Private anonymous pages read back as zeros after DONTNEED
+            self.assertEqual(m[0], 0)
+        self.assertRaises(ValueError, m.madvise, mmap.MADV_NORMAL, -1)
+        self.assertRaises(ValueError, m.madvise, mmap.MADV_NORMAL,
+                          PAGESIZE * 4 + 1)
+        self.assertRaises(ValueError, m.madvise, mmap.MADV_NORMAL, 0, -1)
+        m.close()
+
     def test_error(self):
         self.assert_(issubclass(mmap.error, EnvironmentError))
         self.assert_("mmap.error" in str(mmap.error))
@@ -99,8 +99,119 @@ class OpcodeTest(unittest.TestCase):
         self.failIf(f == g)
 
 
+class QuickeningTest(unittest.TestCase):
+    # Code is specialized for the types it sees once it has run a few
+    # times, so each test warms a function up on one set of types and
+    # then changes them underneath it.
+
+    def warm(self, func, *args):
+        for i in range(20):
+            func(*args)
+
+    def test_add(self):
+        def add(a, b):
+            return a + b
+        self.warm(add, 1, 2)
+        self.assertEqual(add(1, 2), 3)
+        self.assertEqual(add(32767, 1), 32768)
+        self.assertEqual(add(-32767, -32767), -65534)
+        self.assertEqual(add(2**40, -2**40), 0)
+        self.assertEqual(add(True, 1), 2)
+        self.assertEqual(add(1.5, 1), 2.5)
+        self.assertEqual(add('a', 'b'), 'ab')
+        self.assertEqual(add([1], [2]), [1, 2])
+        self.assertRaises(TypeError, add, 1, 'a')
+        self.assertEqual(add(1, 2), 3)
+
+    def test_add_strings(self):
+        def add(a, b):
+            return a + b
+        self.warm(add, 'a', 'b')
+        self.assertEqual(add('a', 'b'), 'ab')
+        self.assertEqual(add(1, 2), 3)
+
+    def test_inplace_add(self):
+        def concat(item, n):
+            s = item[:0]
+            for i in range(n):
+                s += item
+            return s
+        self.warm(concat, 'x', 10)
+        self.assertEqual(concat('x', 100), 'x' * 100)
+        self.assertEqual(concat(b'x', 3), b'xxx')
+        self.assertEqual(concat([1], 2), [1, 1])
+        def count(start, n):
+            i = start
+            while i < n:
+                i += 1
+            return i
+        self.warm(count, 0, 10)
+        self.assertEqual(count(0, 100000), 100000)
+        self.assertEqual(count(0.5, 2), 2.5)
+
+    def test_add_subclass(self):
+        class MyInt(int):
+            def __add__(self, other):
+                return 'MyInt'
+            def __lt__(self, other):
+                return 'MyInt'
+        def add(a, b):
+            return a + b
+        def lt(a, b):
+            return a < b
+        self.warm(add, 1, 2)
+        self.warm(lt, 1, 2)
+        self.assertEqual(add(MyInt(1), 2), 'MyInt')
+        self.assertEqual(lt(MyInt(1), 2), 'MyInt')
+
+    def test_compare(self):
+        def compare(a, b):
+            return a < b, a <= b, a == b, a != b, a > b, a >= b
+        self.warm(compare, 1, 2)
+        self.assertEqual(compare(1, 2), (True, True, False, True, False, False))
+        self.assertEqual(compare(-5, -5), (False, True, True, False, False, True))
+        self.assertEqual(compare(0, -1), (False, False, False, True, True, True))
+        self.assertEqual(compare(2**40, 1), (False, False, False, True, True, True))
+        self.assertEqual(compare(1.5, 1), (False, False, False, True, True, True))
+        self.assertEqual(compare('a', 'b'), (True, True, False, True, False, False))
+        self.assertRaises(TypeError, compare, 1, 'a')
+
+    def test_compare_floats(self):
+        def compare(a, b):
+            return a < b, a <= b, a == b, a != b, a > b, a >= b
+        self.warm(compare, 1.0, 2.0)
+        self.assertEqual(compare(0.5, 0.25), (False, False, False, True, True, True))
+        nan = float('nan')
+        self.assertEqual(compare(nan, nan), (False, False, False, True, False, False))
+        self.assertEqual(compare(1.0, 1), (False, True, True, False, False, True))
+
+    def test_call(self):
+        def sub(a, b):
+            return a - b
+        def call(func, a, b):
+            return func(a, b)
+        self.warm(call, sub, 3, 1)
+        self.assertEqual(call(sub, 3, 1), 2)
+        self.assertEqual(call(lambda a, b=5: a * b, 3, 2), 6)
+        self.assertEqual(call(max, 3, 4), 4)
+        self.assertEqual(call(divmod, 7, 2), (3, 1))
+        self.assertRaises(TypeError, call, lambda a: a, 1, 2)
+        class C:
+            def method(self, a):
+                return a
+        self.assertEqual(call(C.method, C(), 7), 7)
+        self.assertEqual(call(sub, 3, 1), 2)
+
+    def test_call_recursion(self):
+        def fib(n):
+            if n < 2:
+                return n
+            return fib(n - 1) + fib(n - 2)
+        self.assertEqual(fib(20), 6765)
+
+
 def test_main():
-    run_unittest(OpcodeTest)
+    run_unittest(OpcodeTest, QuickeningTest)
 
 if __name__ == '__main__':
     test_main()
@@ -217,6 +217,50 @@ class TestTranforms(unittest.TestCase):
         asm = disassemble(f)
         self.assert_('BINARY_ADD' not in asm)
 
+    def test_superinstructions(self):
+        def f(a, b):
+            c = a; d = c
+            if d < b:
+                return a.real
+            return b + 1
+        asm = disassemble(f)
+        for elem in ('STORE_FAST__LOAD_FAST', 'LOAD_FAST__LOAD_FAST',
+                     'COMPARE_OP__JUMP_IF_FALSE', 'LOAD_FAST__LOAD_ATTR',
+                     'LOAD_FAST__LOAD_CONST'):
+            self.assert_(elem in asm, asm)
+        # The second instruction of each pair is left in place
+        self.assertEqual(asm.split().count('LOAD_ATTR'), 1)
+        self.assertEqual(f(1, 2), 1)
+        self.assertEqual(f(2, 1), 2)
+        self.assertRaises(AttributeError, f, "", "x")
+
+        def g(x):
+            if x:
+                x = 1
+            return None
+        asm = disassemble(g)
+        for elem in ('JUMP_IF_FALSE__POP_TOP', 'LOAD_CONST__RETURN_VALUE'):
+            self.assert_(elem in asm, asm)
+        for x in (True, False, [], [1], None):
+            self.assertEqual(g(x), None)
+
+    def test_superinstructions_stay_within_a_line(self):
+        # The second instruction starts a line, which tracing must see
+        def f(a, b):
+            return (a,
+                    b)
+        asm = disassemble(f)
+        self.assert_('LOAD_FAST__LOAD_FAST' not in asm, asm)
+        self.assertEqual(f(1, 2), (1, 2))
+
+    def test_superinstruction_unbound_local(self):
+        def f(a):
+            if a:
+                b = 1
+            return a + b
+        self.assertEqual(f(1), 2)
+        self.assertRaises(UnboundLocalError, f, 0)
+
 
 def test_main(verbose=None):
     import sys
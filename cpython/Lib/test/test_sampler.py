@@ -0,0 +1,84 @@
+"""Test suite for the sampling profiler."""
+
+import sys
+from test import test_support
+from test import sharedmodule
+from test import profiler_tests
+import sampler
+
+
+def busy(n):
+    total = 0
+    for i in range(n):
+        total += i
+    return total
+
+
+class SamplerTests(profiler_tests.CommonTest):
+    setprofile = staticmethod(sys.setsampling)
+    getprofile = staticmethod(sys.getsamples)
+    start_args = (0.001,)
+    stop_args = (0,)
+    nchildren = 2
+
+    def work(self):
+        busy(3000000)
+
+    def check(self, samples):
+        found = 0
+        for thread, stack, count in samples:
+            self.assert_(count > 0)
+            code, lineno = stack[-1]
+            if code is busy.__code__:
+                found += count
+                self.assert_(busy.__code__.co_firstlineno < lineno <=
+                             busy.__code__.co_firstlineno + 4)
+                # The caller is on the stack too
+                self.assert_(self.work.__code__ in
+                             [code for code, lineno in stack])
+        self.assert_(found > 0)
+
+    def child(self):
+        return sharedmodule.spin, 3000000
+
+    def check_children(self, samples, results):
+        threads = set()
+        for thread, stack, count in samples:
+            if stack[-1][0] is sharedmodule.spin.__code__:
+                threads.add(thread)
+        self.assertEqual(len(threads), self.nchildren, threads)
+
+    def test_setsampling(self):
+        self.assertRaises(ValueError, sys.setsampling, -1)
+        self.assertEqual(sys.getsampling(), 0.0)
+        sys.setsampling(0.01)
+        self.assertEqual(sys.getsampling(), 0.01)
+        sys.setsampling(0)
+        self.assertEqual(sys.getsampling(), 0.0)
+
+    def test_sampler(self):
+        with sampler.Sampler(0.001) as s:
+            busy(3000000)
+        self.assert_(s.samples)
+        self.assertEqual(sorted(sys.getsamples()), sorted(s.samples))
+
+    def test_collapse(self):
+        code = busy.__code__
+        samples = [(1, ((code, 3), (code, 4)), 5),
+                   (2, ((code, 3), (code, 4)), 2),
+                   (2, ((code, 3),), 1)]
+        frame = "busy (%s:%%d)" % code.co_filename
+        self.assertEqual(sampler.collapse(samples), [
+            "thread-1;%s;%s 5" % (frame % 3, frame % 4),
+            "thread-2;%s 1" % (frame % 3),
+            "thread-2;%s;%s 2" % (frame % 3, frame % 4)])
+        self.assertEqual(sampler.collapse(samples, threads=False), [
+            "%s 1" % (frame % 3),
+            "%s;%s 7" % (frame % 3, frame % 4)])
+
+
+def test_main():
+    test_support.run_unittest(SamplerTests)
+
+if __name__ == "__main__":
+    test_main()
@@ -0,0 +1,197 @@
+"""Test suite for the shared module images."""
+
+import os
+import sys
+import unittest
+from test import test_support
+
+import sharedimage
+
+CONST = """\
+# The __future__ import can't be on the first line
+from __future__ import shared_module
+from threadtools import Monitor, monitormethod
+
+LIMIT = 3
+
+def double(x):
+    return x * 2
+
+class Base:
+    __shared__ = True
+    def name(self):
+        return 'base'
+
+class Derived(Base):
+    __shared__ = True
+    def name(self):
+        return 'derived ' + super().name()
+    @classmethod
+    def make(cls):
+        return cls()
+    @staticmethod
+    def limit():
+        return LIMIT
+
+class Counter(Monitor):
+    __shared__ = True
+    def __init__(self):
+        self.count = 0
+    @monitormethod
+    def tick(self):
+        self.count += 1
+        return self.count
+"""
+
+USER = """\
+# Imports siconst, which is in the image too
+from __future__ import shared_module
+from siconst import double, Derived
+
+def quadruple(x):
+    return double(double(x))
+"""
+
+CYCLE = """\
+# Imports the other, which imports it
+from __future__ import shared_module
+import %s
+"""
+
+SCRIPT = """\
+import sys
+sys.path[:0] = %r
+import siuser, siconst
+print(' '.join(sorted(n for n in sys.shared_image if n in %r)))
+print(siuser.quadruple(5), siconst.LIMIT, siconst.Derived.limit())
+print(siconst.Derived.make().name(), siuser.Derived is siconst.Derived)
+c = siconst.Counter()
+c.tick()
+print(c.tick())
+"""
+
+RESULTS = "20 3 3\nderived base True\n2\n"
+
+MODULES = ["siconst", "siuser", "siplain", "sicycle1", "sicycle2"]
+
+
+class SharedImageTests(unittest.TestCase):
+
+    def setUp(self):
+        self.dir = os.path.abspath(test_support.TESTFN)
+        os.mkdir(self.dir)
+        self.image = os.path.join(self.dir, "shared.image")
+        self.write_module("siconst", CONST)
+        self.write_module("siuser", USER)
+        sys.path.insert(0, self.dir)
+
+    def tearDown(self):
+        sys.path.remove(self.dir)
+        for name in MODULES:
+            if name in sys.modules:
+                del sys.modules[name]
+        test_support.rmtree(self.dir)
+
+    def write_module(self, name, source):
+        f = open(os.path.join(self.dir, name + ".py"), "w")
+        f.write(source)
+        f.close()
+
+    def run_image(self, path=None):
+        script = os.path.join(self.dir, "script.py")
+        output = os.path.join(self.dir, "output")
+        f = open(script, "w")
+        f.write(SCRIPT % (path or [self.dir], MODULES))
+        f.close()
+        status = os.system("PYTHONSHAREDIMAGE=%s %s %s > %s" %
+                           (self.image, sys.executable, script, output))
+        self.assertEqual(status, 0)
+        f = open(output)
+        try:
+            return f.read()
+        finally:
+            f.close()
+
+    def test_image(self):
+        if os.name != "posix":
+            return
+        included, excluded = sharedimage.write(self.image, ["siuser"])
+        self.assert_("siconst" in included and "siuser" in included)
+        self.assertEqual(self.run_image(), "siconst siuser\n" + RESULTS)
+
+    def test_changed_source(self):
+        if os.name != "posix":
+            return
+        sharedimage.write(self.image, ["siuser"])
+        self.write_module("siconst", CONST + "\n# Changed\n")
+        # siuser still finds it by name, imported normally
+        self.assertEqual(self.run_image(), "siuser\n" + RESULTS)
+
+    def test_shadowed(self):
+        if os.name != "posix":
+            return
+        sharedimage.write(self.image, ["siuser"])
+        # A siconst earlier on sys.path is imported instead of the image's
+        shadow = os.path.join(self.dir, "shadow")
+        os.mkdir(shadow)
+        f = open(os.path.join(shadow, "siconst.py"), "w")
+        f.write(CONST.replace("LIMIT = 3", "LIMIT = 4"))
+        f.close()
+        self.assertEqual(self.run_image([shadow, self.dir]),
+                         "siuser\n" + RESULTS.replace("3 3", "4 4"))
+        # Without it, the image's is used
+        self.assertEqual(self.run_image([self.dir, shadow]),
+                         "siconst siuser\n" + RESULTS)
+
+    def test_bad_image(self):
+        if os.name != "posix":
+            return
+        sharedimage.write(self.image, ["siuser"])
+        f = open(self.image, "rb")
+        data = f.read()
+        f.close()
+        for bad in (b"XXXX" + data[4:], data[:12] + b"\0" * 20, data[:100]):
+            f = open(self.image, "wb")
+            f.write(bad)
+            f.close()
+            self.assertEqual(self.run_image(), "\n" + RESULTS)
+
+    def test_bad_record(self):
+        if os.name != "posix":
+            return
+        import imp, marshal, struct
+        # A part for siconst that gets past its source check, then has a
+        # record that isn't one, ahead of some that are
+        __import__("siconst")
+        source = sharedimage._source(sys.modules["siconst"])
+        records = ("bad",) + ((sharedimage.CONST, 1),) * 50
+        part = marshal.dumps(("siconst", source, records, (), ()))
+        header = sharedimage.MAGIC + struct.pack("<l", sharedimage.VERSION) + \
+                 imp.get_magic()
+        index = marshal.dumps((("siconst", 0),))
+        index = marshal.dumps((("siconst", len(header) + len(index)),))
+        f = open(self.image, "wb")
+        f.write(header + index + part)
+        f.close()
+        self.assertEqual(self.run_image(), "\n" + RESULTS)
+
+    def test_excluded(self):
+        self.write_module("siplain", "LIMIT = 3\n")
+        self.write_module("sicycle1", CYCLE % "sicycle2")
+        self.write_module("sicycle2", CYCLE % "sicycle1")
+        included, excluded = sharedimage.write(self.image,
+                                               ["siplain", "sicycle1"])
+        self.assertEqual(excluded["siplain"], "not a shared module")
+        self.assertEqual(excluded["sicycle1"],
+                         "imports itself through sicycle2")
+        self.assertEqual(excluded["sicycle2"],
+                         "imports itself through sicycle1")
+        self.assert_("siplain" not in included)
+        self.assert_("sicycle1" not in included)
+
+
+def test_main():
+    test_support.run_unittest(SharedImageTests)
+
+if __name__ == "__main__":
+    test_main()
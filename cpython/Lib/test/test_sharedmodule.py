@@ -1,3 +1,6 @@
+import os
+import socket
+import _fileio
 import sys
 import unittest
 from contextlib import contextmanager
@@ -80,7 +83,9 @@ AttributeError: 'MyMonitor' object has no attribute 'plumage'
 []
 
 >>> with threadtools.branch() as children:
-...     children.addresult(sharedmodule.safesharedfunc)
+...     f = children.addresult(sharedmodule.safesharedfunc)
+>>> f.result()
+42
 >>> children.getresults()
 [42]
 >>> children.getresults()
@@ -112,9 +117,9 @@ ZeroDivisionError: int division or modulo by zero
 
 
 >>> with threadtools.branch() as children:
-...     children.addresult(m.foo)
-...     children.addresult(m.bar)
-...     children.addresult(m.baz)
+...     f = children.addresult(m.foo)
+...     f = children.addresult(m.bar)
+...     f = children.addresult(m.baz)
 >>> children.getresults()
 ['pink', 'purple', 'purple']
 
@@ -195,6 +200,27 @@ class BranchTests(unittest.TestCase):
                 1/0
         self.assertRaisesCause(ZeroDivisionError, (ZeroDivisionError, Cancelled), x)
 
+    def test_cancelled_blocking_read(self):
+        import os
+        r, w = os.pipe()
+        try:
+            def x():
+                with threadtools.branch() as children:
+                    children.add(sharedmodule.readfd, r)
+                    1/0
+            # Each cancellation must leave the thread's wakeup fd quiet
+            # for the next read
+            for i in range(3):
+                self.assertRaisesCause(ZeroDivisionError,
+                    (ZeroDivisionError, Cancelled), x)
+            os.write(w, b'x')
+            with threadtools.branch() as children:
+                children.addresult(sharedmodule.readfd, r)
+            self.assertEqual(children.getresults(), [b'x'])
+        finally:
+            os.close(r)
+            os.close(w)
+
     def test_nested_branch_failing_outer(self):
         def x():
             with threadtools.branch() as outer:
@@ -221,6 +247,346 @@ class BranchTests(unittest.TestCase):
         endtime = time()
         self.assert_(endtime - starttime < 5.0)
 
+    def test_concurrent_sleeps(self):
+        # Spread across several levels of the timer wheel
+        delays = [1, 5, 63, 64, 65, 300, 1000] * 4
+        with threadtools.branch() as children:
+            for ms in delays:
+                children.addresult(sharedmodule.sleep_ms, ms)
+        for ms, slept in zip(delays, children.getresults()):
+            self.assert_(slept >= ms * 1000, (ms, slept))
+
+    def test_world_stops_during_loop(self):
+        # A child looping without making calls still reaches a safepoint
+        # on every backward jump, so gc.collect() can stop the world
+        # without waiting for the loop to finish
+        import gc
+        with threadtools.branch() as children:
+            children.addresult(sharedmodule.spin, 5000000)
+            sleep(0.1)
+            gc.collect()
+            collected = int(time() * 1000000)
+        self.assert_(collected < children.getresults()[0])
+
+    def test_quickening_across_threads(self):
+        # Children running the same code on different types all rewrite
+        # the one quickened copy of it
+        with threadtools.branch() as children:
+            for i in range(4):
+                children.addresult(sharedmodule.total, 0, 1, 1000)
+                children.addresult(sharedmodule.total, '', 'x', 1000)
+                children.addresult(sharedmodule.total, 2**40, 2**40, 1000)
+        self.assertEqual(children.getresults(),
+                         [1000, 'x' * 1000, 1001 * 2**40] * 4)
+
+    def test_dxp_across_threads(self):
+        # Each child counts on its own; the counts are added up when read,
+        # including those of children that have exited
+        import opcode
+        code = sharedmodule.total.__code__
+        add = code.co_code.index(bytes([opcode.opmap['BINARY_ADD']]))
+        sys.setdxp(True)
+        try:
+            with threadtools.branch() as children:
+                for i in range(4):
+                    children.addresult(sharedmodule.total, 0, 1, 1000)
+        finally:
+            sys.setdxp(False)
+        counts = sys.getdxpcodes()[code]
+        self.assertEqual(counts[0], 4)
+        self.assertEqual(counts[add], 4000)
+
+    def test_pool_reuse(self):
+        oldsize = sys.getbranchpoolsize()
+        sys.setbranchpoolsize(4)
+        try:
+            for i in range(3):
+                with threadtools.branch() as children:
+                    children.addresult(sharedmodule.safesharedfunc)
+                self.assertEqual(children.getresults(), [42])
+            stats = sys.getbranchpoolstats()
+            self.assert_(stats['reused'] >= 2)
+            self.assert_(stats['idle'] <= 4)
+        finally:
+            sys.setbranchpoolsize(oldsize)
+
+    def test_pool_disabled(self):
+        oldsize = sys.getbranchpoolsize()
+        sys.setbranchpoolsize(0)
+        try:
+            with threadtools.branch() as children:
+                children.addresult(sharedmodule.safesharedfunc)
+            self.assertEqual(children.getresults(), [42])
+            self.assertEqual(sys.getbranchpoolstats()['idle'], 0)
+        finally:
+            sys.setbranchpoolsize(oldsize)
+        self.assertRaises(ValueError, sys.setbranchpoolsize, -1)
+
+    def test_map(self):
+        with threadtools.branch() as children:
+            results = children.map(sharedmodule.square, range(13))
+            self.assertEqual(results, [x * x for x in range(13)])
+            results = children.map(sharedmodule.square, iter(range(13)),
+                chunksize=4, max_inflight=2)
+            self.assertEqual(results, [x * x for x in range(13)])
+            self.assertEqual(children.map(sharedmodule.square, []), [])
+        self.assertEqual(children.getresults(), [])
+
+    def test_map_failing(self):
+        def x():
+            with threadtools.branch() as children:
+                children.map(sharedmodule.square, range(100), chunksize=3)
+        self.assertRaisesCause(ValueError, ValueError, x)
+
+    def test_map_bad_args(self):
+        with threadtools.branch() as children:
+            self.assertRaises(ValueError, children.map,
+                sharedmodule.square, range(5), chunksize=0)
+            self.assertRaises(ValueError, children.map,
+                sharedmodule.square, range(5), max_inflight=0)
+            self.assertRaises(TypeError, children.map,
+                sharedmodule.square, [[]])
+
+    def test_future(self):
+        q = threadtools.Queue()
+        with threadtools.branch() as children:
+            f = children.addresult(q.get)
+            self.assert_(not f.done())
+            self.assertRaises(threadtools.Timeout, f.result, 0.05)
+            q.put(5)
+            self.assertEqual(f.result(), 5)
+            self.assert_(f.done())
+        self.assertEqual(children.getresults(), [5])
+
+    def test_future_exception(self):
+        futures = []
+        def x():
+            with threadtools.branch() as children:
+                futures.append(children.addresult(sharedmodule.square, 13))
+        self.assertRaises(ValueError, x)
+        self.assert_(futures[0].done())
+        self.assertRaisesCause(ValueError, ValueError, futures[0].result)
+
+    def test_as_completed(self):
+        q = threadtools.Queue()
+        with threadtools.branch() as children:
+            slow = children.addresult(q.get)
+            fast = children.addresult(sharedmodule.square, 3)
+            completed = children.as_completed()
+            self.assert_(next(completed) is fast)
+            q.put(7)
+            self.assert_(next(completed) is slow)
+            self.assertRaises(StopIteration, next, completed)
+        self.assertEqual(children.getresults(), [7, 9])
+
+
+class QueueTests(unittest.TestCase):
+    def test_fifo(self):
+        q = threadtools.Queue(4)
+        self.assertEqual(q.maxsize, 4)
+        self.assert_(q.empty())
+        for i in range(4):
+            q.put(i)
+        self.assert_(q.full())
+        self.assertEqual(q.qsize(), 4)
+        self.assertEqual([q.get() for i in range(4)], [0, 1, 2, 3])
+        self.assert_(q.empty())
+
+    def test_nowait(self):
+        q = threadtools.Queue(2)
+        self.assertRaises(threadtools.Empty, q.get_nowait)
+        self.assertRaises(threadtools.Empty, q.get, timeout=0.01)
+        q.put_nowait(1)
+        q.put_nowait(2)
+        self.assertRaises(threadtools.Full, q.put_nowait, 3)
+        self.assertRaises(threadtools.Full, q.put, 3, timeout=0.01)
+        self.assertRaises(threadtools.Full, q.put, 3, False)
+        self.assertEqual(q.get(False), 1)
+
+    def test_many(self):
+        q = threadtools.Queue(8)
+        q.put_many(range(5))
+        self.assertEqual(q.get_many(3), [0, 1, 2])
+        q.put_many([5, 6, 7, 8, 9])
+        self.assertEqual(q.get_many(100), [3, 4, 5, 6, 7, 8, 9])
+        self.assertRaises(threadtools.Full, q.put_many, range(9), False)
+        self.assertEqual(q.get_many(100), list(range(8)))
+
+    def test_unshareable(self):
+        q = threadtools.Queue()
+        self.assertRaises(TypeError, q.put, [])
+        self.assertRaises(ValueError, threadtools.Queue, 0)
+
+    def test_producers_consumers(self):
+        q = threadtools.Queue(16)
+        with threadtools.branch() as children:
+            for i in range(4):
+                children.add(sharedmodule.produce, q, i * 1000, 1000)
+            for i in range(4):
+                children.addresult(sharedmodule.consume, q, 1000)
+        self.assertEqual(sum(children.getresults()), sum(range(4000)))
+        self.assert_(q.empty())
+
+    def test_cancelled_get(self):
+        q = threadtools.Queue()
+        def x():
+            with threadtools.branch() as children:
+                children.add(q.get)
+                1/0
+        self.assertRaisesCause(ZeroDivisionError,
+            (ZeroDivisionError, Cancelled), x)
+
+    assertRaisesCause = BranchTests.assertRaisesCause
+
+
+class SelectTests(unittest.TestCase):
+    def test_ready(self):
+        q1 = threadtools.Queue()
+        q2 = threadtools.Queue()
+        q2.put(1)
+        self.assert_(threadtools.select([q1, q2]) is q2)
+        q1.put(1)
+        self.assert_(threadtools.select([q1, q2]) is q1)
+
+    def test_timeout(self):
+        q = threadtools.Queue()
+        self.assertEqual(threadtools.select([q], timeout=0), None)
+        start = time()
+        self.assertEqual(threadtools.select([q], timeout=0.1), None)
+        self.assert_(time() - start >= 0.1)
+
+    def test_wakeup(self):
+        q1 = threadtools.Queue()
+        q2 = threadtools.Queue()
+        with threadtools.branch() as children:
+            children.add(sharedmodule.put_later, q2, 'x')
+            self.assert_(threadtools.select([q1, q2]) is q2)
+        self.assertEqual(q2.get(), 'x')
+
+    def test_deathqueue(self):
+        from _weakref import DeathQueueType
+        class Watched:
+            pass
+        q = threadtools.Queue()
+        dq = DeathQueueType()
+        obj = Watched()
+        dq.watch(obj, 'dead')
+        self.assertEqual(threadtools.select([q, dq], timeout=0), None)
+        del obj
+        self.assert_(threadtools.select([q, dq]) is dq)
+        self.assertEqual(dq.pop(), 'dead')
+
+    def test_condition(self):
+        cp = sharedmodule.Checkpoint()
+        q = threadtools.Queue()
+        with threadtools.branch() as children:
+            children.add(sharedmodule.put_later, q, 'x')
+            self.assertEqual(cp.select(q), 'x')
+        with threadtools.branch() as children:
+            children.addresult(cp.select, q)
+            sleep(0.1)
+            cp.set()
+        self.assertEqual(children.getresults(), ['finished'])
+
+    def test_cancelled(self):
+        q = threadtools.Queue()
+        def x():
+            with threadtools.branch() as children:
+                children.add(threadtools.select, (q,))
+                1/0
+        self.assertRaisesCause(ZeroDivisionError,
+            (ZeroDivisionError, Cancelled), x)
+
+    def test_fd(self):
+        r, w = os.pipe()
+        try:
+            rw, ww = threadtools.readable(r), threadtools.writable(w)
+            self.assertEqual(rw.fd, r)
+            self.assertEqual(threadtools.select([rw], timeout=0), None)
+            self.assert_(threadtools.select([rw, ww]) is ww)
+            os.write(w, b'x')
+            self.assert_(threadtools.select([rw, ww]) is rw)
+        finally:
+            os.close(r)
+            os.close(w)
+
+    def test_fd_wakeup(self):
+        r, w = os.pipe()
+        try:
+            rw = threadtools.readable(r)
+            q = threadtools.Queue()
+            with threadtools.branch() as children:
+                children.add(sharedmodule.write_later, w, b'x')
+                self.assert_(threadtools.select([q, rw]) is rw)
+            self.assertEqual(os.read(r, 1), b'x')
+        finally:
+            os.close(r)
+            os.close(w)
+
+    def test_fd_shared(self):
+        # Several threads parked on one fd each get their turn
+        r, w = os.pipe()
+        try:
+            with threadtools.branch() as children:
+                for i in range(4):
+                    children.addresult(sharedmodule.read_when_ready, r)
+                children.add(sharedmodule.write_later, w, b'abcd')
+            self.assertEqual(sorted(children.getresults()),
+                [b'a', b'b', b'c', b'd'])
+        finally:
+            os.close(r)
+            os.close(w)
+
+    def test_fd_cancelled(self):
+        r, w = os.pipe()
+        def x():
+            with threadtools.branch() as children:
+                children.add(threadtools.select, (threadtools.readable(r),))
+                1/0
+        try:
+            self.assertRaisesCause(ZeroDivisionError,
+                (ZeroDivisionError, Cancelled), x)
+        finally:
+            os.close(r)
+            os.close(w)
+
+    if hasattr(_fileio._FileIO, 'submit_read'):
+        def test_submit_cancelled(self):
+            r, w = os.pipe()
+            def x():
+                with threadtools.branch() as children:
+                    children.add(sharedmodule.submit_and_wait, r)
+                    1/0
+            try:
+                self.assertRaisesCause(ZeroDivisionError,
+                    (ZeroDivisionError, Cancelled), x)
+            finally:
+                os.close(r)
+                os.close(w)
+
+    if hasattr(socket.socket, 'splice_to'):
+        def test_splice_cancelled(self):
+            a, b = socket.socketpair()
+            c, d = socket.socketpair()
+            def x():
+                with threadtools.branch() as children:
+                    children.add(sharedmodule.splice_fds, b.fileno(),
+                                 c.fileno(), 10)
+                    1/0
+            try:
+                self.assertRaisesCause(ZeroDivisionError,
+                    (ZeroDivisionError, Cancelled), x)
+            finally:
+                for s in a, b, c, d:
+                    s.close()
+
+    def test_bad_args(self):
+        self.assertRaises(TypeError, threadtools.select, [1])
+        self.assertRaises(ValueError, threadtools.select, [], -1)
+        self.assertRaises(ValueError, threadtools.readable, -1)
+
+    assertRaisesCause = BranchTests.assertRaisesCause
+
 
 class MonitorTests(unittest.TestCase):
     def test_condition_wait(self):
@@ -339,7 +705,8 @@ __test__ = {'sharedmoduletest' : sharedmoduletest}
 def test_main(verbose=None):
     from test import test_sharedmodule
     test_support.run_doctest(test_sharedmodule, verbose)
-    test_support.run_unittest(BranchTests, MonitorTests, FinalizeTests, DeadlockTests)
+    test_support.run_unittest(BranchTests, QueueTests, SelectTests,
+        MonitorTests, FinalizeTests, DeadlockTests)
 
 
 if __name__ == "__main__":
@@ -635,6 +635,37 @@ class BasicUDPTest(ThreadedUDPSocketTest):
     def _testRecvFromNegative(self):
         self.cli.sendto(MSG, 0, (HOST, self.port))
 
+    if hasattr(socket.socket, 'recvmmsg_into'):
+        def testRecvmmsgInto(self):
+            bufs = [b' ' * 1024 for i in range(4)]
+            msgs = []
+            while len(msgs) < 3:
+                lengths, addrs = self.serv.recvmmsg_into(bufs)
+                self.assertEqual(len(lengths), len(addrs))
+                msgs += [buf[:n] for buf, n in zip(bufs, lengths)]
+            self.assertEqual(msgs, [MSG, MSG[:5], b''])
+            self.serv.setblocking(False)
+            self.assertRaises(socket.error, self.serv.recvmmsg_into, bufs)
+            self.assertEqual(self.serv.recvmmsg_into([]), ([], []))
+
+        def _testRecvmmsgInto(self):
+            for msg in MSG, MSG[:5], b'':
+                self.cli.sendto(msg, 0, (HOST, self.port))
+
+    if hasattr(socket.socket, 'sendmmsg'):
+        def testSendmmsg(self):
+            for msg in MSG, MSG[:5], MSG:
+                self.assertEqual(self.serv.recv(len(MSG)), msg)
+
+        def _testSendmmsg(self):
+            addr = (HOST, self.port)
+            self.assertEqual(
+                self.cli.sendmmsg([(MSG, addr), (MSG[:5], addr)]), 2)
+            self.cli.connect(addr)
+            self.assertEqual(self.cli.sendmmsg([MSG]), 1)
+            self.assertRaises(TypeError, self.cli.sendmmsg, ['str'])
+            self.assertRaises(TypeError, self.cli.sendmmsg, [(MSG,)])
+
 class TCPCloserTest(ThreadedTCPSocketTest):
 
     def testClose(self):
@@ -673,6 +704,45 @@ class BasicSocketPairTest(SocketPairTest):
         msg = self.cli.recv(1024)
         self.assertEqual(msg, MSG)
 
+    if hasattr(socket.socket, 'sendfile'):
+        def testSendfile(self):
+            with open(test_support.TESTFN, 'wb') as f:
+                f.write(MSG * 100)
+            try:
+                with open(test_support.TESTFN, 'rb') as f:
+                    self.assertEqual(self.serv.sendfile(f, len(MSG)),
+                                     len(MSG) * 99)
+                    self.assertEqual(f.tell(), 0)
+                    self.assertEqual(self.serv.sendfile(f.fileno(), 0, 5), 5)
+            finally:
+                os.remove(test_support.TESTFN)
+
+        def _testSendfile(self):
+            msg = b''
+            while len(msg) < len(MSG) * 99 + 5:
+                msg += self.cli.recv(4096)
+            self.assertEqual(msg, MSG * 99 + MSG[:5])
+
+    if hasattr(socket.socket, 'splice_to'):
+        def testSpliceTo(self):
+            out, sink = socket.socketpair()
+            try:
+                self.assertEqual(self.serv.splice_to(out, len(MSG) * 2),
+                                 len(MSG) * 2)
+                self.assertEqual(sink.recv(1024), MSG * 2)
+                # Stops short when the peer closes
+                self.assertEqual(self.serv.splice_to(out, 1024), len(MSG))
+                self.assertEqual(sink.recv(1024), MSG)
+                self.assertRaises(ValueError, self.serv.splice_to, out, -1)
+                self.assertRaises(TypeError, self.serv.splice_to, 1, 1)
+            finally:
+                out.close()
+                sink.close()
+
+        def _testSpliceTo(self):
+            self.cli.sendall(MSG * 3)
+            self.cli.shutdown(socket.SHUT_WR)
+
 class NonBlockingTCPTests(ThreadedTCPSocketTest):
 
     def __init__(self, methodName='runTest'):
@@ -0,0 +1,234 @@
+# Tests of the socket methods that move data in bulk, over socketpairs
+# in a single thread, so they run where test_socket's threaded harness
+# can't.
+
+import unittest
+from test import test_support
+
+import os
+import socket
+
+MSG = b'Michael Gilfix was here\n'
+
+if not hasattr(socket, 'socketpair'):
+    raise test_support.TestSkipped("socketpair() not available")
+
+
+class SendfileTest(unittest.TestCase):
+
+    def setUp(self):
+        self.serv, self.cli = socket.socketpair()
+        with open(test_support.TESTFN, 'wb') as f:
+            f.write(MSG * 100)
+        self.file = open(test_support.TESTFN, 'rb')
+
+    def tearDown(self):
+        self.file.close()
+        self.serv.close()
+        self.cli.close()
+        os.remove(test_support.TESTFN)
+
+    def recv(self, n):
+        data = b''
+        while len(data) < n:
+            data += self.cli.recv(n - len(data))
+        return data
+
+    def testWholeFile(self):
+        self.assertEqual(self.serv.sendfile(self.file), len(MSG) * 100)
+        self.assertEqual(self.recv(len(MSG) * 100), MSG * 100)
+        self.assertEqual(self.file.tell(), 0)
+
+    def testOffsetAndCount(self):
+        self.assertEqual(self.serv.sendfile(self.file, len(MSG)),
+                         len(MSG) * 99)
+        self.assertEqual(self.serv.sendfile(self.file.fileno(), 0, 5), 5)
+        self.assertEqual(self.serv.sendfile(self.file, len(MSG), None),
+                         len(MSG) * 99)
+        self.assertEqual(self.recv(len(MSG) * 198 + 5),
+                         MSG * 99 + MSG[:5] + MSG * 99)
+        self.assertEqual(self.file.tell(), 0)
+
+    def testNothingToSend(self):
+        self.assertEqual(self.serv.sendfile(self.file, 0, 0), 0)
+        self.assertEqual(self.serv.sendfile(self.file, len(MSG) * 100), 0)
+        self.assertEqual(self.serv.sendfile(self.file, 1 << 30), 0)
+
+    def testNonBlocking(self):
+        # Stops once the send buffer is full, then has nothing to send
+        big = test_support.TESTFN + '.big'
+        with open(big, 'wb') as f:
+            f.write(MSG * 200000)
+        try:
+            self.serv.setblocking(False)
+            with open(big, 'rb') as f:
+                n = self.serv.sendfile(f)
+                self.assert_(0 < n < len(MSG) * 200000, n)
+                self.assertRaises(socket.error, self.serv.sendfile, f, n)
+                data = self.recv(n)
+                self.assertEqual(data, (MSG * (n // len(MSG) + 1))[:n])
+                self.assertEqual(self.serv.sendfile(f, n, 5), 5)
+                self.assertEqual(self.recv(5), (MSG * 2)[n % len(MSG):][:5])
+        finally:
+            os.remove(big)
+
+    def testErrors(self):
+        self.assertRaises(ValueError, self.serv.sendfile, self.file, -1)
+        self.assertRaises(ValueError, self.serv.sendfile, self.file, 0, -1)
+        self.assertRaises(TypeError, self.serv.sendfile, 'file')
+        self.assertRaises(TypeError, self.serv.sendfile, self.file, 0, 'n')
+        self.file.close()
+        self.assertRaises(ValueError, self.serv.sendfile, self.file)
+        r, w = os.pipe()
+        os.close(w)
+        try:
+            self.assertRaises(socket.error, self.serv.sendfile, r)
+        finally:
+            os.close(r)
+
+
+class SpliceToTest(unittest.TestCase):
+
+    def setUp(self):
+        self.serv, self.cli = socket.socketpair()
+        self.out, self.sink = socket.socketpair()
+
+    def tearDown(self):
+        for sock in self.serv, self.cli, self.out, self.sink:
+            sock.close()
+
+    def testCount(self):
+        self.cli.sendall(MSG * 3)
+        self.assertEqual(self.serv.splice_to(self.out, len(MSG) * 2),
+                         len(MSG) * 2)
+        self.assertEqual(self.sink.recv(1024), MSG * 2)
+        self.assertEqual(self.serv.splice_to(self.out, 0), 0)
+        self.assertEqual(self.serv.recv(1024), MSG)
+
+    def testPeerClosed(self):
+        # Stops short when the peer closes
+        self.cli.sendall(MSG * 3)
+        self.cli.shutdown(socket.SHUT_WR)
+        self.assertEqual(self.serv.splice_to(self.out, 1024), len(MSG) * 3)
+        self.assertEqual(self.sink.recv(1024), MSG * 3)
+        self.assertEqual(self.serv.splice_to(self.out, 1024), 0)
+
+    def testNonBlocking(self):
+        # Moves what's waiting, then has nothing to move
+        self.serv.setblocking(False)
+        self.cli.sendall(MSG)
+        self.assertEqual(self.serv.splice_to(self.out, 1024), len(MSG))
+        self.assertEqual(self.sink.recv(1024), MSG)
+        self.assertRaises(socket.error, self.serv.splice_to, self.out, 1024)
+
+    def testErrors(self):
+        self.assertRaises(ValueError, self.serv.splice_to, self.out, -1)
+        self.assertRaises(TypeError, self.serv.splice_to, 1, 1)
+        self.assertRaises(TypeError, self.serv.splice_to, self.out)
+
+
+class MmsgTest(unittest.TestCase):
+
+    def setUp(self):
+        self.serv, self.cli = socket.socketpair(socket.AF_UNIX,
+                                                socket.SOCK_DGRAM)
+
+    def tearDown(self):
+        self.serv.close()
+        self.cli.close()
+
+    def drain(self):
+        self.serv.setblocking(False)
+        n = 0
+        while True:
+            try:
+                lengths, addrs = self.serv.recvmmsg_into([b' '] * 1024)
+            except socket.error:
+                return n
+            n += len(lengths)
+
+    def testBatch(self):
+        self.assertEqual(self.cli.sendmmsg([MSG, MSG[:5], b'']), 3)
+        bufs = [b' ' * 1024 for i in range(4)]
+        lengths, addrs = self.serv.recvmmsg_into(bufs)
+        # Takes what has arrived, leaving the last buffer untouched
+        self.assertEqual(lengths, [len(MSG), 5, 0])
+        self.assertEqual(len(addrs), 3)
+        self.assertEqual([buf[:n] for buf, n in zip(bufs, lengths)],
+                         [MSG, MSG[:5], b''])
+        self.assertEqual(bufs[3], b' ' * 1024)
+
+    def testPartialBatch(self):
+        self.assertEqual(self.cli.sendmmsg([MSG] * 3), 3)
+        bufs = [b' ' * 1024 for i in range(2)]
+        self.assertEqual(self.serv.recvmmsg_into(bufs)[0], [len(MSG)] * 2)
+        self.assertEqual(self.serv.recvmmsg_into(bufs)[0], [len(MSG)])
+
+    def testTruncated(self):
+        self.cli.sendmmsg([MSG])
+        bufs = [b' ' * 5]
+        self.assertEqual(self.serv.recvmmsg_into(bufs)[0], [5])
+        self.assertEqual(bufs[0], MSG[:5])
+
+    def testNonBlocking(self):
+        self.serv.setblocking(False)
+        self.assertRaises(socket.error, self.serv.recvmmsg_into, [b' '])
+        self.assertEqual(self.serv.recvmmsg_into([]), ([], []))
+        # Sends what fits in the queue, then nothing
+        self.cli.setblocking(False)
+        n = self.cli.sendmmsg([MSG] * 1024)
+        self.assert_(0 < n <= 1024, n)
+        if n < 1024:
+            self.assertRaises(socket.error, self.cli.sendmmsg, [MSG])
+        self.assertEqual(self.drain(), n)
+
+    def testLimit(self):
+        # At most 1024 messages go in one call; UDP doesn't wait for the
+        # receiver, which may drop some
+        serv = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        cli = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        try:
+            port = test_support.bind_port(serv)
+            cli.connect((test_support.HOST, port))
+            self.assertEqual(cli.sendmmsg([b'x'] * 1500), 1024)
+            lengths, addrs = serv.recvmmsg_into([b' '] * 2000)
+            self.assert_(0 < len(lengths) <= 1024, len(lengths))
+        finally:
+            serv.close()
+            cli.close()
+
+    def testAddresses(self):
+        path = test_support.TESTFN + '.sock'
+        serv = socket.socket(socket.AF_UNIX, socket.SOCK_DGRAM)
+        try:
+            serv.bind(path)
+            self.assertEqual(self.cli.sendmmsg([(MSG, path), (MSG, path)]),
+                             2)
+            bufs = [b' ' * 1024 for i in range(2)]
+            self.assertEqual(serv.recvmmsg_into(bufs)[0], [len(MSG)] * 2)
+        finally:
+            serv.close()
+            os.remove(path)
+
+    def testErrors(self):
+        self.assertRaises(TypeError, self.cli.sendmmsg, ['str'])
+        self.assertRaises(TypeError, self.cli.sendmmsg, [(MSG,)])
+        self.assertRaises(TypeError, self.cli.sendmmsg, [(MSG, 1, 2)])
+        self.assertRaises(TypeError, self.cli.sendmmsg, 1)
+        self.assertRaises(TypeError, self.serv.recvmmsg_into, 1)
+        self.assertRaises(TypeError, self.serv.recvmmsg_into, ['str'])
+
+
+def test_main():
+    tests = []
+    if hasattr(socket.socket, 'sendfile'):
+        tests.append(SendfileTest)
+    if hasattr(socket.socket, 'splice_to'):
+        tests.append(SpliceToTest)
+    if hasattr(socket.socket, 'sendmmsg') and \
+       hasattr(socket.socket, 'recvmmsg_into'):
+        tests.append(MmsgTest)
+    test_support.run_unittest(*tests)
+
+if __name__ == "__main__":
+    test_main()
@@ -139,6 +139,41 @@ class SysModuleTest(unittest.TestCase):
             sys.setcheckinterval(n)
             self.assertEquals(sys.getcheckinterval(), n)
 
+    def test_dxp(self):
+        import opcode
+        def loop(n):
+            i = 0
+            while i < n:
+                i += 1
+            return i
+        code = loop.__code__
+        add = code.co_code.index(bytes([opcode.opmap['INPLACE_ADD']]))
+
+        self.assertRaises(TypeError, sys.setdxp)
+        sys.setdxp(True)
+        try:
+            loop(1000)
+        finally:
+            sys.setdxp(False)
+        loop(1000)      # Not counted
+        profile = sys.getdxp()
+        self.assertEqual(len(profile), 257)
+        self.assertEqual([len(row) for row in profile], [256] * 257)
+        counts = sys.getdxpcodes()[code]
+        self.assertEqual(len(counts), len(code.co_code))
+        self.assertEqual(counts[add], 1000)
+        self.assertEqual(counts[0], 1)
+        self.assert_(sum(profile[256]) >= sum(counts))
+        for op in range(256):
+            self.assert_(sum(row[op] for row in profile[:256]) <=
+                         profile[256][op])
+
+        # Turning it on again starts from zero
+        sys.setdxp(True)
+        sys.setdxp(False)
+        self.assert_(code not in sys.getdxpcodes())
+        self.assert_(sum(sys.getdxp()[256]) < 100)
+
     def test_recursionlimit(self):
         self.assertRaises(TypeError, sys.getrecursionlimit, 42)
         oldlimit = sys.getrecursionlimit()
@@ -324,7 +359,7 @@ class SysModuleTest(unittest.TestCase):
         self.failUnless(sys.flags)
         attrs = ("debug", "division_warning",
                  "inspect", "interactive", "optimize", "dont_write_bytecode",
-                 "no_site", "ignore_environment", "tabcheck", "verbose")
+                 "lazy_code", "no_site", "ignore_environment", "tabcheck", "verbose")
         for attr in attrs:
             self.assert_(hasattr(sys.flags, attr), attr)
             self.assertEqual(type(getattr(sys.flags, attr)), int, attr)
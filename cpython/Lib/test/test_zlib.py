@@ -94,6 +94,30 @@ class CompressTestCase(unittest.TestCase):
         x = zlib.compress(data)
         self.assertEqual(zlib.decompress(x), data)
 
+    def test_parallel(self):
+        # several pieces, each primed with the one before
+        data = HAMLET_SCENE * 512
+        for threads in 1, 2, 5, 0:
+            x = zlib.compress_parallel(data, 6, threads)
+            self.assertEqual(zlib.decompress(x), data)
+        self.assert_(len(x) < len(zlib.compress(data)) * 1.05)
+        x = zlib.compress_parallel(HAMLET_SCENE, 9, 4)
+        self.assertEqual(x, zlib.compress(HAMLET_SCENE, 9))
+        self.assertEqual(zlib.decompress(zlib.compress_parallel(b'')), b'')
+
+    def test_parallel_wbits(self):
+        data = HAMLET_SCENE * 512
+        for wbits in 9, 12, -zlib.MAX_WBITS, -10, 16 + zlib.MAX_WBITS:
+            x = zlib.compress_parallel(data, 1, 3, wbits)
+            self.assertEqual(zlib.decompress(x, wbits), data)
+        x = zlib.compress_parallel(data, 1, 3, 16 + zlib.MAX_WBITS)
+        self.assertEqual(x[:2], b'\x1f\x8b')
+        self.assertRaises(ValueError, zlib.compress_parallel, data, 1, 3, 8)
+        self.assertRaises(ValueError, zlib.compress_parallel, data, 1, 3, 16)
+        self.assertRaises(ValueError, zlib.compress_parallel, data, 1, -1)
+        self.assertRaises(zlib.error, zlib.compress_parallel, data, 10)
+        self.assertRaises(TypeError, zlib.compress_parallel, 'text')
+
 
 
 
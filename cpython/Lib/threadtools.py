@@ -4,4 +4,5 @@ from __future__ import shared_module
 # use the full operator.isShareable() name
 #import operator
 from _threadtools import (Monitor, MonitorSpace, MonitorMeta, branch,
-    monitormethod, condition, wait)
+    monitormethod, condition, wait, select, readable, writable, Queue, Empty,
+    Full, Timeout)
@@ -0,0 +1,2140 @@
+/* Fast implementation of io's buffered and text layers */
+
+#define PY_SSIZE_T_CLEAN
+#include "Python.h"
+#include "structmember.h"
+
+#include <stddef.h> /* For offsetof */
+
+/*
+ * io.py mixes each type here into the pure Python class of the same name,
+ * ahead of it in the MRO.  The C types only take over the methods that
+ * run once per read, line or write; everything else (TextIOWrapper's
+ * __init__, tell() and seek(), close(), truncate(), ...) stays in Python
+ * and works on the same state, which is exposed under the attribute names
+ * the Python code uses.
+ *
+ * Raw streams are only ever reached through their Python methods, so a
+ * blocking _FileIO still waits in poll_single_fd() and can be cancelled.
+ * An exception from the raw stream leaves the buffers as they were.
+ */
+
+#define DEFAULT_BUFFER_SIZE (8 * 1024)
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+
+static PyObject *str_closed, *str_read, *str_read1, *str_write, *str_seek,
+	*str_tell, *str_flush, *str_decode, *str_getstate, *str_setstate,
+	*str_reset, *str_encode, *str_chunk_size, *str_get_encoder,
+	*str_get_decoder, *str_module;
+static PyObject *empty_bytes, *cr_bytes, *empty_str, *lf_str;
+
+static PyTypeObject BufferedReader_Type;
+static PyTypeObject BufferedWriter_Type;
+static PyTypeObject BufferedRandom_Type;
+static PyTypeObject NLDecoder_Type;
+static PyTypeObject TextIO_Type;
+
+static int
+is_true(PyObject *obj)
+{
+	return obj != NULL && PyObject_IsTrue(obj) > 0;
+}
+
+static PyObject *
+err_uninitialized(void)
+{
+	PyErr_SetString(PyExc_ValueError,
+			"I/O operation on uninitialized object");
+	return NULL;
+}
+
+
+/* BlockingIOError lives in io.py */
+
+typedef struct {
+	PyObject *errno_obj;
+	PyObject *strerror;
+	Py_ssize_t written;
+} blocking_info;
+
+/* If the exception set is a BlockingIOError, clears it, fills in *info
+ * and returns 1.  Otherwise leaves it set and returns 0. */
+static int
+fetch_blocking(blocking_info *info)
+{
+	PyObject *type, *value, *tb, *io, *cls, *obj;
+	int match;
+
+	PyErr_Fetch(&type, &value, &tb);
+	io = PyImport_ImportModule("io");
+	if (io == NULL)
+		goto fail;
+	cls = PyObject_GetAttrString(io, "BlockingIOError");
+	Py_DECREF(io);
+	if (cls == NULL)
+		goto fail;
+	match = PyErr_GivenExceptionMatches(type, cls);
+	Py_DECREF(cls);
+	if (!match) {
+		PyErr_Restore(type, value, tb);
+		return 0;
+	}
+
+	PyErr_NormalizeException(&type, &value, &tb);
+	info->errno_obj = PyObject_GetAttrString(value, "errno");
+	info->strerror = PyObject_GetAttrString(value, "strerror");
+	obj = PyObject_GetAttrString(value, "characters_written");
+	info->written = obj ? PyNumber_AsSsize_t(obj, PyExc_OverflowError) : 0;
+	Py_XDECREF(obj);
+	if (info->errno_obj == NULL || info->strerror == NULL ||
+	    PyErr_Occurred()) {
+		/* Better the original than a confusing substitute */
+		Py_XDECREF(info->errno_obj);
+		Py_XDECREF(info->strerror);
+		PyErr_Clear();
+		PyErr_Restore(type, value, tb);
+		return 0;
+	}
+	Py_XDECREF(type);
+	Py_XDECREF(value);
+	Py_XDECREF(tb);
+	return 1;
+
+  fail:
+	/* Can't tell, so pass the original on */
+	PyErr_Clear();
+	PyErr_Restore(type, value, tb);
+	return 0;
+}
+
+/* Raises BlockingIOError(errno, strerror, written), consuming info */
+static void
+raise_blocking(blocking_info *info, Py_ssize_t written)
+{
+	PyObject *io, *cls, *exc;
+
+	io = PyImport_ImportModule("io");
+	if (io != NULL) {
+		cls = PyObject_GetAttrString(io, "BlockingIOError");
+		Py_DECREF(io);
+		if (cls != NULL) {
+			exc = PyObject_CallFunction(cls, "OOn",
+				info->errno_obj, info->strerror, written);
+			if (exc != NULL) {
+				PyErr_SetObject(cls, exc);
+				Py_DECREF(exc);
+			}
+			Py_DECREF(cls);
+		}
+	}
+	Py_XDECREF(info->errno_obj);
+	Py_XDECREF(info->strerror);
+}
+
+
+/* Buffered streams.  BufferedReader, BufferedWriter and BufferedRandom
+ * share one struct and one set of methods; a reader just never has
+ * anything in write_buf, nor a writer in read_buf. */
+
+typedef struct {
+	PyObject_HEAD
+	PyObject *raw;
+	Py_ssize_t buffer_size;
+	Py_ssize_t max_buffer_size;
+	/* Read ahead but not yet returned: read_buf[read_pos:read_end] */
+	char *read_buf;
+	Py_ssize_t read_pos, read_end, read_alloc;
+	/* Written but not yet flushed: write_buf[:write_len] */
+	char *write_buf;
+	Py_ssize_t write_len, write_alloc;
+	PyObject *weakreflist;
+} BufferedObject;
+
+#define READ_AVAIL(self) ((self)->read_end - (self)->read_pos)
+
+#define CHECK_INITIALIZED(self) \
+	if ((self)->raw == NULL) \
+		return err_uninitialized();
+
+static PyObject *
+buffered_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+	BufferedObject *self;
+
+	self = PyObject_New(type);
+	if (self == NULL)
+		return NULL;
+	self->raw = NULL;
+	self->buffer_size = DEFAULT_BUFFER_SIZE;
+	self->max_buffer_size = 2 * DEFAULT_BUFFER_SIZE;
+	self->read_buf = NULL;
+	self->read_pos = self->read_end = self->read_alloc = 0;
+	self->write_buf = NULL;
+	self->write_len = self->write_alloc = 0;
+	self->weakreflist = NULL;
+	return (PyObject *)self;
+}
+
+static int
+buffered_traverse(BufferedObject *self, visitproc visit, void *arg)
+{
+	Py_VISIT(self->raw);
+	return 0;
+}
+
+static int
+buffered_clear(BufferedObject *self)
+{
+	Py_CLEAR(self->raw);
+	return 0;
+}
+
+static void
+buffered_dealloc(BufferedObject *self)
+{
+	Py_CLEAR(self->raw);
+	PyMem_Free(self->read_buf);
+	PyMem_Free(self->write_buf);
+	PyObject_Del(self);
+}
+
+static int
+buffered_check(PyObject *raw, const char *name)
+{
+	PyObject *res = PyObject_CallMethod(raw, (char *)name, NULL);
+
+	Py_XDECREF(res);
+	return res == NULL ? -1 : 0;
+}
+
+static int
+buffered_setup(BufferedObject *self, PyObject *raw, Py_ssize_t buffer_size,
+	       PyObject *max_buffer_size)
+{
+	Py_ssize_t max_size = 2 * buffer_size;
+
+	if (max_buffer_size != NULL && max_buffer_size != Py_None) {
+		max_size = PyNumber_AsSsize_t(max_buffer_size,
+					      PyExc_OverflowError);
+		if (max_size == -1 && PyErr_Occurred())
+			return -1;
+	}
+
+	Py_INCREF(raw);
+	Py_XDECREF(self->raw);
+	self->raw = raw;
+	self->buffer_size = buffer_size;
+	self->max_buffer_size = max_size;
+	self->read_pos = self->read_end = 0;
+	self->write_len = 0;
+	return 0;
+}
+
+static int
+bufferedreader_init(BufferedObject *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"raw", "buffer_size", NULL};
+	PyObject *raw;
+	Py_ssize_t buffer_size = DEFAULT_BUFFER_SIZE;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|n:BufferedReader",
+					 kwlist, &raw, &buffer_size))
+		return -1;
+	if (buffered_check(raw, "_checkReadable") < 0)
+		return -1;
+	return buffered_setup(self, raw, buffer_size, NULL);
+}
+
+static int
+bufferedwriter_init(BufferedObject *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"raw", "buffer_size", "max_buffer_size",
+				 NULL};
+	PyObject *raw, *max_buffer_size = NULL;
+	Py_ssize_t buffer_size = DEFAULT_BUFFER_SIZE;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|nO:BufferedWriter",
+					 kwlist, &raw, &buffer_size,
+					 &max_buffer_size))
+		return -1;
+	if (buffered_check(raw, "_checkWritable") < 0)
+		return -1;
+	return buffered_setup(self, raw, buffer_size, max_buffer_size);
+}
+
+static int
+bufferedrandom_init(BufferedObject *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"raw", "buffer_size", "max_buffer_size",
+				 NULL};
+	PyObject *raw, *max_buffer_size = NULL;
+	Py_ssize_t buffer_size = DEFAULT_BUFFER_SIZE;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|nO:BufferedRandom",
+					 kwlist, &raw, &buffer_size,
+					 &max_buffer_size))
+		return -1;
+	if (buffered_check(raw, "_checkSeekable") < 0 ||
+	    buffered_check(raw, "_checkReadable") < 0 ||
+	    buffered_check(raw, "_checkWritable") < 0)
+		return -1;
+	return buffered_setup(self, raw, buffer_size, max_buffer_size);
+}
+
+/* Drops n bytes from the front of the read buffer */
+static void
+buffered_consume(BufferedObject *self, Py_ssize_t n)
+{
+	self->read_pos += n;
+	if (self->read_pos == self->read_end) {
+		self->read_pos = self->read_end = 0;
+		/* Don't hang on to what a big read() grew it to */
+		if (self->read_alloc > 2 * MAX(self->buffer_size,
+					       DEFAULT_BUFFER_SIZE)) {
+			PyMem_Free(self->read_buf);
+			self->read_buf = NULL;
+			self->read_alloc = 0;
+		}
+	}
+}
+
+static void
+buffered_reset_read(BufferedObject *self)
+{
+	self->read_pos = self->read_end = 0;
+}
+
+static int
+grow_buffer(char **buf, Py_ssize_t *alloc, Py_ssize_t needed)
+{
+	Py_ssize_t size = MAX(needed, 2 * *alloc);
+	char *p;
+
+	p = PyMem_Realloc(*buf, size);
+	if (p == NULL) {
+		PyErr_NoMemory();
+		return -1;
+	}
+	*buf = p;
+	*alloc = size;
+	return 0;
+}
+
+static int
+buffered_append_read(BufferedObject *self, const char *data, Py_ssize_t n)
+{
+	Py_ssize_t avail = READ_AVAIL(self);
+
+	if (self->read_end + n > self->read_alloc) {
+		if (self->read_pos > 0) {
+			memmove(self->read_buf,
+				self->read_buf + self->read_pos, avail);
+			self->read_pos = 0;
+			self->read_end = avail;
+		}
+		if (avail + n > self->read_alloc &&
+		    grow_buffer(&self->read_buf, &self->read_alloc,
+				avail + n) < 0)
+			return -1;
+	}
+	memcpy(self->read_buf + self->read_end, data, n);
+	self->read_end += n;
+	return 0;
+}
+
+/* Appends up to n bytes from raw.read() to the read buffer.  Returns how
+ * many, 0 at EOF, -2 if the raw stream would have blocked (returned
+ * None), or -1 with an exception set. */
+static Py_ssize_t
+buffered_raw_read(BufferedObject *self, Py_ssize_t n)
+{
+	PyObject *nobj, *data;
+	Py_buffer view;
+	Py_ssize_t len;
+
+	nobj = PyLong_FromSsize_t(n);
+	if (nobj == NULL)
+		return -1;
+	data = PyObject_CallMethodObjArgs(self->raw, str_read, nobj, NULL);
+	Py_DECREF(nobj);
+	if (data == NULL)
+		return -1;
+	if (data == Py_None) {
+		Py_DECREF(data);
+		return -2;
+	}
+	if (PyObject_GetBuffer(data, &view, PyBUF_SIMPLE) < 0) {
+		Py_DECREF(data);
+		return -1;
+	}
+	len = view.len;
+	if (len > 0 && buffered_append_read(self, view.buf, len) < 0)
+		len = -1;
+	PyObject_ReleaseBuffer(data, &view);
+	Py_DECREF(data);
+	return len;
+}
+
+/* Writes out the whole write buffer.  On a BlockingIOError what did get
+ * written is dropped from the buffer and the error says how much that
+ * was. */
+static int
+buffered_flush_internal(BufferedObject *self)
+{
+	Py_ssize_t written = 0;
+
+	while (self->write_len > 0) {
+		PyObject *data, *res;
+		Py_ssize_t n;
+		blocking_info info;
+
+		data = PyString_FromStringAndSize(self->write_buf,
+						  self->write_len);
+		if (data == NULL)
+			return -1;
+		res = PyObject_CallMethodObjArgs(self->raw, str_write, data,
+						 NULL);
+		Py_DECREF(data);
+		if (res == NULL) {
+			if (fetch_blocking(&info)) {
+				n = MIN(MAX(info.written, 0), self->write_len);
+				memmove(self->write_buf, self->write_buf + n,
+					self->write_len - n);
+				self->write_len -= n;
+				raise_blocking(&info, written + n);
+			}
+			return -1;
+		}
+		if (res == Py_None) {
+			/* Same as raw.write() raising BlockingIOError */
+			Py_DECREF(res);
+			info.errno_obj = PyLong_FromLong(EAGAIN);
+			info.strerror = PyUnicode_FromString(
+				"write could not complete without blocking");
+			if (info.errno_obj != NULL && info.strerror != NULL)
+				raise_blocking(&info, written);
+			else {
+				Py_XDECREF(info.errno_obj);
+				Py_XDECREF(info.strerror);
+			}
+			return -1;
+		}
+		n = PyNumber_AsSsize_t(res, PyExc_OverflowError);
+		Py_DECREF(res);
+		if (n == -1 && PyErr_Occurred())
+			return -1;
+		n = MIN(MAX(n, 0), self->write_len);
+		memmove(self->write_buf, self->write_buf + n,
+			self->write_len - n);
+		self->write_len -= n;
+		written += n;
+	}
+	return 0;
+}
+
+static int
+buffered_check_closed(BufferedObject *self, const char *msg)
+{
+	PyObject *res = PyObject_GetAttr(self->raw, str_closed);
+	int closed;
+
+	if (res == NULL)
+		return -1;
+	closed = PyObject_IsTrue(res);
+	Py_DECREF(res);
+	if (closed > 0) {
+		PyErr_SetString(PyExc_ValueError, msg);
+		return -1;
+	}
+	return closed;
+}
+
+/* What a BufferedRandom does before reading */
+#define FLUSH_FOR_READ(self) \
+	if ((self)->write_len && buffered_flush_internal(self) < 0) \
+		return NULL;
+
+static PyObject *
+buffered_read_internal(BufferedObject *self, Py_ssize_t n)
+{
+	Py_ssize_t got = 0;
+	PyObject *res;
+
+	while (n < 0 || READ_AVAIL(self) < n) {
+		got = buffered_raw_read(self, MAX(self->buffer_size, n));
+		if (got == -1)
+			return NULL;
+		if (got <= 0)
+			break;
+	}
+	if (READ_AVAIL(self) == 0) {
+		if (got == -2)
+			Py_RETURN_NONE;
+		Py_INCREF(empty_bytes);
+		return empty_bytes;
+	}
+	if (n < 0 || n > READ_AVAIL(self))
+		n = READ_AVAIL(self);
+	res = PyString_FromStringAndSize(self->read_buf + self->read_pos, n);
+	if (res != NULL)
+		buffered_consume(self, n);
+	return res;
+}
+
+static PyObject *
+buffered_read(BufferedObject *self, PyObject *args)
+{
+	PyObject *nobj = Py_None;
+	Py_ssize_t n = -1;
+
+	CHECK_INITIALIZED(self)
+	if (!PyArg_ParseTuple(args, "|O:read", &nobj))
+		return NULL;
+	if (nobj != Py_None) {
+		n = PyNumber_AsSsize_t(nobj, PyExc_OverflowError);
+		if (n == -1 && PyErr_Occurred())
+			return NULL;
+	}
+	FLUSH_FOR_READ(self)
+	return buffered_read_internal(self, n);
+}
+
+static PyObject *
+buffered_peek(BufferedObject *self, PyObject *args)
+{
+	Py_ssize_t n = 0, have;
+
+	CHECK_INITIALIZED(self)
+	if (!PyArg_ParseTuple(args, "|n:peek", &n))
+		return NULL;
+	FLUSH_FOR_READ(self)
+	have = READ_AVAIL(self);
+	if (have < MIN(n, self->buffer_size) &&
+	    buffered_raw_read(self, self->buffer_size - have) == -1)
+		return NULL;
+	return PyString_FromStringAndSize(self->read_buf + self->read_pos,
+					  READ_AVAIL(self));
+}
+
+static PyObject *
+buffered_read1(BufferedObject *self, PyObject *args)
+{
+	Py_ssize_t n;
+
+	CHECK_INITIALIZED(self)
+	if (!PyArg_ParseTuple(args, "n:read1", &n))
+		return NULL;
+	if (n <= 0) {
+		Py_INCREF(empty_bytes);
+		return empty_bytes;
+	}
+	FLUSH_FOR_READ(self)
+	/* Only go to the raw stream if there's nothing buffered */
+	if (READ_AVAIL(self) == 0 &&
+	    buffered_raw_read(self, self->buffer_size) == -1)
+		return NULL;
+	return buffered_read_internal(self, MIN(n, READ_AVAIL(self)));
+}
+
+static PyObject *
+buffered_readinto(BufferedObject *self, PyObject *args)
+{
+	PyObject *b, *data;
+	Py_buffer view;
+	Py_ssize_t n;
+
+	CHECK_INITIALIZED(self)
+	if (!PyArg_ParseTuple(args, "O:readinto", &b))
+		return NULL;
+	if (PyObject_GetBuffer(b, &view, PyBUF_WRITABLE) < 0)
+		return NULL;
+	data = NULL;
+	if (!self->write_len || buffered_flush_internal(self) == 0)
+		data = buffered_read_internal(self, view.len);
+	if (data == NULL || data == Py_None) {
+		PyObject_ReleaseBuffer(b, &view);
+		return data;
+	}
+	n = PyString_GET_SIZE(data);
+	memcpy(view.buf, PyString_AS_STRING(data), n);
+	PyObject_ReleaseBuffer(b, &view);
+	Py_DECREF(data);
+	return PyLong_FromSsize_t(n);
+}
+
+static PyObject *
+buffered_readline(BufferedObject *self, PyObject *args)
+{
+	PyObject *limitobj = Py_None, *res = NULL;
+	Py_ssize_t limit = -1, total = 0, alloc = 0;
+	char *line = NULL;
+
+	CHECK_INITIALIZED(self)
+	if (!PyArg_ParseTuple(args, "|O:readline", &limitobj))
+		return NULL;
+	if (limitobj != Py_None) {
+		limit = PyNumber_AsSsize_t(limitobj, PyExc_OverflowError);
+		if (limit == -1 && PyErr_Occurred())
+			return NULL;
+	}
+	FLUSH_FOR_READ(self)
+
+	while (limit < 0 || total < limit) {
+		char *start, *nl;
+		Py_ssize_t scan, take;
+
+		if (READ_AVAIL(self) == 0) {
+			Py_ssize_t got = buffered_raw_read(self,
+							   self->buffer_size);
+			if (got == -1)
+				goto done;
+			if (got <= 0)
+				break;
+		}
+		start = self->read_buf + self->read_pos;
+		scan = READ_AVAIL(self);
+		if (limit >= 0)
+			scan = MIN(scan, limit - total);
+		nl = memchr(start, '\n', scan);
+		take = nl ? nl - start + 1 : scan;
+
+		if (nl != NULL && total == 0) {
+			/* The whole line was buffered */
+			res = PyString_FromStringAndSize(start, take);
+			if (res != NULL)
+				buffered_consume(self, take);
+			goto done;
+		}
+		if (total + take > alloc &&
+		    grow_buffer(&line, &alloc, total + take) < 0)
+			goto done;
+		memcpy(line + total, start, take);
+		buffered_consume(self, take);
+		total += take;
+		if (nl != NULL)
+			break;
+	}
+	res = PyString_FromStringAndSize(line, total);
+
+  done:
+	PyMem_Free(line);
+	return res;
+}
+
+static PyObject *
+buffered_write(BufferedObject *self, PyObject *args)
+{
+	PyObject *b, *copy = NULL;
+	Py_buffer view;
+	Py_ssize_t written;
+	blocking_info info;
+
+	CHECK_INITIALIZED(self)
+	if (!PyArg_ParseTuple(args, "O:write", &b))
+		return NULL;
+	if (buffered_check_closed(self, "write to closed file") < 0)
+		return NULL;
+	if (PyUnicode_Check(b)) {
+		PyErr_SetString(PyExc_TypeError,
+				"can't write str to binary stream");
+		return NULL;
+	}
+	if (PyObject_GetBuffer(b, &view, PyBUF_SIMPLE) < 0) {
+		/* Any iterable of ints will do, as for bytearray.extend() */
+		PyObject *it;
+
+		if (!PyErr_ExceptionMatches(PyExc_TypeError))
+			return NULL;
+		PyErr_Clear();
+		it = PyObject_GetIter(b);
+		if (it == NULL)
+			return NULL;
+		copy = PyBytes_FromObject(it);
+		Py_DECREF(it);
+		if (copy == NULL)
+			return NULL;
+		b = copy;
+		if (PyObject_GetBuffer(b, &view, PyBUF_SIMPLE) < 0) {
+			Py_DECREF(copy);
+			return NULL;
+		}
+	}
+
+	/* A BufferedRandom undoes its readahead */
+	if (READ_AVAIL(self) > 0) {
+		PyObject *res = PyObject_CallMethod(self->raw, "seek", "ni",
+						    -READ_AVAIL(self), 1);
+		if (res == NULL)
+			goto error;
+		Py_DECREF(res);
+		buffered_reset_read(self);
+	}
+
+	if (self->write_len > self->buffer_size) {
+		/* We're full, so let's pre-flush the buffer */
+		if (buffered_flush_internal(self) < 0) {
+			/* We can't accept anything else */
+			if (fetch_blocking(&info))
+				raise_blocking(&info, 0);
+			goto error;
+		}
+	}
+	if (self->write_len + view.len > self->write_alloc &&
+	    grow_buffer(&self->write_buf, &self->write_alloc,
+			self->write_len + view.len) < 0)
+		goto error;
+	memcpy(self->write_buf + self->write_len, view.buf, view.len);
+	self->write_len += view.len;
+	written = view.len;
+
+	if (self->write_len > self->buffer_size &&
+	    buffered_flush_internal(self) < 0) {
+		if (!fetch_blocking(&info))
+			goto error;
+		if (self->write_len > self->max_buffer_size) {
+			/* We've hit max_buffer_size.  We have to accept a
+			 * partial write and cut back our buffer. */
+			Py_ssize_t overage = self->write_len -
+					     self->max_buffer_size;
+			self->write_len = self->max_buffer_size;
+			raise_blocking(&info, overage);
+			goto error;
+		}
+		Py_DECREF(info.errno_obj);
+		Py_DECREF(info.strerror);
+	}
+
+	PyObject_ReleaseBuffer(b, &view);
+	Py_XDECREF(copy);
+	return PyLong_FromSsize_t(written);
+
+  error:
+	PyObject_ReleaseBuffer(b, &view);
+	Py_XDECREF(copy);
+	return NULL;
+}
+
+static PyObject *
+buffered_flush(BufferedObject *self)
+{
+	CHECK_INITIALIZED(self)
+	if (buffered_check_closed(self, "flush of closed file") < 0 ||
+	    buffered_flush_internal(self) < 0)
+		return NULL;
+	Py_RETURN_NONE;
+}
+
+static PyObject *
+buffered_seek(BufferedObject *self, PyObject *args)
+{
+	PyObject *pos, *whence = NULL, *res;
+
+	CHECK_INITIALIZED(self)
+	if (!PyArg_ParseTuple(args, "O|O:seek", &pos, &whence))
+		return NULL;
+	if (!PyObject_TypeCheck(self, &BufferedReader_Type)) {
+		if (buffered_check_closed(self, "flush of closed file") < 0 ||
+		    buffered_flush_internal(self) < 0)
+			return NULL;
+	}
+
+	Py_INCREF(pos);
+	if (whence != NULL && READ_AVAIL(self) > 0) {
+		long how = PyLong_AsLong(whence);
+
+		if (how == -1 && PyErr_Occurred()) {
+			Py_DECREF(pos);
+			return NULL;
+		}
+		if (how == 1) {
+			/* The raw position is past what's been read */
+			PyObject *avail = PyLong_FromSsize_t(READ_AVAIL(self));
+			PyObject *adjusted = NULL;
+
+			if (avail != NULL) {
+				adjusted = PyNumber_Subtract(pos, avail);
+				Py_DECREF(avail);
+			}
+			Py_DECREF(pos);
+			if (adjusted == NULL)
+				return NULL;
+			pos = adjusted;
+		}
+	}
+	if (whence != NULL)
+		res = PyObject_CallMethodObjArgs(self->raw, str_seek, pos,
+						 whence, NULL);
+	else
+		res = PyObject_CallMethodObjArgs(self->raw, str_seek, pos,
+						 NULL);
+	Py_DECREF(pos);
+	if (res != NULL)
+		buffered_reset_read(self);
+	return res;
+}
+
+static PyObject *
+buffered_tell(BufferedObject *self)
+{
+	PyObject *pos, *delta, *res;
+	Py_ssize_t adjust;
+
+	CHECK_INITIALIZED(self)
+	pos = PyObject_CallMethodObjArgs(self->raw, str_tell, NULL);
+	adjust = self->write_len - READ_AVAIL(self);
+	if (pos == NULL || adjust == 0)
+		return pos;
+	delta = PyLong_FromSsize_t(adjust);
+	if (delta == NULL) {
+		Py_DECREF(pos);
+		return NULL;
+	}
+	res = PyNumber_Add(pos, delta);
+	Py_DECREF(pos);
+	Py_DECREF(delta);
+	return res;
+}
+
+PyDoc_STRVAR(read_doc,
+"read([n]) -> bytes.  Read up to n bytes, or to EOF if n is omitted.\n"
+"\n"
+"Returns None if the raw stream is non-blocking and has nothing ready.");
+
+PyDoc_STRVAR(peek_doc,
+"peek([n]) -> bytes.  Return buffered bytes without advancing.\n"
+"\n"
+"Does at most one raw read, and only if fewer than n bytes (capped at\n"
+"the buffer size) are buffered.");
+
+PyDoc_STRVAR(read1_doc,
+"read1(n) -> bytes.  Read up to n bytes with at most one raw read.");
+
+PyDoc_STRVAR(readinto_doc,
+"readinto(b) -> int.  Read up to len(b) bytes into b.");
+
+PyDoc_STRVAR(readline_doc,
+"readline([limit]) -> bytes.  Read up to and including the next newline.");
+
+PyDoc_STRVAR(write_doc,
+"write(b) -> int.  Buffer b, flushing once more than buffer_size bytes\n"
+"are waiting.\n"
+"\n"
+"If the raw stream is non-blocking and the buffer would grow past\n"
+"max_buffer_size, raises BlockingIOError saying how much of b was left\n"
+"out.");
+
+PyDoc_STRVAR(flush_doc,
+"flush() -> None.  Write out everything buffered.");
+
+PyDoc_STRVAR(seek_doc,
+"seek(pos[, whence]) -> int.  Change the stream position.");
+
+PyDoc_STRVAR(tell_doc,
+"tell() -> int.  Current stream position.");
+
+static PyMethodDef bufferedreader_methods[] = {
+	{"read",     (PyCFunction)buffered_read, METH_VARARGS, read_doc},
+	{"peek",     (PyCFunction)buffered_peek, METH_VARARGS, peek_doc},
+	{"read1",    (PyCFunction)buffered_read1, METH_VARARGS, read1_doc},
+	{"readinto", (PyCFunction)buffered_readinto, METH_VARARGS,
+	 readinto_doc},
+	{"readline", (PyCFunction)buffered_readline, METH_VARARGS,
+	 readline_doc},
+	{"seek",     (PyCFunction)buffered_seek, METH_VARARGS, seek_doc},
+	{"tell",     (PyCFunction)buffered_tell, METH_NOARGS, tell_doc},
+	{NULL,	     NULL}		/* sentinel */
+};
+
+static PyMethodDef bufferedwriter_methods[] = {
+	{"write",    (PyCFunction)buffered_write, METH_VARARGS, write_doc},
+	{"flush",    (PyCFunction)buffered_flush, METH_NOARGS, flush_doc},
+	{"seek",     (PyCFunction)buffered_seek, METH_VARARGS, seek_doc},
+	{"tell",     (PyCFunction)buffered_tell, METH_NOARGS, tell_doc},
+	{NULL,	     NULL}		/* sentinel */
+};
+
+static PyMethodDef bufferedrandom_methods[] = {
+	{"read",     (PyCFunction)buffered_read, METH_VARARGS, read_doc},
+	{"peek",     (PyCFunction)buffered_peek, METH_VARARGS, peek_doc},
+	{"read1",    (PyCFunction)buffered_read1, METH_VARARGS, read1_doc},
+	{"readinto", (PyCFunction)buffered_readinto, METH_VARARGS,
+	 readinto_doc},
+	{"readline", (PyCFunction)buffered_readline, METH_VARARGS,
+	 readline_doc},
+	{"write",    (PyCFunction)buffered_write, METH_VARARGS, write_doc},
+	{"flush",    (PyCFunction)buffered_flush, METH_NOARGS, flush_doc},
+	{"seek",     (PyCFunction)buffered_seek, METH_VARARGS, seek_doc},
+	{"tell",     (PyCFunction)buffered_tell, METH_NOARGS, tell_doc},
+	{NULL,	     NULL}		/* sentinel */
+};
+
+static PyMemberDef bufferedreader_members[] = {
+	{"raw", T_OBJECT, offsetof(BufferedObject, raw), READONLY},
+	{"buffer_size", T_PYSSIZET, offsetof(BufferedObject, buffer_size), 0},
+	{NULL}
+};
+
+static PyMemberDef bufferedwriter_members[] = {
+	{"raw", T_OBJECT, offsetof(BufferedObject, raw), READONLY},
+	{"buffer_size", T_PYSSIZET, offsetof(BufferedObject, buffer_size), 0},
+	{"max_buffer_size", T_PYSSIZET,
+	 offsetof(BufferedObject, max_buffer_size), 0},
+	{NULL}
+};
+
+PyDoc_STRVAR(bufferedreader_doc,
+"_BufferedReader(raw[, buffer_size]) -> buffered reader for a raw stream");
+
+PyDoc_STRVAR(bufferedwriter_doc,
+"_BufferedWriter(raw[, buffer_size[, max_buffer_size]]) -> buffered writer\n"
+"for a raw stream");
+
+PyDoc_STRVAR(bufferedrandom_doc,
+"_BufferedRandom(raw[, buffer_size[, max_buffer_size]]) -> buffered\n"
+"reader and writer for a seekable raw stream");
+
+#define BUFFERED_TYPE(type, name, methods, members, init, doc) \
+static PyTypeObject type = { \
+	PyVarObject_HEAD_INIT(&PyType_Type, 0) \
+	name, \
+	sizeof(BufferedObject), \
+	0, \
+	(destructor)buffered_dealloc,		/* tp_dealloc */ \
+	0,					/* tp_print */ \
+	0,					/* tp_getattr */ \
+	0,					/* tp_setattr */ \
+	0,					/* tp_compare */ \
+	0,					/* tp_repr */ \
+	0,					/* tp_as_number */ \
+	0,					/* tp_as_sequence */ \
+	0,					/* tp_as_mapping */ \
+	0,					/* tp_hash */ \
+	0,					/* tp_call */ \
+	0,					/* tp_str */ \
+	PyObject_GenericGetAttr,		/* tp_getattro */ \
+	0,					/* tp_setattro */ \
+	0,					/* tp_as_buffer */ \
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | \
+		Py_TPFLAGS_HAVE_GC,		/* tp_flags */ \
+	doc,					/* tp_doc */ \
+	(traverseproc)buffered_traverse,	/* tp_traverse */ \
+	(inquiry)buffered_clear,		/* tp_clear */ \
+	0,					/* tp_richcompare */ \
+	offsetof(BufferedObject, weakreflist),	/* tp_weaklistoffset */ \
+	0,					/* tp_iter */ \
+	0,					/* tp_iternext */ \
+	methods,				/* tp_methods */ \
+	members,				/* tp_members */ \
+	0,					/* tp_getset */ \
+	0,					/* tp_base */ \
+	0,					/* tp_dict */ \
+	0,					/* tp_descr_get */ \
+	0,					/* tp_descr_set */ \
+	0,					/* tp_dictoffset */ \
+	(initproc)init,				/* tp_init */ \
+	buffered_new,				/* tp_new */ \
+};
+
+BUFFERED_TYPE(BufferedReader_Type, "_BufferedReader", bufferedreader_methods,
+	      bufferedreader_members, bufferedreader_init, bufferedreader_doc)
+BUFFERED_TYPE(BufferedWriter_Type, "_BufferedWriter", bufferedwriter_methods,
+	      bufferedwriter_members, bufferedwriter_init, bufferedwriter_doc)
+BUFFERED_TYPE(BufferedRandom_Type, "_BufferedRandom", bufferedrandom_methods,
+	      bufferedwriter_members, bufferedrandom_init, bufferedrandom_doc)
+
+
+/* IncrementalNewlineDecoder.  io.py's __init__ fills in the fields. */
+
+typedef struct {
+	PyObject_HEAD
+	PyObject *decoder;
+	PyObject *translate;
+	int pendingcr;	/* A \r held back from the end of the last output */
+	int seennl;	/* SEEN_LF | SEEN_CR | SEEN_CRLF */
+} NLDecoderObject;
+
+#define SEEN_LF 1
+#define SEEN_CR 2
+#define SEEN_CRLF 4
+
+static PyObject *
+nldecoder_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+	NLDecoderObject *self;
+
+	self = PyObject_New(type);
+	if (self == NULL)
+		return NULL;
+	self->decoder = NULL;
+	self->translate = NULL;
+	self->pendingcr = 0;
+	self->seennl = 0;
+	return (PyObject *)self;
+}
+
+static int
+nldecoder_traverse(NLDecoderObject *self, visitproc visit, void *arg)
+{
+	Py_VISIT(self->decoder);
+	Py_VISIT(self->translate);
+	return 0;
+}
+
+static int
+nldecoder_clear(NLDecoderObject *self)
+{
+	Py_CLEAR(self->decoder);
+	Py_CLEAR(self->translate);
+	return 0;
+}
+
+static void
+nldecoder_dealloc(NLDecoderObject *self)
+{
+	nldecoder_clear(self);
+	PyObject_Del(self);
+}
+
+static PyObject *
+nldecoder_decode_internal(NLDecoderObject *self, PyObject *input, int final)
+{
+	PyObject *output, *prefixed = NULL;
+	Py_UNICODE *in, *out;
+	Py_ssize_t len, i, j, cr = 0, lf = 0, crlf = 0;
+
+	if (self->decoder == NULL) {
+		PyErr_SetString(PyExc_AttributeError, "decoder");
+		return NULL;
+	}
+
+	/* Decode input with the \r held back from the previous pass */
+	if (self->pendingcr) {
+		Py_buffer view;
+
+		if (PyObject_GetBuffer(input, &view, PyBUF_SIMPLE) < 0)
+			return NULL;
+		prefixed = PyString_FromStringAndSize(NULL, view.len + 1);
+		if (prefixed != NULL) {
+			PyString_AS_STRING(prefixed)[0] = '\r';
+			memcpy(PyString_AS_STRING(prefixed) + 1, view.buf,
+			       view.len);
+		}
+		PyObject_ReleaseBuffer(input, &view);
+		if (prefixed == NULL)
+			return NULL;
+		input = prefixed;
+	}
+	output = PyObject_CallMethodObjArgs(self->decoder, str_decode, input,
+					    final ? Py_True : Py_False, NULL);
+	Py_XDECREF(prefixed);
+	if (output == NULL)
+		return NULL;
+	if (!PyUnicode_Check(output)) {
+		PyErr_Format(PyExc_TypeError,
+			     "decoder should return a string result, not '%.200s'",
+			     Py_TYPE(output)->tp_name);
+		Py_DECREF(output);
+		return NULL;
+	}
+	in = PyUnicode_AS_UNICODE(output);
+	len = PyUnicode_GET_SIZE(output);
+
+	/* Hold back a trailing \r even when not translating, so readline()
+	 * is sure to get \r\n in one piece */
+	self->pendingcr = 0;
+	if (len > 0 && in[len - 1] == '\r' && !final) {
+		self->pendingcr = 1;
+		len--;
+	}
+
+	/* Record which newlines are read */
+	for (i = 0; i < len; i++) {
+		if (in[i] == '\n')
+			lf++;
+		else if (in[i] == '\r') {
+			if (i + 1 < len && in[i + 1] == '\n') {
+				crlf++;
+				i++;
+			}
+			else
+				cr++;
+		}
+	}
+	self->seennl |= (lf ? SEEN_LF : 0) | (cr ? SEEN_CR : 0) |
+			(crlf ? SEEN_CRLF : 0);
+
+	if ((cr || crlf) && is_true(self->translate)) {
+		PyObject *translated;
+
+		translated = PyUnicode_FromUnicode(NULL, len - crlf);
+		if (translated == NULL) {
+			Py_DECREF(output);
+			return NULL;
+		}
+		out = PyUnicode_AS_UNICODE(translated);
+		for (i = j = 0; i < len; i++) {
+			if (in[i] == '\r') {
+				if (i + 1 < len && in[i + 1] == '\n')
+					i++;
+				out[j++] = '\n';
+			}
+			else
+				out[j++] = in[i];
+		}
+		Py_DECREF(output);
+		return translated;
+	}
+	if (len != PyUnicode_GET_SIZE(output)) {
+		PyObject *shortened = PyUnicode_FromUnicode(in, len);
+		Py_DECREF(output);
+		return shortened;
+	}
+	return output;
+}
+
+static PyObject *
+nldecoder_decode(NLDecoderObject *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"input", "final", NULL};
+	PyObject *input, *final = Py_False;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O:decode", kwlist,
+					 &input, &final))
+		return NULL;
+	return nldecoder_decode_internal(self, input, is_true(final));
+}
+
+static PyObject *
+nldecoder_getstate(NLDecoderObject *self)
+{
+	PyObject *state, *buf, *flag, *res;
+
+	if (self->decoder == NULL) {
+		PyErr_SetString(PyExc_AttributeError, "decoder");
+		return NULL;
+	}
+	state = PyObject_CallMethodObjArgs(self->decoder, str_getstate, NULL);
+	if (state == NULL)
+		return NULL;
+	if (!PyArg_ParseTuple(state, "OO;decoder state must be a pair",
+			      &buf, &flag)) {
+		Py_DECREF(state);
+		return NULL;
+	}
+	Py_INCREF(buf);
+	if (self->pendingcr) {
+		PyObject *joined = PyNumber_Add(buf, cr_bytes);
+
+		Py_DECREF(buf);
+		if (joined == NULL) {
+			Py_DECREF(state);
+			return NULL;
+		}
+		buf = joined;
+	}
+	res = PyTuple_Pack(2, buf, flag);
+	Py_DECREF(buf);
+	Py_DECREF(state);
+	return res;
+}
+
+static PyObject *
+nldecoder_setstate(NLDecoderObject *self, PyObject *state)
+{
+	PyObject *buf, *flag, *res;
+	Py_buffer view;
+	int pendingcr;
+
+	if (self->decoder == NULL) {
+		PyErr_SetString(PyExc_AttributeError, "decoder");
+		return NULL;
+	}
+	if (!PyArg_ParseTuple(state, "OO;state must be a pair", &buf, &flag))
+		return NULL;
+	if (PyObject_GetBuffer(buf, &view, PyBUF_SIMPLE) < 0)
+		return NULL;
+	pendingcr = view.len > 0 && ((char *)view.buf)[view.len - 1] == '\r';
+	PyObject_ReleaseBuffer(buf, &view);
+	if (pendingcr) {
+		buf = PySequence_GetSlice(buf, 0, view.len - 1);
+		if (buf == NULL)
+			return NULL;
+	}
+	else
+		Py_INCREF(buf);
+	self->pendingcr = pendingcr;
+	res = PyObject_CallMethod(self->decoder, "setstate", "((OO))",
+				  buf, flag);
+	Py_DECREF(buf);
+	return res;
+}
+
+static PyObject *
+nldecoder_reset(NLDecoderObject *self)
+{
+	self->seennl = 0;
+	self->pendingcr = 0;
+	if (self->decoder == NULL) {
+		PyErr_SetString(PyExc_AttributeError, "decoder");
+		return NULL;
+	}
+	return PyObject_CallMethodObjArgs(self->decoder, str_reset, NULL);
+}
+
+static PyObject *
+nldecoder_get_buffer(NLDecoderObject *self, void *closure)
+{
+	PyObject *res = self->pendingcr ? cr_bytes : empty_bytes;
+
+	Py_INCREF(res);
+	return res;
+}
+
+static int
+nldecoder_set_buffer(NLDecoderObject *self, PyObject *value, void *closure)
+{
+	int pending;
+
+	if (value == NULL) {
+		PyErr_SetString(PyExc_AttributeError, "can't delete buffer");
+		return -1;
+	}
+	pending = PyObject_IsTrue(value);
+	if (pending < 0)
+		return -1;
+	self->pendingcr = pending;
+	return 0;
+}
+
+PyDoc_STRVAR(decode_doc,
+"decode(input[, final]) -> str.  Decode input, noting its newlines.");
+
+static PyMethodDef nldecoder_methods[] = {
+	{"decode",   (PyCFunction)nldecoder_decode,
+	 METH_VARARGS | METH_KEYWORDS, decode_doc},
+	{"getstate", (PyCFunction)nldecoder_getstate, METH_NOARGS},
+	{"setstate", (PyCFunction)nldecoder_setstate, METH_O},
+	{"reset",    (PyCFunction)nldecoder_reset, METH_NOARGS},
+	{NULL,	     NULL}		/* sentinel */
+};
+
+static PyMemberDef nldecoder_members[] = {
+	{"decoder", T_OBJECT, offsetof(NLDecoderObject, decoder), 0},
+	{"translate", T_OBJECT, offsetof(NLDecoderObject, translate), 0},
+	{"seennl", T_INT, offsetof(NLDecoderObject, seennl), 0},
+	{NULL}
+};
+
+static PyGetSetDef nldecoder_getsetlist[] = {
+	{"buffer", (getter)nldecoder_get_buffer, (setter)nldecoder_set_buffer,
+	 "b'\\r' if one is being held back, else b''"},
+	{NULL},
+};
+
+PyDoc_STRVAR(nldecoder_doc,
+"Fast decode() for io.IncrementalNewlineDecoder");
+
+static PyTypeObject NLDecoder_Type = {
+	PyVarObject_HEAD_INIT(&PyType_Type, 0)
+	"_IncrementalNewlineDecoder",
+	sizeof(NLDecoderObject),
+	0,
+	(destructor)nldecoder_dealloc,		/* tp_dealloc */
+	0,					/* tp_print */
+	0,					/* tp_getattr */
+	0,					/* tp_setattr */
+	0,					/* tp_compare */
+	0,					/* tp_repr */
+	0,					/* tp_as_number */
+	0,					/* tp_as_sequence */
+	0,					/* tp_as_mapping */
+	0,					/* tp_hash */
+	0,					/* tp_call */
+	0,					/* tp_str */
+	PyObject_GenericGetAttr,		/* tp_getattro */
+	0,					/* tp_setattro */
+	0,					/* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE |
+		Py_TPFLAGS_HAVE_GC,		/* tp_flags */
+	nldecoder_doc,				/* tp_doc */
+	(traverseproc)nldecoder_traverse,	/* tp_traverse */
+	(inquiry)nldecoder_clear,		/* tp_clear */
+	0,					/* tp_richcompare */
+	0,					/* tp_weaklistoffset */
+	0,					/* tp_iter */
+	0,					/* tp_iternext */
+	nldecoder_methods,			/* tp_methods */
+	nldecoder_members,			/* tp_members */
+	nldecoder_getsetlist,			/* tp_getset */
+	0,					/* tp_base */
+	0,					/* tp_dict */
+	0,					/* tp_descr_get */
+	0,					/* tp_descr_set */
+	0,					/* tp_dictoffset */
+	0,					/* tp_init */
+	nldecoder_new,				/* tp_new */
+};
+
+
+/* TextIOWrapper.  io.py's __init__, tell() and seek() run on these
+ * fields directly. */
+
+enum { ENCODE_NONE, ENCODE_UTF8, ENCODE_LATIN1, ENCODE_ASCII };
+
+typedef struct {
+	PyObject_HEAD
+	PyObject *buffer;
+	PyObject *line_buffering;
+	PyObject *encoding;
+	PyObject *errors;
+	PyObject *readuniversal;
+	PyObject *readtranslate;
+	PyObject *readnl;
+	PyObject *writetranslate;
+	PyObject *writenl;
+	PyObject *encoder;
+	PyObject *decoder;
+	/* Decoded but not yet returned: decoded_chars[decoded_chars_used:] */
+	PyObject *decoded_chars;
+	Py_ssize_t decoded_chars_used;
+	PyObject *snapshot;
+	PyObject *seekable;
+	PyObject *telling;
+	/* What encoder and decoder the fast paths were last checked for */
+	PyObject *checked_encoder;
+	int encodefunc;
+	PyObject *checked_decoder;
+	int fastdecode;
+	PyObject *weakreflist;
+} TextIOObject;
+
+#define TEXTIO_CHECK_INITIALIZED(self) \
+	if ((self)->buffer == NULL) \
+		return err_uninitialized();
+
+static PyObject *
+textio_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+	TextIOObject *self;
+
+	self = PyObject_New(type);
+	if (self == NULL)
+		return NULL;
+	self->buffer = NULL;
+	self->line_buffering = NULL;
+	self->encoding = NULL;
+	self->errors = NULL;
+	self->readuniversal = NULL;
+	self->readtranslate = NULL;
+	self->readnl = NULL;
+	self->writetranslate = NULL;
+	self->writenl = NULL;
+	self->encoder = NULL;
+	self->decoder = NULL;
+	self->decoded_chars = NULL;
+	self->decoded_chars_used = 0;
+	self->snapshot = NULL;
+	self->seekable = NULL;
+	self->telling = NULL;
+	self->checked_encoder = NULL;
+	self->encodefunc = ENCODE_NONE;
+	self->checked_decoder = NULL;
+	self->fastdecode = 0;
+	self->weakreflist = NULL;
+	return (PyObject *)self;
+}
+
+static int
+textio_traverse(TextIOObject *self, visitproc visit, void *arg)
+{
+	Py_VISIT(self->buffer);
+	Py_VISIT(self->line_buffering);
+	Py_VISIT(self->encoding);
+	Py_VISIT(self->errors);
+	Py_VISIT(self->readuniversal);
+	Py_VISIT(self->readtranslate);
+	Py_VISIT(self->readnl);
+	Py_VISIT(self->writetranslate);
+	Py_VISIT(self->writenl);
+	Py_VISIT(self->encoder);
+	Py_VISIT(self->decoder);
+	Py_VISIT(self->decoded_chars);
+	Py_VISIT(self->snapshot);
+	Py_VISIT(self->seekable);
+	Py_VISIT(self->telling);
+	Py_VISIT(self->checked_encoder);
+	Py_VISIT(self->checked_decoder);
+	return 0;
+}
+
+static int
+textio_clear(TextIOObject *self)
+{
+	Py_CLEAR(self->buffer);
+	Py_CLEAR(self->line_buffering);
+	Py_CLEAR(self->encoding);
+	Py_CLEAR(self->errors);
+	Py_CLEAR(self->readuniversal);
+	Py_CLEAR(self->readtranslate);
+	Py_CLEAR(self->readnl);
+	Py_CLEAR(self->writetranslate);
+	Py_CLEAR(self->writenl);
+	Py_CLEAR(self->encoder);
+	Py_CLEAR(self->decoder);
+	Py_CLEAR(self->decoded_chars);
+	Py_CLEAR(self->snapshot);
+	Py_CLEAR(self->seekable);
+	Py_CLEAR(self->telling);
+	Py_CLEAR(self->checked_encoder);
+	Py_CLEAR(self->checked_decoder);
+	return 0;
+}
+
+static void
+textio_dealloc(TextIOObject *self)
+{
+	textio_clear(self);
+	PyObject_Del(self);
+}
+
+static void
+textio_set(PyObject **field, PyObject *value)
+{
+	PyObject *old = *field;
+
+	Py_INCREF(value);
+	*field = value;
+	Py_XDECREF(old);
+}
+
+/* Steals a reference to chars */
+static void
+textio_set_decoded_chars(TextIOObject *self, PyObject *chars)
+{
+	PyObject *old = self->decoded_chars;
+
+	self->decoded_chars = chars;
+	self->decoded_chars_used = 0;
+	Py_XDECREF(old);
+}
+
+/* Sets *s and *len to what's left of decoded_chars */
+static int
+textio_pending(TextIOObject *self, Py_UNICODE **s, Py_ssize_t *len)
+{
+	PyObject *chars = self->decoded_chars;
+	Py_ssize_t used = self->decoded_chars_used;
+
+	*s = NULL;
+	*len = 0;
+	if (chars == NULL)
+		return 0;
+	if (!PyUnicode_Check(chars)) {
+		PyErr_SetString(PyExc_TypeError,
+				"decoded_chars should be a string");
+		return -1;
+	}
+	used = MAX(MIN(used, PyUnicode_GET_SIZE(chars)), 0);
+	*s = PyUnicode_AS_UNICODE(chars) + used;
+	*len = PyUnicode_GET_SIZE(chars) - used;
+	return 0;
+}
+
+/* Takes up to n characters (all of them if n < 0) from decoded_chars */
+static PyObject *
+textio_get_decoded_chars(TextIOObject *self, Py_ssize_t n)
+{
+	Py_UNICODE *s;
+	Py_ssize_t len;
+
+	if (textio_pending(self, &s, &len) < 0)
+		return NULL;
+	if (n < 0 || n > len)
+		n = len;
+	if (n == 0) {
+		Py_INCREF(empty_str);
+		return empty_str;
+	}
+	if (n == PyUnicode_GET_SIZE(self->decoded_chars)) {
+		self->decoded_chars_used = n;
+		Py_INCREF(self->decoded_chars);
+		return self->decoded_chars;
+	}
+	self->decoded_chars_used = s - PyUnicode_AS_UNICODE(
+		self->decoded_chars) + n;
+	return PyUnicode_FromUnicode(s, n);
+}
+
+static PyObject *
+textio_decoder(TextIOObject *self)
+{
+	if (self->decoder == NULL || self->decoder == Py_None) {
+		PyObject *decoder;
+
+		decoder = PyObject_CallMethodObjArgs((PyObject *)self,
+						     str_get_decoder, NULL);
+		if (decoder == NULL)
+			return NULL;
+		if (self->decoder == NULL || self->decoder == Py_None)
+			textio_set(&self->decoder, decoder);
+		Py_DECREF(decoder);
+	}
+	return self->decoder;
+}
+
+static PyObject *
+textio_decode(TextIOObject *self, PyObject *decoder, PyObject *input,
+	      int final)
+{
+	/* Call the C decode() directly unless a subclass overrides it */
+	if (decoder != self->checked_decoder) {
+		PyObject *descr = NULL;
+		int fast = 0;
+
+		if (PyObject_TypeCheck(decoder, &NLDecoder_Type)) {
+			if (_PyType_LookupEx(Py_TYPE(decoder), str_decode,
+					     &descr) < 0)
+				return NULL;
+			fast = descr != NULL && descr == PyDict_GetItem(
+				NLDecoder_Type.tp_dict, str_decode);
+			Py_XDECREF(descr);
+		}
+		textio_set(&self->checked_decoder, decoder);
+		self->fastdecode = fast;
+	}
+	if (self->fastdecode)
+		return nldecoder_decode_internal((NLDecoderObject *)decoder,
+						 input, final);
+	return PyObject_CallMethodObjArgs(decoder, str_decode, input,
+					  final ? Py_True : Py_False, NULL);
+}
+
+/* Reads and decodes the next chunk into decoded_chars.  Returns 1 unless
+ * EOF was reached (0), or -1 on error. */
+static int
+textio_read_chunk(TextIOObject *self)
+{
+	PyObject *state = NULL, *dec_buffer = NULL, *dec_flags = NULL;
+	PyObject *chunk_size, *input_chunk, *decoded;
+	int eof;
+
+	if (self->decoder == NULL || self->decoder == Py_None) {
+		PyErr_SetString(PyExc_ValueError, "no decoder");
+		return -1;
+	}
+
+	if (is_true(self->telling)) {
+		/* To prepare for tell(), we need to snapshot a point in the
+		 * file where the decoder's input buffer is empty */
+		state = PyObject_CallMethodObjArgs(self->decoder,
+						   str_getstate, NULL);
+		if (state == NULL)
+			return -1;
+		if (!PyArg_ParseTuple(state,
+				      "OO;decoder state must be a pair",
+				      &dec_buffer, &dec_flags)) {
+			Py_DECREF(state);
+			return -1;
+		}
+	}
+
+	chunk_size = PyObject_GetAttr((PyObject *)self, str_chunk_size);
+	if (chunk_size == NULL)
+		goto error;
+	input_chunk = PyObject_CallMethodObjArgs(self->buffer, str_read1,
+						 chunk_size, NULL);
+	Py_DECREF(chunk_size);
+	if (input_chunk == NULL)
+		goto error;
+	eof = !PyObject_IsTrue(input_chunk);
+
+	decoded = textio_decode(self, self->decoder, input_chunk, eof);
+	if (decoded == NULL) {
+		Py_DECREF(input_chunk);
+		goto error;
+	}
+	textio_set_decoded_chars(self, decoded);
+
+	if (state != NULL) {
+		/* At the snapshot point, len(dec_buffer) bytes before the
+		 * read, the next input to be decoded is dec_buffer +
+		 * input_chunk */
+		PyObject *next_input, *snapshot;
+
+		next_input = PyNumber_Add(dec_buffer, input_chunk);
+		Py_DECREF(input_chunk);
+		if (next_input == NULL)
+			goto error;
+		snapshot = PyTuple_Pack(2, dec_flags, next_input);
+		Py_DECREF(next_input);
+		if (snapshot == NULL)
+			goto error;
+		textio_set(&self->snapshot, snapshot);
+		Py_DECREF(snapshot);
+		Py_DECREF(state);
+	}
+	else
+		Py_DECREF(input_chunk);
+	return !eof;
+
+  error:
+	Py_XDECREF(state);
+	return -1;
+}
+
+static int
+textio_at_eof(TextIOObject *self)
+{
+	Py_INCREF(empty_str);
+	textio_set_decoded_chars(self, empty_str);
+	textio_set(&self->snapshot, Py_None);
+	return 0;
+}
+
+static int
+textio_encodefunc(TextIOObject *self)
+{
+	static const struct {
+		const char *module;
+		int func;
+	} fast[] = {
+		{"encodings.utf_8", ENCODE_UTF8},
+		{"encodings.latin_1", ENCODE_LATIN1},
+		{"encodings.ascii", ENCODE_ASCII},
+		{NULL}
+	};
+	PyObject *module;
+	int i, func = ENCODE_NONE;
+
+	/* Only the stock stateless encoders can be bypassed */
+	module = PyDict_GetItem(Py_TYPE(self->encoder)->tp_dict, str_module);
+	if (module != NULL && PyUnicode_Check(module)) {
+		const char *name = PyUnicode_AsString(module);
+
+		if (name == NULL)
+			return -1;
+		for (i = 0; fast[i].module != NULL; i++)
+			if (strcmp(name, fast[i].module) == 0)
+				func = fast[i].func;
+	}
+	textio_set(&self->checked_encoder, self->encoder);
+	self->encodefunc = func;
+	return 0;
+}
+
+static PyObject *
+textio_encode(TextIOObject *self, PyObject *s)
+{
+	const char *errors = NULL;
+
+	if (self->encoder == NULL || self->encoder == Py_None) {
+		PyObject *encoder;
+
+		encoder = PyObject_CallMethodObjArgs((PyObject *)self,
+						     str_get_encoder, NULL);
+		if (encoder == NULL)
+			return NULL;
+		if (self->encoder == NULL || self->encoder == Py_None)
+			textio_set(&self->encoder, encoder);
+		Py_DECREF(encoder);
+	}
+	if (self->encoder != self->checked_encoder &&
+	    textio_encodefunc(self) < 0)
+		return NULL;
+
+	if (self->encodefunc != ENCODE_NONE && self->errors != NULL &&
+	    PyUnicode_Check(self->errors)) {
+		errors = PyUnicode_AsString(self->errors);
+		if (errors == NULL)
+			return NULL;
+		if (strcmp(errors, "strict") == 0)
+			errors = NULL;
+		switch (self->encodefunc) {
+		case ENCODE_UTF8:
+			return PyUnicode_EncodeUTF8(PyUnicode_AS_UNICODE(s),
+				PyUnicode_GET_SIZE(s), errors);
+		case ENCODE_LATIN1:
+			return PyUnicode_EncodeLatin1(PyUnicode_AS_UNICODE(s),
+				PyUnicode_GET_SIZE(s), errors);
+		case ENCODE_ASCII:
+			return PyUnicode_EncodeASCII(PyUnicode_AS_UNICODE(s),
+				PyUnicode_GET_SIZE(s), errors);
+		}
+	}
+	return PyObject_CallMethodObjArgs(self->encoder, str_encode, s, NULL);
+}
+
+static PyObject *
+textio_write(TextIOObject *self, PyObject *args)
+{
+	PyObject *s, *closed, *b, *res;
+	Py_UNICODE *p, *end;
+	Py_ssize_t length;
+	int translate, line_buffering, haslf = 0, hascr = 0, closedflag;
+
+	TEXTIO_CHECK_INITIALIZED(self)
+	if (!PyArg_ParseTuple(args, "O:write", &s))
+		return NULL;
+	closed = PyObject_GetAttr((PyObject *)self, str_closed);
+	if (closed == NULL)
+		return NULL;
+	closedflag = PyObject_IsTrue(closed);
+	Py_DECREF(closed);
+	if (closedflag < 0)
+		return NULL;
+	if (closedflag) {
+		PyErr_SetString(PyExc_ValueError, "write to closed file");
+		return NULL;
+	}
+	if (!PyUnicode_Check(s)) {
+		PyErr_Format(PyExc_TypeError,
+			     "can't write %.200s to text stream",
+			     Py_TYPE(s)->tp_name);
+		return NULL;
+	}
+
+	length = PyUnicode_GET_SIZE(s);
+	translate = is_true(self->writetranslate);
+	line_buffering = is_true(self->line_buffering);
+	p = PyUnicode_AS_UNICODE(s);
+	end = p + length;
+	if (translate || line_buffering) {
+		for (; p < end; p++) {
+			if (*p == '\n')
+				haslf = 1;
+			else if (*p == '\r')
+				hascr = 1;
+		}
+	}
+
+	Py_INCREF(s);
+	if (haslf && translate && self->writenl != NULL &&
+	    PyUnicode_Check(self->writenl) &&
+	    !(PyUnicode_GET_SIZE(self->writenl) == 1 &&
+	      PyUnicode_AS_UNICODE(self->writenl)[0] == '\n')) {
+		PyObject *replaced = PyUnicode_Replace(s, lf_str,
+						       self->writenl, -1);
+		Py_DECREF(s);
+		if (replaced == NULL)
+			return NULL;
+		s = replaced;
+	}
+
+	b = textio_encode(self, s);
+	Py_DECREF(s);
+	if (b == NULL)
+		return NULL;
+	res = PyObject_CallMethodObjArgs(self->buffer, str_write, b, NULL);
+	Py_DECREF(b);
+	if (res == NULL)
+		return NULL;
+	Py_DECREF(res);
+
+	if (line_buffering && (haslf || hascr)) {
+		res = PyObject_CallMethodObjArgs((PyObject *)self, str_flush,
+						 NULL);
+		if (res == NULL)
+			return NULL;
+		Py_DECREF(res);
+	}
+	textio_set(&self->snapshot, Py_None);
+	if (is_true(self->decoder)) {
+		res = PyObject_CallMethodObjArgs(self->decoder, str_reset,
+						 NULL);
+		if (res == NULL)
+			return NULL;
+		Py_DECREF(res);
+	}
+	return PyLong_FromSsize_t(length);
+}
+
+static PyObject *
+textio_read(TextIOObject *self, PyObject *args)
+{
+	PyObject *nobj = Py_None, *decoder, *result;
+	Py_ssize_t n = -1;
+
+	TEXTIO_CHECK_INITIALIZED(self)
+	if (!PyArg_ParseTuple(args, "|O:read", &nobj))
+		return NULL;
+	if (nobj != Py_None) {
+		n = PyNumber_AsSsize_t(nobj, PyExc_OverflowError);
+		if (n == -1 && PyErr_Occurred())
+			return NULL;
+	}
+	decoder = textio_decoder(self);
+	if (decoder == NULL)
+		return NULL;
+
+	if (n < 0) {
+		/* Read everything */
+		PyObject *rest, *bytes, *decoded;
+
+		rest = textio_get_decoded_chars(self, -1);
+		if (rest == NULL)
+			return NULL;
+		bytes = PyObject_CallMethodObjArgs(self->buffer, str_read,
+						   NULL);
+		if (bytes == NULL) {
+			Py_DECREF(rest);
+			return NULL;
+		}
+		Py_INCREF(decoder);
+		decoded = textio_decode(self, decoder, bytes, 1);
+		Py_DECREF(decoder);
+		Py_DECREF(bytes);
+		if (decoded == NULL) {
+			Py_DECREF(rest);
+			return NULL;
+		}
+		result = PyUnicode_Concat(rest, decoded);
+		Py_DECREF(rest);
+		Py_DECREF(decoded);
+		if (result != NULL)
+			textio_at_eof(self);
+		return result;
+	}
+
+	/* Keep reading chunks until we have n characters to return */
+	result = textio_get_decoded_chars(self, n);
+	while (result != NULL && PyUnicode_GET_SIZE(result) < n) {
+		PyObject *more, *joined;
+		int r = textio_read_chunk(self);
+
+		if (r < 0) {
+			Py_DECREF(result);
+			return NULL;
+		}
+		more = textio_get_decoded_chars(self,
+			n - PyUnicode_GET_SIZE(result));
+		if (more == NULL) {
+			Py_DECREF(result);
+			return NULL;
+		}
+		joined = PyUnicode_Concat(result, more);
+		Py_DECREF(result);
+		Py_DECREF(more);
+		result = joined;
+		if (r == 0)
+			break;
+	}
+	return result;
+}
+
+/* Returns the index just past the first line ending in s[0:len], or -1 */
+static Py_ssize_t
+textio_find_line_ending(TextIOObject *self, int translated, int universal,
+			Py_UNICODE *s, Py_ssize_t len)
+{
+	Py_ssize_t i;
+
+	if (translated) {
+		/* Newlines are already translated, only search for \n */
+		for (i = 0; i < len; i++)
+			if (s[i] == '\n')
+				return i + 1;
+	}
+	else if (universal) {
+		/* Any of \r, \r\n, \n.  The decoder makes sure \r\n isn't
+		 * split in two. */
+		for (i = 0; i < len; i++) {
+			if (s[i] == '\n')
+				return i + 1;
+			if (s[i] == '\r')
+				return i + 1 < len && s[i + 1] == '\n' ?
+					i + 2 : i + 1;
+		}
+	}
+	else {
+		Py_UNICODE *nl = PyUnicode_AS_UNICODE(self->readnl);
+		Py_ssize_t nllen = PyUnicode_GET_SIZE(self->readnl);
+
+		for (i = 0; i + nllen <= len; i++)
+			if (s[i] == nl[0] && (nllen == 1 || s[i + 1] == nl[1]))
+				return i + nllen;
+	}
+	return -1;
+}
+
+static PyObject *
+textio_readline_internal(TextIOObject *self, Py_ssize_t limit)
+{
+	PyObject *chunks = NULL, *line;
+	Py_ssize_t total = 0;
+	int translated, universal, crpending = 0;
+
+	if (textio_decoder(self) == NULL)
+		return NULL;
+	translated = is_true(self->readtranslate);
+	universal = is_true(self->readuniversal);
+	if (!translated && !universal &&
+	    (self->readnl == NULL || !PyUnicode_Check(self->readnl) ||
+	     PyUnicode_GET_SIZE(self->readnl) == 0 ||
+	     PyUnicode_GET_SIZE(self->readnl) > 2)) {
+		PyErr_SetString(PyExc_ValueError, "bad readnl");
+		return NULL;
+	}
+
+	while (1) {
+		Py_UNICODE *s;
+		Py_ssize_t len, endpos = -1;
+		int r;
+
+		if (textio_pending(self, &s, &len) < 0)
+			goto error;
+		if (len > 0) {
+			if (crpending && s[0] == PyUnicode_AS_UNICODE(
+					self->readnl)[1])
+				/* The rest of a \r\n split between chunks */
+				endpos = 1;
+			else
+				endpos = textio_find_line_ending(self,
+					translated, universal, s, len);
+			if (limit >= 0 &&
+			    (endpos < 0 ? len : endpos) >= limit - total)
+				endpos = limit - total;
+			line = textio_get_decoded_chars(self,
+				endpos < 0 ? len : endpos);
+			if (line == NULL)
+				goto error;
+			if (endpos >= 0 && chunks == NULL)
+				return line;
+			if (chunks == NULL && (chunks = PyList_New(0)) == NULL) {
+				Py_DECREF(line);
+				goto error;
+			}
+			r = PyList_Append(chunks, line);
+			Py_DECREF(line);
+			if (r < 0)
+				goto error;
+			if (endpos >= 0)
+				break;
+			total += len;
+			crpending = !translated && !universal &&
+				PyUnicode_GET_SIZE(self->readnl) == 2 &&
+				s[len - 1] == PyUnicode_AS_UNICODE(
+					self->readnl)[0];
+		}
+		if (limit >= 0 && total >= limit)
+			break;
+
+		/* No line ending seen yet - get more data */
+		while ((r = textio_read_chunk(self)) > 0) {
+			if (textio_pending(self, &s, &len) < 0)
+				goto error;
+			if (len > 0)
+				break;
+		}
+		if (r < 0 || textio_pending(self, &s, &len) < 0)
+			goto error;
+		if (len == 0) {
+			textio_at_eof(self);
+			break;
+		}
+	}
+
+	if (chunks == NULL) {
+		Py_INCREF(empty_str);
+		return empty_str;
+	}
+	line = PyUnicode_Join(empty_str, chunks);
+	Py_DECREF(chunks);
+	return line;
+
+  error:
+	Py_XDECREF(chunks);
+	return NULL;
+}
+
+static PyObject *
+textio_readline(TextIOObject *self, PyObject *args)
+{
+	PyObject *limitobj = Py_None;
+	Py_ssize_t limit = -1;
+
+	TEXTIO_CHECK_INITIALIZED(self)
+	if (!PyArg_ParseTuple(args, "|O:readline", &limitobj))
+		return NULL;
+	if (limitobj != Py_None) {
+		limit = PyNumber_AsSsize_t(limitobj, PyExc_OverflowError);
+		if (limit == -1 && PyErr_Occurred())
+			return NULL;
+	}
+	return textio_readline_internal(self, limit);
+}
+
+static PyObject *
+textio_iternext(TextIOObject *self)
+{
+	PyObject *line;
+
+	TEXTIO_CHECK_INITIALIZED(self)
+	textio_set(&self->telling, Py_False);
+	line = textio_readline_internal(self, -1);
+	if (line != NULL && PyUnicode_Check(line) &&
+	    PyUnicode_GET_SIZE(line) == 0) {
+		Py_DECREF(line);
+		textio_set(&self->snapshot, Py_None);
+		textio_set(&self->telling,
+			   self->seekable ? self->seekable : Py_False);
+		return NULL;
+	}
+	return line;
+}
+
+PyDoc_STRVAR(textio_write_doc,
+"write(s) -> int.  Encode s and write it to the buffer.");
+
+PyDoc_STRVAR(textio_read_doc,
+"read([n]) -> str.  Read up to n characters, or to EOF if n is omitted.");
+
+PyDoc_STRVAR(textio_readline_doc,
+"readline([limit]) -> str.  Read up to and including the next newline.");
+
+static PyMethodDef textio_methods[] = {
+	{"write",    (PyCFunction)textio_write, METH_VARARGS,
+	 textio_write_doc},
+	{"read",     (PyCFunction)textio_read, METH_VARARGS, textio_read_doc},
+	{"readline", (PyCFunction)textio_readline, METH_VARARGS,
+	 textio_readline_doc},
+	{NULL,	     NULL}		/* sentinel */
+};
+
+static PyMemberDef textio_members[] = {
+	{"buffer", T_OBJECT, offsetof(TextIOObject, buffer), 0},
+	{"_line_buffering", T_OBJECT,
+	 offsetof(TextIOObject, line_buffering), 0},
+	{"_encoding", T_OBJECT, offsetof(TextIOObject, encoding), 0},
+	{"_errors", T_OBJECT, offsetof(TextIOObject, errors), 0},
+	{"_readuniversal", T_OBJECT, offsetof(TextIOObject, readuniversal), 0},
+	{"_readtranslate", T_OBJECT, offsetof(TextIOObject, readtranslate), 0},
+	{"_readnl", T_OBJECT, offsetof(TextIOObject, readnl), 0},
+	{"_writetranslate", T_OBJECT,
+	 offsetof(TextIOObject, writetranslate), 0},
+	{"_writenl", T_OBJECT, offsetof(TextIOObject, writenl), 0},
+	{"_encoder", T_OBJECT, offsetof(TextIOObject, encoder), 0},
+	{"_decoder", T_OBJECT, offsetof(TextIOObject, decoder), 0},
+	{"_decoded_chars", T_OBJECT, offsetof(TextIOObject, decoded_chars), 0},
+	{"_decoded_chars_used", T_PYSSIZET,
+	 offsetof(TextIOObject, decoded_chars_used), 0},
+	{"_snapshot", T_OBJECT, offsetof(TextIOObject, snapshot), 0},
+	{"_seekable", T_OBJECT, offsetof(TextIOObject, seekable), 0},
+	{"_telling", T_OBJECT, offsetof(TextIOObject, telling), 0},
+	{NULL}
+};
+
+PyDoc_STRVAR(textio_doc,
+"Fast read(), readline(), iteration and write() for io.TextIOWrapper");
+
+static PyTypeObject TextIO_Type = {
+	PyVarObject_HEAD_INIT(&PyType_Type, 0)
+	"_TextIOWrapper",
+	sizeof(TextIOObject),
+	0,
+	(destructor)textio_dealloc,		/* tp_dealloc */
+	0,					/* tp_print */
+	0,					/* tp_getattr */
+	0,					/* tp_setattr */
+	0,					/* tp_compare */
+	0,					/* tp_repr */
+	0,					/* tp_as_number */
+	0,					/* tp_as_sequence */
+	0,					/* tp_as_mapping */
+	0,					/* tp_hash */
+	0,					/* tp_call */
+	0,					/* tp_str */
+	PyObject_GenericGetAttr,		/* tp_getattro */
+	0,					/* tp_setattro */
+	0,					/* tp_as_buffer */
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE |
+		Py_TPFLAGS_HAVE_GC,		/* tp_flags */
+	textio_doc,				/* tp_doc */
+	(traverseproc)textio_traverse,		/* tp_traverse */
+	(inquiry)textio_clear,			/* tp_clear */
+	0,					/* tp_richcompare */
+	offsetof(TextIOObject, weakreflist),	/* tp_weaklistoffset */
+	0,					/* tp_iter */
+	(iternextfunc)textio_iternext,		/* tp_iternext */
+	textio_methods,				/* tp_methods */
+	textio_members,				/* tp_members */
+	0,					/* tp_getset */
+	0,					/* tp_base */
+	0,					/* tp_dict */
+	0,					/* tp_descr_get */
+	0,					/* tp_descr_set */
+	0,					/* tp_dictoffset */
+	0,					/* tp_init */
+	textio_new,				/* tp_new */
+};
+
+
+static PyMethodDef module_methods[] = {
+	{NULL, NULL}
+};
+
+static int
+intern_strings(void)
+{
+#define INTERN(var, s) \
+	if ((var = PyUnicode_InternFromString(s)) == NULL) \
+		return -1;
+	INTERN(str_closed, "closed")
+	INTERN(str_read, "read")
+	INTERN(str_read1, "read1")
+	INTERN(str_write, "write")
+	INTERN(str_seek, "seek")
+	INTERN(str_tell, "tell")
+	INTERN(str_flush, "flush")
+	INTERN(str_decode, "decode")
+	INTERN(str_getstate, "getstate")
+	INTERN(str_setstate, "setstate")
+	INTERN(str_reset, "reset")
+	INTERN(str_encode, "encode")
+	INTERN(str_chunk_size, "_CHUNK_SIZE")
+	INTERN(str_get_encoder, "_get_encoder")
+	INTERN(str_get_decoder, "_get_decoder")
+	INTERN(str_module, "__module__")
+	INTERN(empty_str, "")
+	INTERN(lf_str, "\n")
+#undef INTERN
+	empty_bytes = PyString_FromStringAndSize(NULL, 0);
+	cr_bytes = PyString_FromStringAndSize("\r", 1);
+	if (empty_bytes == NULL || cr_bytes == NULL)
+		return -1;
+	return 0;
+}
+
+PyMODINIT_FUNC
+init_bufferedio(void)
+{
+	PyObject *m;	/* a module object */
+
+	m = Py_InitModule3("_bufferedio", module_methods,
+			   "Fast implementation of io's buffered and text layers.");
+	if (m == NULL)
+		return;
+	if (intern_strings() < 0)
+		return;
+	if (PyType_Ready(&BufferedReader_Type) < 0 ||
+	    PyType_Ready(&BufferedWriter_Type) < 0 ||
+	    PyType_Ready(&BufferedRandom_Type) < 0 ||
+	    PyType_Ready(&NLDecoder_Type) < 0 ||
+	    PyType_Ready(&TextIO_Type) < 0)
+		return;
+	Py_INCREF(&BufferedReader_Type);
+	PyModule_AddObject(m, "_BufferedReader",
+			   (PyObject *) &BufferedReader_Type);
+	Py_INCREF(&BufferedWriter_Type);
+	PyModule_AddObject(m, "_BufferedWriter",
+			   (PyObject *) &BufferedWriter_Type);
+	Py_INCREF(&BufferedRandom_Type);
+	PyModule_AddObject(m, "_BufferedRandom",
+			   (PyObject *) &BufferedRandom_Type);
+	Py_INCREF(&NLDecoder_Type);
+	PyModule_AddObject(m, "_IncrementalNewlineDecoder",
+			   (PyObject *) &NLDecoder_Type);
+	Py_INCREF(&TextIO_Type);
+	PyModule_AddObject(m, "_TextIOWrapper", (PyObject *) &TextIO_Type);
+}
@@ -9,6 +9,12 @@
 #include <fcntl.h>
 #include <stddef.h> /* For offsetof */
 #include <poll.h> /* For poll stuff */
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
 
 /*
  * Known likely problems:
@@ -30,6 +36,10 @@
 #include <windows.h>
 #endif
 
+#if defined(HAVE_PREAD) && defined(HAVE_PWRITE)
+#define HAVE_SUBMIT
+#endif
+
 typedef struct {
 	PyObject_HEAD
 	int fd;
@@ -37,7 +47,12 @@ typedef struct {
 	unsigned writable : 1;
 	int seekable : 2; /* -1 means unknown */
 	int closefd : 1;
+	unsigned uring_unavailable : 1;
 	PyObject *weakreflist;
+	/* For submit_read(), submit_write() and wait_completions() */
+	struct fileio_uring *uring;	/* Set up by the first submit */
+	PyObject *completed;		/* [(tag, result), ...] */
+	PY_LONG_LONG next_tag;
 } PyFileIOObject;
 
 PyTypeObject PyFileIO_Type;
@@ -49,96 +64,34 @@ PyTypeObject PyFileIO_Type;
 #define POLL_WRITE 2
 #define POLL_ANY 3
 
-/* XXX FIXME clean up the Cancel API and delete this. */
-typedef struct {
-	int fd;
-	int cancelled;
-} blewed_up;
-
-static void
-poll_wakeup(PyCancelQueue *queue, void *arg)
-{
-	blewed_up *bu = arg;
-	bu->cancelled = 1;
-	if (write(bu->fd, "x", 1) != 1)
-		Py_FatalError("Writing to I/O wakeup pipe failed");
-}
-
+/* Returns 1 with an exception set if cancelled or on error */
 static int
 poll_single_fd(int fd, int mode)
 {
-	int fds[2];
-	PyCancelObject *cancel_scope;
-	struct pollfd events[2];
-	int status;
-	blewed_up bu;
+	short events = 0;
 
 	assert(!(mode & ~POLL_ANY));
 
-	if (pipe(fds)) {
-		PyErr_SetFromErrno(PyExc_IOError);
-		return 1;
-	}
-
-	bu.fd = fds[1];
-	bu.cancelled = 0;
-
-	cancel_scope = PyCancel_New(poll_wakeup, &bu, PyState_Get());
-	if (cancel_scope == NULL) {
-		close(fds[0]); /* XXX FIXME error handling */
-		close(fds[1]);
-		return 1;
-	}
-
-	events[0].fd = fd;
-	events[0].events = 0;
 	if (mode & POLL_READ)
-		events[0].events |= POLLIN;
+		events |= POLLIN;
 	if (mode & POLL_WRITE)
-		events[0].events |= POLLOUT;
-
-	events[1].fd = fds[0];
-	events[1].events = POLLIN;
-
-	PyCancel_Push(cancel_scope);
-	Py_BEGIN_ALLOW_THREADS
-
-	status = poll(events, 2, -1);
-
-	Py_END_ALLOW_THREADS
-	PyCancel_Pop(cancel_scope);
+		events |= POLLOUT;
 
-	if (status == 0)
-		Py_FatalError("I/O wakeup poll somehow returned 0");
-
-	//if (status == -1 || events[1].revents & (POLLIN|POLLHUP)) {
-	if (bu.cancelled) {
-		char buf[1];
-		/* Reset pipe for next usage */
-		/* XXX doesn't matter yet */
-		if (read(fds[0], buf, 1) != 1)
-			Py_FatalError("Resetting I/O wakeup pipe failed");
-	}
-
-	close(fds[0]); /* XXX FIXME error handling */
-	close(fds[1]);
-
-	if (bu.cancelled) {
-		PyErr_SetString(PyExc_Cancelled,
-			"I/O operation cancelled by parent");
-		Py_DECREF(cancel_scope);
-		return 1;
-	}
-
-	Py_DECREF(cancel_scope);
-	return 0;
+	return PyCancel_Poll(fd, events) < 0;
 }
 
+#ifdef HAVE_SUBMIT
+static void async_close(PyFileIOObject *self);
+#endif
+
 /* Returns 0 on success, errno (which is < 0) on failure. */
 static int
 internal_close(PyFileIOObject *self)
 {
 	int save_errno = 0;
+#ifdef HAVE_SUBMIT
+	async_close(self);
+#endif
 	if (self->fd >= 0) {
 		int fd = self->fd;
 		self->fd = -1;
@@ -182,7 +135,11 @@ fileio_new(PyTypeObject *type, PyObject *args, PyObject *kews)
 	self = PyObject_New(type);
 	if (self != NULL) {
 		self->fd = -1;
+		self->uring_unavailable = 0;
 		self->weakreflist = NULL;
+		self->uring = NULL;
+		self->completed = NULL;
+		self->next_tag = 0;
 	}
 
 	return (PyObject *) self;
@@ -390,6 +347,10 @@ fileio_dealloc(PyFileIOObject *self)
                                           errno, strerror(errno));
 		}
 	}
+#ifdef HAVE_SUBMIT
+	/* Still needed if we didn't own the fd */
+	async_close(self);
+#endif
 
 	PyObject_Del(self);
 }
@@ -616,6 +577,418 @@ fileio_write(PyFileIOObject *self, PyObject *args)
 	return PyLong_FromSsize_t(n);
 }
 
+#ifdef HAVE_SUBMIT
+
+/* Asynchronous I/O.  submit_read() and submit_write() start a pread or
+ * pwrite and return a tag for it straight away; wait_completions() hands
+ * back (tag, result) pairs as they finish.
+ *
+ * With io_uring each file gets a ring of its own on its first submit, and
+ * up to URING_DEPTH operations can be in flight.  Waiting polls the ring's
+ * fd like any other blocking read here, so it can be cancelled; anything
+ * still in flight stays in flight, and a later wait reports it.  Without
+ * io_uring (an old kernel, or one that forbids it) each operation is done
+ * synchronously when it's submitted, and the results are the same. */
+
+static int
+async_complete(PyFileIOObject *self, PY_LONG_LONG tag, Py_ssize_t res)
+{
+	PyObject *result, *pair;
+	int err;
+
+	if (self->completed == NULL &&
+	    (self->completed = PyList_New(0)) == NULL)
+		return -1;
+	/* A failure is reported as an exception object for its tag */
+	if (res >= 0)
+		result = PyLong_FromSsize_t(res);
+	else
+		result = PyObject_CallFunction(PyExc_IOError, "is",
+					       (int)-res, strerror((int)-res));
+	if (result == NULL)
+		return -1;
+	pair = Py_BuildValue("(LN)", tag, result);
+	if (pair == NULL)
+		return -1;
+	err = PyList_Append(self->completed, pair);
+	Py_DECREF(pair);
+	return err;
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#define URING_DEPTH 64
+/* user_data of our cancel requests, which report nothing */
+#define URING_CANCEL URING_DEPTH
+
+typedef struct {
+	PyObject *obj;		/* NULL if free; kept alive for the kernel */
+	Py_buffer view;
+	struct iovec iov;
+	PY_LONG_LONG tag;
+} uring_slot;
+
+struct fileio_uring {
+	int fd;
+	volatile unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	volatile unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_map, *cq_map;
+	size_t sq_map_size, cq_map_size, sqes_size;
+	int inflight;
+	int nfree;
+	int free[URING_DEPTH];		/* Stack of free slots */
+	uring_slot slots[URING_DEPTH];
+};
+
+static int
+uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+	    unsigned flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+		       flags, NULL, 0);
+}
+
+/* Returns 1 if there's a ring now, or 0 if io_uring isn't available */
+static int
+uring_setup(PyFileIOObject *self)
+{
+	struct io_uring_params p;
+	struct fileio_uring *u;
+	int i;
+
+	u = PyMem_Malloc(sizeof(*u));
+	if (u == NULL) {
+		PyErr_NoMemory();
+		return -1;
+	}
+	memset(&p, 0, sizeof(p));
+	u->fd = syscall(__NR_io_uring_setup, URING_DEPTH, &p);
+	if (u->fd < 0)
+		goto unavailable;
+
+	u->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_map_size = p.cq_off.cqes +
+			 p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_map_size > u->sq_map_size)
+			u->sq_map_size = u->cq_map_size;
+		u->cq_map_size = 0;
+	}
+	u->sq_map = mmap(NULL, u->sq_map_size, PROT_READ | PROT_WRITE,
+			 MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_map == MAP_FAILED)
+		goto close_ring;
+	u->cq_map = u->sq_map;
+	if (u->cq_map_size) {
+		u->cq_map = mmap(NULL, u->cq_map_size, PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_POPULATE, u->fd,
+				 IORING_OFF_CQ_RING);
+		if (u->cq_map == MAP_FAILED)
+			goto unmap_sq;
+	}
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED)
+		goto unmap_cq;
+
+	u->sq_head = (unsigned *)((char *)u->sq_map + p.sq_off.head);
+	u->sq_tail = (unsigned *)((char *)u->sq_map + p.sq_off.tail);
+	u->sq_mask = (unsigned *)((char *)u->sq_map + p.sq_off.ring_mask);
+	u->sq_array = (unsigned *)((char *)u->sq_map + p.sq_off.array);
+	u->cq_head = (unsigned *)((char *)u->cq_map + p.cq_off.head);
+	u->cq_tail = (unsigned *)((char *)u->cq_map + p.cq_off.tail);
+	u->cq_mask = (unsigned *)((char *)u->cq_map + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)((char *)u->cq_map + p.cq_off.cqes);
+	u->inflight = 0;
+	for (i = 0; i < URING_DEPTH; i++) {
+		u->slots[i].obj = NULL;
+		u->free[i] = URING_DEPTH - 1 - i;
+	}
+	u->nfree = URING_DEPTH;
+	self->uring = u;
+	return 1;
+
+  unmap_cq:
+	if (u->cq_map_size)
+		munmap(u->cq_map, u->cq_map_size);
+  unmap_sq:
+	munmap(u->sq_map, u->sq_map_size);
+  close_ring:
+	close(u->fd);
+  unavailable:
+	PyMem_Free(u);
+	self->uring_unavailable = 1;
+	return 0;
+}
+
+/* Queues an operation, returning -1 with errno set if the kernel won't
+ * take it */
+static int
+uring_push(struct fileio_uring *u, int fd, int opcode, PY_LONG_LONG offset,
+	   unsigned long long addr, unsigned len, unsigned long long data)
+{
+	unsigned tail = *u->sq_tail, index = tail & *u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[index];
+	int res;
+
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->off = offset;
+	sqe->addr = addr;
+	sqe->len = len;
+	sqe->user_data = data;
+	u->sq_array[index] = index;
+	/* The kernel must see the entry before the new tail */
+	AO_nop_full();
+	*u->sq_tail = tail + 1;
+
+	do {
+		res = uring_enter(u->fd, 1, 0, 0);
+	} while (res < 0 && errno == EINTR);
+	if (res < 0 && *u->sq_head == tail) {
+		/* Never taken, so take it back */
+		*u->sq_tail = tail;
+		return -1;
+	}
+	return 0;
+}
+
+/* Moves what's finished into self->completed.  Everything finished is
+ * released even if reporting some of it fails. */
+static int
+uring_reap(PyFileIOObject *self, struct fileio_uring *u, int report)
+{
+	unsigned head = *u->cq_head, tail;
+	int err = 0;
+
+	tail = *u->cq_tail;
+	/* Don't read the entries before the tail that covers them */
+	AO_nop_full();
+	while (head != tail) {
+		struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+		uring_slot *slot;
+
+		head++;
+		if (cqe->user_data >= URING_DEPTH)
+			continue;
+		slot = &u->slots[cqe->user_data];
+		if (report && err == 0 &&
+		    async_complete(self, slot->tag, cqe->res) < 0)
+			err = -1;
+		PyObject_ReleaseBuffer(slot->obj, &slot->view);
+		Py_CLEAR(slot->obj);
+		u->free[u->nfree++] = (int)cqe->user_data;
+		u->inflight--;
+	}
+	/* Nor let the kernel reuse them before we're done */
+	AO_nop_full();
+	*u->cq_head = head;
+	return err;
+}
+
+static int
+uring_submit(PyFileIOObject *self, PyObject *obj, Py_buffer *view,
+	     PY_LONG_LONG offset, int writing, PY_LONG_LONG tag)
+{
+	struct fileio_uring *u = self->uring;
+	uring_slot *slot;
+	int index;
+
+	/* Make room by waiting for something to finish */
+	if (uring_reap(self, u, 1) < 0)
+		return -1;
+	while (u->nfree == 0) {
+		if (poll_single_fd(u->fd, POLL_READ))
+			return -1;
+		if (uring_reap(self, u, 1) < 0)
+			return -1;
+	}
+
+	index = u->free[u->nfree - 1];
+	slot = &u->slots[index];
+	slot->iov.iov_base = view->buf;
+	slot->iov.iov_len = view->len;
+	if (uring_push(u, self->fd, writing ? IORING_OP_WRITEV :
+		       IORING_OP_READV, offset, (unsigned long)&slot->iov, 1,
+		       index) < 0) {
+		PyErr_SetFromErrno(PyExc_IOError);
+		return -1;
+	}
+	u->nfree--;
+	u->inflight++;
+	Py_INCREF(obj);
+	slot->obj = obj;
+	slot->view = *view;
+	slot->tag = tag;
+	return 0;
+}
+
+static void
+uring_close(PyFileIOObject *self)
+{
+	struct fileio_uring *u = self->uring;
+	int i;
+
+	if (u == NULL)
+		return;
+	self->uring = NULL;
+
+	/* The kernel may still be using the buffers, so cancel what's in
+	 * flight and wait for it all to finish before releasing them */
+	for (i = 0; i < URING_DEPTH; i++)
+		if (u->slots[i].obj != NULL)
+			uring_push(u, -1, IORING_OP_ASYNC_CANCEL, 0, i, 0,
+				   URING_CANCEL);
+	while (u->inflight > 0) {
+		int res;
+
+		/* We may be called from tp_dealloc, which does not allow
+		 * suspending.  Cancelled operations finish quickly. */
+		PyState_MaybeSuspend();
+		res = uring_enter(u->fd, 0, 1, IORING_ENTER_GETEVENTS);
+		PyState_MaybeResume();
+		if (res < 0 && errno != EINTR)
+			/* Leak the buffers rather than free them under the
+			 * kernel */
+			break;
+		uring_reap(self, u, 0);
+	}
+
+	munmap(u->sqes, u->sqes_size);
+	if (u->cq_map_size)
+		munmap(u->cq_map, u->cq_map_size);
+	munmap(u->sq_map, u->sq_map_size);
+	close(u->fd);
+	PyMem_Free(u);
+}
+
+#endif /* HAVE_LINUX_IO_URING_H */
+
+/* Drops anything in flight, and anything finished but not yet waited for */
+static void
+async_close(PyFileIOObject *self)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+	uring_close(self);
+#endif
+	Py_CLEAR(self->completed);
+}
+
+static PyObject *
+fileio_submit(PyFileIOObject *self, PyObject *args, int writing)
+{
+	PyObject *obj;
+	Py_buffer view;
+	PY_LONG_LONG offset, tag;
+	Py_ssize_t n;
+
+	if (self->fd < 0)
+		return err_closed();
+	if (writing ? !self->writable : !self->readable)
+		return err_mode(writing ? "writing" : "reading");
+
+	if (!PyArg_ParseTuple(args, writing ? "LO:submit_write" :
+			      "LO:submit_read", &offset, &obj))
+		return NULL;
+	if (offset < 0) {
+		PyErr_SetString(PyExc_ValueError, "negative offset");
+		return NULL;
+	}
+	if (PyUnicode_Check(obj)) {
+		PyErr_SetString(PyExc_TypeError,
+				"can't use str as a binary buffer");
+		return NULL;
+	}
+	if (PyObject_GetBuffer(obj, &view,
+			       writing ? PyBUF_SIMPLE : PyBUF_WRITABLE) < 0)
+		return NULL;
+	tag = self->next_tag++;
+
+#ifdef HAVE_LINUX_IO_URING_H
+	if (self->uring == NULL && !self->uring_unavailable &&
+	    uring_setup(self) < 0)
+		goto error;
+	if (self->uring != NULL) {
+		/* The slot takes over the view */
+		if (uring_submit(self, obj, &view, offset, writing, tag) < 0)
+			goto error;
+		return PyLong_FromLongLong(tag);
+	}
+#endif
+
+	if (poll_single_fd(self->fd, writing ? POLL_WRITE : POLL_READ))
+		goto error;
+	errno = 0;
+	if (writing)
+		n = pwrite(self->fd, view.buf, view.len, (off_t)offset);
+	else
+		n = pread(self->fd, view.buf, view.len, (off_t)offset);
+	if (n < 0)
+		n = -errno;
+	PyObject_ReleaseBuffer(obj, &view);
+	if (async_complete(self, tag, n) < 0)
+		return NULL;
+	return PyLong_FromLongLong(tag);
+
+  error:
+	PyObject_ReleaseBuffer(obj, &view);
+	return NULL;
+}
+
+static PyObject *
+fileio_submit_read(PyFileIOObject *self, PyObject *args)
+{
+	return fileio_submit(self, args, 0);
+}
+
+static PyObject *
+fileio_submit_write(PyFileIOObject *self, PyObject *args)
+{
+	return fileio_submit(self, args, 1);
+}
+
+static PyObject *
+fileio_wait_completions(PyFileIOObject *self, PyObject *args)
+{
+	Py_ssize_t min_complete = 1;
+	PyObject *res;
+
+	if (self->fd < 0)
+		return err_closed();
+	if (!PyArg_ParseTuple(args, "|n:wait_completions", &min_complete))
+		return NULL;
+
+#ifdef HAVE_LINUX_IO_URING_H
+	if (self->uring != NULL) {
+		struct fileio_uring *u = self->uring;
+
+		if (uring_reap(self, u, 1) < 0)
+			return NULL;
+		/* Can't wait for more than is in flight */
+		while (u->inflight > 0 &&
+		       (self->completed == NULL ||
+			PyList_GET_SIZE(self->completed) < min_complete)) {
+			if (poll_single_fd(u->fd, POLL_READ))
+				return NULL;
+			if (uring_reap(self, u, 1) < 0)
+				return NULL;
+		}
+	}
+#endif
+
+	res = self->completed;
+	if (res == NULL)
+		return PyList_New(0);
+	self->completed = NULL;
+	return res;
+}
+
+#endif /* HAVE_SUBMIT */
+
 /* XXX Windows support below is likely incomplete */
 
 #if defined(MS_WIN64) || defined(MS_WINDOWS)
@@ -871,6 +1244,28 @@ PyDoc_STRVAR(write_doc,
 "Only makes one system call, so not all of the data may be written.\n"
 "The number of bytes actually written is returned.");
 
+#ifdef HAVE_SUBMIT
+PyDoc_STRVAR(submit_read_doc,
+"submit_read(offset: int, buf) -> int.  Start reading into buf at offset.\n"
+"\n"
+"Returns a tag; wait_completions() reports the number of bytes read.\n"
+"buf must not be resized or reused until then.");
+
+PyDoc_STRVAR(submit_write_doc,
+"submit_write(offset: int, b) -> int.  Start writing b at offset.\n"
+"\n"
+"Returns a tag; wait_completions() reports the number of bytes written.\n"
+"b must not be changed until then.");
+
+PyDoc_STRVAR(wait_completions_doc,
+"wait_completions([min_complete: int]) -> list.  Wait for submitted I/O.\n"
+"\n"
+"Waits until at least min_complete (default 1) operations have finished,\n"
+"or all of them, and returns a (tag, result) pair for each one finished\n"
+"since the last call.  result is a byte count, or an IOError instance if\n"
+"the operation failed.  Closing the file cancels what's in flight.");
+#endif
+
 PyDoc_STRVAR(fileno_doc,
 "fileno() -> int. \"file descriptor\".\n"
 "\n"
@@ -923,6 +1318,14 @@ static PyMethodDef fileio_methods[] = {
 	{"readall",  (PyCFunction)fileio_readall,  METH_NOARGS,  readall_doc},
 	{"readinto", (PyCFunction)fileio_readinto, METH_VARARGS, readinto_doc},
 	{"write",    (PyCFunction)fileio_write,	   METH_VARARGS, write_doc},
+#ifdef HAVE_SUBMIT
+	{"submit_read", (PyCFunction)fileio_submit_read, METH_VARARGS,
+	 submit_read_doc},
+	{"submit_write", (PyCFunction)fileio_submit_write, METH_VARARGS,
+	 submit_write_doc},
+	{"wait_completions", (PyCFunction)fileio_wait_completions,
+	 METH_VARARGS, wait_completions_doc},
+#endif
 	{"seek",     (PyCFunction)fileio_seek,	   METH_VARARGS, seek_doc},
 	{"tell",     (PyCFunction)fileio_tell,	   METH_VARARGS, tell_doc},
 #ifdef HAVE_FTRUNCATE
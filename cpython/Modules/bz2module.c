@@ -1920,11 +1920,198 @@ bz2_compress(PyObject *self, PyObject *args, PyObject *kwargs)
 	return ret;
 }
 
+/* compress_parallel() cuts the input into pieces of one bzip2 block each
+   and compresses them on several threads at once, the way pbzip2 does.
+   Each piece becomes a stream of its own, and the streams are concatenated;
+   bunzip2 and decompress() read them back as one.  The worker threads only
+   touch the input buffer and memory of their own, never Python objects. */
+
+#include "workerpool.h"
+
+typedef struct {
+	char *out;
+	unsigned int outlen;
+	int bzerror;		/* BZ_OK, or what went wrong */
+} bz2_piece;
+
+typedef struct {
+	char *data;
+	Py_ssize_t length;
+	Py_ssize_t piecesize;
+	Py_ssize_t npieces;
+	int compresslevel;
+	bz2_piece *pieces;
+	workerpool pool;
+} bz2_job;
+
+static void
+bz2_compress_piece(bz2_job *job, Py_ssize_t i)
+{
+	bz2_piece *p = &job->pieces[i];
+	char *start = job->data + i * job->piecesize;
+	unsigned int len, size;
+	bz_stream bzs;
+	int bzerror;
+
+	len = (unsigned int)(i == job->npieces - 1 ?
+			     job->length - i * job->piecesize :
+			     job->piecesize);
+	/* Same bound as compress() */
+	size = len + (len/100+1) + 600;
+	p->out = malloc(size);
+	if (p->out == NULL) {
+		p->bzerror = BZ_MEM_ERROR;
+		return;
+	}
+
+	memset(&bzs, 0, sizeof(bz_stream));
+	bzerror = BZ2_bzCompressInit(&bzs, job->compresslevel, 0, 0);
+	if (bzerror != BZ_OK) {
+		p->bzerror = bzerror;
+		return;
+	}
+	bzs.next_in = start;
+	bzs.avail_in = len;
+	bzs.next_out = p->out;
+	bzs.avail_out = size;
+	for (;;) {
+		char *out;
+
+		bzerror = BZ2_bzCompress(&bzs, BZ_FINISH);
+		if (bzerror != BZ_FINISH_OK)
+			break;
+		/* Out of room after all */
+		out = realloc(p->out, size * 2);
+		if (out == NULL) {
+			bzerror = BZ_MEM_ERROR;
+			break;
+		}
+		p->out = out;
+		bzs.next_out = out + size;
+		bzs.avail_out = size;
+		size *= 2;
+	}
+	if (bzerror == BZ_STREAM_END) {
+		p->outlen = size - bzs.avail_out;
+		bzerror = BZ_OK;
+	}
+	BZ2_bzCompressEnd(&bzs);
+	p->bzerror = bzerror;
+}
+
+static void
+bz2_worker(void *arg)
+{
+	bz2_job *job = arg;
+	Py_ssize_t i;
+	int failed = 0;
+
+	while (workerpool_take(&job->pool, failed, 1, &i) > 0) {
+		bz2_compress_piece(job, i);
+		failed = job->pieces[i].bzerror != BZ_OK;
+	}
+}
+
+PyDoc_STRVAR(bz2_compress_parallel__doc__,
+"compress_parallel(data [, compresslevel=9 [, threads]]) -> string\n\
+\n\
+Compress data in one shot, like compress(), using several threads. The\n\
+result is a concatenation of bzip2 streams of one block each, which\n\
+decompress() and bunzip2 read back whole. The threads parameter, if given,\n\
+is how many threads to use; by default there's one per CPU.\n\
+");
+
+static PyObject *
+bz2_compress_parallel(PyObject *self, PyObject *args, PyObject *kwargs)
+{
+	PyObject *obj, *ret = NULL;
+	Py_buffer view;
+	bz2_job job;
+	Py_ssize_t i, total;
+	int threads = 0;
+	static char *kwlist[] = {"data", "compresslevel", "threads", 0};
+
+	memset(&job, 0, sizeof(job));
+	job.compresslevel = 9;
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|ii",
+					 kwlist, &obj, &job.compresslevel,
+					 &threads))
+		return NULL;
+
+	if (job.compresslevel < 1 || job.compresslevel > 9) {
+		PyErr_SetString(PyExc_ValueError,
+				"compresslevel must be between 1 and 9");
+		return NULL;
+	}
+	if (threads < 0) {
+		PyErr_SetString(PyExc_ValueError,
+				"threads must not be negative");
+		return NULL;
+	}
+	if (PyUnicode_Check(obj)) {
+		PyErr_SetString(PyExc_TypeError, "can't compress str");
+		return NULL;
+	}
+	if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE) < 0)
+		return NULL;
+
+	/* A piece to a block.  One that bzip2's run-length encoding makes
+	 * longer just spills into a second block of its stream. */
+	job.data = view.buf;
+	job.length = view.len;
+	job.piecesize = job.compresslevel * 100000;
+	job.npieces = (job.length + job.piecesize - 1) / job.piecesize;
+	if (job.npieces == 0)
+		job.npieces = 1;
+	job.pieces = PyMem_New(bz2_piece, job.npieces);
+	if (job.pieces == NULL) {
+		PyErr_NoMemory();
+		goto error;
+	}
+	memset(job.pieces, 0, job.npieces * sizeof(bz2_piece));
+
+	if (threads == 0)
+		threads = workerpool_cpus();
+	if (threads > job.npieces)
+		threads = (int)job.npieces;
+	if (workerpool_run(&job.pool, job.npieces, threads, bz2_worker,
+			   &job) < 0)
+		goto error;
+
+	total = 0;
+	for (i = 0; i < job.npieces; i++) {
+		if (job.pieces[i].bzerror != BZ_OK) {
+			Util_CatchBZ2Error(job.pieces[i].bzerror);
+			goto error;
+		}
+		total += job.pieces[i].outlen;
+	}
+	ret = PyString_FromStringAndSize(NULL, total);
+	if (ret == NULL)
+		goto error;
+	total = 0;
+	for (i = 0; i < job.npieces; i++) {
+		memcpy(BUF(ret) + total, job.pieces[i].out,
+		       job.pieces[i].outlen);
+		total += job.pieces[i].outlen;
+	}
+
+error:
+	if (job.pieces != NULL) {
+		for (i = 0; i < job.npieces; i++)
+			free(job.pieces[i].out);
+		PyMem_Free(job.pieces);
+	}
+	PyObject_ReleaseBuffer(obj, &view);
+	return ret;
+}
+
 PyDoc_STRVAR(bz2_decompress__doc__,
 "decompress(data) -> decompressed data\n\
 \n\
 Decompress data in one shot. If you want to decompress data sequentially,\n\
-use an instance of BZ2Decompressor instead.\n\
+use an instance of BZ2Decompressor instead. Streams that follow each\n\
+other, as compress_parallel() writes them, are decompressed as one.\n\
 ");
 
 static PyObject *
@@ -1967,7 +2154,18 @@ bz2_decompress(PyObject *self, PyObject *args)
 		bzerror = BZ2_bzDecompress(bzs);
 		Py_END_ALLOW_THREADS
 		if (bzerror == BZ_STREAM_END) {
-			break;
+			/* Carry on into another stream straight after, as
+			 * compress_parallel() and pbzip2 write them */
+			if (bzs->avail_in < 3 ||
+			    memcmp(bzs->next_in, "BZh", 3) != 0)
+				break;
+			BZ2_bzDecompressEnd(bzs);
+			bzerror = BZ2_bzDecompressInit(bzs, 0, 0);
+			if (bzerror != BZ_OK) {
+				Util_CatchBZ2Error(bzerror);
+				Py_DECREF(ret);
+				return NULL;
+			}
 		} else if (bzerror != BZ_OK) {
 			BZ2_bzDecompressEnd(bzs);
 			Util_CatchBZ2Error(bzerror);
@@ -1982,18 +2180,21 @@ bz2_decompress(PyObject *self, PyObject *args)
 			return NULL;
 		}
 		if (bzs->avail_out == 0) {
+			/* Not BZS_TOTAL_OUT(), which each stream restarts */
+			Py_ssize_t used = bzs->next_out - BUF(ret);
+
 			bufsize = Util_NewBufferSize(bufsize);
 			if (_PyString_Resize(&ret, bufsize) < 0) {
 				BZ2_bzDecompressEnd(bzs);
 				return NULL;
 			}
-			bzs->next_out = BUF(ret) + BZS_TOTAL_OUT(bzs);
-			bzs->avail_out = bufsize - (bzs->next_out - BUF(ret));
+			bzs->next_out = BUF(ret) + used;
+			bzs->avail_out = bufsize - used;
 		}
 	}
 
 	if (bzs->avail_out != 0) {
-		if (_PyString_Resize(&ret, (Py_ssize_t)BZS_TOTAL_OUT(bzs)) < 0) {
+		if (_PyString_Resize(&ret, bzs->next_out - BUF(ret)) < 0) {
 			ret = NULL;
 		}
 	}
@@ -2005,6 +2206,8 @@ bz2_decompress(PyObject *self, PyObject *args)
 static PyMethodDef bz2_methods[] = {
 	{"compress", (PyCFunction) bz2_compress, METH_VARARGS|METH_KEYWORDS,
 		bz2_compress__doc__},
+	{"compress_parallel", (PyCFunction) bz2_compress_parallel,
+		METH_VARARGS|METH_KEYWORDS, bz2_compress_parallel__doc__},
 	{"decompress", (PyCFunction) bz2_decompress, METH_VARARGS,
 		bz2_decompress__doc__},
 	{NULL,		NULL}		/* sentinel */
@@ -20,6 +20,8 @@
 
 #include "Python.h"
 #include "pythread.h"
+#include "pylockprof.h"
+#include "pyallocprof.h"
 
 #define GC_MAX_DEALLOC_DEPTH 50
 
@@ -92,6 +94,36 @@ static int debug;
 static PyObject *tmod = NULL;
 
 static PyThread_type_lock *PyGC_lock;
+/* When the lock profiler saw PyGC_lock acquired; only its holder
+ * touches this */
+static PY_LONG_LONG gc_lock_prof_acquired;
+
+/* PyGC_lock is taken for every GC allocation, so it's only timed while
+ * the lock profiler is on, and then only if it's contended */
+static void
+gc_lock_acquire(void)
+{
+	PY_LONG_LONG since = 0;
+
+	if (!PyThread_lock_tryacquire(PyGC_lock)) {
+		if (_PyLockProf_Enabled)
+			since = _PyLockProf_Now();
+		PyThread_lock_acquire(PyGC_lock);
+	}
+	gc_lock_prof_acquired = 0;
+	if (_PyLockProf_Enabled)
+		gc_lock_prof_acquired = _PyLockProf_Acquired(PyLockProf_GC,
+			"PyGC_lock", PyGC_lock, since);
+}
+
+static void
+gc_lock_release(void)
+{
+	if (_PyLockProf_Enabled)
+		_PyLockProf_Released(PyLockProf_GC, "PyGC_lock", PyGC_lock,
+			gc_lock_prof_acquired);
+	PyThread_lock_release(PyGC_lock);
+}
 
 /*--------------------------------------------------------------------------
 gc_refs values.
@@ -491,7 +523,7 @@ collect(int generation)
     PyGC_Head cleared;
     PyGC_Head old;
 
-    PyThread_lock_release(PyGC_lock);
+    gc_lock_release();
     PyState_StopTheWorld();
 
     //fprintf(stderr, "Collecting... ");
@@ -583,7 +615,7 @@ collect(int generation)
     }
 
     PyState_StartTheWorld();
-    PyThread_lock_acquire(PyGC_lock);
+    gc_lock_acquire();
 
     //fprintf(stderr, "Done\n");
 
@@ -616,9 +648,9 @@ PyDoc_STRVAR(gc_enable__doc__,
 static PyObject *
 gc_enable(PyObject *self, PyObject *noargs)
 {
-	PyThread_lock_acquire(PyGC_lock);
+	gc_lock_acquire();
 	enabled = 1;
-	PyThread_lock_release(PyGC_lock);
+	gc_lock_release();
 	Py_INCREF(Py_None);
 	return Py_None;
 }
@@ -631,9 +663,9 @@ PyDoc_STRVAR(gc_disable__doc__,
 static PyObject *
 gc_disable(PyObject *self, PyObject *noargs)
 {
-	PyThread_lock_acquire(PyGC_lock);
+	gc_lock_acquire();
 	enabled = 0;
-	PyThread_lock_release(PyGC_lock);
+	gc_lock_release();
 	Py_INCREF(Py_None);
 	return Py_None;
 }
@@ -647,9 +679,9 @@ static PyObject *
 gc_isenabled(PyObject *self, PyObject *noargs)
 {
     int value;
-    PyThread_lock_acquire(PyGC_lock);
+    gc_lock_acquire();
     value = enabled;
-    PyThread_lock_release(PyGC_lock);
+    gc_lock_release();
     return PyBool_FromLong((long)value);
 }
 
@@ -676,7 +708,7 @@ gc_collect(PyObject *self, PyObject *args, PyObject *kws)
 		return NULL;
 	}
 
-	PyThread_lock_acquire(PyGC_lock);
+	gc_lock_acquire();
 
 	if (collecting)
 		n = 0; /* already collecting, don't do anything */
@@ -686,7 +718,7 @@ gc_collect(PyObject *self, PyObject *args, PyObject *kws)
 		collecting = 0;
 	}
 
-	PyThread_lock_release(PyGC_lock);
+	gc_lock_release();
 
 	return PyLong_FromSsize_t(n);
 }
@@ -712,9 +744,9 @@ gc_set_debug(PyObject *self, PyObject *args)
     if (!PyArg_ParseTuple(args, "i:set_debug", &value))
         return NULL;
 
-    PyThread_lock_acquire(PyGC_lock);
+    gc_lock_acquire();
     debug = value;
-    PyThread_lock_release(PyGC_lock);
+    gc_lock_release();
 
     Py_INCREF(Py_None);
     return Py_None;
@@ -729,9 +761,9 @@ static PyObject *
 gc_get_debug(PyObject *self, PyObject *noargs)
 {
     int value;
-    PyThread_lock_acquire(PyGC_lock);
+    gc_lock_acquire();
     value = debug;
-    PyThread_lock_release(PyGC_lock);
+    gc_lock_release();
     return Py_BuildValue("i", value);
 }
 
@@ -751,7 +783,7 @@ gc_set_thresh(PyObject *self, PyObject *args)
             &gens[1], &gens[2]))
         return NULL;
 
-    PyThread_lock_acquire(PyGC_lock);
+    gc_lock_acquire();
     generations[0].threshold = gens[0];
     if (PyTuple_GET_SIZE(args) > 1)
         generations[1].threshold = gens[1];
@@ -761,7 +793,7 @@ gc_set_thresh(PyObject *self, PyObject *args)
         /* generations higher than 2 get the same threshold */
         generations[i].threshold = generations[2].threshold;
     }
-    PyThread_lock_release(PyGC_lock);
+    gc_lock_release();
 
     Py_INCREF(Py_None);
     return Py_None;
@@ -777,11 +809,11 @@ gc_get_thresh(PyObject *self, PyObject *noargs)
 {
     int gens[3];
 
-    PyThread_lock_acquire(PyGC_lock);
+    gc_lock_acquire();
     gens[0] = generations[0].threshold;
     gens[1] = generations[1].threshold;
     gens[2] = generations[2].threshold;
-    PyThread_lock_release(PyGC_lock);
+    gc_lock_release();
 
     return Py_BuildValue("(iii)", gens[0], gens[1], gens[2]);
 }
@@ -796,11 +828,11 @@ gc_get_count(PyObject *self, PyObject *noargs)
 {
     int gens[3];
 
-    PyThread_lock_acquire(PyGC_lock);
+    gc_lock_acquire();
     gens[0] = generations[0].count;
     gens[1] = generations[1].count;
     gens[2] = generations[2].count;
-    PyThread_lock_release(PyGC_lock);
+    gc_lock_release();
 
     return Py_BuildValue("(iii)", gens[0], gens[1], gens[2]);
 }
@@ -1043,7 +1075,7 @@ PyGC_Collect(void)
 {
 	Py_ssize_t n;
 
-	PyThread_lock_acquire(PyGC_lock);
+	gc_lock_acquire();
 
 	if (collecting)
 		n = 0; /* already collecting, don't do anything */
@@ -1053,7 +1085,7 @@ PyGC_Collect(void)
 		collecting = 0;
 	}
 
-	PyThread_lock_release(PyGC_lock);
+	gc_lock_release();
 
 	return n;
 }
@@ -1140,7 +1172,7 @@ _Py_Dealloc(register PyState *pystate, PyObject *op)
     assert(dealloc != NULL);
 
     if (pystate->dealloc_depth > GC_MAX_DEALLOC_DEPTH) {
-        PyThread_lock_acquire(PyGC_lock);
+        gc_lock_acquire();
         if (is_young(op)) {
             if (is_tracked(op))
                 op->ob_refcnt_trace = GC_TRACKED;
@@ -1148,7 +1180,7 @@ _Py_Dealloc(register PyState *pystate, PyObject *op)
                 op->ob_refcnt_trace = GC_UNTRACKED;
         }
         gc_list_move(op, &trashcan);
-        PyThread_lock_release(PyGC_lock);
+        gc_lock_release();
         Py_DECREF_ASYNC(op);
         return;
     }
@@ -1348,8 +1380,11 @@ _PyGC_RefMode_Promote(PyObject *op)
 		 * count? */
 		PyState *owner = (PyState *)oldmode;
 		PyCritical dummycrit;
+		PY_LONG_LONG since = 0;
 		PyCritical_EnterDummy(&dummycrit, PyCRITICAL_REFMODE_PROMOTE);
 
+		if (_PyLockProf_Enabled)
+			since = _PyLockProf_Now();
 		PyState_MaybeSuspend();
 		PyThread_lock_acquire(owner->refowner_waiting_lock);
 		AO_store_full(&owner->refowner_waiting_flag, 1);
@@ -1368,6 +1403,12 @@ _PyGC_RefMode_Promote(PyObject *op)
 		PyThread_lock_release(owner->refowner_lock);
 		PyState_MaybeResume();
 
+		/* Every promotion waits on the owner, so it always counts
+		 * as contended.  Only the wait means anything. */
+		if (_PyLockProf_Enabled && since != 0)
+			_PyLockProf_Acquired(PyLockProf_REFOWNER, "refowner",
+				owner, since);
+
 		PyCritical_ExitDummy(&dummycrit);
 	}
 }
@@ -1412,8 +1453,11 @@ Py_DecRef(PyObject *o)
 #define _Py_NOEXPECT(expr) __builtin_expect((expr) != 0, 0)
 
 #ifndef WITH_GIL
+/* The out of line halves of _Py_INCREF and _Py_DECREF in object.h.  They
+ * handle every case, though the inline half only calls them for objects
+ * the current thread doesn't own, or for a DECREF that may deallocate. */
 void
-_Py_INCREF(PyObject *op, register PyState *pystate)
+_Py_INCREF_SLOW(PyObject *op, register PyState *pystate)
 {
 	assert(pystate != NULL);
 	assert(!pystate->suspended);
@@ -1450,7 +1494,7 @@ _Py_INCREF(PyObject *op, register PyState *pystate)
 }
 
 void
-_Py_DECREF(PyObject *op, register PyState *pystate)
+_Py_DECREF_SLOW(PyObject *op, register PyState *pystate)
 {
 	assert(pystate != NULL);
 	assert(!pystate->suspended);
@@ -1595,11 +1639,17 @@ static PyObject *
 _PyObject_GC_Malloc(size_t basicsize)
 {
 	PyGC_Head *g = NULL;
+	void *record = NULL;
 	/* XXX FIXME unsigned -> signed overflow? */
 	//Py_ssize_t size_class = find_size_class(sizeof(PyGC_Head) + basicsize);
 	Py_ssize_t size_class = find_size_class(basicsize);
 
-	if (size_class <= 0) {
+	if (_PyAllocProf_Rate)
+		record = _PyAllocProf_Sample(GET_SIZE(size_class));
+
+	/* Sampled objects have the allocation profiler's record in front of
+	 * them, so they neither come from nor go to the cache */
+	if (record == NULL && size_class <= 0) {
 		PyState *pystate = PyState_Get();
 		Py_ssize_t i;
 
@@ -1617,13 +1667,25 @@ _PyObject_GC_Malloc(size_t basicsize)
 
 	if (g == NULL) {
 		//printf("Cache miss.\n");
-		g = malloc(GET_SIZE(size_class));
-		if (g == NULL)
-			return PyErr_NoMemory();
-		g->ob_sizeclass = size_class;
+		if (record != NULL) {
+			char *mem = malloc(_PyAllocProf_PREFIX +
+				GET_SIZE(size_class));
+			if (mem == NULL) {
+				_PyAllocProf_Freed(record);
+				return PyErr_NoMemory();
+			}
+			*(void **)mem = record;
+			g = (PyGC_Head *)(mem + _PyAllocProf_PREFIX);
+			g->ob_sizeclass = size_class ^ _PyAllocProf_FLAG;
+		} else {
+			g = malloc(GET_SIZE(size_class));
+			if (g == NULL)
+				return PyErr_NoMemory();
+			g->ob_sizeclass = size_class;
+		}
 		g->ob_refcnt_trace = GC_UNTRACKED_YOUNG;
 
-		PyThread_lock_acquire(PyGC_lock);
+		gc_lock_acquire();
 		PyGC_lock_count();
 
 		generations[0].count++; /* number of allocated GC objects */
@@ -1639,7 +1701,7 @@ _PyObject_GC_Malloc(size_t basicsize)
 
 		gc_list_append(g, _PyGC_generation0);
 
-		PyThread_lock_release(PyGC_lock);
+		gc_lock_release();
 	}
 
 	return FROM_GC(g);
@@ -1658,25 +1720,37 @@ _PyObject_GC_Resize(PyVarObject *op, Py_ssize_t nitems)
 	if (is_tracked((PyObject *)op))
 		Py_FatalError("_PyObject_GC_Resize called for tracked object");
 
-	if (size_class == g->ob_sizeclass) {
+	if (size_class == _PyAllocProf_SIZECLASS(g->ob_sizeclass)) {
 		//printf("Resize avoided\n");
 		Py_SIZE(op) = nitems;
 		return op; /* That was easy */
 	}
 
 	//printf("Resizing\n");
-	PyThread_lock_acquire(PyGC_lock);
-
-	g = realloc(g, GET_SIZE(size_class));
-	if (g == NULL) {
-		PyThread_lock_release(PyGC_lock);
-		return (PyVarObject *) PyErr_NoMemory();
+	gc_lock_acquire();
+
+	if (_PyAllocProf_IS_SAMPLED(g->ob_sizeclass)) {
+		char *mem = realloc((char *)g - _PyAllocProf_PREFIX,
+			_PyAllocProf_PREFIX + GET_SIZE(size_class));
+		if (mem == NULL) {
+			gc_lock_release();
+			return (PyVarObject *) PyErr_NoMemory();
+		}
+		g = (PyObject *)(mem + _PyAllocProf_PREFIX);
+		g->ob_sizeclass = size_class ^ _PyAllocProf_FLAG;
+		_PyAllocProf_Resized(_PyAllocProf_RECORD(g),
+			GET_SIZE(size_class));
+	} else {
+		g = realloc(g, GET_SIZE(size_class));
+		if (g == NULL) {
+			gc_lock_release();
+			return (PyVarObject *) PyErr_NoMemory();
+		}
+		g->ob_sizeclass = size_class;
 	}
-
-	g->ob_sizeclass = size_class;
 	gc_list_move(g, _PyGC_generation0);
 
-	PyThread_lock_release(PyGC_lock);
+	gc_lock_release();
 
 	op = (PyVarObject *) FROM_GC(g);
 	Py_SIZE(op) = nitems;
@@ -1688,10 +1762,14 @@ _PyObject_GC_Del(void *arg)
 {
 	PyGC_Head *g = AS_GC(arg);
 	Py_ssize_t size_class = g->ob_sizeclass;
+	void *mem = g;
 
 	assert(g == arg); /* WTF? */
 
-	if (size_class <= 0 && is_young(g)) {
+	if (_PyAllocProf_IS_SAMPLED(size_class)) {
+		_PyAllocProf_Freed(_PyAllocProf_RECORD(g));
+		mem = (char *)g - _PyAllocProf_PREFIX;
+	} else if (size_class <= 0 && is_young(g)) {
 		PyState *pystate = PyState_Get();
 		Py_ssize_t i;
 
@@ -1705,7 +1783,7 @@ _PyObject_GC_Del(void *arg)
 	}
 	//printf("Cache full\n");
 
-	PyThread_lock_acquire(PyGC_lock);
+	gc_lock_acquire();
 	PyGC_lock_count();
 
 	gc_list_remove(g);
@@ -1713,8 +1791,8 @@ _PyObject_GC_Del(void *arg)
 		generations[0].count--;
 	}
 
-	PyThread_lock_release(PyGC_lock);
-	free(g);
+	gc_lock_release();
+	free(mem);
 }
 
 void
@@ -1723,7 +1801,7 @@ _PyGC_Object_Cache_Flush(void)
 	PyState *pystate = PyState_Get();
 	Py_ssize_t i, j;
 
-	PyThread_lock_acquire(PyGC_lock);
+	gc_lock_acquire();
 	PyGC_lock_count();
 
 	for (i = 0; i < PYGC_CACHE_SIZECLASSES; i++) {
@@ -1744,7 +1822,7 @@ _PyGC_Object_Cache_Flush(void)
 		}
 	}
 
-	PyThread_lock_release(PyGC_lock);
+	gc_lock_release();
 }
 
 void *
@@ -1759,6 +1837,8 @@ PyObject_New(PyTypeObject *tp)
 //		printf("New obj type %s %d\n", tp->tp_name, Py_RefcntSnoop(tp));
 
 	Py_TYPE(op) = tp;
+	if (_PyAllocProf_IS_SAMPLED(op->ob_sizeclass))
+		_PyAllocProf_SetType(_PyAllocProf_RECORD(op), tp);
 	_Py_NewReference(op);
 	Py_INCREF(tp);
 	if (!PyType_HasFeature(tp, Py_TPFLAGS_SKIPWIPE)) {
@@ -1785,6 +1865,8 @@ PyObject_NewVar(PyTypeObject *tp, Py_ssize_t nitems)
 
 	Py_SIZE(op) = nitems;
 	Py_TYPE(op) = tp;
+	if (_PyAllocProf_IS_SAMPLED(op->ob_sizeclass))
+		_PyAllocProf_SetType(_PyAllocProf_RECORD(op), tp);
 	_Py_NewReference(op);
 	Py_INCREF(tp);
 	if (!PyType_HasFeature(tp, Py_TPFLAGS_SKIPWIPE)) {
@@ -0,0 +1,357 @@
+/* Multi-buffer hashing, shared by the _md5, _sha1, _sha256 and _sha512
+   modules.
+
+   Hashing many small messages one at a time leaves most of the CPU idle:
+   each block's rounds depend on the last, so there's little for the
+   processor to overlap.  Here a kernel hashes several independent messages
+   at once instead, one per lane.  With the GCC vector extensions each
+   lane is a SIMD element and one call compresses a block of each message;
+   without them a module offers a single lane, and what remains is the
+   bookkeeping done outside the Python thread.  A lane takes on the next
+   message as soon as its own is done, and messages are handed out
+   longest first so that the lanes finish together.  Given threads, each
+   thread runs lanes of its own, taking messages from a workerpool.
+
+   A module describes its algorithm with a hashmany_algorithm and passes
+   it to hashmany_buffers() and hashmany_leaves().  The threads never touch
+   Python objects. */
+
+#ifndef Py_HASHMANY_H
+#define Py_HASHMANY_H
+
+#include "workerpool.h"
+
+#if defined(__clang__) || (defined(__GNUC__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7)))
+#define HASHMANY_VECTOR
+typedef unsigned int hashmany_u32 __attribute__((vector_size(16)));
+#endif
+
+#define HASHMANY_MAX_LANES 4
+#define HASHMANY_MAX_BLOCK 128
+#define HASHMANY_STATE_SIZE 512
+
+/* Messages handed to a thread at a time */
+#define HASHMANY_BATCH 16
+
+/* Input per thread that makes starting one worthwhile */
+#define HASHMANY_PER_THREAD (256*1024)
+
+typedef struct {
+	int lanes;		/* Messages compress() works on at once */
+	int block_size;
+	int digest_size;
+	int count_size;		/* Bytes of bit count ending the padding */
+	int count_little_endian;
+	/* Starts a message in a lane */
+	void (*init)(void *state, int lane);
+	/* Compresses a block for each lane */
+	void (*compress)(void *state, const unsigned char **blocks);
+	/* Stores the digest of a lane's message once it's all compressed */
+	void (*digest)(void *state, int lane, unsigned char *out);
+} hashmany_algorithm;
+
+/* For the kernels' state, suitably aligned for their vectors */
+typedef union {
+#ifdef HASHMANY_VECTOR
+	hashmany_u32 align;
+#endif
+	double align_double;
+	unsigned char bytes[HASHMANY_STATE_SIZE];
+} hashmany_state;
+
+typedef struct {
+	const unsigned char *p;
+	Py_ssize_t len;
+	Py_ssize_t index;	/* Where its digest goes */
+} hashmany_msg;
+
+typedef struct {
+	const hashmany_algorithm *alg;
+	hashmany_msg *msgs;
+	Py_ssize_t nmsgs;
+	unsigned char *out;	/* digest_size bytes per message */
+	workerpool pool;
+} hashmany_job;
+
+typedef struct {
+	Py_ssize_t msg;		/* Index into msgs, or -1 if idle */
+	const unsigned char *p;	/* Next block, in the message or in tail */
+	Py_ssize_t full;	/* Blocks left in the message itself */
+	int ntail;		/* Padded blocks left after those */
+	unsigned char tail[2 * HASHMANY_MAX_BLOCK];
+} hashmany_lane;
+
+static void
+hashmany_start(const hashmany_algorithm *alg, hashmany_state *state,
+	       hashmany_lane *lane, int i, const hashmany_msg *msg)
+{
+	int bs = alg->block_size, rest, end, k;
+	unsigned PY_LONG_LONG lo, hi;
+
+	lane->full = msg->len / bs;
+	rest = (int)(msg->len % bs);
+	memcpy(lane->tail, msg->p + lane->full * bs, rest);
+	lane->tail[rest] = 0x80;
+	lane->ntail = rest + 1 + alg->count_size <= bs ? 1 : 2;
+	end = lane->ntail * bs;
+	memset(lane->tail + rest + 1, 0, end - alg->count_size - rest - 1);
+
+	/* The length in bits, as many bytes of it as the count takes */
+	lo = (unsigned PY_LONG_LONG)msg->len << 3;
+	hi = (unsigned PY_LONG_LONG)msg->len >> 61;
+	for (k = 0; k < alg->count_size; k++) {
+		unsigned char byte = (unsigned char)
+			(k < 8 ? lo >> 8 * k : k < 16 ? hi >> 8 * (k - 8) : 0);
+
+		if (alg->count_little_endian)
+			lane->tail[end - alg->count_size + k] = byte;
+		else
+			lane->tail[end - 1 - k] = byte;
+	}
+
+	lane->p = lane->full ? msg->p : lane->tail;
+	alg->init(state, i);
+}
+
+/* Runs lanes until there's nothing left to take */
+static void
+hashmany_work(void *arg)
+{
+	hashmany_job *job = arg;
+	static const unsigned char idle[HASHMANY_MAX_BLOCK];
+	const hashmany_algorithm *alg = job->alg;
+	hashmany_state state;
+	hashmany_lane lanes[HASHMANY_MAX_LANES];
+	const unsigned char *blocks[HASHMANY_MAX_LANES];
+	Py_ssize_t next = 0, end = 0;
+	int bs = alg->block_size, active = 0, i;
+
+	for (i = 0; i < alg->lanes; i++)
+		lanes[i].msg = -1;
+
+	for (;;) {
+		for (i = 0; i < alg->lanes; i++) {
+			if (lanes[i].msg >= 0)
+				continue;
+			if (next == end) {
+				end = workerpool_take(&job->pool, 0,
+						      HASHMANY_BATCH, &next);
+				end += next;
+				if (next == end)
+					break;
+			}
+			lanes[i].msg = next++;
+			hashmany_start(alg, &state, &lanes[i], i,
+				       &job->msgs[lanes[i].msg]);
+			active++;
+		}
+		if (active == 0)
+			break;
+
+		for (i = 0; i < alg->lanes; i++)
+			blocks[i] = lanes[i].msg >= 0 ? lanes[i].p : idle;
+		alg->compress(&state, blocks);
+
+		for (i = 0; i < alg->lanes; i++) {
+			hashmany_lane *lane = &lanes[i];
+
+			if (lane->msg < 0)
+				continue;
+			if (lane->full > 0) {
+				lane->p += bs;
+				if (--lane->full == 0)
+					lane->p = lane->tail;
+				continue;
+			}
+			lane->p += bs;
+			if (--lane->ntail > 0)
+				continue;
+			alg->digest(&state, i, job->out + alg->digest_size *
+				    job->msgs[lane->msg].index);
+			lane->msg = -1;
+			active--;
+		}
+	}
+}
+
+static int
+hashmany_compare(const void *a, const void *b)
+{
+	Py_ssize_t alen = ((const hashmany_msg *)a)->len;
+	Py_ssize_t blen = ((const hashmany_msg *)b)->len;
+
+	return alen > blen ? -1 : alen < blen;
+}
+
+/* Hashes msgs, returning a list of their digests in index order */
+static PyObject *
+hashmany_run(const hashmany_algorithm *alg, hashmany_msg *msgs,
+	     Py_ssize_t nmsgs, int threads)
+{
+	PyObject *result = NULL;
+	hashmany_job job;
+	Py_ssize_t i, total = 0;
+
+	memset(&job, 0, sizeof(job));
+	job.alg = alg;
+	job.msgs = msgs;
+	job.nmsgs = nmsgs;
+	if (nmsgs > 0) {
+		job.out = PyMem_Malloc(nmsgs * alg->digest_size);
+		if (job.out == NULL)
+			return PyErr_NoMemory();
+	}
+	for (i = 0; i < nmsgs; i++)
+		total += msgs[i].len;
+	qsort(msgs, nmsgs, sizeof(hashmany_msg), hashmany_compare);
+
+	if (threads == 0) {
+		threads = workerpool_cpus();
+		if (threads > total / HASHMANY_PER_THREAD)
+			threads = (int)(total / HASHMANY_PER_THREAD);
+		if (threads < 1)
+			threads = 1;
+	}
+	if (threads > (nmsgs + alg->lanes - 1) / alg->lanes)
+		threads = (int)((nmsgs + alg->lanes - 1) / alg->lanes);
+	if (workerpool_run(&job.pool, nmsgs, threads, hashmany_work,
+			   &job) < 0)
+		goto error;
+
+	result = PyList_New(nmsgs);
+	if (result == NULL)
+		goto error;
+	for (i = 0; i < nmsgs; i++) {
+		PyObject *digest = PyString_FromStringAndSize(
+			(char *)job.out + i * alg->digest_size,
+			alg->digest_size);
+		if (digest == NULL) {
+			Py_CLEAR(result);
+			goto error;
+		}
+		PyList_SET_ITEM(result, i, digest);
+	}
+
+  error:
+	PyMem_Free(job.out);
+	return result;
+}
+
+static int
+hashmany_check_threads(int threads)
+{
+	if (threads < 0) {
+		PyErr_SetString(PyExc_ValueError,
+				"threads must not be negative");
+		return -1;
+	}
+	return 0;
+}
+
+static int
+hashmany_getbuffer(PyObject *obj, Py_buffer *view)
+{
+	if (PyUnicode_Check(obj)) {
+		PyErr_SetString(PyExc_TypeError, "can't hash str");
+		return -1;
+	}
+	return PyObject_GetBuffer(obj, view, PyBUF_SIMPLE);
+}
+
+/* The digest of each of buffers, an iterable of bytes-like objects */
+static PyObject *
+hashmany_buffers(const hashmany_algorithm *alg, PyObject *buffers,
+		 int threads)
+{
+	PyObject *seq, *result = NULL;
+	Py_buffer *views = NULL;
+	hashmany_msg *msgs = NULL;
+	Py_ssize_t i, n, got = 0;
+
+	if (hashmany_check_threads(threads) < 0)
+		return NULL;
+	seq = PySequence_Fast(buffers, "buffers must be iterable");
+	if (seq == NULL)
+		return NULL;
+	n = PySequence_Fast_GET_SIZE(seq);
+	views = PyMem_New(Py_buffer, n ? n : 1);
+	msgs = PyMem_New(hashmany_msg, n ? n : 1);
+	if (views == NULL || msgs == NULL) {
+		PyErr_NoMemory();
+		goto error;
+	}
+	for (got = 0; got < n; got++) {
+		if (hashmany_getbuffer(PySequence_Fast_GET_ITEM(seq, got),
+				       &views[got]) < 0)
+			goto error;
+		msgs[got].p = views[got].buf;
+		msgs[got].len = views[got].len;
+		msgs[got].index = got;
+	}
+	result = hashmany_run(alg, msgs, n, threads);
+
+  error:
+	for (i = 0; i < got; i++)
+		PyObject_ReleaseBuffer(PySequence_Fast_GET_ITEM(seq, i),
+				       &views[i]);
+	PyMem_Free(views);
+	PyMem_Free(msgs);
+	Py_DECREF(seq);
+	return result;
+}
+
+/* The digest of each whole leaf_size piece of data[offset:], leaving
+   out any shorter piece at the end */
+static PyObject *
+hashmany_leaves(const hashmany_algorithm *alg, PyObject *data,
+		Py_ssize_t leaf_size, Py_ssize_t offset, int threads)
+{
+	PyObject *result = NULL;
+	Py_buffer view;
+	hashmany_msg *msgs;
+	Py_ssize_t i, n;
+
+	if (hashmany_check_threads(threads) < 0)
+		return NULL;
+	if (leaf_size <= 0) {
+		PyErr_SetString(PyExc_ValueError,
+				"leaf_size must be positive");
+		return NULL;
+	}
+	if (hashmany_getbuffer(data, &view) < 0)
+		return NULL;
+	if (offset < 0 || offset > view.len) {
+		PyErr_SetString(PyExc_ValueError, "offset out of range");
+		goto error;
+	}
+
+	n = (view.len - offset) / leaf_size;
+	msgs = PyMem_New(hashmany_msg, n ? n : 1);
+	if (msgs == NULL) {
+		PyErr_NoMemory();
+		goto error;
+	}
+	for (i = 0; i < n; i++) {
+		msgs[i].p = (unsigned char *)view.buf + offset + i * leaf_size;
+		msgs[i].len = leaf_size;
+		msgs[i].index = i;
+	}
+	result = hashmany_run(alg, msgs, n, threads);
+	PyMem_Free(msgs);
+
+  error:
+	PyObject_ReleaseBuffer(data, &view);
+	return result;
+}
+
+/* Loading message words, for kernels */
+
+#define hashmany_load32be(p)						\
+	((unsigned int)(p)[0] << 24 | (unsigned int)(p)[1] << 16 |	\
+	 (unsigned int)(p)[2] << 8 | (unsigned int)(p)[3])
+#define hashmany_load32le(p)						\
+	((unsigned int)(p)[3] << 24 | (unsigned int)(p)[2] << 16 |	\
+	 (unsigned int)(p)[1] << 8 | (unsigned int)(p)[0])
+
+#endif /* !Py_HASHMANY_H */
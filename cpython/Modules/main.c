@@ -95,6 +95,8 @@ static char *usage_5 = "\
 PYTHONHOME   : alternate <prefix> directory (or <prefix>%c<exec_prefix>).\n\
                The default module search path uses %s.\n\
 PYTHONCASEOK : ignore case in 'import' statements (Windows).\n\
+PYTHONLAZYCODE: unmarshal the code in .py[co] files as it's first needed.\n\
+PYTHONSHAREDIMAGE: shared modules image to load at startup (see sharedimage).\n\
 ";
 
 #ifndef MS_WINDOWS
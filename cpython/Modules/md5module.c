@@ -312,13 +312,181 @@ void md5_done(struct md5_state *md5, unsigned char *out)
  * ------------------------------------------------------------------------
  */
 
+/* Multi-buffer kernels for md5_many() and md5_leaves(); see hashmany.h */
+
+#include "hashmany.h"
+
+#ifdef HASHMANY_VECTOR
+
+#define VROL(x, n)      ((x) << (n) | (x) >> (32 - (n)))
+
+#define VSTEP(f,a,b,c,d,M,s,t)                  \
+    {                                           \
+        hashmany_u32 k = {t, t, t, t};          \
+        a += f(b,c,d) + M + k;                  \
+        a = VROL(a, s) + b;                     \
+    }
+
+static void
+md5_lanes_compress(void *state, const unsigned char **blocks)
+{
+    hashmany_u32 *S = state, W[16], a, b, c, d;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        hashmany_u32 w = {hashmany_load32le(blocks[0] + 4 * i),
+                          hashmany_load32le(blocks[1] + 4 * i),
+                          hashmany_load32le(blocks[2] + 4 * i),
+                          hashmany_load32le(blocks[3] + 4 * i)};
+        W[i] = w;
+    }
+
+    a = S[0];
+    b = S[1];
+    c = S[2];
+    d = S[3];
+
+    VSTEP(F,a,b,c,d,W[0],7,0xd76aa478UL)
+    VSTEP(F,d,a,b,c,W[1],12,0xe8c7b756UL)
+    VSTEP(F,c,d,a,b,W[2],17,0x242070dbUL)
+    VSTEP(F,b,c,d,a,W[3],22,0xc1bdceeeUL)
+    VSTEP(F,a,b,c,d,W[4],7,0xf57c0fafUL)
+    VSTEP(F,d,a,b,c,W[5],12,0x4787c62aUL)
+    VSTEP(F,c,d,a,b,W[6],17,0xa8304613UL)
+    VSTEP(F,b,c,d,a,W[7],22,0xfd469501UL)
+    VSTEP(F,a,b,c,d,W[8],7,0x698098d8UL)
+    VSTEP(F,d,a,b,c,W[9],12,0x8b44f7afUL)
+    VSTEP(F,c,d,a,b,W[10],17,0xffff5bb1UL)
+    VSTEP(F,b,c,d,a,W[11],22,0x895cd7beUL)
+    VSTEP(F,a,b,c,d,W[12],7,0x6b901122UL)
+    VSTEP(F,d,a,b,c,W[13],12,0xfd987193UL)
+    VSTEP(F,c,d,a,b,W[14],17,0xa679438eUL)
+    VSTEP(F,b,c,d,a,W[15],22,0x49b40821UL)
+    VSTEP(G,a,b,c,d,W[1],5,0xf61e2562UL)
+    VSTEP(G,d,a,b,c,W[6],9,0xc040b340UL)
+    VSTEP(G,c,d,a,b,W[11],14,0x265e5a51UL)
+    VSTEP(G,b,c,d,a,W[0],20,0xe9b6c7aaUL)
+    VSTEP(G,a,b,c,d,W[5],5,0xd62f105dUL)
+    VSTEP(G,d,a,b,c,W[10],9,0x02441453UL)
+    VSTEP(G,c,d,a,b,W[15],14,0xd8a1e681UL)
+    VSTEP(G,b,c,d,a,W[4],20,0xe7d3fbc8UL)
+    VSTEP(G,a,b,c,d,W[9],5,0x21e1cde6UL)
+    VSTEP(G,d,a,b,c,W[14],9,0xc33707d6UL)
+    VSTEP(G,c,d,a,b,W[3],14,0xf4d50d87UL)
+    VSTEP(G,b,c,d,a,W[8],20,0x455a14edUL)
+    VSTEP(G,a,b,c,d,W[13],5,0xa9e3e905UL)
+    VSTEP(G,d,a,b,c,W[2],9,0xfcefa3f8UL)
+    VSTEP(G,c,d,a,b,W[7],14,0x676f02d9UL)
+    VSTEP(G,b,c,d,a,W[12],20,0x8d2a4c8aUL)
+    VSTEP(H,a,b,c,d,W[5],4,0xfffa3942UL)
+    VSTEP(H,d,a,b,c,W[8],11,0x8771f681UL)
+    VSTEP(H,c,d,a,b,W[11],16,0x6d9d6122UL)
+    VSTEP(H,b,c,d,a,W[14],23,0xfde5380cUL)
+    VSTEP(H,a,b,c,d,W[1],4,0xa4beea44UL)
+    VSTEP(H,d,a,b,c,W[4],11,0x4bdecfa9UL)
+    VSTEP(H,c,d,a,b,W[7],16,0xf6bb4b60UL)
+    VSTEP(H,b,c,d,a,W[10],23,0xbebfbc70UL)
+    VSTEP(H,a,b,c,d,W[13],4,0x289b7ec6UL)
+    VSTEP(H,d,a,b,c,W[0],11,0xeaa127faUL)
+    VSTEP(H,c,d,a,b,W[3],16,0xd4ef3085UL)
+    VSTEP(H,b,c,d,a,W[6],23,0x04881d05UL)
+    VSTEP(H,a,b,c,d,W[9],4,0xd9d4d039UL)
+    VSTEP(H,d,a,b,c,W[12],11,0xe6db99e5UL)
+    VSTEP(H,c,d,a,b,W[15],16,0x1fa27cf8UL)
+    VSTEP(H,b,c,d,a,W[2],23,0xc4ac5665UL)
+    VSTEP(I,a,b,c,d,W[0],6,0xf4292244UL)
+    VSTEP(I,d,a,b,c,W[7],10,0x432aff97UL)
+    VSTEP(I,c,d,a,b,W[14],15,0xab9423a7UL)
+    VSTEP(I,b,c,d,a,W[5],21,0xfc93a039UL)
+    VSTEP(I,a,b,c,d,W[12],6,0x655b59c3UL)
+    VSTEP(I,d,a,b,c,W[3],10,0x8f0ccc92UL)
+    VSTEP(I,c,d,a,b,W[10],15,0xffeff47dUL)
+    VSTEP(I,b,c,d,a,W[1],21,0x85845dd1UL)
+    VSTEP(I,a,b,c,d,W[8],6,0x6fa87e4fUL)
+    VSTEP(I,d,a,b,c,W[15],10,0xfe2ce6e0UL)
+    VSTEP(I,c,d,a,b,W[6],15,0xa3014314UL)
+    VSTEP(I,b,c,d,a,W[13],21,0x4e0811a1UL)
+    VSTEP(I,a,b,c,d,W[4],6,0xf7537e82UL)
+    VSTEP(I,d,a,b,c,W[11],10,0xbd3af235UL)
+    VSTEP(I,c,d,a,b,W[2],15,0x2ad7d2bbUL)
+    VSTEP(I,b,c,d,a,W[9],21,0xeb86d391UL)
+
+    S[0] += a;
+    S[1] += b;
+    S[2] += c;
+    S[3] += d;
+}
+
+#undef VSTEP
+
+static void
+md5_lanes_init(void *state, int lane)
+{
+    hashmany_u32 *S = state;
+
+    S[0][lane] = 0x67452301UL;
+    S[1][lane] = 0xefcdab89UL;
+    S[2][lane] = 0x98badcfeUL;
+    S[3][lane] = 0x10325476UL;
+}
+
+static void
+md5_lanes_digest(void *state, int lane, unsigned char *out)
+{
+    hashmany_u32 *S = state;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        STORE32L(S[i][lane], out+(4*i));
+    }
+}
+
+static const hashmany_algorithm md5_algorithm = {
+    4, MD5_BLOCKSIZE, MD5_DIGESTSIZE, 8, 1,
+    md5_lanes_init, md5_lanes_compress, md5_lanes_digest
+};
+
+#else /* !HASHMANY_VECTOR */
+
+/* One lane, in a struct md5_state */
+
+static void
+md5_one_init(void *state, int lane)
+{
+    md5_init((struct md5_state *)state);
+}
+
+static void
+md5_one_compress(void *state, const unsigned char **blocks)
+{
+    md5_compress((struct md5_state *)state, (unsigned char *)blocks[0]);
+}
+
+static void
+md5_one_digest(void *state, int lane, unsigned char *out)
+{
+    struct md5_state *md5 = state;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        STORE32L(md5->state[i], out+(4*i));
+    }
+}
+
+static const hashmany_algorithm md5_algorithm = {
+    1, MD5_BLOCKSIZE, MD5_DIGESTSIZE, 8, 1,
+    md5_one_init, md5_one_compress, md5_one_digest
+};
+
+#endif /* !HASHMANY_VECTOR */
+
 static PyTypeObject MD5type;
 
 
 static MD5object *
 newMD5object(void)
 {
-    return (MD5object *)PyObject_New(MD5object, &MD5type);
+    return (MD5object *)PyObject_New(&MD5type);
 }
 
 
@@ -534,11 +702,51 @@ MD5_new(PyObject *self, PyObject *args, PyObject *kwdict)
     return (PyObject *)new;
 }
 
+PyDoc_STRVAR(MD5_many__doc__,
+"md5_many(buffers[, threads]) -> list of digests\n\
+\n\
+Return the MD5 digest of each of buffers, hashing several at once.\n\
+Optional arg threads is how many threads to use; by default it's one per\n\
+CPU, as far as there's enough to hash to keep them busy.");
+
+static PyObject *
+MD5_many(PyObject *self, PyObject *args)
+{
+    PyObject *buffers;
+    int threads = 0;
+
+    if (!PyArg_ParseTuple(args, "O|i:md5_many", &buffers, &threads))
+        return NULL;
+    return hashmany_buffers(&md5_algorithm, buffers, threads);
+}
+
+PyDoc_STRVAR(MD5_leaves__doc__,
+"md5_leaves(data, leaf_size[, offset[, threads]]) -> list of digests\n\
+\n\
+Return the MD5 digest of each leaf_size piece of data[offset:], hashing\n\
+several at once, as md5_many() does.  A shorter piece at the end is left\n\
+out.");
+
+static PyObject *
+MD5_leaves(PyObject *self, PyObject *args)
+{
+    PyObject *data;
+    Py_ssize_t leaf_size, offset = 0;
+    int threads = 0;
+
+    if (!PyArg_ParseTuple(args, "On|ni:md5_leaves", &data, &leaf_size,
+                          &offset, &threads))
+        return NULL;
+    return hashmany_leaves(&md5_algorithm, data, leaf_size, offset, threads);
+}
+
 
 /* List of functions exported by this module */
 
 static struct PyMethodDef MD5_functions[] = {
     {"md5", (PyCFunction)MD5_new, METH_VARARGS|METH_KEYWORDS, MD5_new__doc__},
+    {"md5_many", (PyCFunction)MD5_many, METH_VARARGS, MD5_many__doc__},
+    {"md5_leaves", (PyCFunction)MD5_leaves, METH_VARARGS, MD5_leaves__doc__},
     {NULL,	NULL}		 /* Sentinel */
 };
 
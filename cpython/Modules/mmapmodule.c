@@ -92,6 +92,7 @@ typedef struct {
 	size_t	pos;    /* relative to offset */
 	size_t	offset; 
         int     exports;
+	int	shareable;	/* Read-only and safe to hand to other threads */
 
 #ifdef MS_WINDOWS
 	HANDLE	map_handle;
@@ -136,6 +137,12 @@ mmap_object_dealloc(mmap_object *m_obj)
 static PyObject *
 mmap_close_method(mmap_object *self, PyObject *unused)
 {
+	if (self->shareable) {
+		/* Another thread may be reading it */
+		PyErr_SetString(PyExc_TypeError,
+				"can't close a shareable mmap");
+		return NULL;
+	}
         if (self->exports > 0) {
                 PyErr_SetString(PyExc_BufferError, "cannot close "\
                                 "exported pointers exist");
@@ -196,11 +203,24 @@ do {									\
 } while (0)
 #endif /* UNIX */
 
+/* A shareable mmap has no position: threads sharing it would race on it */
+static int
+has_position(mmap_object *self)
+{
+	if (!self->shareable)
+		return 1;
+	PyErr_SetString(PyExc_TypeError,
+			"shareable mmap has no position; index or slice it");
+	return 0;
+}
+
 static PyObject *
 mmap_read_byte_method(mmap_object *self,
 		      PyObject *unused)
 {
 	CHECK_VALID(NULL);
+	if (!has_position(self))
+		return NULL;
 	if (self->pos < self->size) {
 	        char value = self->data[self->pos];
 		self->pos += 1;
@@ -221,6 +241,8 @@ mmap_read_line_method(mmap_object *self,
 	PyObject *result;
 
 	CHECK_VALID(NULL);
+	if (!has_position(self))
+		return NULL;
 
 	eol = memchr(start, '\n', self->size - self->pos);
 	if (!eol)
@@ -241,6 +263,8 @@ mmap_read_method(mmap_object *self,
 	PyObject *result;
 
 	CHECK_VALID(NULL);
+	if (!has_position(self))
+		return NULL;
 	if (!PyArg_ParseTuple(args, "n:read", &num_bytes))
 		return(NULL);
 
@@ -253,6 +277,82 @@ mmap_read_method(mmap_object *self,
 	return result;
 }
 
+/* Searching leaves the scanning to memchr(), which C libraries vectorize.
+   Unlike stringlib's fastsearch it never reads past the end of the data,
+   here possibly the end of the last mapped page. */
+
+static Py_ssize_t
+mmap_search(const char *s, Py_ssize_t n, const char *p, Py_ssize_t m)
+{
+	const char *cur = s, *last;
+
+	if (m > n)
+		return -1;
+	if (m == 0)
+		return 0;
+	last = s + n - m;
+	while (cur <= last) {
+		cur = memchr(cur, p[0], last - cur + 1);
+		if (cur == NULL)
+			return -1;
+		if (memcmp(cur + 1, p + 1, m - 1) == 0)
+			return cur - s;
+		cur++;
+	}
+	return -1;
+}
+
+static Py_ssize_t
+mmap_rsearch(const char *s, Py_ssize_t n, const char *p, Py_ssize_t m)
+{
+	const char *cur;
+
+	if (m > n)
+		return -1;
+	for (cur = s + n - m; cur >= s; cur--) {
+		if (m == 0 || (*cur == p[0] && memcmp(cur + 1, p + 1, m - 1) == 0))
+			return cur - s;
+	}
+	return -1;
+}
+
+/* Non-overlapping matches, as bytes.count() counts them */
+static Py_ssize_t
+mmap_count(const char *s, Py_ssize_t n, const char *p, Py_ssize_t m)
+{
+	Py_ssize_t count = 0, i;
+
+	if (m > n)
+		return 0;
+	if (m == 0)
+		return n + 1;
+	while ((i = mmap_search(s, n, p, m)) >= 0) {
+		count++;
+		s += i + m;
+		n -= i + m;
+	}
+	return count;
+}
+
+/* Clips start and end as slice indices of the data */
+static void
+mmap_clip(mmap_object *self, Py_ssize_t *start, Py_ssize_t *end)
+{
+	if (*start < 0)
+		*start += self->size;
+	if (*start < 0)
+		*start = 0;
+	else if ((size_t)*start > self->size)
+		*start = self->size;
+
+	if (*end < 0)
+		*end += self->size;
+	if (*end < 0)
+		*end = 0;
+	else if ((size_t)*end > self->size)
+		*end = self->size;
+}
+
 static PyObject *
 mmap_gfind(mmap_object *self,
 	   PyObject *args,
@@ -261,44 +361,46 @@ mmap_gfind(mmap_object *self,
 	Py_ssize_t start = self->pos;
 	Py_ssize_t end = self->size;
 	const char *needle;
-	Py_ssize_t len;
+	Py_ssize_t len, found;
 
 	CHECK_VALID(NULL);
 	if (!PyArg_ParseTuple(args, reverse ? "s#|nn:rfind" : "s#|nn:find",
-			      &needle, &len, &start, &end)) {
+			      &needle, &len, &start, &end))
 		return NULL;
-	} else {
-		const char *p, *start_p, *end_p;
-		int sign = reverse ? -1 : 1;
-
-                if (start < 0)
-			start += self->size;
-                if (start < 0)
-			start = 0;
-                else if ((size_t)start > self->size)
-			start = self->size;
-
-                if (end < 0)
-			end += self->size;
-		if (end < 0)
-			end = 0;
-		else if ((size_t)end > self->size)
-			end = self->size;
-
-		start_p = self->data + start;
-		end_p = self->data + end;
-
-		for (p = (reverse ? end_p - len : start_p);
-		     (p >= start_p) && (p + len <= end_p); p += sign) {
-			Py_ssize_t i;
-			for (i = 0; i < len && needle[i] == p[i]; ++i)
-				/* nothing */;
-			if (i == len) {
-				return PyLong_FromSsize_t(p - self->data);
-			}
-		}
-		return PyLong_FromLong(-1);
-	}
+	mmap_clip(self, &start, &end);
+
+	Py_BEGIN_ALLOW_THREADS
+	if (reverse)
+		found = mmap_rsearch(self->data + start, end - start,
+				     needle, len);
+	else
+		found = mmap_search(self->data + start, end - start,
+				    needle, len);
+	Py_END_ALLOW_THREADS
+	if (found >= 0)
+		found += start;
+	return PyLong_FromSsize_t(found);
+}
+
+static PyObject *
+mmap_count_method(mmap_object *self,
+		  PyObject *args)
+{
+	Py_ssize_t start = self->pos;
+	Py_ssize_t end = self->size;
+	const char *needle;
+	Py_ssize_t len, count;
+
+	CHECK_VALID(NULL);
+	if (!PyArg_ParseTuple(args, "s#|nn:count", &needle, &len,
+			      &start, &end))
+		return NULL;
+	mmap_clip(self, &start, &end);
+
+	Py_BEGIN_ALLOW_THREADS
+	count = mmap_count(self->data + start, end - start, needle, len);
+	Py_END_ALLOW_THREADS
+	return PyLong_FromSsize_t(count);
 }
 
 static PyObject *
@@ -566,6 +668,8 @@ mmap_seek_method(mmap_object *self, PyObject *args)
 	Py_ssize_t dist;
 	int how=0;
 	CHECK_VALID(NULL);
+	if (!has_position(self))
+		return NULL;
 	if (!PyArg_ParseTuple(args, "n|i:seek", &dist, &how))
 		return NULL;
 	else {
@@ -627,18 +731,72 @@ mmap_move_method(mmap_object *self, PyObject *args)
 	}
 }
 
+#ifdef HAVE_MADVISE
+static PyObject *
+mmap_madvise_method(mmap_object *self, PyObject *args)
+{
+	int option;
+	Py_ssize_t start = 0, length = PY_SSIZE_T_MAX;
+	size_t skip;
+
+	CHECK_VALID(NULL);
+	if (!PyArg_ParseTuple(args, "i|nn:madvise", &option, &start, &length))
+		return NULL;
+	if (start < 0 || (size_t)start > self->size) {
+		PyErr_SetString(PyExc_ValueError, "madvise start out of range");
+		return NULL;
+	}
+	if (length < 0) {
+		PyErr_SetString(PyExc_ValueError, "madvise length is negative");
+		return NULL;
+	}
+	if ((size_t)length > self->size - start)
+		length = self->size - start;
+	if (length == 0) {
+		Py_INCREF(Py_None);
+		return Py_None;
+	}
+
+	/* madvise() wants a page-aligned address; the mapping starts on one */
+	skip = start % my_getpagesize();
+	if (madvise(self->data + start - skip, length + skip, option) == -1) {
+		PyErr_SetFromErrno(mmap_module_error);
+		return NULL;
+	}
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+#endif /* HAVE_MADVISE */
+
+static int
+mmap_isshareable(mmap_object *self)
+{
+	/* Not a subclass, unless it's a shared one */
+	return self->shareable &&
+		PyType_HasFeature(Py_TYPE(self), Py_TPFLAGS_SHAREABLE);
+}
+
 static struct PyMethodDef mmap_object_methods[] = {
 	{"close",	(PyCFunction) mmap_close_method,	METH_NOARGS},
-	{"find",	(PyCFunction) mmap_find_method,		METH_VARARGS},
-	{"rfind",	(PyCFunction) mmap_rfind_method,	METH_VARARGS},
+	{"count",	(PyCFunction) mmap_count_method,
+	 METH_SHARED | METH_VARARGS},
+	{"find",	(PyCFunction) mmap_find_method,
+	 METH_SHARED | METH_VARARGS},
+	{"rfind",	(PyCFunction) mmap_rfind_method,
+	 METH_SHARED | METH_VARARGS},
 	{"flush",	(PyCFunction) mmap_flush_method,	METH_VARARGS},
+#ifdef HAVE_MADVISE
+	{"madvise",	(PyCFunction) mmap_madvise_method,
+	 METH_SHARED | METH_VARARGS},
+#endif
 	{"move",	(PyCFunction) mmap_move_method,		METH_VARARGS},
 	{"read",	(PyCFunction) mmap_read_method,		METH_VARARGS},
 	{"read_byte",	(PyCFunction) mmap_read_byte_method,  	METH_NOARGS},
 	{"readline",	(PyCFunction) mmap_read_line_method,	METH_NOARGS},
 	{"resize",	(PyCFunction) mmap_resize_method,	METH_VARARGS},
 	{"seek",	(PyCFunction) mmap_seek_method,		METH_VARARGS},
-	{"size",	(PyCFunction) mmap_size_method,		METH_NOARGS},
+	{"size",	(PyCFunction) mmap_size_method,
+	 METH_SHARED | METH_NOARGS},
 	{"tell",	(PyCFunction) mmap_tell_method,		METH_NOARGS},
 	{"write",	(PyCFunction) mmap_write_method,	METH_VARARGS},
 	{"write_byte",	(PyCFunction) mmap_write_byte_method,	METH_VARARGS},
@@ -654,14 +812,18 @@ mmap_buffer_getbuf(mmap_object *self, Py_buffer *view, int flags)
         if (PyBuffer_FillInfo(view, self->data, self->size,
                               (self->access == ACCESS_READ), flags) < 0)
                 return -1;
-        self->exports++;
+	/* Exports only hold off close() and resize(), which a shareable mmap
+	   can't do anyway, and counting them would race */
+	if (!self->shareable)
+		self->exports++;
         return 0;
 }
 
 static void
 mmap_buffer_releasebuf(mmap_object *self, Py_buffer *view)
 {
-        self->exports--;
+	if (!self->shareable)
+		self->exports--;
 }
 
 static Py_ssize_t
@@ -917,7 +1079,13 @@ object will be private to this process, and MAP_SHARED`creates a mapping\n\
 that's shared with all other processes mapping the same areas of the file.\n\
 The default value is MAP_SHARED.\n\
 \n\
-To map anonymous memory, pass -1 as the fileno (both versions).");
+To map anonymous memory, pass -1 as the fileno (both versions).\n\
+\n\
+Both versions also take a keyword argument shareable.  If true, the map\n\
+must be read-only, and it can be handed to other threads, which may index,\n\
+slice and search it at once.  It then has no position, so read(),\n\
+readline(), read_byte() and seek() aren't available, and it can't be\n\
+closed; it's unmapped when the last reference to it goes.");
 
 
 static PyTypeObject mmap_object_type = {
@@ -941,7 +1109,8 @@ static PyTypeObject mmap_object_type = {
 	PyObject_GenericGetAttr,		/*tp_getattro*/
 	0,					/*tp_setattro*/
 	&mmap_as_buffer,			/*tp_as_buffer*/
-	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,		/*tp_flags*/
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE |
+		Py_TPFLAGS_SHAREABLE,			/*tp_flags*/
 	mmap_doc,				/*tp_doc*/
 	0,					/* tp_traverse */
 	0,					/* tp_clear */
@@ -959,6 +1128,13 @@ static PyTypeObject mmap_object_type = {
 	0,					/* tp_dictoffset */
 	0,                                      /* tp_init */
 	new_mmap_object,			/* tp_new */
+	0,					/* tp_is_gc */
+	0,					/* tp_bases */
+	0,					/* tp_mro */
+	0,					/* tp_cache */
+	0,					/* tp_subclasses */
+	0,					/* tp_weaklist */
+	(isshareablefunc)mmap_isshareable,	/* tp_isshareable */
 };
 
 
@@ -1001,13 +1177,15 @@ new_mmap_object(PyTypeObject *type, PyObject *args, PyObject *kwdict)
 	int fd, flags = MAP_SHARED, prot = PROT_WRITE | PROT_READ;
 	int devzero = -1;
 	int access = (int)ACCESS_DEFAULT;
+	int shareable = 0;
 	static char *keywords[] = {"fileno", "length",
                                          "flags", "prot",
-                                         "access", "offset", NULL};
+                                         "access", "offset", "shareable",
+                                         NULL};
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwdict, "iO|iiiO", keywords,
+	if (!PyArg_ParseTupleAndKeywords(args, kwdict, "iO|iiiOi", keywords,
 					 &fd, &map_size_obj, &flags, &prot,
-                                         &access, &offset_obj))
+                                         &access, &offset_obj, &shareable))
 		return NULL;
 	map_size = _GetMapSize(map_size_obj, "size");
 	if (map_size < 0)
@@ -1044,6 +1222,9 @@ new_mmap_object(PyTypeObject *type, PyObject *args, PyObject *kwdict)
     if (prot == PROT_READ) {
         access = ACCESS_READ;
     }
+	if (shareable && access != ACCESS_READ)
+		return PyErr_Format(PyExc_ValueError,
+				    "shareable mmap must be read-only.");
 
 #ifdef HAVE_FSTAT
 #  ifdef __VMS
@@ -1068,6 +1249,7 @@ new_mmap_object(PyTypeObject *type, PyObject *args, PyObject *kwdict)
 	m_obj->size = (size_t) map_size;
 	m_obj->pos = (size_t) 0;
 	m_obj->exports = 0;
+	m_obj->shareable = 0;
         m_obj->offset = offset;
 	if (fd == -1) {
 		m_obj->fd = -1;
@@ -1111,6 +1293,7 @@ new_mmap_object(PyTypeObject *type, PyObject *args, PyObject *kwdict)
 		return NULL;
 	}
 	m_obj->access = (access_mode)access;
+	m_obj->shareable = shareable != 0;
 	return (PyObject *)m_obj;
 }
 #endif /* UNIX */
@@ -1131,16 +1314,22 @@ new_mmap_object(PyTypeObject *type, PyObject *args, PyObject *kwdict)
 	int fileno;
 	HANDLE fh = 0;
 	int access = (access_mode)ACCESS_DEFAULT;
+	int shareable = 0;
 	DWORD flProtect, dwDesiredAccess;
 	static char *keywords[] = { "fileno", "length",
                                           "tagname",
-                                          "access", "offset", NULL };
+                                          "access", "offset", "shareable",
+                                          NULL };
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwdict, "iO|ziO", keywords,
+	if (!PyArg_ParseTupleAndKeywords(args, kwdict, "iO|ziOi", keywords,
 					 &fileno, &map_size_obj,
-					 &tagname, &access, &offset_obj)) {
+					 &tagname, &access, &offset_obj,
+					 &shareable)) {
 		return NULL;
 	}
+	if (shareable && access != ACCESS_READ)
+		return PyErr_Format(PyExc_ValueError,
+				    "shareable mmap must be read-only.");
 
 	switch((access_mode)access) {
 	case ACCESS_READ:
@@ -1186,7 +1375,7 @@ new_mmap_object(PyTypeObject *type, PyObject *args, PyObject *kwdict)
 		lseek(fileno, 0, SEEK_SET);
 	}
 
-	m_obj = PyObject_New(&type);
+	m_obj = PyObject_New(type);
 	if (m_obj == NULL)
 		return NULL;
 	/* Set every field to an invalid marker, so we can safely
@@ -1196,6 +1385,7 @@ new_mmap_object(PyTypeObject *type, PyObject *args, PyObject *kwdict)
 	m_obj->map_handle = INVALID_HANDLE_VALUE;
 	m_obj->tagname = NULL;
 	m_obj->offset = offset;
+	m_obj->shareable = 0;
 
 	if (fh) {
 		/* It is necessary to duplicate the handle, so the
@@ -1289,8 +1479,10 @@ new_mmap_object(PyTypeObject *type, PyObject *args, PyObject *kwdict)
 						     off_hi,
 						     off_lo,
 						     0);
-		if (m_obj->data != NULL)
+		if (m_obj->data != NULL) {
+			m_obj->shareable = shareable != 0;
 			return (PyObject *)m_obj;
+		}
 		else
 			dwErr = GetLastError();
 	} else
@@ -1364,4 +1556,28 @@ initmmap(void)
 	setint(dict, "ACCESS_READ", ACCESS_READ);
 	setint(dict, "ACCESS_WRITE", ACCESS_WRITE);
 	setint(dict, "ACCESS_COPY", ACCESS_COPY);
+
+#ifdef HAVE_MADVISE
+#ifdef MADV_NORMAL
+	setint(dict, "MADV_NORMAL", MADV_NORMAL);
+#endif
+#ifdef MADV_RANDOM
+	setint(dict, "MADV_RANDOM", MADV_RANDOM);
+#endif
+#ifdef MADV_SEQUENTIAL
+	setint(dict, "MADV_SEQUENTIAL", MADV_SEQUENTIAL);
+#endif
+#ifdef MADV_WILLNEED
+	setint(dict, "MADV_WILLNEED", MADV_WILLNEED);
+#endif
+#ifdef MADV_DONTNEED
+	setint(dict, "MADV_DONTNEED", MADV_DONTNEED);
+#endif
+#ifdef MADV_HUGEPAGE
+	setint(dict, "MADV_HUGEPAGE", MADV_HUGEPAGE);
+#endif
+#ifdef MADV_NOHUGEPAGE
+	setint(dict, "MADV_NOHUGEPAGE", MADV_NOHUGEPAGE);
+#endif
+#endif /* HAVE_MADVISE */
 }
@@ -288,13 +288,151 @@ void sha1_done(struct sha1_state *sha1, unsigned char *out)
  * ------------------------------------------------------------------------
  */
 
+/* Multi-buffer kernels for sha1_many() and sha1_leaves(); see hashmany.h */
+
+#include "hashmany.h"
+
+#ifdef HASHMANY_VECTOR
+
+#define VROL(x, n)      ((x) << (n) | (x) >> (32 - (n)))
+
+static void
+sha1_lanes_compress(void *state, const unsigned char **blocks)
+{
+    hashmany_u32 *S = state, W[80], a, b, c, d, e, t;
+    hashmany_u32 k0 = {0x5a827999UL, 0x5a827999UL, 0x5a827999UL, 0x5a827999UL};
+    hashmany_u32 k1 = {0x6ed9eba1UL, 0x6ed9eba1UL, 0x6ed9eba1UL, 0x6ed9eba1UL};
+    hashmany_u32 k2 = {0x8f1bbcdcUL, 0x8f1bbcdcUL, 0x8f1bbcdcUL, 0x8f1bbcdcUL};
+    hashmany_u32 k3 = {0xca62c1d6UL, 0xca62c1d6UL, 0xca62c1d6UL, 0xca62c1d6UL};
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        hashmany_u32 w = {hashmany_load32be(blocks[0] + 4 * i),
+                          hashmany_load32be(blocks[1] + 4 * i),
+                          hashmany_load32be(blocks[2] + 4 * i),
+                          hashmany_load32be(blocks[3] + 4 * i)};
+        W[i] = w;
+    }
+    for (i = 16; i < 80; i++) {
+        t = W[i-3] ^ W[i-8] ^ W[i-14] ^ W[i-16];
+        W[i] = VROL(t, 1);
+    }
+
+    a = S[0];
+    b = S[1];
+    c = S[2];
+    d = S[3];
+    e = S[4];
+
+    #define VFF(f,k,a,b,c,d,e,i) e += VROL(a, 5) + f(b,c,d) + W[i] + k; b = VROL(b, 30);
+
+    for (i = 0; i < 20; i += 5) {
+       VFF(F0,k0,a,b,c,d,e,i);
+       VFF(F0,k0,e,a,b,c,d,i+1);
+       VFF(F0,k0,d,e,a,b,c,i+2);
+       VFF(F0,k0,c,d,e,a,b,i+3);
+       VFF(F0,k0,b,c,d,e,a,i+4);
+    }
+    for (; i < 40; i += 5) {
+       VFF(F1,k1,a,b,c,d,e,i);
+       VFF(F1,k1,e,a,b,c,d,i+1);
+       VFF(F1,k1,d,e,a,b,c,i+2);
+       VFF(F1,k1,c,d,e,a,b,i+3);
+       VFF(F1,k1,b,c,d,e,a,i+4);
+    }
+    for (; i < 60; i += 5) {
+       VFF(F2,k2,a,b,c,d,e,i);
+       VFF(F2,k2,e,a,b,c,d,i+1);
+       VFF(F2,k2,d,e,a,b,c,i+2);
+       VFF(F2,k2,c,d,e,a,b,i+3);
+       VFF(F2,k2,b,c,d,e,a,i+4);
+    }
+    for (; i < 80; i += 5) {
+       VFF(F3,k3,a,b,c,d,e,i);
+       VFF(F3,k3,e,a,b,c,d,i+1);
+       VFF(F3,k3,d,e,a,b,c,i+2);
+       VFF(F3,k3,c,d,e,a,b,i+3);
+       VFF(F3,k3,b,c,d,e,a,i+4);
+    }
+
+    #undef VFF
+
+    S[0] += a;
+    S[1] += b;
+    S[2] += c;
+    S[3] += d;
+    S[4] += e;
+}
+
+static void
+sha1_lanes_init(void *state, int lane)
+{
+    hashmany_u32 *S = state;
+
+    S[0][lane] = 0x67452301UL;
+    S[1][lane] = 0xefcdab89UL;
+    S[2][lane] = 0x98badcfeUL;
+    S[3][lane] = 0x10325476UL;
+    S[4][lane] = 0xc3d2e1f0UL;
+}
+
+static void
+sha1_lanes_digest(void *state, int lane, unsigned char *out)
+{
+    hashmany_u32 *S = state;
+    int i;
+
+    for (i = 0; i < 5; i++) {
+        STORE32H(S[i][lane], out+(4*i));
+    }
+}
+
+static const hashmany_algorithm sha1_algorithm = {
+    4, SHA1_BLOCKSIZE, SHA1_DIGESTSIZE, 8, 0,
+    sha1_lanes_init, sha1_lanes_compress, sha1_lanes_digest
+};
+
+#else /* !HASHMANY_VECTOR */
+
+/* One lane, in a struct sha1_state */
+
+static void
+sha1_one_init(void *state, int lane)
+{
+    sha1_init((struct sha1_state *)state);
+}
+
+static void
+sha1_one_compress(void *state, const unsigned char **blocks)
+{
+    sha1_compress((struct sha1_state *)state, (unsigned char *)blocks[0]);
+}
+
+static void
+sha1_one_digest(void *state, int lane, unsigned char *out)
+{
+    struct sha1_state *sha1 = state;
+    int i;
+
+    for (i = 0; i < 5; i++) {
+        STORE32H(sha1->state[i], out+(4*i));
+    }
+}
+
+static const hashmany_algorithm sha1_algorithm = {
+    1, SHA1_BLOCKSIZE, SHA1_DIGESTSIZE, 8, 0,
+    sha1_one_init, sha1_one_compress, sha1_one_digest
+};
+
+#endif /* !HASHMANY_VECTOR */
+
 static PyTypeObject SHA1type;
 
 
 static SHA1object *
 newSHA1object(void)
 {
-    return (SHA1object *)PyObject_New(SHA1object, &SHA1type);
+    return (SHA1object *)PyObject_New(&SHA1type);
 }
 
 
@@ -510,11 +648,51 @@ SHA1_new(PyObject *self, PyObject *args, PyObject *kwdict)
     return (PyObject *)new;
 }
 
+PyDoc_STRVAR(SHA1_many__doc__,
+"sha1_many(buffers[, threads]) -> list of digests\n\
+\n\
+Return the SHA1 digest of each of buffers, hashing several at once.\n\
+Optional arg threads is how many threads to use; by default it's one per\n\
+CPU, as far as there's enough to hash to keep them busy.");
+
+static PyObject *
+SHA1_many(PyObject *self, PyObject *args)
+{
+    PyObject *buffers;
+    int threads = 0;
+
+    if (!PyArg_ParseTuple(args, "O|i:sha1_many", &buffers, &threads))
+        return NULL;
+    return hashmany_buffers(&sha1_algorithm, buffers, threads);
+}
+
+PyDoc_STRVAR(SHA1_leaves__doc__,
+"sha1_leaves(data, leaf_size[, offset[, threads]]) -> list of digests\n\
+\n\
+Return the SHA1 digest of each leaf_size piece of data[offset:], hashing\n\
+several at once, as sha1_many() does.  A shorter piece at the end is left\n\
+out.");
+
+static PyObject *
+SHA1_leaves(PyObject *self, PyObject *args)
+{
+    PyObject *data;
+    Py_ssize_t leaf_size, offset = 0;
+    int threads = 0;
+
+    if (!PyArg_ParseTuple(args, "On|ni:sha1_leaves", &data, &leaf_size,
+                          &offset, &threads))
+        return NULL;
+    return hashmany_leaves(&sha1_algorithm, data, leaf_size, offset, threads);
+}
+
 
 /* List of functions exported by this module */
 
 static struct PyMethodDef SHA1_functions[] = {
     {"sha1",(PyCFunction)SHA1_new, METH_VARARGS|METH_KEYWORDS,SHA1_new__doc__},
+    {"sha1_many", (PyCFunction)SHA1_many, METH_VARARGS, SHA1_many__doc__},
+    {"sha1_leaves", (PyCFunction)SHA1_leaves, METH_VARARGS, SHA1_leaves__doc__},
     {NULL,	NULL}		 /* Sentinel */
 };
 
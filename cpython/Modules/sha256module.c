@@ -375,6 +375,193 @@ sha_final(unsigned char digest[SHA_DIGESTSIZE], SHAobject *sha_info)
  * ------------------------------------------------------------------------
  */
 
+/* Multi-buffer kernels for sha256_many() and friends; see hashmany.h */
+
+#include "hashmany.h"
+
+#ifdef HASHMANY_VECTOR
+
+static const SHA_INT32 sha256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/* The logical functions above, on a word of each lane */
+#define VROR(x, n)      ((x) >> (n) | (x) << (32 - (n)))
+#define VSigma0(x)      (VROR(x, 2) ^ VROR(x, 13) ^ VROR(x, 22))
+#define VSigma1(x)      (VROR(x, 6) ^ VROR(x, 11) ^ VROR(x, 25))
+#define VGamma0(x)      (VROR(x, 7) ^ VROR(x, 18) ^ ((x) >> 3))
+#define VGamma1(x)      (VROR(x, 17) ^ VROR(x, 19) ^ ((x) >> 10))
+
+static void
+sha256_lanes_compress(void *state, const unsigned char **blocks)
+{
+    hashmany_u32 *S = state, W[64], a, b, c, d, e, f, g, h, t0, t1;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        hashmany_u32 w = {hashmany_load32be(blocks[0] + 4 * i),
+                          hashmany_load32be(blocks[1] + 4 * i),
+                          hashmany_load32be(blocks[2] + 4 * i),
+                          hashmany_load32be(blocks[3] + 4 * i)};
+        W[i] = w;
+    }
+    for (i = 16; i < 64; i++)
+        W[i] = VGamma1(W[i - 2]) + W[i - 7] + VGamma0(W[i - 15]) + W[i - 16];
+
+    a = S[0]; b = S[1]; c = S[2]; d = S[3];
+    e = S[4]; f = S[5]; g = S[6]; h = S[7];
+
+#define VRND(a,b,c,d,e,f,g,h,i)                                 \
+    {                                                           \
+        hashmany_u32 k = {sha256_K[i], sha256_K[i],             \
+                          sha256_K[i], sha256_K[i]};            \
+        t0 = h + VSigma1(e) + Ch(e, f, g) + k + W[i];           \
+        t1 = VSigma0(a) + Maj(a, b, c);                         \
+        d += t0;                                                \
+        h  = t0 + t1;                                           \
+    }
+
+    for (i = 0; i < 64; i += 8) {
+        VRND(a,b,c,d,e,f,g,h,i);
+        VRND(h,a,b,c,d,e,f,g,i+1);
+        VRND(g,h,a,b,c,d,e,f,i+2);
+        VRND(f,g,h,a,b,c,d,e,i+3);
+        VRND(e,f,g,h,a,b,c,d,i+4);
+        VRND(d,e,f,g,h,a,b,c,i+5);
+        VRND(c,d,e,f,g,h,a,b,i+6);
+        VRND(b,c,d,e,f,g,h,a,i+7);
+    }
+
+#undef VRND
+
+    S[0] += a; S[1] += b; S[2] += c; S[3] += d;
+    S[4] += e; S[5] += f; S[6] += g; S[7] += h;
+}
+
+static const SHA_INT32 sha256_iv[8] = {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+    0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+static const SHA_INT32 sha224_iv[8] = {
+    0xc1059ed8, 0x367cd507, 0x3070dd17, 0xf70e5939,
+    0xffc00b31, 0x68581511, 0x64f98fa7, 0xbefa4fa4
+};
+
+static void
+sha256_lanes_init(void *state, int lane)
+{
+    hashmany_u32 *S = state;
+    int i;
+
+    for (i = 0; i < 8; i++)
+        S[i][lane] = sha256_iv[i];
+}
+
+static void
+sha224_lanes_init(void *state, int lane)
+{
+    hashmany_u32 *S = state;
+    int i;
+
+    for (i = 0; i < 8; i++)
+        S[i][lane] = sha224_iv[i];
+}
+
+static void
+sha256_lanes_digest(void *state, int lane, unsigned char *out)
+{
+    hashmany_u32 *S = state;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        out[4 * i]     = (unsigned char)(S[i][lane] >> 24);
+        out[4 * i + 1] = (unsigned char)(S[i][lane] >> 16);
+        out[4 * i + 2] = (unsigned char)(S[i][lane] >> 8);
+        out[4 * i + 3] = (unsigned char)S[i][lane];
+    }
+}
+
+static void
+sha224_lanes_digest(void *state, int lane, unsigned char *out)
+{
+    unsigned char digest[SHA_DIGESTSIZE];
+
+    sha256_lanes_digest(state, lane, digest);
+    memcpy(out, digest, 28);
+}
+
+static const hashmany_algorithm sha256_algorithm = {
+    4, SHA_BLOCKSIZE, 32, 8, 0,
+    sha256_lanes_init, sha256_lanes_compress, sha256_lanes_digest
+};
+
+static const hashmany_algorithm sha224_algorithm = {
+    4, SHA_BLOCKSIZE, 28, 8, 0,
+    sha224_lanes_init, sha256_lanes_compress, sha224_lanes_digest
+};
+
+#else /* !HASHMANY_VECTOR */
+
+/* One lane, kept in an SHAobject that's never a Python object */
+
+static void
+sha256_one_init(void *state, int lane)
+{
+    sha_init((SHAobject *)state);
+}
+
+static void
+sha224_one_init(void *state, int lane)
+{
+    sha224_init((SHAobject *)state);
+}
+
+static void
+sha256_one_compress(void *state, const unsigned char **blocks)
+{
+    SHAobject *sha_info = state;
+
+    memcpy(sha_info->data, blocks[0], SHA_BLOCKSIZE);
+    sha_transform(sha_info);
+}
+
+static void
+sha256_one_digest(void *state, int lane, unsigned char *out)
+{
+    SHAobject *sha_info = state;
+    int i;
+
+    for (i = 0; i < sha_info->digestsize / 4; i++) {
+        out[4 * i]     = (unsigned char)(sha_info->digest[i] >> 24);
+        out[4 * i + 1] = (unsigned char)(sha_info->digest[i] >> 16);
+        out[4 * i + 2] = (unsigned char)(sha_info->digest[i] >> 8);
+        out[4 * i + 3] = (unsigned char)sha_info->digest[i];
+    }
+}
+
+static const hashmany_algorithm sha256_algorithm = {
+    1, SHA_BLOCKSIZE, 32, 8, 0,
+    sha256_one_init, sha256_one_compress, sha256_one_digest
+};
+
+static const hashmany_algorithm sha224_algorithm = {
+    1, SHA_BLOCKSIZE, 28, 8, 0,
+    sha224_one_init, sha256_one_compress, sha256_one_digest
+};
+
+#endif /* !HASHMANY_VECTOR */
+
 static PyTypeObject SHA224type;
 static PyTypeObject SHA256type;
 
@@ -382,13 +569,13 @@ static PyTypeObject SHA256type;
 static SHAobject *
 newSHA224object(void)
 {
-    return (SHAobject *)PyObject_New(SHAobject, &SHA224type);
+    return (SHAobject *)PyObject_New(&SHA224type);
 }
 
 static SHAobject *
 newSHA256object(void)
 {
-    return (SHAobject *)PyObject_New(SHAobject, &SHA256type);
+    return (SHAobject *)PyObject_New(&SHA256type);
 }
 
 /* Internal methods for a hash object */
@@ -668,12 +855,90 @@ SHA224_new(PyObject *self, PyObject *args, PyObject *kwdict)
     return (PyObject *)new;
 }
 
+PyDoc_STRVAR(SHA256_many__doc__,
+"sha256_many(buffers[, threads]) -> list of digests\n\
+\n\
+Return the SHA-256 digest of each of buffers, hashing several at once.\n\
+Optional arg threads is how many threads to use; by default it's one per\n\
+CPU, as far as there's enough to hash to keep them busy.");
+
+static PyObject *
+SHA256_many(PyObject *self, PyObject *args)
+{
+    PyObject *buffers;
+    int threads = 0;
+
+    if (!PyArg_ParseTuple(args, "O|i:sha256_many", &buffers, &threads))
+        return NULL;
+    return hashmany_buffers(&sha256_algorithm, buffers, threads);
+}
+
+PyDoc_STRVAR(SHA224_many__doc__,
+"sha224_many(buffers[, threads]) -> list of digests\n\
+\n\
+Like sha256_many(), for SHA-224.");
+
+static PyObject *
+SHA224_many(PyObject *self, PyObject *args)
+{
+    PyObject *buffers;
+    int threads = 0;
+
+    if (!PyArg_ParseTuple(args, "O|i:sha224_many", &buffers, &threads))
+        return NULL;
+    return hashmany_buffers(&sha224_algorithm, buffers, threads);
+}
+
+PyDoc_STRVAR(SHA256_leaves__doc__,
+"sha256_leaves(data, leaf_size[, offset[, threads]]) -> list of digests\n\
+\n\
+Return the SHA-256 digest of each leaf_size piece of data[offset:],\n\
+hashing several at once, as sha256_many() does.  A shorter piece at the\n\
+end is left out.");
+
+static PyObject *
+SHA256_leaves(PyObject *self, PyObject *args)
+{
+    PyObject *data;
+    Py_ssize_t leaf_size, offset = 0;
+    int threads = 0;
+
+    if (!PyArg_ParseTuple(args, "On|ni:sha256_leaves", &data, &leaf_size,
+                          &offset, &threads))
+        return NULL;
+    return hashmany_leaves(&sha256_algorithm, data, leaf_size, offset,
+                           threads);
+}
+
+PyDoc_STRVAR(SHA224_leaves__doc__,
+"sha224_leaves(data, leaf_size[, offset[, threads]]) -> list of digests\n\
+\n\
+Like sha256_leaves(), for SHA-224.");
+
+static PyObject *
+SHA224_leaves(PyObject *self, PyObject *args)
+{
+    PyObject *data;
+    Py_ssize_t leaf_size, offset = 0;
+    int threads = 0;
+
+    if (!PyArg_ParseTuple(args, "On|ni:sha224_leaves", &data, &leaf_size,
+                          &offset, &threads))
+        return NULL;
+    return hashmany_leaves(&sha224_algorithm, data, leaf_size, offset,
+                           threads);
+}
+
 
 /* List of functions exported by this module */
 
 static struct PyMethodDef SHA_functions[] = {
     {"sha256", (PyCFunction)SHA256_new, METH_VARARGS|METH_KEYWORDS, SHA256_new__doc__},
     {"sha224", (PyCFunction)SHA224_new, METH_VARARGS|METH_KEYWORDS, SHA224_new__doc__},
+    {"sha256_many", (PyCFunction)SHA256_many, METH_VARARGS, SHA256_many__doc__},
+    {"sha224_many", (PyCFunction)SHA224_many, METH_VARARGS, SHA224_many__doc__},
+    {"sha256_leaves", (PyCFunction)SHA256_leaves, METH_VARARGS, SHA256_leaves__doc__},
+    {"sha224_leaves", (PyCFunction)SHA224_leaves, METH_VARARGS, SHA224_leaves__doc__},
     {NULL,	NULL}		 /* Sentinel */
 };
 
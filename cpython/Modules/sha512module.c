@@ -441,6 +441,59 @@ sha512_final(unsigned char digest[SHA_DIGESTSIZE], SHAobject *sha_info)
  * ------------------------------------------------------------------------
  */
 
+/* Multi-buffer kernels for sha512_many() and friends; see hashmany.h */
+
+#include "hashmany.h"
+
+/* Unlike the 32-bit hashes, a lane per SIMD element loses to the plain
+   transform: without 64-bit vector rotates, the rounds cost more than
+   they save.  So there's one lane, and what's gained is hashing outside
+   the Python thread, several threads at a time.  The lane is kept in an
+   SHAobject that's never a Python object. */
+
+static void
+sha512_one_init(void *state, int lane)
+{
+    sha512_init((SHAobject *)state);
+}
+
+static void
+sha384_one_init(void *state, int lane)
+{
+    sha384_init((SHAobject *)state);
+}
+
+static void
+sha512_one_compress(void *state, const unsigned char **blocks)
+{
+    SHAobject *sha_info = state;
+
+    memcpy(sha_info->data, blocks[0], SHA_BLOCKSIZE);
+    sha512_transform(sha_info);
+}
+
+static void
+sha512_one_digest(void *state, int lane, unsigned char *out)
+{
+    SHAobject *sha_info = state;
+    int i, j;
+
+    for (i = 0; i < sha_info->digestsize / 8; i++)
+        for (j = 0; j < 8; j++)
+            out[8 * i + j] =
+                (unsigned char)(sha_info->digest[i] >> (56 - 8 * j));
+}
+
+static const hashmany_algorithm sha512_algorithm = {
+    1, SHA_BLOCKSIZE, 64, 16, 0,
+    sha512_one_init, sha512_one_compress, sha512_one_digest
+};
+
+static const hashmany_algorithm sha384_algorithm = {
+    1, SHA_BLOCKSIZE, 48, 16, 0,
+    sha384_one_init, sha512_one_compress, sha512_one_digest
+};
+
 static PyTypeObject SHA384type;
 static PyTypeObject SHA512type;
 
@@ -448,13 +501,13 @@ static PyTypeObject SHA512type;
 static SHAobject *
 newSHA384object(void)
 {
-    return (SHAobject *)PyObject_New(SHAobject, &SHA384type);
+    return (SHAobject *)PyObject_New(&SHA384type);
 }
 
 static SHAobject *
 newSHA512object(void)
 {
-    return (SHAobject *)PyObject_New(SHAobject, &SHA512type);
+    return (SHAobject *)PyObject_New(&SHA512type);
 }
 
 /* Internal methods for a hash object */
@@ -734,12 +787,90 @@ SHA384_new(PyObject *self, PyObject *args, PyObject *kwdict)
     return (PyObject *)new;
 }
 
+PyDoc_STRVAR(SHA512_many__doc__,
+"sha512_many(buffers[, threads]) -> list of digests\n\
+\n\
+Return the SHA-512 digest of each of buffers, hashing several at once.\n\
+Optional arg threads is how many threads to use; by default it's one per\n\
+CPU, as far as there's enough to hash to keep them busy.");
+
+static PyObject *
+SHA512_many(PyObject *self, PyObject *args)
+{
+    PyObject *buffers;
+    int threads = 0;
+
+    if (!PyArg_ParseTuple(args, "O|i:sha512_many", &buffers, &threads))
+        return NULL;
+    return hashmany_buffers(&sha512_algorithm, buffers, threads);
+}
+
+PyDoc_STRVAR(SHA384_many__doc__,
+"sha384_many(buffers[, threads]) -> list of digests\n\
+\n\
+Like sha512_many(), for SHA-384.");
+
+static PyObject *
+SHA384_many(PyObject *self, PyObject *args)
+{
+    PyObject *buffers;
+    int threads = 0;
+
+    if (!PyArg_ParseTuple(args, "O|i:sha384_many", &buffers, &threads))
+        return NULL;
+    return hashmany_buffers(&sha384_algorithm, buffers, threads);
+}
+
+PyDoc_STRVAR(SHA512_leaves__doc__,
+"sha512_leaves(data, leaf_size[, offset[, threads]]) -> list of digests\n\
+\n\
+Return the SHA-512 digest of each leaf_size piece of data[offset:],\n\
+hashing several at once, as sha512_many() does.  A shorter piece at the\n\
+end is left out.");
+
+static PyObject *
+SHA512_leaves(PyObject *self, PyObject *args)
+{
+    PyObject *data;
+    Py_ssize_t leaf_size, offset = 0;
+    int threads = 0;
+
+    if (!PyArg_ParseTuple(args, "On|ni:sha512_leaves", &data, &leaf_size,
+                          &offset, &threads))
+        return NULL;
+    return hashmany_leaves(&sha512_algorithm, data, leaf_size, offset,
+                           threads);
+}
+
+PyDoc_STRVAR(SHA384_leaves__doc__,
+"sha384_leaves(data, leaf_size[, offset[, threads]]) -> list of digests\n\
+\n\
+Like sha512_leaves(), for SHA-384.");
+
+static PyObject *
+SHA384_leaves(PyObject *self, PyObject *args)
+{
+    PyObject *data;
+    Py_ssize_t leaf_size, offset = 0;
+    int threads = 0;
+
+    if (!PyArg_ParseTuple(args, "On|ni:sha384_leaves", &data, &leaf_size,
+                          &offset, &threads))
+        return NULL;
+    return hashmany_leaves(&sha384_algorithm, data, leaf_size, offset,
+                           threads);
+}
+
 
 /* List of functions exported by this module */
 
 static struct PyMethodDef SHA_functions[] = {
     {"sha512", (PyCFunction)SHA512_new, METH_VARARGS|METH_KEYWORDS, SHA512_new__doc__},
     {"sha384", (PyCFunction)SHA384_new, METH_VARARGS|METH_KEYWORDS, SHA384_new__doc__},
+    {"sha512_many", (PyCFunction)SHA512_many, METH_VARARGS, SHA512_many__doc__},
+    {"sha384_many", (PyCFunction)SHA384_many, METH_VARARGS, SHA384_many__doc__},
+    {"sha512_leaves", (PyCFunction)SHA512_leaves, METH_VARARGS, SHA512_leaves__doc__},
+    {"sha384_leaves", (PyCFunction)SHA384_leaves, METH_VARARGS, SHA384_leaves__doc__},
     {NULL,	NULL}		 /* Sentinel */
 };
 
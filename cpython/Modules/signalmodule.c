@@ -745,7 +745,8 @@ _PySignal_Init(void)
     }
     pthread_sigmask(SIG_BLOCK, &set, NULL);
 
-    signal_branch_crit = PyCritical_Allocate(PyCRITICAL_NORMAL);
+    signal_branch_crit = PyCritical_AllocateNamed(PyCRITICAL_NORMAL,
+        "signal branch");
     if (signal_branch_crit == NULL)
         Py_FatalError("failed to initialize signal_branch_crit");
 
@@ -91,6 +91,7 @@ Local naming conventions:
 
 #include "Python.h"
 #include "structmember.h"
+#include "cancelobject.h"
 
 #undef MAX
 #define MAX(x, y) ((x) < (y) ? (y) : (x))
@@ -456,6 +457,13 @@ static PyTypeObject sock_type;
 #include <sys/poll.h>
 #endif
 
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+#ifdef HAVE_SPLICE
+#include <fcntl.h>
+#endif
+
 #ifdef Py_SOCKET_FD_CAN_BE_GE_FD_SETSIZE
 /* Platform can select file descriptors beyond FD_SETSIZE */
 #define IS_SELECTABLE(s) 1
@@ -2549,6 +2557,487 @@ until all data is sent.  If an error occurs, it's impossible\n\
 to tell how much data has been sent.");
 
 
+#if defined(HAVE_SENDFILE) || defined(HAVE_SPLICE) || \
+    defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)
+
+/* sendfile() and splice_to() move data between fds in the kernel,
+   TRANSFER_CHUNK bytes per system call, and recvmmsg_into() and
+   sendmmsg() move many datagrams per system call.  Before each one we
+   wait for the socket: with internal_select() if it has a timeout, or
+   with PyCancel_Poll() if it's blocking, so that a cancelled branch
+   child gets out between calls.  Returns 0, or -1 with an exception
+   set. */
+
+#define TRANSFER_CHUNK (64 * 1024)
+
+static int
+transfer_wait(PySocketSockObject *s, int writing)
+{
+	int timeout;
+
+	if (s->sock_timeout < 0.0)
+		return PyCancel_Poll(s->sock_fd, writing ? POLLOUT : POLLIN);
+
+	Py_BEGIN_ALLOW_THREADS
+	timeout = internal_select(s, writing);
+	Py_END_ALLOW_THREADS
+
+	if (timeout == 1) {
+		PyErr_SetString(socket_timeout, "timed out");
+		return -1;
+	}
+	if (timeout < 0) {
+		s->errorhandler();
+		return -1;
+	}
+	return 0;
+}
+
+#endif /* HAVE_SENDFILE || HAVE_SPLICE || HAVE_RECVMMSG || HAVE_SENDMMSG */
+
+
+#ifdef HAVE_SENDFILE
+
+/* s.sendfile(file[, offset[, count]]) method */
+
+static PyObject *
+sock_sendfile(PySocketSockObject *s, PyObject *args)
+{
+	PyObject *fileobj, *countobj = Py_None;
+	Py_ssize_t offsetarg = 0, count = -1;
+	PY_LONG_LONG total = 0;
+	off_t offset;
+	ssize_t n;
+	int fd;
+
+	if (!PyArg_ParseTuple(args, "O|nO:sendfile", &fileobj, &offsetarg,
+			      &countobj))
+		return NULL;
+
+	fd = PyObject_AsFileDescriptor(fileobj);
+	if (fd < 0)
+		return NULL;
+	if (offsetarg < 0) {
+		PyErr_SetString(PyExc_ValueError,
+				"negative offset in sendfile");
+		return NULL;
+	}
+	offset = offsetarg;
+	if (countobj != Py_None) {
+		count = PyNumber_AsSsize_t(countobj, PyExc_OverflowError);
+		if (count == -1 && PyErr_Occurred())
+			return NULL;
+		if (count < 0) {
+			PyErr_SetString(PyExc_ValueError,
+					"negative count in sendfile");
+			return NULL;
+		}
+	}
+
+	while (count != 0) {
+		size_t chunk = TRANSFER_CHUNK;
+
+		if (count > 0 && (size_t)count < chunk)
+			chunk = count;
+		if (transfer_wait(s, 1) < 0)
+			return NULL;
+
+		Py_BEGIN_ALLOW_THREADS
+		n = sendfile(s->sock_fd, fd, &offset, chunk);
+		Py_END_ALLOW_THREADS
+
+		if (n < 0) {
+			/* Someone else filled the buffer since we polled */
+			if (errno == EAGAIN && s->sock_timeout != 0.0)
+				continue;
+			if (errno == EAGAIN && total > 0)
+				break;
+			return s->errorhandler();
+		}
+		if (n == 0)
+			break;	/* End of file */
+		total += n;
+		if (count > 0)
+			count -= n;
+	}
+
+	return PyLong_FromLongLong(total);
+}
+
+PyDoc_STRVAR(sendfile_doc,
+"sendfile(file[, offset[, count]]) -> nbytes_sent\n\
+\n\
+Send count bytes (or up to the end) of file, starting at offset, without\n\
+copying them through Python.  file may be a file descriptor or have a\n\
+fileno() method; its file position isn't used or changed.  A\n\
+non-blocking socket stops once its buffer is full.");
+
+#endif /* HAVE_SENDFILE */
+
+
+#ifdef HAVE_SPLICE
+
+/* s.splice_to(other, nbytes) method */
+
+static PyObject *
+sock_splice_to(PySocketSockObject *s, PyObject *args)
+{
+	PySocketSockObject *other;
+	Py_ssize_t nbytes;
+	PY_LONG_LONG total = 0;
+	ssize_t n, inpipe;
+	int pipefd[2];
+
+	if (!PyArg_ParseTuple(args, "O!n:splice_to", &sock_type, &other,
+			      &nbytes))
+		return NULL;
+	if (nbytes < 0) {
+		PyErr_SetString(PyExc_ValueError,
+				"negative nbytes in splice_to");
+		return NULL;
+	}
+
+	/* splice() needs a pipe at one end, so the data goes through one
+	   on its way from socket to socket, staying in the kernel. */
+	if (pipe(pipefd) < 0)
+		return s->errorhandler();
+
+	while (total < nbytes) {
+		size_t chunk = TRANSFER_CHUNK;
+
+		if ((size_t)(nbytes - total) < chunk)
+			chunk = nbytes - total;
+		if (transfer_wait(s, 0) < 0)
+			goto error;
+
+		Py_BEGIN_ALLOW_THREADS
+		n = splice(s->sock_fd, NULL, pipefd[1], NULL, chunk,
+			   SPLICE_F_MOVE | SPLICE_F_MORE);
+		Py_END_ALLOW_THREADS
+
+		if (n < 0) {
+			if (errno == EAGAIN && s->sock_timeout != 0.0)
+				continue;
+			if (errno == EAGAIN && total > 0)
+				break;
+			s->errorhandler();
+			goto error;
+		}
+		if (n == 0)
+			break;	/* Other end closed */
+
+		/* What we've read has to be written, even if other is
+		   non-blocking, or it'd be lost */
+		for (inpipe = n; inpipe > 0; inpipe -= n) {
+			if (other->sock_timeout == 0.0) {
+				if (PyCancel_Poll(other->sock_fd, POLLOUT) < 0)
+					goto error;
+			} else if (transfer_wait(other, 1) < 0)
+				goto error;
+
+			Py_BEGIN_ALLOW_THREADS
+			n = splice(pipefd[0], NULL, other->sock_fd, NULL,
+				   inpipe, SPLICE_F_MOVE | SPLICE_F_MORE);
+			Py_END_ALLOW_THREADS
+
+			if (n < 0) {
+				if (errno == EAGAIN) {
+					n = 0;
+					continue;
+				}
+				other->errorhandler();
+				goto error;
+			}
+			total += n;
+		}
+	}
+
+	close(pipefd[0]);
+	close(pipefd[1]);
+	return PyLong_FromLongLong(total);
+
+error:
+	close(pipefd[0]);
+	close(pipefd[1]);
+	return NULL;
+}
+
+PyDoc_STRVAR(splice_to_doc,
+"splice_to(other, nbytes) -> nbytes_moved\n\
+\n\
+Receive up to nbytes from this socket and send them on to the socket\n\
+other, without copying them through Python.  Stops early if this\n\
+socket is closed by its peer or, when non-blocking, has no more data.\n\
+Everything received is sent, even if other is non-blocking.");
+
+#endif /* HAVE_SPLICE */
+
+
+#if defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)
+
+/* The arrays handed to recvmmsg() and sendmmsg(), one entry per
+   datagram, and the buffers they point into. */
+
+#define MMSG_MAX 1024	/* The kernel's limit, UIO_MAXIOV */
+
+typedef struct {
+	struct mmsghdr *msgs;
+	struct iovec *iovs;
+	sock_addr_t *addrs;
+	Py_buffer *views;
+	PyObject **objs;	/* Whose buffers are in views */
+	Py_ssize_t nviews;	/* How many views to release */
+} mmsg_vec;
+
+static int
+mmsg_alloc(mmsg_vec *v, Py_ssize_t n)
+{
+	v->msgs = PyMem_New(struct mmsghdr, n);
+	v->iovs = PyMem_New(struct iovec, n);
+	v->addrs = PyMem_New(sock_addr_t, n);
+	v->views = PyMem_New(Py_buffer, n);
+	v->objs = PyMem_New(PyObject *, n);
+	v->nviews = 0;
+	if (!v->msgs || !v->iovs || !v->addrs || !v->views || !v->objs) {
+		PyErr_NoMemory();
+		return -1;
+	}
+	memset(v->msgs, 0, n * sizeof(struct mmsghdr));
+	return 0;
+}
+
+/* Fills in entry nviews to point at obj's buffer, and returns it */
+static struct msghdr *
+mmsg_add(mmsg_vec *v, PyObject *obj, int flags)
+{
+	Py_ssize_t i = v->nviews;
+	struct msghdr *hdr = &v->msgs[i].msg_hdr;
+
+	if (PyObject_GetBuffer(obj, &v->views[i], flags) < 0)
+		return NULL;
+	v->objs[i] = obj;
+	v->nviews++;
+
+	v->iovs[i].iov_base = v->views[i].buf;
+	v->iovs[i].iov_len = v->views[i].len;
+	hdr->msg_iov = &v->iovs[i];
+	hdr->msg_iovlen = 1;
+	return hdr;
+}
+
+static void
+mmsg_free(mmsg_vec *v)
+{
+	Py_ssize_t i;
+
+	for (i = 0; i < v->nviews; i++)
+		PyObject_ReleaseBuffer(v->objs[i], &v->views[i]);
+	PyMem_Free(v->msgs);
+	PyMem_Free(v->iovs);
+	PyMem_Free(v->addrs);
+	PyMem_Free(v->views);
+	PyMem_Free(v->objs);
+}
+
+#endif /* HAVE_RECVMMSG || HAVE_SENDMMSG */
+
+
+#ifdef HAVE_RECVMMSG
+
+/* s.recvmmsg_into(buffers[, flags]) method */
+
+static PyObject *
+sock_recvmmsg_into(PySocketSockObject *s, PyObject *args)
+{
+	PyObject *buffers, *seq, *lengths = NULL, *addrs = NULL, *ret = NULL;
+	mmsg_vec v;
+	socklen_t addrlen;
+	Py_ssize_t i, n;
+	int count, flags = 0;
+
+	if (!PyArg_ParseTuple(args, "O|i:recvmmsg_into", &buffers, &flags))
+		return NULL;
+	if (!getsockaddrlen(s, &addrlen))
+		return NULL;
+	seq = PySequence_Fast(buffers,
+			      "recvmmsg_into() buffers must be a sequence");
+	if (seq == NULL)
+		return NULL;
+
+	n = PySequence_Fast_GET_SIZE(seq);
+	if (n > MMSG_MAX)
+		n = MMSG_MAX;
+	if (mmsg_alloc(&v, n) < 0)
+		goto finally;
+	for (i = 0; i < n; i++) {
+		struct msghdr *hdr = mmsg_add(&v,
+			PySequence_Fast_GET_ITEM(seq, i), PyBUF_WRITABLE);
+
+		if (hdr == NULL)
+			goto finally;
+		hdr->msg_name = &v.addrs[i];
+		hdr->msg_namelen = addrlen;
+	}
+
+	count = 0;
+	while (n > 0) {
+		if (transfer_wait(s, 0) < 0)
+			goto finally;
+
+		/* Take whatever has arrived, rather than waiting to fill
+		   every buffer */
+		Py_BEGIN_ALLOW_THREADS
+		count = recvmmsg(s->sock_fd, v.msgs, n, flags | MSG_DONTWAIT,
+				 NULL);
+		Py_END_ALLOW_THREADS
+
+		if (count >= 0)
+			break;
+		/* Someone else got it first, so wait again */
+		if (errno != EAGAIN || s->sock_timeout == 0.0) {
+			s->errorhandler();
+			goto finally;
+		}
+	}
+
+	lengths = PyList_New(count);
+	addrs = PyList_New(count);
+	if (lengths == NULL || addrs == NULL)
+		goto finally;
+	for (i = 0; i < count; i++) {
+		struct msghdr *hdr = &v.msgs[i].msg_hdr;
+		PyObject *length, *addr;
+
+		length = PyLong_FromLong((long)v.msgs[i].msg_len);
+		if (length == NULL)
+			goto finally;
+		PyList_SET_ITEM(lengths, i, length);
+		addr = makesockaddr(s->sock_fd, SAS2SA(&v.addrs[i]),
+				    hdr->msg_namelen, s->sock_proto);
+		if (addr == NULL)
+			goto finally;
+		PyList_SET_ITEM(addrs, i, addr);
+	}
+	ret = PyTuple_Pack(2, lengths, addrs);
+
+finally:
+	mmsg_free(&v);
+	Py_DECREF(seq);
+	Py_XDECREF(lengths);
+	Py_XDECREF(addrs);
+	return ret;
+}
+
+PyDoc_STRVAR(recvmmsg_into_doc,
+"recvmmsg_into(buffers[, flags]) -> (lengths, addresses)\n\
+\n\
+Receive as many datagrams as have arrived, up to one into each of the\n\
+writable buffers, in a single system call.  Waits for the first one\n\
+unless the socket is non-blocking.  lengths[i] is the number of bytes\n\
+written into buffers[i] by the datagram from addresses[i]; buffers\n\
+after the last one received are left as they were.  At most 1024\n\
+buffers are used.");
+
+#endif /* HAVE_RECVMMSG */
+
+
+#ifdef HAVE_SENDMMSG
+
+/* s.sendmmsg(messages[, flags]) method */
+
+static PyObject *
+sock_sendmmsg(PySocketSockObject *s, PyObject *args)
+{
+	PyObject *messages, *seq, *ret = NULL;
+	mmsg_vec v;
+	Py_ssize_t i, n, sent = 0;
+	int count, flags = 0;
+
+	if (!PyArg_ParseTuple(args, "O|i:sendmmsg", &messages, &flags))
+		return NULL;
+	seq = PySequence_Fast(messages, "sendmmsg() messages must be a sequence");
+	if (seq == NULL)
+		return NULL;
+
+	n = PySequence_Fast_GET_SIZE(seq);
+	if (n > MMSG_MAX)
+		n = MMSG_MAX;
+	if (mmsg_alloc(&v, n) < 0)
+		goto finally;
+	for (i = 0; i < n; i++) {
+		PyObject *data = PySequence_Fast_GET_ITEM(seq, i), *addro = NULL;
+		struct msghdr *hdr;
+		int addrlen;
+
+		if (PyTuple_Check(data)) {
+			if (PyTuple_GET_SIZE(data) != 2) {
+				PyErr_SetString(PyExc_TypeError,
+					"sendmmsg() messages must be data or "
+					"(data, address) pairs");
+				goto finally;
+			}
+			addro = PyTuple_GET_ITEM(data, 1);
+			data = PyTuple_GET_ITEM(data, 0);
+		}
+		if (PyUnicode_Check(data)) {
+			PyErr_SetString(PyExc_TypeError,
+				"sendmmsg() data must be bytes or a buffer, "
+				"not str");
+			goto finally;
+		}
+		hdr = mmsg_add(&v, data, PyBUF_SIMPLE);
+		if (hdr == NULL)
+			goto finally;
+		if (addro != NULL) {
+			if (!getsockaddrarg(s, addro, SAS2SA(&v.addrs[i]),
+					    &addrlen))
+				goto finally;
+			hdr->msg_name = &v.addrs[i];
+			hdr->msg_namelen = addrlen;
+		}
+	}
+
+	while (sent < n) {
+		if (transfer_wait(s, 1) < 0)
+			goto finally;
+
+		Py_BEGIN_ALLOW_THREADS
+		count = sendmmsg(s->sock_fd, v.msgs + sent, n - sent,
+				 flags | MSG_DONTWAIT);
+		Py_END_ALLOW_THREADS
+
+		if (count < 0) {
+			if (errno == EAGAIN && s->sock_timeout != 0.0)
+				continue;
+			if (errno == EAGAIN && sent > 0)
+				break;
+			s->errorhandler();
+			goto finally;
+		}
+		sent += count;
+		/* A non-blocking socket sends what it can in one go */
+		if (s->sock_timeout == 0.0)
+			break;
+	}
+	ret = PyLong_FromSsize_t(sent);
+
+finally:
+	mmsg_free(&v);
+	Py_DECREF(seq);
+	return ret;
+}
+
+PyDoc_STRVAR(sendmmsg_doc,
+"sendmmsg(messages[, flags]) -> count\n\
+\n\
+Send each of messages as a datagram, in as few system calls as\n\
+possible.  A message is either data, for a connected socket, or a\n\
+(data, address) pair.  Returns the number of messages sent, which is\n\
+all of them (up to the first 1024) unless the socket is non-blocking.");
+
+#endif /* HAVE_SENDMMSG */
+
+
 /* s.sendto(data, [flags,] sockaddr) method */
 
 static PyObject *
@@ -2684,10 +3173,22 @@ static PyMethodDef sock_methods[] = {
 			  recvfrom_doc},
 	{"recvfrom_into",  (PyCFunction)sock_recvfrom_into, METH_VARARGS | METH_KEYWORDS,
 			  recvfrom_into_doc},
+#ifdef HAVE_RECVMMSG
+	{"recvmmsg_into",  (PyCFunction)sock_recvmmsg_into, METH_VARARGS,
+			  recvmmsg_into_doc},
+#endif
 	{"send",	  (PyCFunction)sock_send, METH_VARARGS,
 			  send_doc},
 	{"sendall",	  (PyCFunction)sock_sendall, METH_VARARGS,
 			  sendall_doc},
+#ifdef HAVE_SENDFILE
+	{"sendfile",	  (PyCFunction)sock_sendfile, METH_VARARGS,
+			  sendfile_doc},
+#endif
+#ifdef HAVE_SENDMMSG
+	{"sendmmsg",	  (PyCFunction)sock_sendmmsg, METH_VARARGS,
+			  sendmmsg_doc},
+#endif
 	{"sendto",	  (PyCFunction)sock_sendto, METH_VARARGS,
 			  sendto_doc},
 	{"setblocking",	  (PyCFunction)sock_setblocking, METH_O,
@@ -2700,6 +3201,10 @@ static PyMethodDef sock_methods[] = {
 			  setsockopt_doc},
 	{"shutdown",	  (PyCFunction)sock_shutdown, METH_O,
 			  shutdown_doc},
+#ifdef HAVE_SPLICE
+	{"splice_to",	  (PyCFunction)sock_splice_to, METH_VARARGS,
+			  splice_to_doc},
+#endif
 	{NULL,			NULL}		/* sentinel */
 };
 
@@ -946,40 +946,8 @@ floattime(void)
 /* Implement floatsleep().
    When interrupted (or when another error occurs), return -1 and
    set an exception; else return 0. */
-static void
-sleep_wakeup(PyCancelQueue *queue, void *arg)
-{
-    PyThread_type_flag *flag = arg;
-    PyThread_flag_set(flag);
-}
-
 static int
 floatsleep(double secs)
 {
-    PyState *pystate = PyState_Get();
-    /* We reuse condition_flag here.  It shouldn't be in use at this
-     * point anyway */
-    PyThread_type_flag *flag = pystate->condition_flag;
-    PyCancelObject *cancel_scope;
-    int value;
-
-    cancel_scope = PyCancel_New(sleep_wakeup, flag, pystate);
-
-    PyCancel_Push(cancel_scope);
-    PyState_Suspend();
-
-    value = PyThread_flag_timedwait(flag, secs);
-
-    PyState_Resume();
-    PyCancel_Pop(cancel_scope);
-
-    PyThread_flag_clear(flag);
-    Py_DECREF(cancel_scope);
-
-    if (value) {
-        PyErr_SetString(PyExc_Cancelled, "sleep cancelled");
-        return -1;
-    }
-
-    return 0;
+    return PyCancel_Sleep(secs);
 }
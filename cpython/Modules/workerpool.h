@@ -0,0 +1,136 @@
+/* A pool of threads working through a job together, shared by the
+   compress_parallel() functions of zlib and bz2 and by hashmany.h.
+
+   The job is a run of items, numbered from 0, that the threads take a few
+   at a time with workerpool_take() until none are left.  The thread
+   calling workerpool_run() is one of them; it starts the rest, does its
+   share with the GIL released, and waits for them all to finish.  Should
+   starting a thread fail, the others just take up its share, and once an
+   item has failed nobody takes on more.  The threads never touch Python
+   objects. */
+
+#ifndef Py_WORKERPOOL_H
+#define Py_WORKERPOOL_H
+
+#ifdef WITH_THREAD
+#include "pythread.h"
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+typedef struct {
+	Py_ssize_t count;	/* Items in the job */
+	void (*work)(void *arg);	/* Run by each thread */
+	void *arg;
+#ifdef WITH_THREAD
+	PyThread_type_lock *lock;
+	PyThread_type_cond *done;
+#endif
+	Py_ssize_t next;	/* Next item for a thread to take */
+	int failed;
+	int running;		/* Threads started and not yet finished */
+} workerpool;
+
+/* The number of threads to use by default, one per CPU */
+static int
+workerpool_cpus(void)
+{
+	int cpus = 1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	return cpus < 1 ? 1 : cpus;
+}
+
+/* Takes up to batch items, setting *start to the first, and returns how
+   many were taken: 0 once there are none left or any have failed.  A
+   worker passes failed as nonzero if the items it last took did. */
+static Py_ssize_t
+workerpool_take(workerpool *pool, int failed, Py_ssize_t batch,
+		Py_ssize_t *start)
+{
+	Py_ssize_t end;
+
+#ifdef WITH_THREAD
+	PyThread_lock_acquire(pool->lock);
+#endif
+	pool->failed |= failed;
+	*start = pool->failed ? pool->count : pool->next;
+	end = *start + batch;
+	if (end > pool->count)
+		end = pool->count;
+	pool->next = end;
+#ifdef WITH_THREAD
+	PyThread_lock_release(pool->lock);
+#endif
+	return end - *start;
+}
+
+#ifdef WITH_THREAD
+static void
+workerpool_thread(void *arg)
+{
+	workerpool *pool = arg;
+
+	pool->work(pool->arg);
+	PyThread_lock_acquire(pool->lock);
+	if (--pool->running == 0)
+		PyThread_cond_wakeall(pool->done);
+	PyThread_lock_release(pool->lock);
+}
+#endif
+
+/* Has up to threads threads, this one included, call work(arg) until the
+   count items are all taken, and returns once they've all finished: 0,
+   or -1 with an exception set if the pool couldn't be made.  Whether any
+   item failed is for work to record. */
+static int
+workerpool_run(workerpool *pool, Py_ssize_t count, int threads,
+	       void (*work)(void *), void *arg)
+{
+	memset(pool, 0, sizeof(workerpool));
+	pool->count = count;
+	pool->work = work;
+	pool->arg = arg;
+
+#ifdef WITH_THREAD
+	pool->lock = PyThread_lock_allocate();
+	pool->done = PyThread_cond_allocate();
+	if (pool->lock == NULL || pool->done == NULL) {
+		if (pool->lock != NULL)
+			PyThread_lock_free(pool->lock);
+		if (pool->done != NULL)
+			PyThread_cond_free(pool->done);
+		PyErr_NoMemory();
+		return -1;
+	}
+	PyThread_lock_acquire(pool->lock);
+	while (pool->running < threads - 1) {
+		if (PyThread_start_new_thread(NULL, workerpool_thread,
+					      pool) < 0)
+			break;
+		pool->running++;
+	}
+	PyThread_lock_release(pool->lock);
+#endif
+
+	Py_BEGIN_ALLOW_THREADS
+	work(arg);
+#ifdef WITH_THREAD
+	PyThread_lock_acquire(pool->lock);
+	while (pool->running > 0)
+		PyThread_cond_wait(pool->done, pool->lock);
+	PyThread_lock_release(pool->lock);
+#endif
+	Py_END_ALLOW_THREADS
+
+#ifdef WITH_THREAD
+	PyThread_lock_free(pool->lock);
+	PyThread_cond_free(pool->done);
+#endif
+	return 0;
+}
+
+#endif /* !Py_WORKERPOOL_H */
@@ -51,6 +51,11 @@ static PyThread_type_lock *zlib_lock = NULL; /* initialized on module load */
 #endif
 #define DEF_WBITS MAX_WBITS
 
+/* compress_parallel() needs adler32_combine() and crc32_combine() */
+#if defined(ZLIB_VERNUM) && ZLIB_VERNUM >= 0x1221
+#define HAVE_ZLIB_COMBINE
+#endif
+
 /* The output buffer will be increased in chunks of DEFAULTALLOC bytes. */
 #define DEFAULTALLOC (16*1024)
 #define PyInit_zlib initzlib
@@ -185,6 +190,297 @@ PyZlib_compress(PyObject *self, PyObject *args)
     return ReturnVal;
 }
 
+#ifdef HAVE_ZLIB_COMBINE
+
+/* compress_parallel() splits the input into PARALLEL_CHUNK sized pieces and
+   deflates them on several threads at once, the way pigz does.  Each piece
+   is primed with the 32K of input before it, so little compression is lost,
+   and all but the last end with a sync flush so the pieces can simply be
+   concatenated into one deflate stream.  The check value is combined from
+   the pieces' own.  The worker threads only touch the input buffer and
+   memory of their own, never Python objects. */
+
+#include "workerpool.h"
+
+#define PARALLEL_CHUNK (128*1024)
+
+typedef struct {
+    Byte *out;
+    uLong outlen;
+    uLong check;	/* adler32 or crc32 of this piece's input */
+    int err;		/* Z_OK, or what went wrong */
+} deflate_piece;
+
+typedef struct {
+    Byte *data;
+    Py_ssize_t length;
+    Py_ssize_t npieces;
+    int level;
+    int wbits;		/* As given, selecting the container */
+    deflate_piece *pieces;
+    workerpool pool;
+} deflate_job;
+
+static void
+deflate_one_piece(deflate_job *job, Py_ssize_t i)
+{
+    deflate_piece *p = &job->pieces[i];
+    int window = (job->wbits < 0 ? -job->wbits : job->wbits) & 15;
+    int last = i == job->npieces - 1;
+    Byte *start = job->data + i * PARALLEL_CHUNK;
+    uInt len = (uInt)(last ? job->length - i * PARALLEL_CHUNK
+			   : PARALLEL_CHUNK);
+    uLong size;
+    z_stream zst;
+    int err;
+
+    memset(&zst, 0, sizeof(zst));
+    err = deflateInit2(&zst, job->level, DEFLATED, -window, DEF_MEM_LEVEL,
+		       Z_DEFAULT_STRATEGY);
+    if (err != Z_OK) {
+	p->err = err;
+	return;
+    }
+    if (i > 0) {
+	uInt dictlen = 1U << window;
+
+	if (dictlen > (uInt)(i * PARALLEL_CHUNK))
+	    dictlen = (uInt)(i * PARALLEL_CHUNK);
+	err = deflateSetDictionary(&zst, start - dictlen, dictlen);
+	if (err != Z_OK)
+	    goto done;
+    }
+
+    /* Room for a sync flush's empty stored block too */
+    size = deflateBound(&zst, len) + 16;
+    p->out = malloc(size);
+    if (p->out == NULL) {
+	err = Z_MEM_ERROR;
+	goto done;
+    }
+    zst.next_in = start;
+    zst.avail_in = len;
+    zst.next_out = p->out;
+    zst.avail_out = size;
+    for (;;) {
+	Byte *out;
+
+	err = deflate(&zst, last ? Z_FINISH : Z_SYNC_FLUSH);
+	if (last ? err == Z_STREAM_END : err == Z_OK && zst.avail_out > 0) {
+	    err = Z_OK;
+	    break;
+	}
+	if (err != Z_OK && err != Z_BUF_ERROR)
+	    goto done;
+	/* Out of room after all */
+	out = realloc(p->out, size * 2);
+	if (out == NULL) {
+	    err = Z_MEM_ERROR;
+	    goto done;
+	}
+	p->out = out;
+	zst.next_out = out + size;
+	zst.avail_out = size;
+	size *= 2;
+    }
+    p->outlen = zst.total_out;
+    if (job->wbits > 16)
+	p->check = crc32(crc32(0L, Z_NULL, 0), start, len);
+    else
+	p->check = adler32(adler32(0L, Z_NULL, 0), start, len);
+
+  done:
+    deflateEnd(&zst);
+    p->err = err;
+}
+
+static void
+deflate_worker(void *arg)
+{
+    deflate_job *job = arg;
+    Py_ssize_t i;
+    int failed = 0;
+
+    while (workerpool_take(&job->pool, failed, 1, &i) > 0) {
+	deflate_one_piece(job, i);
+	failed = job->pieces[i].err != Z_OK;
+    }
+}
+
+/* Builds the stream from the finished pieces */
+static PyObject *
+deflate_join(deflate_job *job)
+{
+    PyObject *result;
+    Byte header[10], *out;
+    int headerlen = 0, trailerlen = 0;
+    uLong check = 0;
+    Py_ssize_t i, total;
+
+    if (job->wbits > 16) {
+	/* gzip: no name or mtime, and Unix as the OS, like gzip -n */
+	header[0] = 0x1f;
+	header[1] = 0x8b;
+	header[2] = DEFLATED;
+	memset(header + 3, 0, 5);
+	header[8] = job->level == 9 ? 2 : job->level == 1 ? 4 : 0;
+	header[9] = 3;
+	headerlen = 10;
+	trailerlen = 8;
+	check = crc32(0L, Z_NULL, 0);
+    }
+    else if (job->wbits > 0) {
+	/* zlib, with the level hint deflate itself would write */
+	int flags = (job->wbits - 8) << 12 | DEFLATED << 8;
+
+	if (job->level < 2)
+	    flags |= 0 << 6;
+	else if (job->level < 6)
+	    flags |= 1 << 6;
+	else if (job->level == 6)
+	    flags |= 2 << 6;
+	else
+	    flags |= 3 << 6;
+	flags += 31 - flags % 31;
+	header[0] = flags >> 8;
+	header[1] = flags & 0xff;
+	headerlen = 2;
+	trailerlen = 4;
+	check = adler32(0L, Z_NULL, 0);
+    }
+
+    total = headerlen + trailerlen;
+    for (i = 0; i < job->npieces; i++)
+	total += job->pieces[i].outlen;
+    result = PyBytes_FromStringAndSize(NULL, total);
+    if (result == NULL)
+	return NULL;
+
+    out = (Byte *)PyBytes_AS_STRING(result);
+    memcpy(out, header, headerlen);
+    out += headerlen;
+    for (i = 0; i < job->npieces; i++) {
+	deflate_piece *p = &job->pieces[i];
+	z_off_t len = i == job->npieces - 1 ?
+		      job->length - i * PARALLEL_CHUNK : PARALLEL_CHUNK;
+
+	memcpy(out, p->out, p->outlen);
+	out += p->outlen;
+	if (job->wbits > 16)
+	    check = crc32_combine(check, p->check, len);
+	else if (job->wbits > 0)
+	    check = adler32_combine(check, p->check, len);
+    }
+    if (job->wbits > 16) {
+	unsigned long isize = (unsigned long)job->length;
+
+	for (i = 0; i < 4; i++)
+	    *out++ = (Byte)(check >> (8 * i));
+	for (i = 0; i < 4; i++)
+	    *out++ = (Byte)(isize >> (8 * i));
+    }
+    else if (job->wbits > 0) {
+	for (i = 3; i >= 0; i--)
+	    *out++ = (Byte)(check >> (8 * i));
+    }
+    return result;
+}
+
+PyDoc_STRVAR(compress_parallel__doc__,
+"compress_parallel(data[, level[, threads[, wbits]]]) -- Compress data\n"
+"using several threads.\n"
+"\n"
+"The result is a single standard stream, which decompress() and other\n"
+"zlib users read as usual.  Optional arg level is the compression level,\n"
+"in 1-9.  Optional arg threads is how many threads to use, by default one\n"
+"per CPU.  Optional arg wbits is the window buffer size, as for\n"
+"decompress(): add 16 for a gzip stream, or negate it for raw deflate.");
+
+static PyObject *
+PyZlib_compress_parallel(PyObject *self, PyObject *args)
+{
+    PyObject *obj, *ReturnVal = NULL;
+    Py_buffer view;
+    deflate_job job;
+    Py_ssize_t i;
+    int threads = 0, window;
+
+    memset(&job, 0, sizeof(job));
+    job.level = Z_DEFAULT_COMPRESSION;
+    job.wbits = DEF_WBITS;
+    if (!PyArg_ParseTuple(args, "O|iii:compress_parallel", &obj,
+			  &job.level, &threads, &job.wbits))
+	return NULL;
+    window = (job.wbits < 0 ? -job.wbits : job.wbits) & 15;
+    if (job.wbits < -MAX_WBITS || job.wbits > MAX_WBITS + 16 ||
+	(job.wbits > MAX_WBITS && job.wbits <= 16) || window < 9) {
+	PyErr_SetString(PyExc_ValueError, "invalid wbits");
+	return NULL;
+    }
+    if (job.level == Z_DEFAULT_COMPRESSION)
+	job.level = 6;
+    if (job.level < 0 || job.level > 9) {
+	PyErr_SetString(ZlibError, "Bad compression level");
+	return NULL;
+    }
+    if (threads < 0) {
+	PyErr_SetString(PyExc_ValueError, "threads must not be negative");
+	return NULL;
+    }
+    if (PyUnicode_Check(obj)) {
+	PyErr_SetString(PyExc_TypeError, "can't compress str");
+	return NULL;
+    }
+    if (PyObject_GetBuffer(obj, &view, PyBUF_SIMPLE) < 0)
+	return NULL;
+
+    job.data = view.buf;
+    job.length = view.len;
+    job.npieces = (job.length + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK;
+    if (job.npieces == 0)
+	job.npieces = 1;
+    job.pieces = PyMem_New(deflate_piece, job.npieces);
+    if (job.pieces == NULL) {
+	PyErr_NoMemory();
+	goto error;
+    }
+    memset(job.pieces, 0, job.npieces * sizeof(deflate_piece));
+
+    if (threads == 0)
+	threads = workerpool_cpus();
+    if (threads > job.npieces)
+	threads = (int)job.npieces;
+    if (workerpool_run(&job.pool, job.npieces, threads, deflate_worker,
+		       &job) < 0)
+	goto error;
+
+    for (i = 0; i < job.npieces; i++) {
+	int err = job.pieces[i].err;
+
+	if (err == Z_MEM_ERROR) {
+	    PyErr_SetString(PyExc_MemoryError,
+			    "Out of memory while compressing data");
+	    goto error;
+	}
+	if (err != Z_OK) {
+	    PyErr_Format(ZlibError, "Error %d while compressing data", err);
+	    goto error;
+	}
+    }
+    ReturnVal = deflate_join(&job);
+
+ error:
+    if (job.pieces != NULL) {
+	for (i = 0; i < job.npieces; i++)
+	    free(job.pieces[i].out);
+	PyMem_Free(job.pieces);
+    }
+    PyObject_ReleaseBuffer(obj, &view);
+    return ReturnVal;
+}
+
+#endif /* HAVE_ZLIB_COMBINE */
+
 PyDoc_STRVAR(decompress__doc__,
 "decompress(string[, wbits[, bufsize]]) -- Return decompressed string.\n"
 "\n"
@@ -955,6 +1251,10 @@ static PyMethodDef zlib_methods[] =
                 adler32__doc__},
     {"compress", (PyCFunction)PyZlib_compress,  METH_VARARGS,
                  compress__doc__},
+#ifdef HAVE_ZLIB_COMBINE
+    {"compress_parallel", (PyCFunction)PyZlib_compress_parallel, METH_VARARGS,
+                          compress_parallel__doc__},
+#endif
     {"compressobj", (PyCFunction)PyZlib_compressobj, METH_VARARGS,
                     compressobj__doc__},
     {"crc32", (PyCFunction)PyZlib_crc32, METH_VARARGS,
@@ -5,22 +5,88 @@
 #include "monitorobject.h"
 #include "branchobject.h"
 
+#include <sys/time.h>
+
+
+/* Worker pool.  Rather than starting a new OS thread and PyState for
+ * every branch.add(), finished children park their thread here and the
+ * next add() hands its child straight to a parked worker.  If nobody is
+ * parked a new worker is started, so children never queue behind each
+ * other and the blocking/deadlock semantics are the same as with a
+ * thread per child. */
+
+typedef struct _PyBranchWorker {
+    PyState *pystate;
+    PyThread_type_flag *wakeup;
+    PyBranchChild *task;
+    PyLinkedListNode idle_links;
+} PyBranchWorker;
+
+#define BRANCH_POOL_DEFAULT_SIZE 16
+
+static PyThread_type_lock *pool_lock;
+static PyThread_type_cond *pool_exited;
+static PyLinkedList pool_idle;
+static Py_ssize_t pool_size = BRANCH_POOL_DEFAULT_SIZE;
+static Py_ssize_t pool_idlecount;
+static Py_ssize_t pool_threads;
+static int pool_shutdown;
+
+/* Statistics, protected by pool_lock */
+static Py_ssize_t pool_tasks;
+static Py_ssize_t pool_spawned;
+static Py_ssize_t pool_reused;
+static double pool_latency_total;
+static double pool_latency_max;
+
+static void branchworker_bootstrap(void *arg);
+static void branch_runchild(PyBranchChild *child);
+
+
+/* State shared by branch.map() and the chunks it has in flight.  Lives
+ * on the mapping thread's stack and is protected by the branch's crit. */
+
+typedef struct _PyBranchMap {
+    PyLinkedList chunks;    /* Oldest first, linked by children_links */
+    int failed;
+} PyBranchMap;
+
+#define BRANCH_MAP_DEFAULT_INFLIGHT 8
+
+
+/* State of a branch.as_completed() iterator */
+
+typedef struct {
+    PyObject_HEAD
+    PyObject *pending;      /* Futures not yet yielded */
+} branchcompletion;
+
+static PyObject *branch_mapchunk(PyObject *func, PyObject *items);
+static void branch_cancelchunks(PyCancelQueue *queue, PyBranchMap *map,
+    PyBranchChild *skip);
+
 
 /* Branch methods */
 
 static void branch_basecancel(PyCancelQueue *queue, void *arg);
 static void branchchild_cancel(PyCancelQueue *queue, void *arg);
-static int branch_add_common(PyBranchObject *self, PyObject *args,
-    PyObject *kwds, char *name, int saveresult);
-static void branch_threadbootstrap(void *arg);
-static int branch_spawn_thread(PyBranchObject *self, PyObject *func,
-    PyObject *args, PyObject *kwds, char *name, int save_result);
+static PyBranchChild *branch_add_common(PyBranchObject *self,
+    PyObject *args, PyObject *kwds, char *name, int saveresult);
+static int branch_dispatch(PyBranchChild *child);
+static PyBranchChild *branch_spawn_thread(PyBranchObject *self,
+    PyObject *func, PyObject *args, PyObject *kwds, char *name,
+    int save_result, struct _PyBranchMap *map);
 
 static void BranchChild_Delete(PyBranchChild *child);
 
 static void branch_cleanchildren(PyBranchObject *self);
 static PyObject *Branch_getresults(PyBranchObject *self);
 static void Branch_raiseexception(PyBranchObject *self);
+static void branch_reraise(PyObject *exception);
+
+static PyBranchFutureObject *BranchFuture_New(void);
+static void branchfuture_complete(PyBranchFutureObject *self,
+    PyObject *result, PyObject *exception);
 
 static PyObject *
 Branch_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
@@ -33,7 +99,7 @@ Branch_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
     if (self == NULL)
         return NULL;
 
-    self->crit = PyCritical_Allocate(PyCRITICAL_NORMAL);
+    self->crit = PyCritical_AllocateNamed(PyCRITICAL_NORMAL, "branch");
     if (self->crit == NULL) {
 #warning Branch_new should not call PyObject_Del
         PyObject_Del(self);
@@ -90,9 +156,12 @@ Branch_dealloc(PyBranchObject *self)
     PyObject_Del(self);
 }
 
+/* The child's pystate (and that of its cancel scope) starts out as the
+ * creating thread's.  branch_dispatch rebinds them to the worker that
+ * will run the child. */
 static PyBranchChild *
 BranchChild_New(PyBranchObject *branch, PyObject *func, PyObject *args,
-        PyObject *kwds, int new_pystate)
+        PyObject *kwds)
 {
     PyBranchChild *child;
 
@@ -102,20 +171,10 @@ BranchChild_New(PyBranchObject *branch, PyObject *func, PyObject *args,
         return NULL;
     }
 
-    if (new_pystate) {
-        child->pystate = _PyState_New();
-        if (child->pystate == NULL) {
-            free(child);
-            PyErr_NoMemory();
-            return NULL;
-        }
-    } else
-        child->pystate = PyState_Get();
+    child->pystate = PyState_Get();
 
     child->cancel_scope = PyCancel_New(branchchild_cancel, NULL, child->pystate);
     if (child->cancel_scope == NULL) {
-        if (new_pystate)
-            _PyState_Delete(child->pystate);
         free(child);
         PyErr_NoMemory();
         return NULL;
@@ -124,8 +183,6 @@ BranchChild_New(PyBranchObject *branch, PyObject *func, PyObject *args,
     child->dead = PyThread_flag_allocate();
     if (child->dead == NULL) {
         Py_DECREF(child->cancel_scope);
-        if (new_pystate)
-            _PyState_Delete(child->pystate);
         free(child);
         PyErr_NoMemory();
         return NULL;
@@ -134,8 +191,6 @@ BranchChild_New(PyBranchObject *branch, PyObject *func, PyObject *args,
     child->waitfor.lock = PyThread_lock_allocate();
     if (child->waitfor.lock == NULL) {
         Py_DECREF(child->cancel_scope);
-        if (new_pystate)
-            _PyState_Delete(child->pystate);
         PyThread_flag_free(child->dead);
         free(child);
         PyErr_NoMemory();
@@ -152,6 +207,9 @@ BranchChild_New(PyBranchObject *branch, PyObject *func, PyObject *args,
     child->save_result = 0;
     child->result = NULL;
     child->exception = NULL;
+    child->queued_at = 0.0;
+    child->map = NULL;
+    child->future = NULL;
     PyLinkedList_InitNode(&child->children_links);
     PyLinkedList_InitNode(&child->alive_links);
 
@@ -177,6 +235,7 @@ BranchChild_Delete(PyBranchChild *child)
 
     PyThread_flag_free(child->dead);
 
+    Py_XDECREF(child->future);
     Py_XDECREF(child->func);
     Py_XDECREF(child->args);
     Py_XDECREF(child->kwds);
@@ -200,7 +259,7 @@ static PyObject *
 Branch___enter__(PyBranchObject *self)
 {
     PyCancelObject *basecancel;
-    PyBranchChild *mainchild = BranchChild_New(self, Py_None, Py_None, Py_None, 0);
+    PyBranchChild *mainchild = BranchChild_New(self, Py_None, Py_None, Py_None);
     if (mainchild == NULL)
         return NULL;
 
@@ -357,7 +416,7 @@ branch_basecancel(PyCancelQueue *queue, void *arg)
 static PyObject *
 Branch_add(PyBranchObject *self, PyObject *args, PyObject *kwds)
 {
-    if (!branch_add_common(self, args, kwds, "branch.add", 0))
+    if (branch_add_common(self, args, kwds, "branch.add", 0) == NULL)
         return NULL;
 
     Py_INCREF(Py_None);
@@ -367,24 +426,30 @@ Branch_add(PyBranchObject *self, PyObject *args, PyObject *kwds)
 static PyObject *
 Branch_addresult(PyBranchObject *self, PyObject *args, PyObject *kwds)
 {
-    if (!branch_add_common(self, args, kwds, "branch.addresult", 1))
+    PyBranchChild *child;
+
+    child = branch_add_common(self, args, kwds, "branch.addresult", 1);
+    if (child == NULL)
         return NULL;
 
-    Py_INCREF(Py_None);
-    return Py_None;
+    /* Children that save a result aren't deleted before getresults() or
+     * __exit__, both of which only we can call, so child is still valid */
+    Py_INCREF(child->future);
+    return (PyObject *)child->future;
 }
 
-static int
+static PyBranchChild *
 branch_add_common(PyBranchObject *self, PyObject *args, PyObject *kwds,
         char *name, int saveresult)
 {
     PyObject *func;
     PyObject *smallargs;
+    PyBranchChild *child;
 
     if (PyTuple_Size(args) < 1) {
         PyErr_Format(PyExc_TypeError, "%s() needs a function to be "
             "called", name);
-        return 0;
+        return NULL;
     }
 
     func = PyTuple_GetItem(args, 0);
@@ -392,40 +457,47 @@ branch_add_common(PyBranchObject *self, PyObject *args, PyObject *kwds,
     if (!PyObject_IsShareable(func)) {
         PyErr_Format(PyExc_TypeError, "%s()'s function argument must be "
             "shareable, '%s' object is not", name, func->ob_type->tp_name);
-        return 0;
+        return NULL;
     }
 
     smallargs = PyTuple_GetSlice(args, 1, PyTuple_Size(args));
     if (smallargs == NULL) {
-        return 0;
+        return NULL;
     }
 
     if (!PyArg_RequireShareable(name, smallargs, kwds)) {
         Py_DECREF(smallargs);
-        return 0;
-    }
-
-    if (!branch_spawn_thread(self, func, smallargs, kwds, name, saveresult)) {
-        Py_DECREF(smallargs);
-        return 0;
+        return NULL;
     }
 
+    child = branch_spawn_thread(self, func, smallargs, kwds, name,
+        saveresult, NULL);
     Py_DECREF(smallargs);
-    return 1;
+    return child;
 }
 
-static int
+/* Chunks of a branch.map() go on the map's own list rather than the
+ * branch's children, so they're never mixed up with getresults(). */
+static PyBranchChild *
 branch_spawn_thread(PyBranchObject *self, PyObject *func, PyObject *args,
-        PyObject *kwds, char *name, int save_result)
+        PyObject *kwds, char *name, int save_result, struct _PyBranchMap *map)
 {
     PyBranchChild *child;
     PyObject *exc;
     const char *format;
 
-    child = BranchChild_New(self, func, args, kwds, 1);
+    child = BranchChild_New(self, func, args, kwds);
     if (child == NULL)
-        return 0;
+        return NULL;
     child->save_result = save_result;
+    child->map = map;
+    if (save_result && map == NULL) {
+        child->future = BranchFuture_New();
+        if (child->future == NULL) {
+            BranchChild_Delete(child);
+            return NULL;
+        }
+    }
 
     if (self->col_cancelling)
         /* XXX FIXME this is a hack! */
@@ -442,17 +514,23 @@ branch_spawn_thread(PyBranchObject *self, PyObject *func, PyObject *args,
     if (PyState_Get()->import_depth)
         Py_FatalError("importing is not thread-safe");
 
-    PyLinkedList_Append(&self->children, child);
+    if (map != NULL && map->failed)
+        child->cancel_scope->cancelled = 1;
+
+    if (map != NULL)
+        PyLinkedList_Append(&map->chunks, child);
+    else
+        PyLinkedList_Append(&self->children, child);
     PyLinkedList_Append(&self->alive, child);
 
-    if (PyThread_start_new_thread(NULL, branch_threadbootstrap, child) < 0) {
+    if (branch_dispatch(child) < 0) {
         exc = PyExc_RuntimeError;
         format = "%s can't spawn new thread";
         goto failed;
     }
 
     PyCritical_Exit(self->crit);
-    return 1;
+    return child;
 
 failed:
     if (!PyLinkedList_Detached(&child->children_links))
@@ -461,8 +539,6 @@ failed:
         PyLinkedList_Remove(&child->alive_links);
     PyCritical_Exit(self->crit);
 
-    if (child->pystate)
-        _PyState_Delete(child->pystate);
     BranchChild_Delete(child);
 
     if (exc != NULL)
@@ -470,35 +546,201 @@ failed:
     else
         PyErr_NoMemory();
 
+    return NULL;
+}
+
+static double
+branch_time(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (double)tv.tv_sec + tv.tv_usec * 0.000001;
+}
+
+/* Rebind the child (and its cancel scope) to the worker that will run
+ * it.  Called with the branch's crit held, which is also what anybody
+ * cancelling the child must hold, so they'll never see it half-moved. */
+static void
+branchchild_bind(PyBranchChild *child, PyBranchWorker *worker)
+{
+    child->pystate = worker->pystate;
+    child->cancel_scope->pystate = worker->pystate;
+    worker->task = child;
+}
+
+static PyBranchWorker *
+BranchWorker_New(void)
+{
+    PyBranchWorker *worker;
+
+    worker = malloc(sizeof(PyBranchWorker));
+    if (worker == NULL)
+        return NULL;
+
+    worker->pystate = _PyState_New();
+    if (worker->pystate == NULL) {
+        free(worker);
+        return NULL;
+    }
+
+    worker->wakeup = PyThread_flag_allocate();
+    if (worker->wakeup == NULL) {
+        _PyState_Delete(worker->pystate);
+        free(worker);
+        return NULL;
+    }
+
+    worker->task = NULL;
+    PyLinkedList_InitNode(&worker->idle_links);
+    return worker;
+}
+
+static void
+BranchWorker_Delete(PyBranchWorker *worker)
+{
+    assert(worker->task == NULL);
+    assert(PyLinkedList_Detached(&worker->idle_links));
+
+    PyThread_flag_free(worker->wakeup);
+    free(worker);
+}
+
+/* Hand the child to a parked worker, or start a new one.  Returns -1
+ * if no thread could be started. */
+static int
+branch_dispatch(PyBranchChild *child)
+{
+    PyBranchWorker *worker;
+
+    child->queued_at = branch_time();
+
+    PyThread_lock_acquire(pool_lock);
+    worker = PyLinkedList_Last(&pool_idle);
+    if (worker != NULL) {
+        PyLinkedList_Remove(&worker->idle_links);
+        pool_idlecount--;
+        pool_reused++;
+        branchchild_bind(child, worker);
+        PyThread_flag_set(worker->wakeup);
+        PyThread_lock_release(pool_lock);
+        return 0;
+    }
+    pool_threads++;
+    pool_spawned++;
+    PyThread_lock_release(pool_lock);
+
+    worker = BranchWorker_New();
+    if (worker == NULL)
+        goto failed;
+
+    branchchild_bind(child, worker);
+    if (PyThread_start_new_thread(NULL, branchworker_bootstrap, worker) < 0) {
+        worker->task = NULL;
+        _PyState_Delete(worker->pystate);
+        BranchWorker_Delete(worker);
+        goto failed;
+    }
     return 0;
+
+failed:
+    PyThread_lock_acquire(pool_lock);
+    pool_threads--;
+    pool_spawned--;
+    PyThread_lock_release(pool_lock);
+    return -1;
+}
+
+/* Park the current worker until it's given another child.  Returns 0 if
+ * the worker should exit instead. */
+static int
+branchworker_park(PyBranchWorker *worker)
+{
+    PyThread_lock_acquire(pool_lock);
+    if (pool_shutdown || pool_idlecount >= pool_size) {
+        PyThread_lock_release(pool_lock);
+        return 0;
+    }
+    PyLinkedList_Append(&pool_idle, worker);
+    pool_idlecount++;
+    PyThread_lock_release(pool_lock);
+
+    PyState_Suspend();
+    PyThread_flag_wait(worker->wakeup);
+    PyState_Resume();
+
+    PyThread_lock_acquire(pool_lock);
+    PyThread_flag_clear(worker->wakeup);
+    PyThread_lock_release(pool_lock);
+
+    return worker->task != NULL;
 }
 
 static void
-branch_threadbootstrap(void *arg)
+branchworker_bootstrap(void *arg)
 {
-    PyCancelQueue queue;
-    int run_queue = 0;
-    PyBranchChild *child = (PyBranchChild *)arg;
+    PyBranchWorker *worker = (PyBranchWorker *)arg;
     PyState_EnterFrame enterframe;
-    PyBranchObject *branch = child->branch;
-    int delete_child = 0;
 
-    if (_PyState_EnterPreallocated(&enterframe, child->pystate)) {
+    if (_PyState_EnterPreallocated(&enterframe, worker->pystate)) {
         /* Because we preallocate everything, it should be
          * impossible to fail. */
         Py_FatalError("PyState_EnterPreallocated failed");
     }
 
+    do {
+        PyBranchChild *child = worker->task;
+        double latency = branch_time() - child->queued_at;
+
+        worker->task = NULL;
+
+        PyThread_lock_acquire(pool_lock);
+        pool_tasks++;
+        pool_latency_total += latency;
+        if (latency > pool_latency_max)
+            pool_latency_max = latency;
+        PyThread_lock_release(pool_lock);
+
+        branch_runchild(child);
+
+        /* Whatever the child left behind must not leak into the next
+         * one; it should look like a fresh thread. */
+        _PyState_Recycle(&enterframe);
+    } while (branchworker_park(worker));
+
+    _PyState_ExitPreallocated(&enterframe);
+    BranchWorker_Delete(worker);
+
+    PyThread_lock_acquire(pool_lock);
+    pool_threads--;
+    PyThread_cond_wakeall(pool_exited);
+    PyThread_lock_release(pool_lock);
+}
+
+static void
+branch_runchild(PyBranchChild *child)
+{
+    PyCancelQueue queue;
+    int run_queue = 0;
+    PyBranchObject *branch = child->branch;
+    int delete_child = 0;
+
+    assert(child->pystate == PyState_Get());
+
     Py_INCREF(branch);
 
     _PyMonitorSpace_BlockOnSelf(&child->waitfor);
 
     PyCancel_Push(child->cancel_scope);
 
-    child->result = PyObject_Call(child->func, child->args, child->kwds);
-    if (!PyArg_RequireShareableReturn("branch._threadbootstrap",
-            child->func, child->result))
-        Py_CLEAR(child->result);
+    if (child->map != NULL)
+        child->result = branch_mapchunk(child->func, child->args);
+    else {
+        child->result = PyObject_Call(child->func, child->args, child->kwds);
+        if (!PyArg_RequireShareableReturn("branch._threadbootstrap",
+                child->func, child->result))
+            Py_CLEAR(child->result);
+    }
 
     Py_CLEAR(child->func);
     Py_CLEAR(child->args);
@@ -513,9 +755,25 @@ branch_threadbootstrap(void *arg)
         child->exception = PyErr_SimplifyException(type, val, tb);
     }
 
+    /* Before anyone is cancelled, so a thread waiting on the future
+     * sees the outcome rather than its own cancellation */
+    if (child->future != NULL)
+        branchfuture_complete(child->future, child->result,
+            child->exception);
+
     PyCritical_Enter(branch->crit);
 
-    if (child->result != NULL) {
+    if (child->map != NULL) {
+        /* branch.map() collects the chunk itself.  A failure only
+         * cancels the rest of that map; the mapping thread decides what
+         * to raise. */
+        if (child->result == NULL && !child->map->failed) {
+            child->map->failed = 1;
+            PyCancelQueue_Init(&queue);
+            branch_cancelchunks(&queue, child->map, child);
+            run_queue = 1;
+        }
+    } else if (child->result != NULL) {
         if (child->save_result)
             branch->col_resultcount++;
         else {
@@ -561,8 +819,6 @@ branch_threadbootstrap(void *arg)
     PyCritical_Exit(branch->crit);
 
     Py_DECREF(branch);
-
-    _PyState_ExitPreallocated(&enterframe);
 }
 
 static void
@@ -624,6 +880,258 @@ Branch_getresults(PyBranchObject *self)
     return results;
 }
 
+/* Runs in the worker.  Calls func on each item of the chunk, returning a
+ * tuple of the results. */
+static PyObject *
+branch_mapchunk(PyObject *func, PyObject *items)
+{
+    PyObject *results;
+    Py_ssize_t i, size = PyTuple_GET_SIZE(items);
+
+    results = PyTuple_New(size);
+    if (results == NULL)
+        return NULL;
+
+    for (i = 0; i < size; i++) {
+        PyObject *x;
+
+        /* Don't wait for the whole chunk if another one failed */
+        if (PyCancel_CheckCancelled()) {
+            Py_DECREF(results);
+            return NULL;
+        }
+
+        x = PyObject_CallFunctionObjArgs(func, PyTuple_GET_ITEM(items, i),
+            NULL);
+        if (!PyArg_RequireShareableReturn("branch.map", func, x))
+            Py_CLEAR(x);
+        if (x == NULL) {
+            Py_DECREF(results);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(results, i, x);
+    }
+
+    return results;
+}
+
+/* Assumes the branch's crit is held.  Finished chunks are skipped, as
+ * their worker (and its PyState) may already be gone. */
+static void
+branch_cancelchunks(PyCancelQueue *queue, PyBranchMap *map,
+        PyBranchChild *skip)
+{
+    PyBranchChild *child = NULL;
+
+    while (PyLinkedList_Next(&map->chunks, &child)) {
+        if (child != skip && !PyLinkedList_Detached(&child->alive_links))
+            PyCancelQueue_Cancel(queue, child->cancel_scope);
+    }
+}
+
+/* Pulls up to chunksize items off the iterator.  Returns an empty tuple
+ * once it's exhausted. */
+static PyObject *
+branch_nextchunk(PyObject *it, Py_ssize_t chunksize)
+{
+    PyObject *chunk, *item;
+    Py_ssize_t i;
+
+    chunk = PyTuple_New(chunksize);
+    if (chunk == NULL)
+        return NULL;
+
+    for (i = 0; i < chunksize; i++) {
+        item = PyIter_Next(it);
+        if (item == NULL) {
+            if (PyErr_Occurred()) {
+                Py_DECREF(chunk);
+                return NULL;
+            }
+            break;
+        }
+        PyTuple_SET_ITEM(chunk, i, item);
+    }
+
+    if (i < chunksize && _PyTuple_Resize(&chunk, i) < 0)
+        return NULL;
+    return chunk;
+}
+
+static Py_ssize_t
+branch_mapsize(PyObject *arg, Py_ssize_t defaultsize, const char *name)
+{
+    Py_ssize_t size;
+
+    if (arg == Py_None)
+        return defaultsize;
+
+    size = PyNumber_AsSsize_t(arg, PyExc_OverflowError);
+    if (size == -1 && PyErr_Occurred())
+        return -1;
+    if (size < 1) {
+        PyErr_Format(PyExc_ValueError, "branch.map() %s must be at "
+            "least 1", name);
+        return -1;
+    }
+    return size;
+}
+
+/* Feeds the iterable to the branch in chunks, keeping at most
+ * max_inflight of them running (or finished but not yet collected), and
+ * collects the results in order.  The first failure cancels whatever
+ * else is in flight and is re-raised here, with the chunks' exceptions
+ * as its cause. */
+static PyObject *
+Branch_map(PyBranchObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"func", "iterable", "chunksize",
+        "max_inflight", NULL};
+    PyObject *func, *iterable;
+    PyObject *chunksizeobj = Py_None, *inflightobj = Py_None;
+    Py_ssize_t chunksize, max_inflight, inflight = 0;
+    PyObject *it, *results;
+    PyObject *type = NULL, *val = NULL, *tb = NULL;
+    PyObject *interesting = NULL;
+    PyBranchMap map;
+    PyCancelQueue queue;
+    int exhausted = 0, stopping = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO|OO:map", kwlist,
+            &func, &iterable, &chunksizeobj, &inflightobj))
+        return NULL;
+
+    if (!PyObject_IsShareable(func)) {
+        PyErr_Format(PyExc_TypeError, "branch.map()'s function argument "
+            "must be shareable, '%s' object is not", func->ob_type->tp_name);
+        return NULL;
+    }
+
+    chunksize = branch_mapsize(chunksizeobj, 1, "chunksize");
+    if (chunksize < 0)
+        return NULL;
+    max_inflight = branch_mapsize(inflightobj, BRANCH_MAP_DEFAULT_INFLIGHT,
+        "max_inflight");
+    if (max_inflight < 0)
+        return NULL;
+
+    it = PyObject_GetIter(iterable);
+    if (it == NULL)
+        return NULL;
+
+    results = PyList_New(0);
+    if (results == NULL) {
+        Py_DECREF(it);
+        return NULL;
+    }
+
+    PyLinkedList_InitBase(&map.chunks, offsetof(PyBranchChild, children_links));
+    map.failed = 0;
+
+    while (1) {
+        PyBranchChild *child;
+
+        /* Top up the chunks in flight.  Any error here is our own, and
+         * is held on to while the rest are cancelled and collected. */
+        while (!stopping && !map.failed && !exhausted &&
+                inflight < max_inflight) {
+            PyObject *chunk;
+
+            if (PyCancel_CheckCancelled())
+                chunk = NULL;
+            else
+                chunk = branch_nextchunk(it, chunksize);
+
+            if (chunk != NULL && PyTuple_GET_SIZE(chunk) == 0) {
+                Py_DECREF(chunk);
+                exhausted = 1;
+                break;
+            }
+
+            if (chunk != NULL && PyArg_RequireShareable("branch.map", chunk,
+                    NULL) && branch_spawn_thread(self, func, chunk, NULL,
+                    "branch.map", 1, &map) != NULL) {
+                Py_DECREF(chunk);
+                inflight++;
+                continue;
+            }
+
+            Py_XDECREF(chunk);
+            PyErr_Fetch(&type, &val, &tb);
+            stopping = 1;
+        }
+
+        if (stopping && !map.failed) {
+            PyCritical_Enter(self->crit);
+            map.failed = 1;
+            PyCancelQueue_Init(&queue);
+            branch_cancelchunks(&queue, &map, NULL);
+            PyCritical_Exit(self->crit);
+            PyCancelQueue_Finish(&queue);
+        }
+
+        if (inflight == 0)
+            break;
+
+        /* Collect the oldest chunk */
+        child = PyLinkedList_First(&map.chunks);
+        _PyMonitorSpace_WaitForBranchChild(child);
+
+        PyCritical_Enter(self->crit);
+        PyLinkedList_Remove(&child->children_links);
+        if (child->result == NULL)
+            stopping = 1;
+        PyCritical_Exit(self->crit);
+        inflight--;
+
+        if (child->result != NULL) {
+            Py_ssize_t i;
+
+            for (i = 0; !stopping && i < PyTuple_GET_SIZE(child->result);
+                    i++) {
+                if (PyList_Append(results,
+                        PyTuple_GET_ITEM(child->result, i)) < 0) {
+                    PyErr_Fetch(&type, &val, &tb);
+                    stopping = 1;
+                }
+            }
+            Py_CLEAR(child->result);
+        } else {
+            /* Prefer the failure that caused the others to be
+             * cancelled */
+            if (interesting == NULL || (PyErr_GivenExceptionMatches(
+                    interesting, PyExc_Cancelled) &&
+                    !PyErr_GivenExceptionMatches(child->exception,
+                    PyExc_Cancelled))) {
+                Py_XDECREF(interesting);
+                Py_INCREF(child->exception);
+                interesting = child->exception;
+            }
+            Py_CLEAR(child->exception);
+        }
+
+        BranchChild_Delete(child);
+    }
+
+    Py_DECREF(it);
+
+    if (type != NULL) {
+        Py_XDECREF(interesting);
+        Py_DECREF(results);
+        PyErr_Restore(type, val, tb);
+        return NULL;
+    }
+
+    if (interesting != NULL) {
+        Py_DECREF(results);
+        branch_reraise(interesting);
+        Py_DECREF(interesting);
+        return NULL;
+    }
+
+    return results;
+}
+
 static void
 Branch_raiseexception(PyBranchObject *self)
 {
@@ -697,11 +1205,74 @@ Branch_raiseexception(PyBranchObject *self)
     return;
 }
 
+/* Raises a copy of a child's exception, with the original as its cause,
+ * in the current thread */
+static void
+branch_reraise(PyObject *exception)
+{
+    PyObject *causes, *type, *val, *tb;
+
+    causes = PyTuple_Pack(1, exception);
+    PyErr_SetObject((PyObject *)Py_TYPE(exception),
+        ((PyBaseExceptionObject *)exception)->args);
+    if (causes != NULL) {
+        PyErr_Fetch(&type, &val, &tb);
+        PyErr_NormalizeException(&type, &val, &tb);
+        PyException_SetCause(val, causes);
+        PyErr_Restore(type, val, tb);
+    }
+}
+
+static PyObject *
+Branch_as_completed(PyBranchObject *self)
+{
+    branchcompletion *it;
+    PyBranchChild *child = NULL;
+
+    it = PyObject_New(&PyBranchCompletion_Type);
+    if (it == NULL)
+        return NULL;
+    it->pending = PyList_New(0);
+    if (it->pending == NULL) {
+        PyObject_Del(it);
+        return NULL;
+    }
+
+    PyCritical_Enter(self->crit);
+    while (PyLinkedList_Next(&self->children, &child)) {
+        if (child->future != NULL &&
+                PyList_Append(it->pending, (PyObject *)child->future) < 0) {
+            PyCritical_Exit(self->crit);
+            Py_DECREF(it);
+            return NULL;
+        }
+    }
+    PyCritical_Exit(self->crit);
+
+    return (PyObject *)it;
+}
+
 PyDoc_STRVAR(Branch___enter____doc__, "");
 PyDoc_STRVAR(Branch___exit____doc__, "");
 PyDoc_STRVAR(Branch_add__doc__, "add(func, *args, **kwargs) -> None");
-PyDoc_STRVAR(Branch_addresult__doc__, "addresult(func, *args, **kwargs) -> None");
+PyDoc_STRVAR(Branch_addresult__doc__,
+"addresult(func, *args, **kwargs) -> future\n\
+\n\
+Like add(), but the result is kept for getresults().  It can also be had\n\
+from the returned future as soon as func returns.");
+PyDoc_STRVAR(Branch_as_completed__doc__,
+"as_completed() -> iterator\n\
+\n\
+Iterate over the futures from addresult() so far, in the order they\n\
+finish.  Waiting for the next one is cancellable.");
 PyDoc_STRVAR(Branch_getresults__doc__, "getresults() -> list");
+PyDoc_STRVAR(Branch_map__doc__,
+"map(func, iterable, chunksize=None, max_inflight=None) -> list\n\
+\n\
+Call func on every item of iterable in child threads, chunksize items at a\n\
+time, and return the results in order.  At most max_inflight chunks are\n\
+outstanding at once.  The first exception cancels the remaining chunks\n\
+and is re-raised.");
 
 static PyMethodDef Branch_methods[] = {
     {"__enter__",       (PyCFunction)Branch___enter__,  METH_NOARGS,
@@ -714,6 +1285,10 @@ static PyMethodDef Branch_methods[] = {
         Branch_addresult__doc__},
     {"getresults",      (PyCFunction)Branch_getresults, METH_NOARGS,
         Branch_getresults__doc__},
+    {"map",             (PyCFunction)Branch_map,        METH_VARARGS | METH_KEYWORDS,
+        Branch_map__doc__},
+    {"as_completed",    (PyCFunction)Branch_as_completed,   METH_NOARGS,
+        Branch_as_completed__doc__},
     {NULL,              NULL}  /* sentinel */
 };
 
@@ -757,3 +1332,413 @@ PyTypeObject PyBranch_Type = {
     Branch_new,                         /*tp_new*/
 };
 
+
+/* Futures.  Waiting goes through threadtools.select(), which gives us
+ * timeouts, cancellation and waiting on several futures at once. */
+
+PyObject *PyExc_FutureTimeout;
+
+static PyBranchFutureObject *
+BranchFuture_New(void)
+{
+    PyBranchFutureObject *self;
+
+    self = PyObject_New(&PyBranchFuture_Type);
+    if (self == NULL)
+        return NULL;
+
+    self->lock = PyThread_lock_allocate();
+    if (self->lock == NULL) {
+        PyObject_Del(self);
+        PyErr_NoMemory();
+        return NULL;
+    }
+    self->done = 0;
+    self->result = NULL;
+    self->exception = NULL;
+    PyLinkedList_InitBase(&self->selectors,
+        offsetof(PySelectWaiter, links));
+
+    return self;
+}
+
+static void
+BranchFuture_dealloc(PyBranchFutureObject *self)
+{
+    assert(PyLinkedList_Empty(&self->selectors));
+
+    Py_XDECREF(self->result);
+    Py_XDECREF(self->exception);
+    PyThread_lock_free(self->lock);
+    PyObject_Del(self);
+}
+
+static int
+BranchFuture_traverse(PyBranchFutureObject *self, visitproc visit, void *arg)
+{
+    Py_VISIT(self->result);
+    Py_VISIT(self->exception);
+    return 0;
+}
+
+/* Called once, by the child.  Does not steal references. */
+static void
+branchfuture_complete(PyBranchFutureObject *self, PyObject *result,
+        PyObject *exception)
+{
+    PySelectWaiter *w = NULL;
+
+    Py_XINCREF(result);
+    Py_XINCREF(exception);
+
+    PyThread_lock_acquire(self->lock);
+    assert(!self->done);
+    self->result = result;
+    self->exception = exception;
+    self->done = 1;
+    while (PyLinkedList_Next(&self->selectors, &w))
+        PyThread_flag_set(w->pystate->condition_flag);
+    PyThread_lock_release(self->lock);
+}
+
+static int
+branchfuture_done(PyBranchFutureObject *self)
+{
+    int done;
+
+    PyThread_lock_acquire(self->lock);
+    done = self->done;
+    PyThread_lock_release(self->lock);
+    return done;
+}
+
+int
+_PyBranchFuture_AddSelector(PyBranchFutureObject *self, PySelectWaiter *w)
+{
+    int done;
+
+    PyThread_lock_acquire(self->lock);
+    PyLinkedList_Append(&self->selectors, w);
+    done = self->done;
+    PyThread_lock_release(self->lock);
+    return done;
+}
+
+void
+_PyBranchFuture_RemoveSelector(PyBranchFutureObject *self, PySelectWaiter *w)
+{
+    PyThread_lock_acquire(self->lock);
+    PyLinkedList_Remove(&w->links);
+    PyThread_lock_release(self->lock);
+}
+
+static PyObject *
+BranchFuture_result(PyBranchFutureObject *self, PyObject *args,
+        PyObject *kwds)
+{
+    static char *kwlist[] = {"timeout", NULL};
+    PyObject *timeoutobj = Py_None;
+    double timeout = -1.0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O:result", kwlist,
+            &timeoutobj))
+        return NULL;
+
+    if (timeoutobj != Py_None) {
+        timeout = PyFloat_AsDouble(timeoutobj);
+        if (timeout == -1.0 && PyErr_Occurred())
+            return NULL;
+        if (timeout < 0) {
+            PyErr_SetString(PyExc_ValueError,
+                "'timeout' must be a positive number");
+            return NULL;
+        }
+    }
+
+    if (!branchfuture_done(self)) {
+        PyObject *sources, *x;
+
+        sources = PyTuple_Pack(1, self);
+        if (sources == NULL)
+            return NULL;
+        x = _PyMonitorSpace_Select(sources, timeout);
+        Py_DECREF(sources);
+        if (x == NULL)
+            return NULL;
+        if (x == Py_None) {
+            Py_DECREF(x);
+            PyErr_SetNone(PyExc_FutureTimeout);
+            return NULL;
+        }
+        Py_DECREF(x);
+    }
+
+    /* Once done is seen under the lock, result and exception are fixed */
+    if (self->exception != NULL) {
+        branch_reraise(self->exception);
+        return NULL;
+    }
+    Py_INCREF(self->result);
+    return self->result;
+}
+
+static PyObject *
+BranchFuture_done(PyBranchFutureObject *self)
+{
+    return PyBool_FromLong(branchfuture_done(self));
+}
+
+static int
+BranchFuture_isshareable(PyBranchFutureObject *self)
+{
+    return 1;
+}
+
+PyDoc_STRVAR(BranchFuture_result__doc__,
+"result(timeout=None) -> object\n\
+\n\
+Wait for the child to finish and return its result, or raise a copy of\n\
+its exception.  Raises Timeout if it hasn't finished in time.  This is\n\
+cancellable.");
+PyDoc_STRVAR(BranchFuture_done__doc__,
+"done() -> bool.  True once the child has finished.");
+
+static PyMethodDef BranchFuture_methods[] = {
+    {"result", (PyCFunction)BranchFuture_result,
+        METH_SHARED | METH_VARARGS | METH_KEYWORDS,
+        BranchFuture_result__doc__},
+    {"done", (PyCFunction)BranchFuture_done,
+        METH_SHARED | METH_NOARGS, BranchFuture_done__doc__},
+    {NULL, NULL}  /* sentinel */
+};
+
+PyDoc_STRVAR(BranchFuture__doc__,
+"The eventual result of a child added by branch.addresult().");
+
+PyTypeObject PyBranchFuture_Type = {
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    "_threadtoolsmodule.future",        /*tp_name*/
+    sizeof(PyBranchFutureObject),       /*tp_basicsize*/
+    0,                                  /*tp_itemsize*/
+    (destructor)BranchFuture_dealloc,   /*tp_dealloc*/
+    0,                                  /*tp_print*/
+    0,                                  /*tp_getattr*/
+    0,                                  /*tp_setattr*/
+    0,                                  /*tp_compare*/
+    0,                                  /*tp_repr*/
+    0,                                  /*tp_as_number*/
+    0,                                  /*tp_as_sequence*/
+    0,                                  /*tp_as_mapping*/
+    0,                                  /*tp_hash*/
+    0,                                  /*tp_call*/
+    0,                                  /*tp_str*/
+    PyObject_GenericGetAttr,            /*tp_getattro*/
+    0,                                  /*tp_setattro*/
+    0,                                  /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC |
+        Py_TPFLAGS_SHAREABLE,           /*tp_flags*/
+    BranchFuture__doc__,                /*tp_doc*/
+    (traverseproc)BranchFuture_traverse,    /*tp_traverse*/
+    0,                                  /*tp_clear*/
+    0,                                  /*tp_richcompare*/
+    0,                                  /*tp_weaklistoffset*/
+    0,                                  /*tp_iter*/
+    0,                                  /*tp_iternext*/
+    BranchFuture_methods,               /*tp_methods*/
+    0,                                  /*tp_members*/
+    0,                                  /*tp_getset*/
+    0,                                  /*tp_base*/
+    0,                                  /*tp_dict*/
+    0,                                  /*tp_descr_get*/
+    0,                                  /*tp_descr_set*/
+    0,                                  /*tp_dictoffset*/
+    0,                                  /*tp_init*/
+    0,                                  /*tp_new*/
+    0,                                  /*tp_is_gc*/
+    0,                                  /*tp_bases*/
+    0,                                  /*tp_mro*/
+    0,                                  /*tp_cache*/
+    0,                                  /*tp_subclasses*/
+    0,                                  /*tp_weaklist*/
+    (isshareablefunc)BranchFuture_isshareable,  /*tp_isshareable*/
+};
+
+
+/* The iterator returned by branch.as_completed().  Each step selects
+ * over the futures not yet yielded. */
+
+static void
+BranchCompletion_dealloc(branchcompletion *self)
+{
+    Py_DECREF(self->pending);
+    PyObject_Del(self);
+}
+
+static PyObject *
+BranchCompletion_iternext(branchcompletion *self)
+{
+    PyObject *sources, *x;
+    Py_ssize_t i;
+
+    if (PyList_GET_SIZE(self->pending) == 0)
+        return NULL;
+
+    sources = PyList_AsTuple(self->pending);
+    if (sources == NULL)
+        return NULL;
+    x = _PyMonitorSpace_Select(sources, -1.0);
+    Py_DECREF(sources);
+    if (x == NULL)
+        return NULL;
+
+    for (i = 0; PyList_GET_ITEM(self->pending, i) != x; i++)
+        ;
+    if (PyList_SetSlice(self->pending, i, i + 1, NULL) < 0) {
+        Py_DECREF(x);
+        return NULL;
+    }
+    return x;
+}
+
+PyTypeObject PyBranchCompletion_Type = {
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    "_threadtoolsmodule.branchcompletion",  /*tp_name*/
+    sizeof(branchcompletion),           /*tp_basicsize*/
+    0,                                  /*tp_itemsize*/
+    (destructor)BranchCompletion_dealloc,   /*tp_dealloc*/
+    0,                                  /*tp_print*/
+    0,                                  /*tp_getattr*/
+    0,                                  /*tp_setattr*/
+    0,                                  /*tp_compare*/
+    0,                                  /*tp_repr*/
+    0,                                  /*tp_as_number*/
+    0,                                  /*tp_as_sequence*/
+    0,                                  /*tp_as_mapping*/
+    0,                                  /*tp_hash*/
+    0,                                  /*tp_call*/
+    0,                                  /*tp_str*/
+    PyObject_GenericGetAttr,            /*tp_getattro*/
+    0,                                  /*tp_setattro*/
+    0,                                  /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,                 /*tp_flags*/
+    0,                                  /*tp_doc*/
+    0,                                  /*tp_traverse*/
+    0,                                  /*tp_clear*/
+    0,                                  /*tp_richcompare*/
+    0,                                  /*tp_weaklistoffset*/
+    PyObject_SelfIter,                  /*tp_iter*/
+    (iternextfunc)BranchCompletion_iternext,    /*tp_iternext*/
+};
+
+
+
+void
+PyBranch_SetPoolSize(Py_ssize_t size)
+{
+    PyBranchWorker *worker;
+
+    assert(size >= 0);
+
+    PyThread_lock_acquire(pool_lock);
+    pool_size = size;
+    /* Surplus idle workers are woken without a task, which makes them
+     * exit. */
+    while (pool_idlecount > pool_size) {
+        worker = PyLinkedList_First(&pool_idle);
+        PyLinkedList_Remove(&worker->idle_links);
+        pool_idlecount--;
+        PyThread_flag_set(worker->wakeup);
+    }
+    PyThread_lock_release(pool_lock);
+}
+
+Py_ssize_t
+PyBranch_GetPoolSize(void)
+{
+    Py_ssize_t size;
+
+    PyThread_lock_acquire(pool_lock);
+    size = pool_size;
+    PyThread_lock_release(pool_lock);
+    return size;
+}
+
+PyObject *
+PyBranch_GetPoolStats(void)
+{
+    Py_ssize_t size, threads, idle, tasks, spawned, reused;
+    double total, max;
+
+    PyThread_lock_acquire(pool_lock);
+    size = pool_size;
+    threads = pool_threads;
+    idle = pool_idlecount;
+    tasks = pool_tasks;
+    spawned = pool_spawned;
+    reused = pool_reused;
+    total = pool_latency_total;
+    max = pool_latency_max;
+    PyThread_lock_release(pool_lock);
+
+    return Py_BuildValue("{s:n,s:n,s:n,s:n,s:n,s:n,s:d,s:d}",
+        "size", size, "threads", threads, "idle", idle, "tasks", tasks,
+        "spawned", spawned, "reused", reused, "latency_total", total,
+        "latency_max", max);
+}
+
+void
+_PyBranch_Init(void)
+{
+    PyLinkedList_InitBase(&pool_idle, offsetof(PyBranchWorker, idle_links));
+    pool_lock = PyThread_lock_allocate();
+    pool_exited = PyThread_cond_allocate();
+    if (!pool_lock || !pool_exited)
+        Py_FatalError("Failed to allocate branch worker pool");
+}
+
+/* Needs the builtin exceptions, so runs later than _PyBranch_Init */
+void
+_PyBranch_InitExceptions(void)
+{
+    PyObject *mod, *dict;
+
+    /* _threadtools is a shared module, so its classes must be too */
+    dict = PyDict_New();
+    if (dict == NULL || PyDict_SetItemString(dict, "__shared__", Py_True) < 0)
+        Py_FatalError("Can't create future exceptions");
+    PyExc_FutureTimeout = PyErr_NewException("_threadtools.Timeout", NULL,
+        dict);
+    Py_DECREF(dict);
+    if (PyExc_FutureTimeout == NULL)
+        Py_FatalError("Can't create future exceptions");
+
+    mod = PyImport_AddModule("_threadtools");
+    if (mod == NULL ||
+            PyModule_AddObject(mod, "Timeout", PyExc_FutureTimeout) < 0)
+        Py_FatalError("Can't add future exceptions to _threadtools");
+    /* PyModule_AddObject stole the reference; keep our own */
+    Py_INCREF(PyExc_FutureTimeout);
+}
+
+/* Called once every branch has finished.  Tells the parked workers to
+ * exit and waits for their PyStates to go away, so that only the main
+ * thread is left. */
+void
+_PyBranch_Fini(void)
+{
+    PyBranchWorker *worker;
+
+    PyState_Suspend();
+    PyThread_lock_acquire(pool_lock);
+    pool_shutdown = 1;
+    while (!PyLinkedList_Empty(&pool_idle)) {
+        worker = PyLinkedList_First(&pool_idle);
+        PyLinkedList_Remove(&worker->idle_links);
+        pool_idlecount--;
+        PyThread_flag_set(worker->wakeup);
+    }
+    while (pool_threads > 0)
+        PyThread_cond_wait(pool_exited, pool_lock);
+    PyThread_lock_release(pool_lock);
+    PyState_Resume();
+}
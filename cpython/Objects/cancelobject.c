@@ -2,6 +2,12 @@
 #include "Python.h"
 #include "cancelobject.h"
 #include "pystate.h"
+#include "pytimer.h"
+
+#include <poll.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -284,10 +290,112 @@ PyCancel_SignalExit(void)
     Py_FatalError("PyCancel_SignalExit not implemented");
 }
 
+/* Each thread has one wakeup fd, opened the first time it waits and kept
+ * for the life of its PyState.  A cancelled wait's callback writes to it
+ * and the waiter drains it again, so it's always quiet between waits and
+ * a wait costs only the poll() itself. */
+
+typedef struct {
+    PyState *pystate;
+    int cancelled;
+} poll_waiter;
+
+static int
+cancel_openwakeup(PyState *pystate)
+{
+    if (pystate->cancel_wakeup[0] >= 0)
+        return 0;
+
+#ifdef HAVE_SYS_EVENTFD_H
+    pystate->cancel_wakeup[0] = eventfd(0, EFD_CLOEXEC);
+    if (pystate->cancel_wakeup[0] < 0) {
+        PyErr_SetFromErrno(PyExc_IOError);
+        return -1;
+    }
+    pystate->cancel_wakeup[1] = pystate->cancel_wakeup[0];
+#else
+    if (pipe(pystate->cancel_wakeup)) {
+        pystate->cancel_wakeup[0] = -1;
+        pystate->cancel_wakeup[1] = -1;
+        PyErr_SetFromErrno(PyExc_IOError);
+        return -1;
+    }
+#endif
+    return 0;
+}
+
+static void
+poll_cancelwakeup(PyCancelQueue *queue, void *arg)
+{
+    poll_waiter *pw = arg;
+#ifdef HAVE_SYS_EVENTFD_H
+    uint64_t one = 1;
+#else
+    char one = 'x';
+#endif
+
+    pw->cancelled = 1;
+    if (write(pw->pystate->cancel_wakeup[1], &one, sizeof(one)) !=
+            sizeof(one))
+        Py_FatalError("Writing to cancel wakeup fd failed");
+}
+
 int
-PyCancel_Poll(int fd)
+PyCancel_Poll(int fd, short events)
 {
-    Py_FatalError("PyCancel_Poll not implemented");
+    PyState *pystate = PyState_Get();
+    PyCancelObject *cancel_scope;
+    struct pollfd fds[2];
+    int status, saved_errno = 0;
+    poll_waiter pw;
+
+    if (cancel_openwakeup(pystate) < 0)
+        return -1;
+
+    pw.pystate = pystate;
+    pw.cancelled = 0;
+
+    cancel_scope = PyCancel_New(poll_cancelwakeup, &pw, pystate);
+    if (cancel_scope == NULL)
+        return -1;
+
+    fds[0].fd = fd;
+    fds[0].events = events;
+    fds[1].fd = pystate->cancel_wakeup[0];
+    fds[1].events = POLLIN;
+
+    PyCancel_Push(cancel_scope);
+    PyState_Suspend();
+    do {
+        status = poll(fds, 2, -1);
+    } while (status < 0 && errno == EINTR && !pw.cancelled);
+    if (status < 0)
+        saved_errno = errno;
+    PyState_Resume();
+    /* Waits for the callback, if it was started, to finish writing */
+    PyCancel_Pop(cancel_scope);
+    Py_DECREF(cancel_scope);
+
+    if (pw.cancelled) {
+#ifdef HAVE_SYS_EVENTFD_H
+        uint64_t buf;
+#else
+        char buf;
+#endif
+        if (read(pystate->cancel_wakeup[0], &buf, sizeof(buf)) !=
+                sizeof(buf))
+            Py_FatalError("Resetting cancel wakeup fd failed");
+        PyErr_SetString(PyExc_Cancelled,
+            "I/O operation cancelled by parent");
+        return -1;
+    }
+
+    if (status < 0) {
+        errno = saved_errno;
+        PyErr_SetFromErrno(PyExc_IOError);
+        return -1;
+    }
+    return 0;
 }
 
 #if 0
@@ -298,20 +406,70 @@ PyCancel_WaitForMultipleObjects(...)
 }
 #endif
 
+static void
+sleep_cancelwakeup(PyCancelQueue *queue, void *arg)
+{
+    poll_waiter *pw = arg;
+
+    pw->cancelled = 1;
+    PyThread_flag_set(pw->pystate->condition_flag);
+}
+
+/* Sleeps on condition_flag, which shouldn't be in use at this point.
+ * secs < 0 means forever. */
+static int
+cancel_sleep(double secs)
+{
+    PyState *pystate = PyState_Get();
+    PyCancelObject *cancel_scope;
+    PyTimer timer;
+    poll_waiter pw;
+
+    pw.pystate = pystate;
+    pw.cancelled = 0;
+
+    cancel_scope = PyCancel_New(sleep_cancelwakeup, &pw, pystate);
+    if (cancel_scope == NULL)
+        return -1;
+    if (secs >= 0 && PyTimer_Start(&timer, pystate->condition_flag,
+            secs) < 0) {
+        Py_DECREF(cancel_scope);
+        return -1;
+    }
+
+    PyCancel_Push(cancel_scope);
+    PyState_Suspend();
+    PyThread_flag_wait(pystate->condition_flag);
+    PyState_Resume();
+    PyCancel_Pop(cancel_scope);
+
+    /* Nobody else can set the flag once both are stopped */
+    if (secs >= 0)
+        PyTimer_Stop(&timer);
+    PyThread_flag_clear(pystate->condition_flag);
+    Py_DECREF(cancel_scope);
+
+    if (pw.cancelled) {
+        PyErr_SetString(PyExc_Cancelled, "sleep cancelled");
+        return -1;
+    }
+    return 0;
+}
+
 int
 PyCancel_Sleep(double secs)
 {
-    Py_FatalError("PyCancel_Sleep not implemented");
+    if (secs < 0)
+        secs = 0;
+    return cancel_sleep(secs);
 }
 
-/* XXX FIXME consider replacing this with Sleep(Inf) */
 int
 PyCancel_SleepForever(void)
 {
-    Py_FatalError("PyCancel_SleepForever not implemented");
+    return cancel_sleep(-1);
 }
 
-
 #ifdef __cplusplus
 }
 #endif
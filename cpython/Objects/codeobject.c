@@ -1,5 +1,6 @@
 #include "Python.h"
 #include "code.h"
+#include "marshal.h"
 #include "structmember.h"
 
 #define NAME_CHARS \
@@ -41,6 +42,22 @@ intern_strings(PyObject *tuple)
 	}
 }
 
+/* Intern selected string constants */
+static void
+intern_consts(PyObject *consts)
+{
+	Py_ssize_t i;
+
+	for (i = PyTuple_Size(consts); --i >= 0; ) {
+		PyObject *v = PyTuple_GetItem(consts, i);
+		if (!PyUnicode_Check(v))
+			continue;
+		if (!all_name_chars(PyUnicode_AS_UNICODE(v)))
+			continue;
+		PyUnicode_InternInPlace(&PyTuple_GET_ITEM(consts, i));
+	}
+}
+
 
 PyCodeObject *
 PyCode_New(int argcount, int kwonlyargcount,
@@ -51,7 +68,6 @@ PyCode_New(int argcount, int kwonlyargcount,
 	   PyObject *lnotab)
 {
 	PyCodeObject *co;
-	Py_ssize_t i;
 
 	/* Check argument types */
 	if (argcount < 0 || nlocals < 0 ||
@@ -72,15 +88,7 @@ PyCode_New(int argcount, int kwonlyargcount,
 	intern_strings(varnames);
 	intern_strings(freevars);
 	intern_strings(cellvars);
-	/* Intern selected string constants */
-	for (i = PyTuple_Size(consts); --i >= 0; ) {
-		PyObject *v = PyTuple_GetItem(consts, i);
-		if (!PyUnicode_Check(v))
-			continue;
-		if (!all_name_chars(PyUnicode_AS_UNICODE(v)))
-			continue;
-		PyUnicode_InternInPlace(&PyTuple_GET_ITEM(consts, i));
-	}
+	intern_consts(consts);
 	co = PyObject_New(&PyCode_Type);
 	if (co != NULL) {
 		co->co_argcount = argcount;
@@ -108,10 +116,104 @@ PyCode_New(int argcount, int kwonlyargcount,
 		Py_INCREF(lnotab);
 		co->co_lnotab = lnotab;
                 co->co_zombieframe = NULL;
+                co->co_quickened = 0;
+                co->co_warmup = 0;
+		co->co_lazy = NULL;
+	}
+	return co;
+}
+
+PyCodeObject *
+_PyCode_NewLazy(int argcount, int kwonlyargcount,
+	   int nlocals, int stacksize, int flags,
+	   PyObject *varnames, PyObject *freevars, PyObject *cellvars,
+	   PyObject *filename, PyObject *name, int firstlineno,
+	   PyCodeLazy *lazy)
+{
+	PyCodeObject *co;
+
+	if (argcount < 0 || nlocals < 0 ||
+	    varnames == NULL || !PyTuple_Check(varnames) ||
+	    freevars == NULL || !PyTuple_Check(freevars) ||
+	    cellvars == NULL || !PyTuple_Check(cellvars) ||
+	    name == NULL || !PyUnicode_Check(name) ||
+	    filename == NULL || !PyUnicode_Check(filename)) {
+		_PyMarshal_FreeLazyCode(lazy);
+		PyErr_BadInternalCall();
+		return NULL;
 	}
+	intern_strings(varnames);
+	intern_strings(freevars);
+	intern_strings(cellvars);
+	co = PyObject_New(&PyCode_Type);
+	if (co == NULL) {
+		_PyMarshal_FreeLazyCode(lazy);
+		return NULL;
+	}
+	co->co_argcount = argcount;
+	co->co_kwonlyargcount = kwonlyargcount;
+	co->co_nlocals = nlocals;
+	co->co_stacksize = stacksize;
+	co->co_flags = flags;
+	co->co_code = NULL;
+	co->co_consts = NULL;
+	co->co_names = NULL;
+	Py_INCREF(varnames);
+	co->co_varnames = varnames;
+	Py_INCREF(freevars);
+	co->co_freevars = freevars;
+	Py_INCREF(cellvars);
+	co->co_cellvars = cellvars;
+	Py_INCREF(filename);
+	co->co_filename = filename;
+	Py_INCREF(name);
+	co->co_name = name;
+	co->co_firstlineno = firstlineno;
+	co->co_lnotab = NULL;
+	co->co_zombieframe = NULL;
+	co->co_quickened = 0;
+	co->co_warmup = 0;
+	co->co_lazy = lazy;
 	return co;
 }
 
+/* Sets a field left NULL by _PyCode_NewLazy(), unless another thread
+   loading the same code got there first */
+static void
+load_field(PyObject **field, PyObject *v)
+{
+	if (!AO_compare_and_swap_full((AO_t *)field, 0, (AO_t)v))
+		Py_DECREF(v);
+}
+
+int
+_PyCode_Load(PyCodeObject *co)
+{
+	PyObject *code, *consts, *names, *lnotab;
+
+	/* Threads running the code for the first time at once each read it,
+	   and all but the first to fill in a field throw theirs away */
+	if (_PyMarshal_ReadLazyCode(co->co_lazy, &code, &consts, &names,
+			&lnotab) < 0)
+		return -1;
+	if (!PyTuple_Check(consts) || !PyTuple_Check(names) ||
+	    !PyString_Check(lnotab) || !PyObject_CheckReadBuffer(code)) {
+		Py_DECREF(code);
+		Py_DECREF(consts);
+		Py_DECREF(names);
+		Py_DECREF(lnotab);
+		PyErr_SetString(PyExc_ValueError, "bad marshal data");
+		return -1;
+	}
+	intern_strings(names);
+	intern_consts(consts);
+	load_field(&co->co_code, code);
+	load_field(&co->co_consts, consts);
+	load_field(&co->co_names, names);
+	load_field(&co->co_lnotab, lnotab);
+	return 0;
+}
+
 
 #define OFF(x) offsetof(PyCodeObject, x)
 
@@ -121,16 +223,58 @@ static PyMemberDef code_memberlist[] = {
 	{"co_nlocals",	T_INT,		OFF(co_nlocals),	READONLY},
 	{"co_stacksize",T_INT,		OFF(co_stacksize),	READONLY},
 	{"co_flags",	T_INT,		OFF(co_flags),		READONLY},
-	{"co_code",	T_OBJECT,	OFF(co_code),		READONLY},
-	{"co_consts",	T_OBJECT,	OFF(co_consts),		READONLY},
-	{"co_names",	T_OBJECT,	OFF(co_names),		READONLY},
 	{"co_varnames",	T_OBJECT,	OFF(co_varnames),	READONLY},
 	{"co_freevars",	T_OBJECT,	OFF(co_freevars),	READONLY},
 	{"co_cellvars",	T_OBJECT,	OFF(co_cellvars),	READONLY},
 	{"co_filename",	T_OBJECT,	OFF(co_filename),	READONLY},
 	{"co_name",	T_OBJECT,	OFF(co_name),		READONLY},
 	{"co_firstlineno", T_INT,	OFF(co_firstlineno),	READONLY},
-	{"co_lnotab",	T_OBJECT,	OFF(co_lnotab),		READONLY},
+	{NULL}	/* Sentinel */
+};
+
+/* The fields a lazily unmarshalled code object may not have yet */
+
+static PyObject *
+code_get_code(PyCodeObject *co, void *closure)
+{
+	if (PyCode_Load(co) < 0)
+		return NULL;
+	Py_INCREF(co->co_code);
+	return co->co_code;
+}
+
+static PyObject *
+code_get_consts(PyCodeObject *co, void *closure)
+{
+	if (PyCode_Load(co) < 0)
+		return NULL;
+	Py_INCREF(co->co_consts);
+	return co->co_consts;
+}
+
+static PyObject *
+code_get_names(PyCodeObject *co, void *closure)
+{
+	if (PyCode_Load(co) < 0)
+		return NULL;
+	Py_INCREF(co->co_names);
+	return co->co_names;
+}
+
+static PyObject *
+code_get_lnotab(PyCodeObject *co, void *closure)
+{
+	if (PyCode_Load(co) < 0)
+		return NULL;
+	Py_INCREF(co->co_lnotab);
+	return co->co_lnotab;
+}
+
+static PyGetSetDef code_getsetlist[] = {
+	{"co_code",	(getter)code_get_code,		NULL, NULL},
+	{"co_consts",	(getter)code_get_consts,	NULL, NULL},
+	{"co_names",	(getter)code_get_names,		NULL, NULL},
+	{"co_lnotab",	(getter)code_get_lnotab,	NULL, NULL},
 	{NULL}	/* Sentinel */
 };
 
@@ -282,8 +426,12 @@ code_dealloc(PyCodeObject *co)
 	Py_XDECREF(co->co_filename);
 	Py_XDECREF(co->co_name);
 	Py_XDECREF(co->co_lnotab);
+	if (co->co_lazy != NULL)
+		_PyMarshal_FreeLazyCode(co->co_lazy);
         if (co->co_zombieframe != NULL)
                 PyObject_Del(co->co_zombieframe);
+        if (co->co_quickened != 0)
+                PyMem_FREE((void *)co->co_quickened);
 	PyObject_Del(co);
 }
 
@@ -318,6 +466,8 @@ code_richcompare(PyObject *self, PyObject *other, int op)
 
 	co = (PyCodeObject *)self;
 	cp = (PyCodeObject *)other;
+	if (PyCode_Load(co) < 0 || PyCode_Load(cp) < 0)
+		return NULL;
 
 	eq = PyObject_RichCompareBool(co->co_name, cp->co_name, Py_EQ);
 	if (eq <= 0) goto unequal;
@@ -367,6 +517,8 @@ static long
 code_hash(PyCodeObject *co)
 {
 	long h, h0, h1, h2, h3, h4, h5, h6;
+	if (PyCode_Load(co) < 0)
+		return -1;
 	h0 = PyObject_Hash(co->co_name);
 	if (h0 == -1) return -1;
 	h1 = PyObject_Hash(co->co_code);
@@ -420,7 +572,7 @@ PyTypeObject PyCode_Type = {
 	0,				/* tp_iternext */
 	0,				/* tp_methods */
 	code_memberlist,		/* tp_members */
-	0,				/* tp_getset */
+	code_getsetlist,		/* tp_getset */
 	0,				/* tp_base */
 	0,				/* tp_dict */
 	0,				/* tp_descr_get */
@@ -477,10 +629,16 @@ was actually done until 2.2) expand 300, 300 to 255, 255,  45, 45, but to
 int
 PyCode_Addr2Line(PyCodeObject *co, int addrq)
 {
-	int size = PyString_Size(co->co_lnotab) / 2;
-	unsigned char *p = (unsigned char*)PyString_AsString(co->co_lnotab);
+	int size;
+	unsigned char *p;
 	int line = co->co_firstlineno;
 	int addr = 0;
+	/* Lazily unmarshalled code that has never run may not have it yet,
+	   and the profilers call this where it mustn't be loaded */
+	if (co->co_lnotab == NULL)
+		return line;
+	size = PyString_Size(co->co_lnotab) / 2;
+	p = (unsigned char*)PyString_AsString(co->co_lnotab);
 	while (--size >= 0) {
 		addr += *p++;
 		if (addr > addrq)
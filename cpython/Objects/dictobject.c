@@ -2507,7 +2507,7 @@ shareddict_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
 
     self->readonly_mode = 0;
     self->read_count = 0;
-    self->crit = PyCritical_Allocate(PyCRITICAL_NORMAL);
+    self->crit = PyCritical_AllocateNamed(PyCRITICAL_NORMAL, "shareddict");
     if (self->crit == NULL) {
         Py_DECREF(self);
         PyErr_NoMemory();
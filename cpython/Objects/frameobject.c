@@ -584,6 +584,8 @@ PyFrame_New(PyState *pystate, PyCodeObject *code, PyObject *globals,
 		return NULL;
 	}
 #endif
+	if (PyCode_Load(code) < 0)
+		return NULL;
 	if (back == NULL || back->f_globals != globals) {
 		if (PyDict_GetItemEx(globals, builtin_object, &builtins) < 0)
 			return NULL;
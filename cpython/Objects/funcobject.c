@@ -25,8 +25,15 @@ PyFunction_New(PyObject *code, PyObject *globals)
 		op->func_defaults = NULL; /* No default arguments */
 		op->func_kwdefaults = NULL; /* No keyword only defaults */
 		op->func_closure = NULL;
-		consts = ((PyCodeObject *)code)->co_consts;
-		if (PyTuple_Size(consts) >= 1) {
+		consts = (PyObject *)AO_load_acquire(
+			(AO_t *)&((PyCodeObject *)code)->co_consts);
+		if (consts == NULL) {
+			/* Unmarshalled lazily, and not worth loading for */
+			doc = ((PyCodeObject *)code)->co_lazy->doc;
+			if (doc == NULL)
+				doc = Py_None;
+		}
+		else if (PyTuple_Size(consts) >= 1) {
 			doc = PyTuple_GetItem(consts, 0);
 			if (!PyUnicode_Check(doc))
 				doc = Py_None;
@@ -724,6 +731,11 @@ typedef struct {
 	PyObject *cm_callable;
 } classmethod;
 
+static PyMemberDef cm_memberlist[] = {
+	{"__func__", T_OBJECT, offsetof(classmethod, cm_callable), READONLY},
+	{NULL}  /* Sentinel */
+};
+
 static void
 cm_dealloc(classmethod *cm)
 {
@@ -839,7 +851,7 @@ PyTypeObject PyClassMethod_Type = {
 	0,					/* tp_iter */
 	0,					/* tp_iternext */
 	0,					/* tp_methods */
-	0,					/* tp_members */
+	cm_memberlist,				/* tp_members */
 	0,					/* tp_getset */
 	0,					/* tp_base */
 	0,					/* tp_dict */
@@ -890,6 +902,11 @@ typedef struct {
 	PyObject *sm_callable;
 } staticmethod;
 
+static PyMemberDef sm_memberlist[] = {
+	{"__func__", T_OBJECT, offsetof(staticmethod, sm_callable), READONLY},
+	{NULL}  /* Sentinel */
+};
+
 static void
 sm_dealloc(staticmethod *sm)
 {
@@ -996,7 +1013,7 @@ PyTypeObject PyStaticMethod_Type = {
 	0,					/* tp_iter */
 	0,					/* tp_iternext */
 	0,					/* tp_methods */
-	0,					/* tp_members */
+	sm_memberlist,				/* tp_members */
 	0,					/* tp_getset */
 	0,					/* tp_base */
 	0,					/* tp_dict */
@@ -4,6 +4,11 @@
 #include "branchobject.h"
 #include "cancelobject.h"
 #include "monitorobject.h"
+#include "queueobject.h"
+#include "pylockprof.h"
+#include "pytimer.h"
+#include "reactorobject.h"
+#include "structmember.h"
 
 static PyObject *PyMonitorSpace_Enter(PyMonitorSpaceObject *self,
     PyObject *func, PyObject *args, PyObject *kwds, ternaryfunc call2);
@@ -191,9 +196,9 @@ monitor_recheck_conditions(PyMonitorObject *self, boundcondition *skipped_bcond)
                 Py_DECREF(value);
                 return;
             } else if (x > 0) {
-                PyState *t = PyLinkedList_First(&bcond->waiters);
+                PySelectWaiter *w = PyLinkedList_First(&bcond->waiters);
 
-                PyThread_flag_set(t->condition_flag);
+                PyThread_flag_set(w->pystate->condition_flag);
                 self->mon_waking = 1;
 
                 Py_DECREF(key);
@@ -435,6 +440,11 @@ Convert a function to be a monitor method.\n\
 \n\
 A monitor method enters the monitor when called.");
 
+static PyMemberDef mm_members[] = {
+    {"__func__", T_OBJECT, offsetof(monitormethod, mm_callable), READONLY},
+    {NULL}  /* Sentinel */
+};
+
 PyTypeObject PyMonitorMethod_Type = {
     PyVarObject_HEAD_INIT(&PyType_Type, 0)
     "monitormethod",
@@ -465,7 +475,7 @@ PyTypeObject PyMonitorMethod_Type = {
     0,                                          /* tp_iter */
     0,                                          /* tp_iternext */
     0,                                          /* tp_methods */
-    0,                                          /* tp_members */
+    mm_members,                                 /* tp_members */
     0,                                          /* tp_getset */
     0,                                          /* tp_base */
     0,                                          /* tp_dict */
@@ -765,6 +775,11 @@ Convert a function to be a monitor condition.\n\
 A monitor condition allows waiting for a property of the monitor\n\
 to become true, using wait(mon.condition).");
 
+static PyMemberDef cond_members[] = {
+    {"__func__", T_OBJECT, offsetof(condition, cond_callable), READONLY},
+    {NULL}  /* Sentinel */
+};
+
 PyTypeObject PyMonitorCondition_Type = {
     PyVarObject_HEAD_INIT(&PyType_Type, 0)
     "condition",
@@ -795,7 +810,7 @@ PyTypeObject PyMonitorCondition_Type = {
     0,                                          /* tp_iter */
     0,                                          /* tp_iternext */
     0,                                          /* tp_methods */
-    0,                                          /* tp_members */
+    cond_members,                               /* tp_members */
     0,                                          /* tp_getset */
     0,                                          /* tp_base */
     0,                                          /* tp_dict */
@@ -849,7 +864,7 @@ PyBoundMonitorCondition_New(PyObject *cond, PyObject *mon)
     bcond->cond = cond;
     Py_INCREF(mon);
     bcond->monitor = mon;
-    PyLinkedList_InitBase(&bcond->waiters, offsetof(PyState, condition_links));
+    PyLinkedList_InitBase(&bcond->waiters, offsetof(PySelectWaiter, links));
 
     return (PyObject *)bcond;
 }
@@ -878,6 +893,7 @@ boundcondition_wait(boundcondition *bcond)
     PyObject *x, *result = NULL;
     int res;
     blewed_up bu;
+    PySelectWaiter waiter;
 
     /* boundconditions aren't shareable, so it shouldn't be possible to
      * call us without being the current monitorspace.  Otherwise we'd
@@ -886,6 +902,8 @@ boundcondition_wait(boundcondition *bcond)
 
     bu.pystate = pystate;
     bu.cancelled = 0;
+    waiter.pystate = pystate;
+    PyLinkedList_InitNode(&waiter.links);
 
     cancel_scope = PyCancel_New(boundcondition_wakeup, &bu, pystate);
     if (cancel_scope == NULL)
@@ -918,7 +936,7 @@ boundcondition_wait(boundcondition *bcond)
         }
 
         /* Otherwise we put ourselves to sleep */
-        PyLinkedList_Append(&bcond->waiters, pystate);
+        PyLinkedList_Append(&bcond->waiters, &waiter);
         monitor_recheck_conditions((PyMonitorObject *)bcond->monitor, bcond);
 
         PyCancel_Push(cancel_scope);
@@ -934,7 +952,7 @@ boundcondition_wait(boundcondition *bcond)
         PyThread_flag_clear(pystate->condition_flag);
         ((PyMonitorObject *)bcond->monitor)->mon_waking = 0;
 
-        PyLinkedList_Remove(&pystate->condition_links);
+        PyLinkedList_Remove(&waiter.links);
 
         /* monitor_recheck_conditions and monitorspace_acquire may both
          * set exceptions */
@@ -948,6 +966,205 @@ boundcondition_wait(boundcondition *bcond)
     return result;
 }
 
+/* threadtools.select().  Every source gets its own PySelectWaiter, all
+ * of them pointing at our condition_flag, so we sleep once and whichever
+ * source becomes ready first wakes us.  Conditions must belong to the
+ * current monitorspace, which we relinquish while asleep just as
+ * boundcondition_wait does.
+ *
+ * Returns 1 if the source is already ready, 0 if not, or -1 with an
+ * exception set.  The waiter is left on the source's list unless -1 is
+ * returned. */
+static int
+select_add(PyObject *source, PySelectWaiter *w)
+{
+    boundcondition *bcond;
+    PyObject *x;
+    int res;
+
+    if (PyQueue_Check(source))
+        return _PyQueue_AddSelector((PyQueueObject *)source, w);
+    if (PyDeathQueue_Check(source))
+        return _PyDeathQueue_AddSelector((PyDeathQueue *)source, w);
+    if (PyBranchFuture_Check(source))
+        return _PyBranchFuture_AddSelector((PyBranchFutureObject *)source,
+            w);
+    if (PyFDWatch_Check(source))
+        return _PyFDWatch_AddSelector((PyFDWatchObject *)source, w);
+
+    bcond = (boundcondition *)source;
+    x = PyObject_CallFunction(((condition *)bcond->cond)->cond_callable,
+        "O", bcond->monitor);
+    if (x == NULL)
+        return -1;
+    res = PyObject_IsTrue(x);
+    Py_DECREF(x);
+    if (res < 0)
+        return -1;
+
+    PyLinkedList_Append(&bcond->waiters, w);
+    if (res == 0) {
+        monitor_recheck_conditions((PyMonitorObject *)bcond->monitor, bcond);
+        if (PyErr_Occurred()) {
+            PyLinkedList_Remove(&w->links);
+            return -1;
+        }
+    }
+    return res;
+}
+
+static void
+select_remove(PyObject *source, PySelectWaiter *w, int woken)
+{
+    if (PyQueue_Check(source))
+        _PyQueue_RemoveSelector((PyQueueObject *)source, w);
+    else if (PyDeathQueue_Check(source))
+        _PyDeathQueue_RemoveSelector((PyDeathQueue *)source, w);
+    else if (PyBranchFuture_Check(source))
+        _PyBranchFuture_RemoveSelector((PyBranchFutureObject *)source, w);
+    else if (PyFDWatch_Check(source))
+        _PyFDWatch_RemoveSelector((PyFDWatchObject *)source, w);
+    else {
+        boundcondition *bcond = (boundcondition *)source;
+
+        PyLinkedList_Remove(&w->links);
+        /* We may have been the waiter monitor_recheck_conditions chose,
+         * even if we return some other source.  Either way the monitor
+         * gets rechecked when our caller leaves it. */
+        if (woken)
+            ((PyMonitorObject *)bcond->monitor)->mon_waking = 0;
+    }
+}
+
+/* sources must be a tuple.  timeout < 0 means forever. */
+PyObject *
+_PyMonitorSpace_Select(PyObject *sources, double timeout)
+{
+    PyState *pystate = PyState_Get();
+    PyMonitorSpaceObject *monitorspace = NULL;
+    Py_ssize_t i, added, n = PyTuple_GET_SIZE(sources);
+    PySelectWaiter *waiters;
+    PyTimer timer;
+    PyCancelObject *cancel_scope;
+    PyObject *result = NULL;
+    int ready;
+    blewed_up bu;
+
+    for (i = 0; i < n; i++) {
+        PyObject *source = PyTuple_GET_ITEM(sources, i);
+
+        if (Py_TYPE(source) == &PyBoundMonitorCondition_Type) {
+            boundcondition *bcond = (boundcondition *)source;
+
+            monitorspace = PyMonitor_GetMonitorSpace(bcond->monitor);
+            if (!PyMonitorSpace_IsCurrent(monitorspace)) {
+                PyErr_SetString(PyExc_RuntimeError, "select() on a "
+                    "condition must be called from within its monitor");
+                return NULL;
+            }
+        } else if (!PyQueue_Check(source) && !PyDeathQueue_Check(source) &&
+                !PyBranchFuture_Check(source) && !PyFDWatch_Check(source)) {
+            PyErr_Format(PyExc_TypeError, "select() expects Queue, "
+                "deathqueue, future, fdwatch or condition objects, "
+                "not '%.200s'",
+                Py_TYPE(source)->tp_name);
+            return NULL;
+        }
+    }
+
+    waiters = PyMem_NEW(PySelectWaiter, n ? n : 1);
+    if (waiters == NULL)
+        return PyErr_NoMemory();
+    for (i = 0; i < n; i++) {
+        PyLinkedList_InitNode(&waiters[i].links);
+        waiters[i].pystate = pystate;
+    }
+
+    bu.pystate = pystate;
+    bu.cancelled = 0;
+
+    cancel_scope = PyCancel_New(boundcondition_wakeup, &bu, pystate);
+    if (cancel_scope == NULL)
+        goto done;
+
+    /* The timer sets condition_flag too, and PyTimer_Stop tells us
+     * whether it was what woke us */
+    if (timeout > 0 && PyTimer_Start(&timer, pystate->condition_flag,
+            timeout) < 0) {
+        Py_DECREF(cancel_scope);
+        goto done;
+    }
+
+    /* Push it briefly in case we're called when cancelled */
+    PyCancel_Push(cancel_scope);
+    PyCancel_Pop(cancel_scope);
+
+    while (1) {
+        if (bu.cancelled) {
+            PyErr_SetString(PyExc_Cancelled, "select() cancelled");
+            break;
+        }
+
+        /* Stop at the first ready source, so earlier ones take priority */
+        ready = 0;
+        for (added = 0; added < n; added++) {
+            ready = select_add(PyTuple_GET_ITEM(sources, added),
+                &waiters[added]);
+            if (ready)
+                break;
+        }
+
+        if (ready < 0) {
+            for (i = 0; i < added; i++)
+                select_remove(PyTuple_GET_ITEM(sources, i), &waiters[i], 0);
+            break;
+        }
+        if (ready > 0) {
+            for (i = 0; i <= added; i++)
+                select_remove(PyTuple_GET_ITEM(sources, i), &waiters[i], 0);
+            result = PyTuple_GET_ITEM(sources, added);
+            Py_INCREF(result);
+            break;
+        }
+        /* The timer marks itself expired before setting our flag, so
+         * we see it once we've woken and cleared the flag */
+        if (timeout == 0 || (timeout > 0 && timer.expired)) {
+            for (i = 0; i < n; i++)
+                select_remove(PyTuple_GET_ITEM(sources, i), &waiters[i], 0);
+            Py_INCREF(Py_None);
+            result = Py_None;
+            break;
+        }
+
+        PyCancel_Push(cancel_scope);
+        if (monitorspace != NULL)
+            monitorspace_release(monitorspace, NULL);
+        PyState_Suspend();
+        PyThread_flag_wait(pystate->condition_flag);
+        PyState_Resume();
+        if (monitorspace != NULL && monitorspace_acquire(monitorspace, 0))
+            Py_FatalError("select() unable to reacquire MonitorSpace");
+        PyCancel_Pop(cancel_scope);
+
+        for (i = 0; i < n; i++)
+            select_remove(PyTuple_GET_ITEM(sources, i), &waiters[i], 1);
+        PyThread_flag_clear(pystate->condition_flag);
+
+        /* monitorspace_acquire may set an exception */
+        if (PyErr_Occurred())
+            break;
+    }
+
+    if (timeout > 0)
+        PyTimer_Stop(&timer);
+    PyThread_flag_clear(pystate->condition_flag);
+    Py_DECREF(cancel_scope);
+
+done:
+    PyMem_FREE(waiters);
+    return result;
+}
+
 static PyMethodDef boundcondition_methods[] = {
     {"__wait__", (PyCFunction)boundcondition_wait, METH_NOARGS,
             NULL},
@@ -1164,6 +1381,17 @@ monitorspace_abortfunc(PyWaitFor_Inspection *insp, PyWaitFor *node)
     PyThread_flag_set(pystate->monitorspace_waitingflag);
 }
 
+/* Notes when self was acquired, having waited since the given time (0
+ * if it wasn't contended), for the lock profiler */
+static void
+monitorspace_acquired(PyMonitorSpaceObject *self, PY_LONG_LONG since)
+{
+    self->prof_acquired = 0;
+    if (_PyLockProf_Enabled)
+        self->prof_acquired = _PyLockProf_Acquired(
+            PyLockProf_MONITORSPACE, "monitorspace", self, since);
+}
+
 /* 0 indicates you got the lock, 1 indicates you failed.  Note that an
  * exception may be set even if you got the lock, if pushing is not
  * set. */
@@ -1174,6 +1402,7 @@ monitorspace_acquire(PyMonitorSpaceObject *self, int pushing)
     PyWaitFor *resource = &self->waitfor;
     PyWaitFor_Inspection insp;
     int check_deadlock = 0;
+    PY_LONG_LONG since = 0;
 
     inspect_init(&insp, 0);
 
@@ -1183,9 +1412,12 @@ monitorspace_acquire(PyMonitorSpaceObject *self, int pushing)
          * switch once (assuming futexes on Linux). */
         resource->blocker = &pystate->waitfor;
         inspect_clear(&insp);
+        monitorspace_acquired(self, 0);
         return 0;
     }
 
+    if (_PyLockProf_Enabled)
+        since = _PyLockProf_Now();
     PyThread_timeout_set(pystate->monitorspace_timeout, deadlock_delay);
     while (resource->blocker != NULL) {
         /* Slightly less fast path.  Deadlock detection is a bottleneck,
@@ -1199,6 +1431,7 @@ monitorspace_acquire(PyMonitorSpaceObject *self, int pushing)
     if (resource->blocker == NULL) {
         resource->blocker = &pystate->waitfor;
         inspect_clear(&insp);
+        monitorspace_acquired(self, since);
         return 0;
     }
     inspect_clear(&insp);
@@ -1258,6 +1491,7 @@ monitorspace_acquire(PyMonitorSpaceObject *self, int pushing)
     if (check_deadlock)
         PyThread_lock_release(deadlock_lock);
 
+    monitorspace_acquired(self, since);
     return 0;
 }
 
@@ -1266,6 +1500,11 @@ monitorspace_release(PyMonitorSpaceObject *self, PyState *give_to)
 {
     PyWaitFor *resource = &self->waitfor;
     PyWaitFor_Inspection insp;
+
+    if (_PyLockProf_Enabled)
+        _PyLockProf_Released(PyLockProf_MONITORSPACE, "monitorspace", self,
+            self->prof_acquired);
+
     inspect_init(&insp, 0);
 
     if (give_to != NULL) {
@@ -1429,6 +1668,7 @@ monitorspace_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
         }
         x->waitfor.self = self;
         x->waitfor.blocker = NULL;
+        x->prof_acquired = 0;
         PyLinkedList_InitBase(&x->waiters, offsetof(PyState, monitorspace_waitinglinks));
         x->waitfor.checking_deadlock = 0;
         x->waitfor.abortfunc = NULL;
@@ -5,6 +5,8 @@
 #include "sliceobject.h" /* For PyEllipsis_Type */
 #include "monitorobject.h"
 #include "branchobject.h"
+#include "queueobject.h"
+#include "reactorobject.h"
 #include "pythread.h"
 
 #ifdef __cplusplus
@@ -1589,6 +1591,18 @@ _Py_ReadyTypes(void)
 	if (PyType_Ready(&PyBranch_Type) < 0)
 		Py_FatalError("Can't initialize 'branch'");
 
+	if (PyType_Ready(&PyBranchFuture_Type) < 0)
+		Py_FatalError("Can't initialize 'future'");
+
+	if (PyType_Ready(&PyBranchCompletion_Type) < 0)
+		Py_FatalError("Can't initialize 'branchcompletion'");
+
+	if (PyType_Ready(&PyQueue_Type) < 0)
+		Py_FatalError("Can't initialize 'Queue'");
+
+	if (PyType_Ready(&PyFDWatch_Type) < 0)
+		Py_FatalError("Can't initialize 'fdwatch'");
+
 	if (PyType_Ready(&PyCancel_Type) < 0)
 		Py_FatalError("Can't initialize 'Cancel' type");
 }
@@ -1,4 +1,5 @@
 #include "Python.h"
+#include "pyallocprof.h"
 
 #include <pthread.h>
 
@@ -12,6 +13,8 @@
 #endif
 
 PyState * (*pymalloc_pystate_hook)(void);
+/* _PyAllocProf_Sample while the allocation profiler is sampling */
+void * (*pymalloc_sample_hook)(size_t);
 
 #if 0
 static pthread_mutex_t pymemwrap_lock = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP;
@@ -53,12 +56,50 @@ find_size_class(size_t size)
 }
 
 
+/* A block sampled by the allocation profiler has its record in front of
+ * the size class, and the size class flagged.  It's never cached. */
+static void *
+malloc_sampled(void *record, Py_ssize_t size_class)
+{
+	void *mem = malloc(_PyAllocProf_PREFIX + sizeof(Py_ssize_t) +
+		GET_SIZE(size_class));
+	if (mem == NULL) {
+		_PyAllocProf_Freed(record);
+		return NULL;
+	}
+	*((void **)mem) = record;
+	mem += _PyAllocProf_PREFIX;
+	*((Py_ssize_t *)mem) = size_class ^ _PyAllocProf_FLAG;
+	return mem + sizeof(Py_ssize_t);
+}
+
+static void *
+realloc_sampled(void *old_outer_mem, Py_ssize_t new_size_class)
+{
+	void *mem = realloc(old_outer_mem - _PyAllocProf_PREFIX,
+		_PyAllocProf_PREFIX + sizeof(Py_ssize_t) +
+		GET_SIZE(new_size_class));
+	if (mem == NULL)
+		return NULL;
+	mem += _PyAllocProf_PREFIX;
+	*((Py_ssize_t *)mem) = new_size_class ^ _PyAllocProf_FLAG;
+	_PyAllocProf_Resized(_PyAllocProf_RECORD(mem),
+		GET_SIZE(new_size_class));
+	return mem + sizeof(Py_ssize_t);
+}
+
 void *
 pymemcache_malloc(size_t size)
 {
 	void *mem;
 	Py_ssize_t size_class = find_size_class(size);
 
+	if (pymalloc_sample_hook != NULL) {
+		void *record = pymalloc_sample_hook(GET_SIZE(size_class));
+		if (record != NULL)
+			return malloc_sampled(record, size_class);
+	}
+
 	if (pymalloc_pystate_hook != NULL && size_class <= 0) {
 		PyState *pystate = pymalloc_pystate_hook();
 		Py_ssize_t i;
@@ -86,7 +127,7 @@ pymemcache_realloc(void *old_inner_mem, size_t size)
 {
 	void *old_outer_mem;
 	void *new_outer_mem;
-	Py_ssize_t old_size_class;
+	Py_ssize_t old_size_class = 0;
 	Py_ssize_t new_size_class = find_size_class(size);
 
 	if (old_inner_mem == NULL)
@@ -94,10 +135,30 @@ pymemcache_realloc(void *old_inner_mem, size_t size)
 	else {
 		old_outer_mem = old_inner_mem - sizeof(Py_ssize_t);
 		old_size_class = *((Py_ssize_t *)old_outer_mem);
-		if (old_size_class == new_size_class)
+		if (_PyAllocProf_SIZECLASS(old_size_class) == new_size_class)
 			return old_inner_mem;  /* That was easy */
 	}
 
+	/* Growing buffers are sampled too, by moving them to a sampled block */
+	if (pymalloc_sample_hook != NULL) {
+		void *record = pymalloc_sample_hook(GET_SIZE(new_size_class));
+		if (record != NULL) {
+			void *new_inner_mem = malloc_sampled(record, new_size_class);
+			if (new_inner_mem != NULL && old_inner_mem != NULL) {
+				Py_ssize_t n = GET_SIZE(
+					_PyAllocProf_SIZECLASS(old_size_class));
+				if (n > GET_SIZE(new_size_class))
+					n = GET_SIZE(new_size_class);
+				memcpy(new_inner_mem, old_inner_mem, n);
+				pymemcache_free(old_inner_mem);
+			}
+			return new_inner_mem;
+		}
+	}
+
+	if (old_outer_mem != NULL && _PyAllocProf_IS_SAMPLED(old_size_class))
+		return realloc_sampled(old_outer_mem, new_size_class);
+
 	new_outer_mem = realloc(old_outer_mem, GET_SIZE(new_size_class) + sizeof(Py_ssize_t));
 	if (new_outer_mem == NULL)
 		return NULL;
@@ -116,6 +177,12 @@ pymemcache_free(void *inner_mem)
 	outer_mem = inner_mem - sizeof(Py_ssize_t);
 	size_class = *((Py_ssize_t *)outer_mem);
 
+	if (_PyAllocProf_IS_SAMPLED(size_class)) {
+		_PyAllocProf_Freed(_PyAllocProf_RECORD(outer_mem));
+		free(outer_mem - _PyAllocProf_PREFIX);
+		return;
+	}
+
 	if (pymalloc_pystate_hook != NULL && size_class <= 0) {
 		PyState *pystate = pymalloc_pystate_hook();
 		Py_ssize_t i;
@@ -938,6 +1005,8 @@ int Py_ADDRESS_IN_RANGE(void *P, poolp pool) Py_NO_INLINE;
  */
 
 PyState * (*pymalloc_pystate_hook)(void);
+/* _PyAllocProf_Sample while the allocation profiler is sampling */
+void * (*pymalloc_sample_hook)(size_t);
 
 #undef PyObject_Malloc
 void *
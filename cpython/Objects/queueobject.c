@@ -0,0 +1,786 @@
+#include "Python.h"
+#include "cancelobject.h"
+#include "queueobject.h"
+
+
+/* Queue object.  Based on Dmitry Vyukov's bounded MPMC queue.  Slot i
+ * starts with seq == i.  A producer may fill the slot at position pos
+ * once seq == pos, then publishes it by setting seq to pos + 1.  A
+ * consumer may empty it once seq == pos + 1, then hands it back to the
+ * producers by setting seq to pos + nslots.  Claiming a position is a
+ * single compare-and-swap on head or tail; batches claim a run of
+ * positions with one compare-and-swap. */
+
+#define QUEUE_DEFAULT_SIZE 1024
+
+PyObject *PyExc_QueueEmpty;
+PyObject *PyExc_QueueFull;
+
+/* Claim up to count consecutive positions from *counter, where slot j of
+ * the run is ready once its seq == pos + j + offset.  Returns the number
+ * claimed (possibly 0) and stores the first position in *start. */
+static Py_ssize_t
+queue_claim(PyQueueObject *self, volatile AO_t *counter, AO_t offset,
+        Py_ssize_t count, AO_t *start)
+{
+    AO_t pos = AO_load_full(counter);
+
+    while (1) {
+        Py_ssize_t n;
+
+        for (n = 0; n < count; n++) {
+            PyQueueSlot *slot = &self->slots[(pos + n) & self->mask];
+            Py_ssize_t dif = (Py_ssize_t)(AO_load_acquire(&slot->seq) -
+                (pos + n + offset));
+
+            if (dif != 0)
+                break;
+        }
+
+        if (n == 0) {
+            PyQueueSlot *slot = &self->slots[pos & self->mask];
+            Py_ssize_t dif = (Py_ssize_t)(AO_load_acquire(&slot->seq) -
+                (pos + offset));
+
+            if (dif < 0)
+                return 0;   /* Full (or empty, for consumers) */
+            /* Somebody else claimed it first */
+            pos = AO_load_full(counter);
+            continue;
+        }
+
+        if (AO_compare_and_swap_full(counter, pos, pos + n)) {
+            *start = pos;
+            return n;
+        }
+        pos = AO_load_full(counter);
+    }
+}
+
+static void
+queue_wake(PyQueueObject *self, volatile AO_t *waiting,
+        PyThread_type_cond *cond, Py_ssize_t count)
+{
+    if (AO_load_full(waiting) == 0)
+        return;
+
+    PyThread_lock_acquire(self->waitlock);
+    if (count == 1)
+        PyThread_cond_wakeone(cond);
+    else
+        PyThread_cond_wakeall(cond);
+    if (cond == self->notempty) {
+        PySelectWaiter *w = NULL;
+
+        while (PyLinkedList_Next(&self->selectors, &w))
+            PyThread_flag_set(w->pystate->condition_flag);
+    }
+    PyThread_lock_release(self->waitlock);
+}
+
+/* Returns the number of items put.  Steals nothing; each item put gets
+ * a new reference. */
+static Py_ssize_t
+queue_tryput(PyQueueObject *self, PyObject **items, Py_ssize_t count)
+{
+    AO_t pos;
+    Py_ssize_t i, n;
+
+    n = queue_claim(self, &self->head, 0, count, &pos);
+    for (i = 0; i < n; i++) {
+        PyQueueSlot *slot = &self->slots[(pos + i) & self->mask];
+
+        Py_INCREF(items[i]);
+        slot->item = items[i];
+        AO_store_full(&slot->seq, pos + i + 1);
+    }
+
+    if (n)
+        queue_wake(self, &self->getters_waiting, self->notempty, n);
+    return n;
+}
+
+/* Returns the number of items got, storing new references in items. */
+static Py_ssize_t
+queue_tryget(PyQueueObject *self, PyObject **items, Py_ssize_t count)
+{
+    AO_t pos;
+    Py_ssize_t i, n;
+
+    n = queue_claim(self, &self->tail, 1, count, &pos);
+    for (i = 0; i < n; i++) {
+        PyQueueSlot *slot = &self->slots[(pos + i) & self->mask];
+
+        items[i] = slot->item;
+        slot->item = NULL;
+        AO_store_full(&slot->seq, pos + i + self->mask + 1);
+    }
+
+    if (n)
+        queue_wake(self, &self->putters_waiting, self->notfull, n);
+    return n;
+}
+
+/* Peek at whether a put (or get) could make progress right now */
+static int
+queue_ready(PyQueueObject *self, int forput)
+{
+    AO_t pos = AO_load_full(forput ? &self->head : &self->tail);
+    PyQueueSlot *slot = &self->slots[pos & self->mask];
+
+    return AO_load_acquire(&slot->seq) == pos + (forput ? 0 : 1);
+}
+
+
+/* Blocking.  A thread that can't make progress sleeps on notfull or
+ * notempty, after announcing itself in putters_waiting or
+ * getters_waiting so the other side knows to take waitlock. */
+
+typedef struct {
+    PyQueueObject *queue;
+    int cancelled;
+    PyCancelObject *cancel_scope;
+    PyThread_type_timeout *deadline;
+} queue_waiter;
+
+static void
+queue_cancelwakeup(PyCancelQueue *cancelqueue, void *arg)
+{
+    queue_waiter *w = arg;
+
+    PyThread_lock_acquire(w->queue->waitlock);
+    w->cancelled = 1;
+    PyThread_cond_wakeall(w->queue->notempty);
+    PyThread_cond_wakeall(w->queue->notfull);
+    PyThread_lock_release(w->queue->waitlock);
+}
+
+/* timeout < 0 means forever */
+static int
+queue_waiter_init(queue_waiter *w, PyQueueObject *queue, double timeout)
+{
+    w->queue = queue;
+    w->cancelled = 0;
+    w->cancel_scope = NULL;
+    w->deadline = NULL;
+
+    if (timeout >= 0) {
+        w->deadline = PyThread_timeout_allocate();
+        if (w->deadline == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+        PyThread_timeout_set(w->deadline, timeout);
+    }
+    return 0;
+}
+
+static void
+queue_waiter_clear(queue_waiter *w)
+{
+    Py_XDECREF(w->cancel_scope);
+    if (w->deadline != NULL)
+        PyThread_timeout_free(w->deadline);
+}
+
+/* Sleeps until a put (or get) might succeed.  Returns -1 with Cancelled
+ * set if cancelled, or 1 if the timeout expired. */
+static int
+queue_sleep(queue_waiter *w, int forput)
+{
+    PyQueueObject *self = w->queue;
+    volatile AO_t *waiting = forput ? &self->putters_waiting :
+        &self->getters_waiting;
+    PyThread_type_cond *cond = forput ? self->notfull : self->notempty;
+    int expired = 0;
+
+    if (w->cancel_scope == NULL) {
+        w->cancel_scope = PyCancel_New(queue_cancelwakeup, w,
+            PyState_Get());
+        if (w->cancel_scope == NULL)
+            return -1;
+    }
+
+    PyCancel_Push(w->cancel_scope);
+    PyState_Suspend();
+    PyThread_lock_acquire(self->waitlock);
+    AO_fetch_and_add_full(waiting, 1);
+
+    while (!w->cancelled && !queue_ready(self, forput)) {
+        if (w->deadline == NULL)
+            PyThread_cond_wait(cond, self->waitlock);
+        else {
+            PyThread_cond_timedwait(cond, self->waitlock, w->deadline);
+            if (PyThread_timeout_expired(w->deadline)) {
+                expired = 1;
+                break;
+            }
+        }
+    }
+
+    AO_fetch_and_add_full(waiting, (AO_t)-1);
+    PyThread_lock_release(self->waitlock);
+    PyState_Resume();
+    PyCancel_Pop(w->cancel_scope);
+
+    if (w->cancelled) {
+        PyErr_SetString(PyExc_Cancelled, "Queue wait cancelled");
+        return -1;
+    }
+    return expired;
+}
+
+/* A selector counts as a waiting getter, so producers will take
+ * waitlock and find it.  As with queue_sleep, announcing ourselves
+ * before checking queue_ready means a concurrent put can't be missed. */
+int
+_PyQueue_AddSelector(PyQueueObject *self, PySelectWaiter *w)
+{
+    int ready;
+
+    PyThread_lock_acquire(self->waitlock);
+    PyLinkedList_Append(&self->selectors, w);
+    AO_fetch_and_add_full(&self->getters_waiting, 1);
+    ready = queue_ready(self, 0);
+    PyThread_lock_release(self->waitlock);
+    return ready;
+}
+
+void
+_PyQueue_RemoveSelector(PyQueueObject *self, PySelectWaiter *w)
+{
+    PyThread_lock_acquire(self->waitlock);
+    AO_fetch_and_add_full(&self->getters_waiting, (AO_t)-1);
+    PyLinkedList_Remove(&w->links);
+    PyThread_lock_release(self->waitlock);
+}
+
+/* Parses the common block/timeout arguments.  *timeout is set to -1 for
+ * no timeout and 0 for non-blocking. */
+static int
+queue_parsetimeout(PyObject *blockobj, PyObject *timeoutobj, double *timeout)
+{
+    int block = PyObject_IsTrue(blockobj);
+
+    if (block < 0)
+        return -1;
+
+    if (!block)
+        *timeout = 0.0;
+    else if (timeoutobj == Py_None)
+        *timeout = -1.0;
+    else {
+        *timeout = PyFloat_AsDouble(timeoutobj);
+        if (*timeout == -1.0 && PyErr_Occurred())
+            return -1;
+        if (*timeout < 0) {
+            PyErr_SetString(PyExc_ValueError,
+                "'timeout' must be a positive number");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Puts all count items, sleeping as needed.  On failure some of the
+ * items may already have been put. */
+static int
+queue_put_common(PyQueueObject *self, PyObject **items, Py_ssize_t count,
+        double timeout)
+{
+    queue_waiter w;
+    Py_ssize_t i, done = 0;
+    int result = 0;
+
+    for (i = 0; i < count; i++) {
+        if (!PyObject_IsShareable(items[i])) {
+            PyErr_Format(PyExc_TypeError, "Queue items must be shareable, "
+                "'%s' object is not", items[i]->ob_type->tp_name);
+            return -1;
+        }
+    }
+
+    done += queue_tryput(self, items, count);
+    if (done == count)
+        return 0;
+    if (timeout == 0) {
+        PyErr_SetNone(PyExc_QueueFull);
+        return -1;
+    }
+
+    if (queue_waiter_init(&w, self, timeout) < 0)
+        return -1;
+
+    while (done < count) {
+        int status = queue_sleep(&w, 1);
+
+        if (status < 0) {
+            result = -1;
+            break;
+        }
+        done += queue_tryput(self, items + done, count - done);
+        if (done < count && status > 0) {
+            PyErr_SetNone(PyExc_QueueFull);
+            result = -1;
+            break;
+        }
+    }
+
+    queue_waiter_clear(&w);
+    return result;
+}
+
+/* Gets between 1 and count items, sleeping until at least one is
+ * available.  Returns the number got, or -1 with an exception set. */
+static Py_ssize_t
+queue_get_common(PyQueueObject *self, PyObject **items, Py_ssize_t count,
+        double timeout)
+{
+    queue_waiter w;
+    Py_ssize_t n;
+
+    n = queue_tryget(self, items, count);
+    if (n)
+        return n;
+    if (timeout == 0) {
+        PyErr_SetNone(PyExc_QueueEmpty);
+        return -1;
+    }
+
+    if (queue_waiter_init(&w, self, timeout) < 0)
+        return -1;
+
+    while (1) {
+        int status = queue_sleep(&w, 0);
+
+        if (status < 0) {
+            n = -1;
+            break;
+        }
+        n = queue_tryget(self, items, count);
+        if (n)
+            break;
+        if (status > 0) {
+            PyErr_SetNone(PyExc_QueueEmpty);
+            n = -1;
+            break;
+        }
+    }
+
+    queue_waiter_clear(&w);
+    return n;
+}
+
+
+static PyObject *
+Queue_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"maxsize", NULL};
+    PyQueueObject *self;
+    Py_ssize_t maxsize = QUEUE_DEFAULT_SIZE, nslots, i;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|n:Queue", kwlist,
+            &maxsize))
+        return NULL;
+
+    if (maxsize <= 0) {
+        PyErr_SetString(PyExc_ValueError, "Queue maxsize must be at "
+            "least 1");
+        return NULL;
+    }
+
+    /* The ring needs a power-of-two number of slots, and at least two
+     * so that a full slot's seq can't be mistaken for an empty one's */
+    for (nslots = 2; nslots < maxsize; nslots <<= 1) {
+        if (nslots > PY_SSIZE_T_MAX / 2 / (Py_ssize_t)sizeof(PyQueueSlot)) {
+            PyErr_SetString(PyExc_OverflowError, "Queue maxsize too large");
+            return NULL;
+        }
+    }
+
+    self = PyObject_New(type);
+    if (self == NULL)
+        return NULL;
+
+    self->slots = NULL;
+    self->waitlock = NULL;
+    self->notempty = NULL;
+    self->notfull = NULL;
+
+    self->slots = PyMem_NEW(PyQueueSlot, nslots);
+    self->waitlock = PyThread_lock_allocate();
+    self->notempty = PyThread_cond_allocate();
+    self->notfull = PyThread_cond_allocate();
+    if (self->slots == NULL || self->waitlock == NULL ||
+            self->notempty == NULL || self->notfull == NULL) {
+        if (self->slots != NULL)
+            PyMem_FREE(self->slots);
+        if (self->waitlock != NULL)
+            PyThread_lock_free(self->waitlock);
+        if (self->notempty != NULL)
+            PyThread_cond_free(self->notempty);
+        if (self->notfull != NULL)
+            PyThread_cond_free(self->notfull);
+        PyObject_Del(self);
+        PyErr_NoMemory();
+        return NULL;
+    }
+
+    for (i = 0; i < nslots; i++) {
+        self->slots[i].seq = i;
+        self->slots[i].item = NULL;
+    }
+    self->mask = nslots - 1;
+    self->head = 0;
+    self->tail = 0;
+    self->getters_waiting = 0;
+    self->putters_waiting = 0;
+    PyLinkedList_InitBase(&self->selectors,
+        offsetof(PySelectWaiter, links));
+
+    return (PyObject *)self;
+}
+
+static void
+Queue_dealloc(PyQueueObject *self)
+{
+    Py_ssize_t i;
+
+    assert(self->getters_waiting == 0 && self->putters_waiting == 0);
+    assert(PyLinkedList_Empty(&self->selectors));
+
+    for (i = 0; i <= (Py_ssize_t)self->mask; i++)
+        Py_XDECREF(self->slots[i].item);
+
+    PyMem_FREE(self->slots);
+    PyThread_lock_free(self->waitlock);
+    PyThread_cond_free(self->notempty);
+    PyThread_cond_free(self->notfull);
+    PyObject_Del(self);
+}
+
+static int
+Queue_traverse(PyQueueObject *self, visitproc visit, void *arg)
+{
+    Py_ssize_t i;
+
+    /* The tracing GC only runs with the world stopped, so nobody is
+     * halfway through a slot. */
+    for (i = 0; i <= (Py_ssize_t)self->mask; i++)
+        Py_VISIT(self->slots[i].item);
+    return 0;
+}
+
+static PyObject *
+Queue_put(PyQueueObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"item", "block", "timeout", NULL};
+    PyObject *item, *blockobj = Py_True, *timeoutobj = Py_None;
+    double timeout;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OO:put", kwlist,
+            &item, &blockobj, &timeoutobj))
+        return NULL;
+    if (queue_parsetimeout(blockobj, timeoutobj, &timeout) < 0)
+        return NULL;
+
+    if (queue_put_common(self, &item, 1, timeout) < 0)
+        return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject *
+Queue_put_nowait(PyQueueObject *self, PyObject *item)
+{
+    if (queue_put_common(self, &item, 1, 0) < 0)
+        return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject *
+Queue_put_many(PyQueueObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"items", "block", "timeout", NULL};
+    PyObject *items, *seq, *blockobj = Py_True, *timeoutobj = Py_None;
+    double timeout;
+    int result;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|OO:put_many", kwlist,
+            &items, &blockobj, &timeoutobj))
+        return NULL;
+    if (queue_parsetimeout(blockobj, timeoutobj, &timeout) < 0)
+        return NULL;
+
+    seq = PySequence_Fast(items, "put_many() requires an iterable");
+    if (seq == NULL)
+        return NULL;
+
+    result = queue_put_common(self, PySequence_Fast_ITEMS(seq),
+        PySequence_Fast_GET_SIZE(seq), timeout);
+    Py_DECREF(seq);
+    if (result < 0)
+        return NULL;
+
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject *
+Queue_get(PyQueueObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"block", "timeout", NULL};
+    PyObject *item, *blockobj = Py_True, *timeoutobj = Py_None;
+    double timeout;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|OO:get", kwlist,
+            &blockobj, &timeoutobj))
+        return NULL;
+    if (queue_parsetimeout(blockobj, timeoutobj, &timeout) < 0)
+        return NULL;
+
+    if (queue_get_common(self, &item, 1, timeout) < 0)
+        return NULL;
+    return item;
+}
+
+static PyObject *
+Queue_get_nowait(PyQueueObject *self)
+{
+    PyObject *item;
+
+    if (queue_get_common(self, &item, 1, 0) < 0)
+        return NULL;
+    return item;
+}
+
+static PyObject *
+Queue_get_many(PyQueueObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"maxitems", "block", "timeout", NULL};
+    PyObject *list, **items, *blockobj = Py_True, *timeoutobj = Py_None;
+    Py_ssize_t maxitems, n, i;
+    double timeout;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "n|OO:get_many", kwlist,
+            &maxitems, &blockobj, &timeoutobj))
+        return NULL;
+    if (queue_parsetimeout(blockobj, timeoutobj, &timeout) < 0)
+        return NULL;
+
+    if (maxitems < 1) {
+        PyErr_SetString(PyExc_ValueError, "get_many() maxitems must be at "
+            "least 1");
+        return NULL;
+    }
+    if (maxitems > (Py_ssize_t)self->mask + 1)
+        maxitems = self->mask + 1;
+
+    items = PyMem_NEW(PyObject *, maxitems);
+    if (items == NULL)
+        return PyErr_NoMemory();
+
+    n = queue_get_common(self, items, maxitems, timeout);
+    if (n < 0) {
+        PyMem_FREE(items);
+        return NULL;
+    }
+
+    list = PyList_New(n);
+    if (list == NULL) {
+        for (i = 0; i < n; i++)
+            Py_DECREF(items[i]);
+    } else {
+        /* Steals the references */
+        for (i = 0; i < n; i++)
+            PyList_SET_ITEM(list, i, items[i]);
+    }
+    PyMem_FREE(items);
+    return list;
+}
+
+static Py_ssize_t
+Queue_qsize_internal(PyQueueObject *self)
+{
+    AO_t tail = AO_load_full(&self->tail);
+    AO_t head = AO_load_full(&self->head);
+    Py_ssize_t size = (Py_ssize_t)(head - tail);
+
+    /* The two loads aren't atomic together, so clamp the estimate */
+    if (size < 0)
+        return 0;
+    if (size > (Py_ssize_t)self->mask + 1)
+        return self->mask + 1;
+    return size;
+}
+
+static PyObject *
+Queue_qsize(PyQueueObject *self)
+{
+    return PyLong_FromSsize_t(Queue_qsize_internal(self));
+}
+
+static PyObject *
+Queue_empty(PyQueueObject *self)
+{
+    return PyBool_FromLong(!queue_ready(self, 0));
+}
+
+static PyObject *
+Queue_full(PyQueueObject *self)
+{
+    return PyBool_FromLong(!queue_ready(self, 1));
+}
+
+static PyObject *
+Queue_get_maxsize(PyQueueObject *self, void *context)
+{
+    return PyLong_FromSsize_t(self->mask + 1);
+}
+
+static int
+Queue_isshareable(PyQueueObject *self)
+{
+    return 1;
+}
+
+PyDoc_STRVAR(Queue_put__doc__,
+"put(item, block=True, timeout=None) -> None\n\
+\n\
+Put a shareable item on the queue, waiting for a free slot if block is\n\
+true.  Raises Full if none is free in time.  This is cancellable.");
+PyDoc_STRVAR(Queue_put_nowait__doc__, "put_nowait(item) -> None");
+PyDoc_STRVAR(Queue_put_many__doc__,
+"put_many(items, block=True, timeout=None) -> None\n\
+\n\
+Put each of items on the queue in order, claiming as many slots at once\n\
+as are free.  If it fails part way some items may already be queued.");
+PyDoc_STRVAR(Queue_get__doc__,
+"get(block=True, timeout=None) -> item\n\
+\n\
+Remove and return the oldest item, waiting for one if block is true.\n\
+Raises Empty if none arrives in time.  This is cancellable.");
+PyDoc_STRVAR(Queue_get_nowait__doc__, "get_nowait() -> item");
+PyDoc_STRVAR(Queue_get_many__doc__,
+"get_many(maxitems, block=True, timeout=None) -> list\n\
+\n\
+Remove and return between 1 and maxitems of the oldest items, waiting\n\
+only if there are none.");
+PyDoc_STRVAR(Queue_qsize__doc__,
+"qsize() -> int.  Approximate, as other threads may be using the queue.");
+PyDoc_STRVAR(Queue_empty__doc__, "empty() -> bool.  Approximate.");
+PyDoc_STRVAR(Queue_full__doc__, "full() -> bool.  Approximate.");
+
+static PyMethodDef Queue_methods[] = {
+    {"put", (PyCFunction)Queue_put,
+        METH_SHARED | METH_VARARGS | METH_KEYWORDS, Queue_put__doc__},
+    {"put_nowait", (PyCFunction)Queue_put_nowait,
+        METH_SHARED | METH_O, Queue_put_nowait__doc__},
+    {"put_many", (PyCFunction)Queue_put_many,
+        METH_SHARED | METH_VARARGS | METH_KEYWORDS, Queue_put_many__doc__},
+    {"get", (PyCFunction)Queue_get,
+        METH_SHARED | METH_VARARGS | METH_KEYWORDS, Queue_get__doc__},
+    {"get_nowait", (PyCFunction)Queue_get_nowait,
+        METH_SHARED | METH_NOARGS, Queue_get_nowait__doc__},
+    {"get_many", (PyCFunction)Queue_get_many,
+        METH_SHARED | METH_VARARGS | METH_KEYWORDS, Queue_get_many__doc__},
+    {"qsize", (PyCFunction)Queue_qsize,
+        METH_SHARED | METH_NOARGS, Queue_qsize__doc__},
+    {"empty", (PyCFunction)Queue_empty,
+        METH_SHARED | METH_NOARGS, Queue_empty__doc__},
+    {"full", (PyCFunction)Queue_full,
+        METH_SHARED | METH_NOARGS, Queue_full__doc__},
+    {NULL, NULL}  /* sentinel */
+};
+
+static PyGetSetDef Queue_getset[] = {
+    {"maxsize", (getter)Queue_get_maxsize, NULL,
+        "Number of slots, maxsize rounded up to a power of two"},
+    {NULL}  /* sentinel */
+};
+
+PyDoc_STRVAR(Queue__doc__,
+"Queue(maxsize=1024) -> Queue\n\
+\n\
+A bounded first-in first-out queue of shareable objects, for passing\n\
+work between threads.  maxsize is rounded up to a power of two, and\n\
+at least 2.");
+
+PyTypeObject PyQueue_Type = {
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    "_threadtoolsmodule.Queue",         /*tp_name*/
+    sizeof(PyQueueObject),              /*tp_basicsize*/
+    0,                                  /*tp_itemsize*/
+    (destructor)Queue_dealloc,          /*tp_dealloc*/
+    0,                                  /*tp_print*/
+    0,                                  /*tp_getattr*/
+    0,                                  /*tp_setattr*/
+    0,                                  /*tp_compare*/
+    0,                                  /*tp_repr*/
+    0,                                  /*tp_as_number*/
+    0,                                  /*tp_as_sequence*/
+    0,                                  /*tp_as_mapping*/
+    0,                                  /*tp_hash*/
+    0,                                  /*tp_call*/
+    0,                                  /*tp_str*/
+    PyObject_GenericGetAttr,            /*tp_getattro*/
+    0,                                  /*tp_setattro*/
+    0,                                  /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC |
+        Py_TPFLAGS_SHAREABLE,           /*tp_flags*/
+    Queue__doc__,                       /*tp_doc*/
+    (traverseproc)Queue_traverse,       /*tp_traverse*/
+    0,                                  /*tp_clear*/
+    0,                                  /*tp_richcompare*/
+    0,                                  /*tp_weaklistoffset*/
+    0,                                  /*tp_iter*/
+    0,                                  /*tp_iternext*/
+    Queue_methods,                      /*tp_methods*/
+    0,                                  /*tp_members*/
+    Queue_getset,                       /*tp_getset*/
+    0,                                  /*tp_base*/
+    0,                                  /*tp_dict*/
+    0,                                  /*tp_descr_get*/
+    0,                                  /*tp_descr_set*/
+    0,                                  /*tp_dictoffset*/
+    0,                                  /*tp_init*/
+    Queue_new,                          /*tp_new*/
+    0,                                  /*tp_is_gc*/
+    0,                                  /*tp_bases*/
+    0,                                  /*tp_mro*/
+    0,                                  /*tp_cache*/
+    0,                                  /*tp_subclasses*/
+    0,                                  /*tp_weaklist*/
+    (isshareablefunc)Queue_isshareable, /*tp_isshareable*/
+};
+
+
+/* Called once the builtin exceptions exist, which is after _threadtools
+ * has been created. */
+void
+_PyQueue_Init(void)
+{
+    PyObject *mod, *dict;
+
+    /* _threadtools is a shared module, so its classes must be too */
+    dict = PyDict_New();
+    if (dict == NULL || PyDict_SetItemString(dict, "__shared__", Py_True) < 0)
+        Py_FatalError("Can't create Queue exceptions");
+    PyExc_QueueEmpty = PyErr_NewException("_threadtools.Empty", NULL, dict);
+    PyExc_QueueFull = PyErr_NewException("_threadtools.Full", NULL, dict);
+    Py_DECREF(dict);
+    if (PyExc_QueueEmpty == NULL || PyExc_QueueFull == NULL)
+        Py_FatalError("Can't create Queue exceptions");
+
+    mod = PyImport_AddModule("_threadtools");
+    if (mod == NULL ||
+            PyModule_AddObject(mod, "Empty", PyExc_QueueEmpty) < 0 ||
+            PyModule_AddObject(mod, "Full", PyExc_QueueFull) < 0)
+        Py_FatalError("Can't add Queue exceptions to _threadtools");
+    /* PyModule_AddObject stole the references; keep our own */
+    Py_INCREF(PyExc_QueueEmpty);
+    Py_INCREF(PyExc_QueueFull);
+}
@@ -0,0 +1,462 @@
+/* File descriptor watch object and the reactor behind it */
+
+#include "Python.h"
+#include "structmember.h"
+#include "reactorobject.h"
+
+#include <poll.h>
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#include <signal.h>
+#include <fcntl.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* One epoll set, watched by a thread of its own, serves every fd that
+ * threadtools.select() waits on.  Waiters park on their condition_flag
+ * as they do for any other source, and the reactor thread only sets the
+ * flag of a waiter whose fd became ready.  A cancelled select() is woken
+ * directly by its cancel scope; the reactor never hears about it.
+ *
+ * Each fd is registered EPOLLONESHOT, so readiness is reported once and
+ * then the fd is left disarmed until its waiters change.  Of the threads
+ * waiting on one fd only the first reader and the first writer are
+ * woken, and moved to the back so they take turns.  When they remove
+ * themselves the fd is rearmed, and if it's still ready the next in line
+ * gets woken.
+ *
+ * The set also holds the read end of a pipe, written to by
+ * _PyReactor_Fini() to wake the reactor thread when it's time to exit. */
+
+static PyThread_type_lock *reactor_lock;
+static PyThread_type_cond *reactor_exited;
+
+#ifdef HAVE_EPOLL
+
+typedef struct {
+    PyLinkedList readers;       /* PySelectWaiters */
+    PyLinkedList writers;
+} reactor_fd;
+
+static int reactor_epfd = -1;
+static int reactor_wakefd[2] = {-1, -1};
+static reactor_fd **reactor_fds;        /* Indexed by fd */
+static int reactor_nfds;
+static int reactor_running;             /* The thread hasn't exited */
+static int reactor_shutdown;
+
+#define REACTOR_BATCH 64
+
+static void
+reactor_wakefirst(PyLinkedList *list)
+{
+    PySelectWaiter *w = PyLinkedList_First(list);
+
+    if (w != NULL) {
+        PyLinkedList_Remove(&w->links);
+        PyLinkedList_Append(list, w);
+        PyThread_flag_set(w->pystate->condition_flag);
+    }
+}
+
+/* Called with reactor_lock held */
+static int
+reactor_arm(int fd, reactor_fd *rfd, uint32_t events, int op)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events | EPOLLONESHOT;
+    ev.data.fd = fd;
+    return epoll_ctl(reactor_epfd, op, fd, &ev);
+}
+
+static uint32_t
+reactor_waiting(reactor_fd *rfd)
+{
+    uint32_t events = 0;
+
+    if (!PyLinkedList_Empty(&rfd->readers))
+        events |= EPOLLIN;
+    if (!PyLinkedList_Empty(&rfd->writers))
+        events |= EPOLLOUT;
+    return events;
+}
+
+static void
+reactor_main(void *unused)
+{
+    struct epoll_event events[REACTOR_BATCH];
+    sigset_t mask;
+    int i, n;
+
+    /* Signals are for the main thread to handle */
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    while (1) {
+        n = epoll_wait(reactor_epfd, events, REACTOR_BATCH, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            Py_FatalError("epoll_wait() failed in fd reactor");
+        }
+
+        PyThread_lock_acquire(reactor_lock);
+        if (reactor_shutdown)
+            break;      /* Woken by _PyReactor_Fini() to exit */
+        for (i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            uint32_t ready = events[i].events;
+            uint32_t rest;
+            reactor_fd *rfd;
+
+            /* The waiters may have given up since epoll_wait() returned */
+            if (fd >= reactor_nfds || (rfd = reactor_fds[fd]) == NULL)
+                continue;
+
+            if (ready & (EPOLLERR | EPOLLHUP))
+                ready |= EPOLLIN | EPOLLOUT;
+            if (ready & EPOLLIN)
+                reactor_wakefirst(&rfd->readers);
+            if (ready & EPOLLOUT)
+                reactor_wakefirst(&rfd->writers);
+
+            /* Whoever's waiting in the other direction stays armed */
+            rest = reactor_waiting(rfd) & ~ready;
+            if (rest)
+                reactor_arm(fd, rfd, rest, EPOLL_CTL_MOD);
+        }
+        PyThread_lock_release(reactor_lock);
+    }
+
+    reactor_running = 0;
+    PyThread_cond_wakeall(reactor_exited);
+    PyThread_lock_release(reactor_lock);
+}
+
+/* Called with reactor_lock held */
+static void
+reactor_close(void)
+{
+    if (reactor_wakefd[0] >= 0) {
+        close(reactor_wakefd[0]);
+        close(reactor_wakefd[1]);
+        reactor_wakefd[0] = reactor_wakefd[1] = -1;
+    }
+    close(reactor_epfd);
+    reactor_epfd = -1;
+}
+
+/* Called with reactor_lock held */
+static int
+reactor_start(void)
+{
+    struct epoll_event ev;
+
+    if (reactor_epfd >= 0)
+        return 0;
+
+    reactor_epfd = epoll_create(REACTOR_BATCH);
+    if (reactor_epfd < 0) {
+        PyErr_SetFromErrno(PyExc_IOError);
+        return -1;
+    }
+    fcntl(reactor_epfd, F_SETFD, FD_CLOEXEC);
+
+    if (pipe(reactor_wakefd) < 0) {
+        PyErr_SetFromErrno(PyExc_IOError);
+        reactor_close();
+        return -1;
+    }
+    fcntl(reactor_wakefd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(reactor_wakefd[1], F_SETFD, FD_CLOEXEC);
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = reactor_wakefd[0];
+    if (epoll_ctl(reactor_epfd, EPOLL_CTL_ADD, reactor_wakefd[0], &ev) < 0) {
+        PyErr_SetFromErrno(PyExc_IOError);
+        reactor_close();
+        return -1;
+    }
+
+    if (PyThread_start_new_thread(NULL, reactor_main, NULL) < 0) {
+        reactor_close();
+        PyErr_SetString(PyExc_RuntimeError, "can't start fd reactor thread");
+        return -1;
+    }
+    reactor_running = 1;
+    return 0;
+}
+
+/* Called with reactor_lock held */
+static reactor_fd *
+reactor_getfd(int fd, int *created)
+{
+    reactor_fd *rfd;
+
+    *created = 0;
+    if (fd >= reactor_nfds) {
+        int i, size = reactor_nfds ? reactor_nfds : 64;
+        reactor_fd **fds;
+
+        while (size <= fd)
+            size *= 2;
+        fds = PyMem_RESIZE(reactor_fds, reactor_fd *, size);
+        if (fds == NULL) {
+            PyErr_NoMemory();
+            return NULL;
+        }
+        for (i = reactor_nfds; i < size; i++)
+            fds[i] = NULL;
+        reactor_fds = fds;
+        reactor_nfds = size;
+    }
+
+    rfd = reactor_fds[fd];
+    if (rfd == NULL) {
+        rfd = PyMem_NEW(reactor_fd, 1);
+        if (rfd == NULL) {
+            PyErr_NoMemory();
+            return NULL;
+        }
+        PyLinkedList_InitBase(&rfd->readers, offsetof(PySelectWaiter, links));
+        PyLinkedList_InitBase(&rfd->writers, offsetof(PySelectWaiter, links));
+        reactor_fds[fd] = rfd;
+        *created = 1;
+    }
+    return rfd;
+}
+
+/* Called with reactor_lock held.  Errors are ignored, as the fd may
+ * have been closed out from under us. */
+static void
+reactor_unlink(int fd, PySelectWaiter *w)
+{
+    reactor_fd *rfd = reactor_fds[fd];
+    uint32_t events;
+
+    PyLinkedList_Remove(&w->links);
+    events = reactor_waiting(rfd);
+    if (events)
+        reactor_arm(fd, rfd, events, EPOLL_CTL_MOD);
+    else {
+        epoll_ctl(reactor_epfd, EPOLL_CTL_DEL, fd, NULL);
+        PyMem_FREE(rfd);
+        reactor_fds[fd] = NULL;
+    }
+}
+
+int
+_PyFDWatch_AddSelector(PyFDWatchObject *self, PySelectWaiter *w)
+{
+    int fd = self->fd;
+    reactor_fd *rfd;
+    int created, res, saved_errno;
+    struct pollfd pfd;
+
+    PyThread_lock_acquire(reactor_lock);
+    if (reactor_start() < 0 || (rfd = reactor_getfd(fd, &created)) == NULL) {
+        PyThread_lock_release(reactor_lock);
+        return -1;
+    }
+
+    PyLinkedList_Append(self->events == POLLIN ?
+        &rfd->readers : &rfd->writers, w);
+    res = reactor_arm(fd, rfd, reactor_waiting(rfd),
+        created ? EPOLL_CTL_ADD : EPOLL_CTL_MOD);
+    /* Closing an fd takes it out of the set without telling us */
+    if (res < 0 && errno == ENOENT && !created)
+        res = reactor_arm(fd, rfd, reactor_waiting(rfd), EPOLL_CTL_ADD);
+    saved_errno = errno;
+    if (res < 0)
+        reactor_unlink(fd, w);
+    PyThread_lock_release(reactor_lock);
+
+    if (res < 0) {
+        /* Regular files can't be watched, but poll() says they're
+         * always ready, so we do too */
+        if (saved_errno == EPERM)
+            return 1;
+        errno = saved_errno;
+        PyErr_SetFromErrno(PyExc_IOError);
+        return -1;
+    }
+
+    /* The reactor will report it anyway if it's ready already, but
+     * select() wants to know without waiting */
+    pfd.fd = fd;
+    pfd.events = self->events;
+    pfd.revents = 0;
+    return poll(&pfd, 1, 0) > 0;
+}
+
+void
+_PyFDWatch_RemoveSelector(PyFDWatchObject *self, PySelectWaiter *w)
+{
+    PyThread_lock_acquire(reactor_lock);
+    if (!PyLinkedList_Detached(&w->links))
+        reactor_unlink(self->fd, w);
+    PyThread_lock_release(reactor_lock);
+}
+
+#else /* !HAVE_EPOLL */
+
+int
+_PyFDWatch_AddSelector(PyFDWatchObject *self, PySelectWaiter *w)
+{
+    PyErr_SetString(PyExc_NotImplementedError,
+        "select() on file descriptors requires epoll");
+    return -1;
+}
+
+void
+_PyFDWatch_RemoveSelector(PyFDWatchObject *self, PySelectWaiter *w)
+{
+}
+
+#endif /* HAVE_EPOLL */
+
+
+PyObject *
+PyFDWatch_New(int fd, int writing)
+{
+    PyFDWatchObject *self;
+
+    if (fd < 0) {
+        PyErr_SetString(PyExc_ValueError,
+            "file descriptor cannot be a negative integer");
+        return NULL;
+    }
+
+    self = PyObject_New(&PyFDWatch_Type);
+    if (self == NULL)
+        return NULL;
+    self->fd = fd;
+    self->events = writing ? POLLOUT : POLLIN;
+    return (PyObject *)self;
+}
+
+static void
+FDWatch_dealloc(PyFDWatchObject *self)
+{
+    PyObject_Del(self);
+}
+
+static PyObject *
+FDWatch_repr(PyFDWatchObject *self)
+{
+    return PyUnicode_FromFormat("<fdwatch %s fd=%d>",
+        self->events == POLLIN ? "readable" : "writable", self->fd);
+}
+
+static int
+FDWatch_isshareable(PyFDWatchObject *self)
+{
+    return 1;
+}
+
+static PyMemberDef FDWatch_members[] = {
+    {"fd", T_INT, offsetof(PyFDWatchObject, fd), READONLY,
+        "The file descriptor being watched"},
+    {NULL}  /* sentinel */
+};
+
+PyDoc_STRVAR(FDWatch__doc__,
+"A file descriptor to wait on with threadtools.select(), made by\n\
+threadtools.readable() or threadtools.writable().");
+
+PyTypeObject PyFDWatch_Type = {
+    PyVarObject_HEAD_INIT(&PyType_Type, 0)
+    "_threadtoolsmodule.fdwatch",       /*tp_name*/
+    sizeof(PyFDWatchObject),            /*tp_basicsize*/
+    0,                                  /*tp_itemsize*/
+    (destructor)FDWatch_dealloc,        /*tp_dealloc*/
+    0,                                  /*tp_print*/
+    0,                                  /*tp_getattr*/
+    0,                                  /*tp_setattr*/
+    0,                                  /*tp_compare*/
+    (reprfunc)FDWatch_repr,             /*tp_repr*/
+    0,                                  /*tp_as_number*/
+    0,                                  /*tp_as_sequence*/
+    0,                                  /*tp_as_mapping*/
+    0,                                  /*tp_hash*/
+    0,                                  /*tp_call*/
+    0,                                  /*tp_str*/
+    PyObject_GenericGetAttr,            /*tp_getattro*/
+    0,                                  /*tp_setattro*/
+    0,                                  /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_SHAREABLE, /*tp_flags*/
+    FDWatch__doc__,                     /*tp_doc*/
+    0,                                  /*tp_traverse*/
+    0,                                  /*tp_clear*/
+    0,                                  /*tp_richcompare*/
+    0,                                  /*tp_weaklistoffset*/
+    0,                                  /*tp_iter*/
+    0,                                  /*tp_iternext*/
+    0,                                  /*tp_methods*/
+    FDWatch_members,                    /*tp_members*/
+    0,                                  /*tp_getset*/
+    0,                                  /*tp_base*/
+    0,                                  /*tp_dict*/
+    0,                                  /*tp_descr_get*/
+    0,                                  /*tp_descr_set*/
+    0,                                  /*tp_dictoffset*/
+    0,                                  /*tp_init*/
+    0,                                  /*tp_new*/
+    0,                                  /*tp_is_gc*/
+    0,                                  /*tp_bases*/
+    0,                                  /*tp_mro*/
+    0,                                  /*tp_cache*/
+    0,                                  /*tp_subclasses*/
+    0,                                  /*tp_weaklist*/
+    (isshareablefunc)FDWatch_isshareable, /*tp_isshareable*/
+};
+
+
+void
+_PyReactor_Init(void)
+{
+    reactor_lock = PyThread_lock_allocate();
+    reactor_exited = PyThread_cond_allocate();
+    if (!reactor_lock || !reactor_exited)
+        Py_FatalError("Failed to allocate fd reactor lock");
+}
+
+/* Called once every branch has finished, so nobody is selecting on an
+ * fd.  Tells the reactor thread, if it was started, to exit and waits
+ * for it to. */
+void
+_PyReactor_Fini(void)
+{
+#ifdef HAVE_EPOLL
+    int i;
+
+    PyState_Suspend();
+    PyThread_lock_acquire(reactor_lock);
+    if (reactor_epfd >= 0) {
+        reactor_shutdown = 1;
+        while (write(reactor_wakefd[1], "x", 1) < 0 && errno == EINTR)
+            ;
+        while (reactor_running)
+            PyThread_cond_wait(reactor_exited, reactor_lock);
+        reactor_close();
+        for (i = 0; i < reactor_nfds; i++)
+            PyMem_FREE(reactor_fds[i]);
+        PyMem_FREE(reactor_fds);
+        reactor_fds = NULL;
+        reactor_nfds = 0;
+    }
+    PyThread_lock_release(reactor_lock);
+    PyState_Resume();
+#endif
+}
+
+
+#ifdef __cplusplus
+}
+#endif
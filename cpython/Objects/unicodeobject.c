@@ -9231,12 +9231,14 @@ PyTypeObject PyUnicode_Type = {
 void
 _PyUnicode_PreInit(void)
 {
-    interned_critical = PyCritical_Allocate(PyCRITICAL_NORMAL);
+    interned_critical = PyCritical_AllocateNamed(PyCRITICAL_NORMAL,
+        "interned");
     if (!interned_critical)
         Py_FatalError("unable to allocate lock");
 
 #ifdef USE_UNICODE_FREELIST
-    free_list_critical = PyCritical_Allocate(PyCRITICAL_NORMAL);
+    free_list_critical = PyCritical_AllocateNamed(PyCRITICAL_NORMAL,
+        "unicode free list");
     if (!free_list_critical)
         Py_FatalError("unable to allocate lock");
 #endif
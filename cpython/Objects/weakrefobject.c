@@ -304,6 +304,7 @@ deathqueue_dealloc(PyDeathQueue *self)
     } else {
         assert(PyLinkedList_Empty(&self->live_links));
         assert(PyLinkedList_Empty(&self->dead_links));
+        assert(PyLinkedList_Empty(&self->selectors));
         PyCritical_Free(self->crit);
         PyThread_cond_free(self->cond);
         PyObject_Del(self);
@@ -382,7 +383,8 @@ deathqueue___new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
     if (queue == NULL)
         return NULL;
 
-    queue->crit = PyCritical_Allocate(PyCRITICAL_WEAKREF_QUEUE);
+    queue->crit = PyCritical_AllocateNamed(PyCRITICAL_WEAKREF_QUEUE,
+        "deathqueue");
     if (queue->crit == NULL) {
         PyObject_Del(queue);
         PyErr_NoMemory();
@@ -401,6 +403,8 @@ deathqueue___new__(PyTypeObject *type, PyObject *args, PyObject *kwargs)
         offsetof(PyDeathQueueHandle, queue_links));
     PyLinkedList_InitBase(&queue->dead_links,
         offsetof(PyDeathQueueHandle, queue_links));
+    PyLinkedList_InitBase(&queue->selectors,
+        offsetof(PySelectWaiter, links));
 
     return (PyObject *)queue;
 }
@@ -443,7 +447,8 @@ deathqueue_watch(PyDeathQueue *queue, PyObject *args)
         return NULL;
     }
 
-    handle->crit = PyCritical_Allocate(PyCRITICAL_WEAKREF_HANDLE);
+    handle->crit = PyCritical_AllocateNamed(PyCRITICAL_WEAKREF_HANDLE,
+        "deathqueuehandle");
     if (handle->crit == NULL) {
         PyObject_Del(handle);
         Py_DECREF(ref);
@@ -664,6 +669,27 @@ deathqueue_wait(PyDeathQueue *queue)
     return Py_None;
 }
 
+int
+_PyDeathQueue_AddSelector(PyDeathQueue *queue, PySelectWaiter *w)
+{
+    int ready;
+
+    PyCritical_Enter(queue->crit);
+    PyLinkedList_Append(&queue->selectors, w);
+    ready = !PyLinkedList_Empty(&queue->dead_links);
+    PyCritical_Exit(queue->crit);
+
+    return ready;
+}
+
+void
+_PyDeathQueue_RemoveSelector(PyDeathQueue *queue, PySelectWaiter *w)
+{
+    PyCritical_Enter(queue->crit);
+    PyLinkedList_Remove(&w->links);
+    PyCritical_Exit(queue->crit);
+}
+
 
 PyDoc_STRVAR(watch_doc,
 "deathqueue.watch(obj, payload) -> handle.  payload is returned from\n\
@@ -795,7 +821,7 @@ PyWeakref_NewRef(PyObject *ob, PyObject *callback)
 
     /* If there isn't a ref we start creating one */
     ref = PyObject_New(&_PyWeakref_Type);
-    ref->crit = PyCritical_Allocate(PyCRITICAL_WEAKREF_REF);
+    ref->crit = PyCritical_AllocateNamed(PyCRITICAL_WEAKREF_REF, "weakref");
     if (ref->crit == NULL) {
         PyObject_Del(ref);
         PyErr_NoMemory();
@@ -853,6 +879,7 @@ _PyWeakref_delete_common(PyObject *object, PyWeakReference *ref)
 
     while (!PyLinkedList_Empty(&ref->handle_links)) {
         PyDeathQueueHandle *handle = PyLinkedList_First(&ref->handle_links);
+        PySelectWaiter *w = NULL;
 
         PyCritical_Enter(handle->crit);
         assert(handle->queue != NULL);
@@ -867,6 +894,8 @@ _PyWeakref_delete_common(PyObject *object, PyWeakReference *ref)
         PyLinkedList_Remove(&handle->queue_links);
         PyLinkedList_Append(&handle->queue->dead_links, handle);
         PyThread_cond_wakeall(handle->queue->cond);
+        while (PyLinkedList_Next(&handle->queue->selectors, &w))
+            PyThread_flag_set(w->pystate->condition_flag);
 
         PyCritical_Exit(handle->queue->crit);
         PyCritical_Exit(handle->crit);
@@ -59,6 +59,7 @@ extern void init_subprocess(void);
 extern void init_lsprof(void);
 extern void init_ast(void);
 extern void init_fileio(void);
+extern void init_bufferedio(void);
 extern void initatexit(void);
 
 /* tools/freeze/makeconfig.py marker for additional "extern" */
@@ -146,6 +147,7 @@ struct _inittab _PyImport_Inittab[] = {
         {"sys", NULL},
         
         {"_fileio", init_fileio},
+        {"_bufferedio", init_bufferedio},
         {"atexit", initatexit},
 
         /* Sentinel */
@@ -0,0 +1,393 @@
+/* Allocation profiler */
+
+#include "Python.h"
+#include "code.h"
+#include "frameobject.h"
+#include "pyallocprof.h"
+#include "pythreadtable.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* A record is one malloc()ed block: the header, then the frames, then
+ * the text of their names.  Names are found by offset rather than by
+ * pointer so that a record can be copied with memcpy().  Each thread keeps
+ * its records in a buffer of its own (see pythreadtable.h).  Records are
+ * only linked into and out of a buffer by its owner, or by someone else
+ * with the world stopped; anyone may mark one freed or resized. */
+
+typedef struct {
+    Py_ssize_t line;
+    Py_ssize_t filename;        /* Offsets of Py_UNICODE text */
+    Py_ssize_t filename_len;
+    Py_ssize_t funcname;
+    Py_ssize_t funcname_len;
+} PyAllocFrame;
+
+#define TYPE_NAME_SIZE 64
+
+typedef struct _PyAllocRecord {
+    _PyAllocProf_RecordHead head;
+    struct _PyAllocRecord *next;
+    unsigned long epoch;
+    long thread;
+    size_t blocksize;
+    char type[TYPE_NAME_SIZE];  /* "" if not an object */
+    Py_ssize_t nframes;
+    PyAllocFrame frames[1];     /* Innermost first */
+} PyAllocRecord;
+
+typedef struct _PyAllocBuffer {
+    _PyThreadTable head;
+    PyAllocRecord *records;     /* Newest first */
+    Py_ssize_t count;
+    Py_ssize_t reap_at;         /* Count at which to drop freed records */
+    unsigned long random;
+} PyAllocBuffer;
+
+Py_ssize_t _PyAllocProf_Rate;
+extern void * (*pymalloc_sample_hook)(size_t);
+
+#define DEFAULT_NFRAMES 16
+#define MAX_NFRAMES 256
+
+static _PyThreadTables allocprof_tables;
+/* Changed only with the world stopped */
+static int allocprof_nframes = DEFAULT_NFRAMES;
+static unsigned long allocprof_epoch;
+/* The rate of the last run, kept after it stops to weigh its samples */
+static Py_ssize_t allocprof_weight_rate;
+
+/* Somewhere between half and one and a half times the rate, so that
+ * allocations of the same size in a loop aren't always (or never) the
+ * ones sampled */
+static Py_ssize_t
+next_countdown(PyAllocBuffer *buffer, Py_ssize_t rate)
+{
+    buffer->random = buffer->random * 1103515245 + 12345;
+    return rate / 2 + (Py_ssize_t)((buffer->random >> 8) % (rate + 1));
+}
+
+/* Drops the records whose blocks have been freed */
+static void
+buffer_reap(PyAllocBuffer *buffer)
+{
+    PyAllocRecord **p = &buffer->records, *record;
+
+    while ((record = *p) != NULL) {
+        if (AO_load_acquire(&record->head.freed)) {
+            *p = record->next;
+            free(record);
+            buffer->count--;
+        } else
+            p = &record->next;
+    }
+    buffer->reap_at = buffer->count < 32 ? 64 : buffer->count * 2;
+}
+
+static void
+buffer_free(_PyThreadTable *t)
+{
+    PyAllocBuffer *buffer = (PyAllocBuffer *)t;
+    PyAllocRecord *record, *next;
+
+    for (record = buffer->records; record != NULL; record = next) {
+        next = record->next;
+        free(record);
+    }
+    free(buffer);
+}
+
+static PyAllocRecord *
+record_new(PyState *pystate, size_t size)
+{
+    PyAllocRecord *record;
+    PyFrameObject *f;
+    Py_ssize_t nframes = 0, text = 0, i;
+    size_t blocksize;
+    Py_UNICODE *p;
+
+    for (f = pystate->frame; f != NULL && nframes < allocprof_nframes;
+            f = f->f_back) {
+        PyCodeObject *co = f->f_code;
+        if (PyUnicode_Check(co->co_filename))
+            text += PyUnicode_GET_SIZE(co->co_filename);
+        if (PyUnicode_Check(co->co_name))
+            text += PyUnicode_GET_SIZE(co->co_name);
+        nframes++;
+    }
+
+    blocksize = sizeof(PyAllocRecord) + nframes * sizeof(PyAllocFrame) +
+        text * sizeof(Py_UNICODE);
+    record = malloc(blocksize);
+    if (record == NULL)
+        return NULL;
+    record->head.freed = 0;
+    record->head.size = size;
+    record->epoch = allocprof_epoch;
+    record->blocksize = blocksize;
+    record->type[0] = '\0';
+    record->nframes = nframes;
+
+    p = (Py_UNICODE *)&record->frames[nframes];
+    for (f = pystate->frame, i = 0; i < nframes; f = f->f_back, i++) {
+        PyCodeObject *co = f->f_code;
+        PyAllocFrame *frame = &record->frames[i];
+
+        frame->line = PyCode_Addr2Line(co, f->f_lasti);
+        frame->filename = (char *)p - (char *)record;
+        frame->filename_len = 0;
+        if (PyUnicode_Check(co->co_filename)) {
+            frame->filename_len = PyUnicode_GET_SIZE(co->co_filename);
+            memcpy(p, PyUnicode_AS_UNICODE(co->co_filename),
+                frame->filename_len * sizeof(Py_UNICODE));
+            p += frame->filename_len;
+        }
+        frame->funcname = (char *)p - (char *)record;
+        frame->funcname_len = 0;
+        if (PyUnicode_Check(co->co_name)) {
+            frame->funcname_len = PyUnicode_GET_SIZE(co->co_name);
+            memcpy(p, PyUnicode_AS_UNICODE(co->co_name),
+                frame->funcname_len * sizeof(Py_UNICODE));
+            p += frame->funcname_len;
+        }
+    }
+    return record;
+}
+
+void *
+_PyAllocProf_Sample(size_t size)
+{
+    PyState *pystate = _PyState_Peek();
+    PyAllocBuffer *buffer;
+    PyAllocRecord *record;
+    Py_ssize_t rate = _PyAllocProf_Rate;
+
+    /* A suspended thread may be running alongside someone who has
+     * stopped the world to read the buffers */
+    if (pystate == NULL || pystate->suspended || rate <= 0)
+        return NULL;
+    pystate->alloc_countdown -= size;
+    if (pystate->alloc_countdown >= 0)
+        return NULL;
+
+    buffer = pystate->allocprof;
+    if (buffer == NULL) {
+        /* A thread starts counting the first time it allocates */
+        buffer = _PyThreadTables_New(&allocprof_tables,
+            sizeof(PyAllocBuffer));
+        if (buffer == NULL)
+            return NULL;
+        buffer->random = (unsigned long)(size_t)pystate ^ buffer->head.thread;
+        buffer->reap_at = 64;
+        pystate->allocprof = buffer;
+        pystate->alloc_countdown = next_countdown(buffer, rate);
+        return NULL;
+    }
+    pystate->alloc_countdown = next_countdown(buffer, rate);
+
+    if (buffer->count >= buffer->reap_at)
+        buffer_reap(buffer);
+    /* Out of memory the sample is simply lost */
+    record = record_new(pystate, size);
+    if (record == NULL)
+        return NULL;
+    record->thread = buffer->head.thread;
+    record->next = buffer->records;
+    buffer->records = record;
+    buffer->count++;
+    return record;
+}
+
+void
+_PyAllocProf_SetType(void *record, PyTypeObject *type)
+{
+    PyAllocRecord *r = record;
+
+    strncpy(r->type, type->tp_name, TYPE_NAME_SIZE - 1);
+    r->type[TYPE_NAME_SIZE - 1] = '\0';
+}
+
+void
+_PyAllocProf_Retire(PyState *pystate)
+{
+    /* Never sample again */
+    pystate->alloc_countdown = PY_SSIZE_T_MAX;
+    _PyThreadTables_Retire(&allocprof_tables, pystate);
+}
+
+static int
+reap_visit(_PyThreadTable *buffer, void *unused)
+{
+    buffer_reap((PyAllocBuffer *)buffer);
+    return 0;
+}
+
+static int
+buffer_empty(_PyThreadTable *buffer)
+{
+    return ((PyAllocBuffer *)buffer)->count == 0;
+}
+
+/* Drops every freed record, and retired buffers left empty.  Call with
+ * the world stopped. */
+static void
+reap_all(void)
+{
+    _PyThreadTables_Visit(&allocprof_tables, reap_visit, NULL);
+    /* The buffers hold no references, so they can be freed right here */
+    _PyThreadTables_FreeList(&allocprof_tables,
+        _PyThreadTables_Prune(&allocprof_tables, buffer_empty));
+}
+
+int
+PyAllocProf_Start(Py_ssize_t rate, int nframes)
+{
+    PyState *t;
+
+    if (rate <= 0) {
+        PyErr_SetString(PyExc_ValueError,
+            "sampling rate must be positive");
+        return -1;
+    }
+    if (nframes < 1 || nframes > MAX_NFRAMES) {
+        PyErr_Format(PyExc_ValueError,
+            "the number of frames must be in the range [1; %d]",
+            MAX_NFRAMES);
+        return -1;
+    }
+
+    /* Blocks sampled by earlier runs keep their records until they're
+     * freed, but a new epoch leaves them out of the samples */
+    PyState_StopTheWorld();
+    reap_all();
+    allocprof_epoch++;
+    allocprof_nframes = nframes;
+    allocprof_weight_rate = rate;
+    for (t = _PyState_Head(); t != NULL; t = t->next) {
+        if (!t->deleted && t->allocprof != NULL)
+            t->alloc_countdown = next_countdown(t->allocprof, rate);
+    }
+    _PyAllocProf_Rate = rate;
+    pymalloc_sample_hook = _PyAllocProf_Sample;
+    PyState_StartTheWorld();
+    return 0;
+}
+
+void
+PyAllocProf_Stop(void)
+{
+    _PyAllocProf_Rate = 0;
+    pymalloc_sample_hook = NULL;
+}
+
+Py_ssize_t
+PyAllocProf_GetRate(void)
+{
+    return _PyAllocProf_Rate;
+}
+
+/* Adds copies of buffer's live records of this epoch to *copies.
+ * Returns -1 if out of memory. */
+static int
+buffer_copy(_PyThreadTable *t, void *copies)
+{
+    PyAllocBuffer *buffer = (PyAllocBuffer *)t;
+    PyAllocRecord *record, *copy;
+
+    for (record = buffer->records; record != NULL; record = record->next) {
+        if (record->epoch != allocprof_epoch ||
+                AO_load_acquire(&record->head.freed))
+            continue;
+        copy = malloc(record->blocksize);
+        if (copy == NULL)
+            return -1;
+        memcpy(copy, record, record->blocksize);
+        copy->next = *(PyAllocRecord **)copies;
+        *(PyAllocRecord **)copies = copy;
+    }
+    return 0;
+}
+
+static PyObject *
+record_to_tuple(PyAllocRecord *record, Py_ssize_t rate)
+{
+    PyObject *traceback, *type;
+    Py_ssize_t i, n = record->nframes;
+    size_t size = record->head.size;
+
+    traceback = PyTuple_New(n);
+    if (traceback == NULL)
+        return NULL;
+    for (i = 0; i < n; i++) {
+        PyAllocFrame *frame = &record->frames[n - 1 - i];
+        PyObject *item = Py_BuildValue("(u#u#n)",
+            (Py_UNICODE *)((char *)record + frame->filename),
+            (int)frame->filename_len,
+            (Py_UNICODE *)((char *)record + frame->funcname),
+            (int)frame->funcname_len, frame->line);
+        if (item == NULL) {
+            Py_DECREF(traceback);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(traceback, i, item);
+    }
+
+    if (record->type[0] == '\0') {
+        Py_INCREF(Py_None);
+        type = Py_None;
+    } else {
+        type = PyUnicode_FromString(record->type);
+        if (type == NULL) {
+            Py_DECREF(traceback);
+            return NULL;
+        }
+    }
+
+    return Py_BuildValue("(lNnnN)", record->thread, type, (Py_ssize_t)size,
+        (Py_ssize_t)(size > (size_t)rate ? size : (size_t)rate), traceback);
+}
+
+PyObject *
+PyAllocProf_GetSamples(void)
+{
+    PyAllocRecord *copies = NULL, *record, *next;
+    PyObject *result, *item;
+    Py_ssize_t rate;
+    int err;
+
+    /* Copy with the world stopped; build the list once it's running */
+    PyState_StopTheWorld();
+    reap_all();
+    rate = allocprof_weight_rate;
+    err = _PyThreadTables_Visit(&allocprof_tables, buffer_copy, &copies);
+    PyState_StartTheWorld();
+
+    result = err ? PyErr_NoMemory() : PyList_New(0);
+    for (record = copies; record != NULL; record = next) {
+        next = record->next;
+        if (result != NULL) {
+            item = record_to_tuple(record, rate);
+            if (item == NULL || PyList_Append(result, item) < 0)
+                Py_CLEAR(result);
+            Py_XDECREF(item);
+        }
+        free(record);
+    }
+    return result;
+}
+
+void
+_PyAllocProf_Init(void)
+{
+    if (_PyThreadTables_Init(&allocprof_tables,
+            offsetof(PyState, allocprof), NULL, buffer_free) < 0)
+        Py_FatalError("Failed to allocate allocation profiler");
+}
+
+
+#ifdef __cplusplus
+}
+#endif
@@ -11,6 +11,8 @@
 
 #include "monitorobject.h"
 #include "branchobject.h"
+#include "queueobject.h"
+#include "reactorobject.h"
 
 /* The default encoding used by the platform file system APIs
    Can remain NULL for all platforms that don't have such a concept
@@ -2360,10 +2362,90 @@ wait(monitor.condition) -> None\n\
 \n\
 Relinquishes monitor until func returns or condition is true.");
 
+static PyObject *
+threadtools_select(PyObject *unused, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = {"sources", "timeout", NULL};
+    PyObject *sources, *timeoutobj = Py_None, *result;
+    double timeout = -1.0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|O:select", kwlist,
+            &sources, &timeoutobj))
+        return NULL;
+
+    if (timeoutobj != Py_None) {
+        timeout = PyFloat_AsDouble(timeoutobj);
+        if (timeout == -1.0 && PyErr_Occurred())
+            return NULL;
+        if (timeout < 0) {
+            PyErr_SetString(PyExc_ValueError,
+                "'timeout' must be a positive number");
+            return NULL;
+        }
+    }
+
+    sources = PySequence_Tuple(sources);
+    if (sources == NULL)
+        return NULL;
+
+    result = _PyMonitorSpace_Select(sources, timeout);
+    Py_DECREF(sources);
+    return result;
+}
+
+PyDoc_STRVAR(select_doc,
+"select(sources, timeout=None) -> source or None\n\
+\n\
+Waits until one of sources is ready and returns it, or returns None if\n\
+timeout expires first.  A Queue is ready when it has an item, a\n\
+deathqueue when a watched object has died, a future when its child has\n\
+finished, readable(fd) or writable(fd) when the file descriptor is, and\n\
+a condition (only from within its monitor, which is relinquished\n\
+meanwhile) when true.\n\
+Earlier sources win ties.  This is cancellable.");
+
+static PyObject *
+threadtools_readable(PyObject *unused, PyObject *fileobj)
+{
+    int fd = PyObject_AsFileDescriptor(fileobj);
+
+    if (fd < 0)
+        return NULL;
+    return PyFDWatch_New(fd, 0);
+}
+
+PyDoc_STRVAR(readable_doc,
+"readable(fd) -> fdwatch\n\
+\n\
+Returns a source for select() that is ready when fd (an integer or an\n\
+object with a fileno() method) can be read without blocking.");
+
+static PyObject *
+threadtools_writable(PyObject *unused, PyObject *fileobj)
+{
+    int fd = PyObject_AsFileDescriptor(fileobj);
+
+    if (fd < 0)
+        return NULL;
+    return PyFDWatch_New(fd, 1);
+}
+
+PyDoc_STRVAR(writable_doc,
+"writable(fd) -> fdwatch\n\
+\n\
+Returns a source for select() that is ready when fd (an integer or an\n\
+object with a fileno() method) can be written without blocking.");
+
 
 static PyMethodDef threadtools_methods[] = {
     {"wait", (PyCFunction)threadtools_wait,
         METH_SHARED | METH_VARARGS | METH_KEYWORDS, wait_doc},
+    {"select", (PyCFunction)threadtools_select,
+        METH_SHARED | METH_VARARGS | METH_KEYWORDS, select_doc},
+    {"readable", (PyCFunction)threadtools_readable,
+        METH_SHARED | METH_O, readable_doc},
+    {"writable", (PyCFunction)threadtools_writable,
+        METH_SHARED | METH_O, writable_doc},
     {NULL, NULL},
 };
 
@@ -2398,6 +2480,7 @@ _Py_ThreadTools_Init(void)
 	SETBUILTIN("condition",		&PyMonitorCondition_Type);
 	SETBUILTIN("MonitorSpace",	&PyMonitorSpace_Type);
 	SETBUILTIN("branch",		&PyBranch_Type);
+	SETBUILTIN("Queue",		&PyQueue_Type);
 
 error:
 	;
@@ -16,6 +16,8 @@
 #include "eval.h"
 #include "opcode.h"
 #include "structmember.h"
+#include "longintrepr.h"
+#include "pythreadtable.h"
 
 #include <ctype.h>
 
@@ -83,6 +85,22 @@ void dump_tsc(int opcode, int ticked, uint64 inst0, uint64 inst1,
 #define CHECKEXC 1	/* Double-check exception checking */
 #endif
 
+/* Computed-goto ("threaded") dispatch: each opcode ends by jumping
+   straight to the next opcode's code through opcode_targets[], rather
+   than going back around the loop to the switch.  Each of those indirect
+   jumps gets its own branch predictor history, and the switch's bounds
+   check goes away.  This needs gcc's labels-as-values; build with
+   -DUSE_COMPUTED_GOTOS=0 to get the plain switch.  The tracing builds
+   print or time every opcode in the loop header, so they keep the
+   switch. */
+#ifndef USE_COMPUTED_GOTOS
+#if defined(__GNUC__) && !defined(LLTRACE) && !defined(WITH_TSC)
+#define USE_COMPUTED_GOTOS 1
+#else
+#define USE_COMPUTED_GOTOS 0
+#endif
+#endif
+
 typedef PyObject *(*callproc)(PyObject *, PyObject *, PyObject *);
 
 /* Forward declarations */
@@ -92,6 +110,7 @@ static PyObject * call_function(PyState *, PyObject ***, int, uint64*, uint64*);
 static PyObject * call_function(PyState *, PyObject ***, int);
 #endif
 static PyObject * fast_function(PyState *, PyObject *, PyObject ***, int, int, int);
+static PyObject * call_exact_function(PyState *, PyObject *, PyObject **, int);
 static PyObject * do_call(PyObject *, PyObject ***, int, int);
 static PyObject * ext_do_call(PyObject *, PyObject ***, int, int, int);
 static PyObject * update_keyword_args(PyObject *, int, PyObject ***,
@@ -132,15 +151,37 @@ static PyObject * unicode_concatenate(PyObject *, PyObject *,
 	"free variable '%.200s' referenced before assignment" \
         " in enclosing scope"
 
-/* Dynamic execution profile */
-#ifdef DYNAMIC_EXECUTION_PROFILE
-#ifdef DXPAIRS
-static long dxpairs[257][256];
-#define dxp dxpairs[256]
-#else
-static long dxp[256];
-#endif
-#endif
+/* Dynamic execution profile.  While sys.setdxp() has it on, each thread
+   counts the opcodes and pairs of opcodes it dispatches, and how often it
+   runs each instruction of each code object, in a PyDXProfile of its own
+   (see pythreadtable.h).  Only the owning thread writes to a profile, so
+   the counts are plain longs, and readers stop the world to add them up.
+   When a thread exits, and when counting is turned off, its profile is
+   added into the retired one. */
+
+typedef struct {
+	_PyHashEntry head;
+	PyCodeObject *code;	/* Strong reference */
+	long *counts;		/* Indexed by instruction offset */
+	Py_ssize_t len;		/* Length of co_code */
+} PyDXCode;
+
+typedef struct _PyDXProfile {
+	_PyThreadTable head;
+	unsigned long epoch;	/* Tells a profile from a later one at the
+				   same address */
+	int lastopcode;
+	long pairs[257][256];	/* pairs[256] counts each opcode alone */
+	_PyHashTable codes;	/* Of PyDXCode, on the code's address */
+} PyDXProfile;
+
+/* Only changed with the world stopped */
+static int dxp_enabled;
+static unsigned long dxp_epoch;
+static _PyThreadTables dxp_tables;
+
+static void dxp_count(PyDXProfile *, PyCodeObject *, int, int,
+		      long **, unsigned long *);
 
 /* Function call profile */
 #ifdef CALL_PROFILE
@@ -296,6 +337,159 @@ PyEval_EvalCode(PyCodeObject *co, PyObject *globals, PyObject *locals)
 }
 
 
+/* Quickening.  Once a code object has been entered QUICKEN_WARMUP times
+   its bytecode is copied, and frames execute from the copy from then on.
+   In the copy, BINARY_ADD, INPLACE_ADD, COMPARE_OP and CALL_FUNCTION
+   start out as *_ADAPTIVE opcodes.  The first time one of those runs it
+   looks at its operands, rewrites itself as the opcode specialized for
+   them (or as the generic opcode if there isn't one), and then carries on
+   as the generic opcode.  A specialized opcode checks its guard every
+   time, and when the guard fails it rewrites itself as the generic opcode
+   for good.  Each instruction is therefore rewritten at most twice, and
+   a site that sees mixed types settles on the generic opcode rather than
+   flapping.
+
+   Code objects are shared between threads, so the copy is published with
+   a compare-and-swap, and a thread that loses the race frees its own.
+   Rewriting an instruction is a single byte store of an opcode taking the
+   same argument, and a thread that reads the old byte runs an opcode that
+   is just as correct there.  co_code itself is never written, so dis,
+   tracing and f_lasti see the same offsets as before. */
+
+#define QUICKEN_WARMUP 8
+
+static unsigned char *
+quicken_code(PyCodeObject *co)
+{
+	unsigned char *code, *q;
+	Py_ssize_t i, len;
+	int op, prev;
+
+	q = (unsigned char *)AO_load_acquire(&co->co_quickened);
+	if (q != NULL)
+		return q;
+	code = (unsigned char *)PyString_AS_STRING(co->co_code);
+	/* Racing updates may lose a count, which only delays quickening */
+	if (co->co_warmup < QUICKEN_WARMUP) {
+		co->co_warmup++;
+		return code;
+	}
+
+	len = PyString_GET_SIZE(co->co_code);
+	q = PyMem_MALLOC(len);
+	if (q == NULL)
+		return code;	/* Try again next time */
+	memcpy(q, code, len);
+	prev = 0;
+	for (i = 0; i < len; i += HAS_ARG(op) ? 3 : 1) {
+		op = q[i];
+		if (prev == EXTENDED_ARG) {
+			prev = op;
+			continue;
+		}
+		switch (op) {
+		case BINARY_ADD:
+			q[i] = BINARY_ADD_ADAPTIVE;
+			break;
+		case INPLACE_ADD:
+			q[i] = INPLACE_ADD_ADAPTIVE;
+			break;
+		case COMPARE_OP:
+			/* Only the rich comparisons have specialized forms */
+			if (q[i+2] == 0 && q[i+1] <= PyCmp_GE)
+				q[i] = COMPARE_OP_ADAPTIVE;
+			break;
+		case CALL_FUNCTION:
+			/* Nor do calls with keyword arguments */
+			if (q[i+2] == 0)
+				q[i] = CALL_FUNCTION_ADAPTIVE;
+			break;
+		}
+		prev = op;
+	}
+
+	if (!AO_compare_and_swap_full(&co->co_quickened, 0, (AO_t)q)) {
+		PyMem_FREE(q);
+		q = (unsigned char *)AO_load_acquire(&co->co_quickened);
+	}
+	return q;
+}
+
+/* Ints of at most one digit, which need no loop to add or compare.  The
+   value of a zero-digit int comes out as 0 whatever ob_digit[0] holds. */
+#define MEDIUM_INT(x)	((size_t)(Py_SIZE(x) + 1) <= 2)
+#define MEDIUM_VALUE(x)	(Py_SIZE(x) * (long)((PyLongObject *)(x))->ob_digit[0])
+
+/* The specialized opcodes' operations.  They skip the slot lookup and
+   subclass checks of PyNumber_Add() and PyObject_RichCompare(), which
+   their guards have already made unnecessary. */
+
+Py_LOCAL_INLINE(PyObject *)
+int_add(PyObject *v, PyObject *w)
+{
+	if (MEDIUM_INT(v) && MEDIUM_INT(w))
+		return PyLong_FromLong(MEDIUM_VALUE(v) + MEDIUM_VALUE(w));
+	return PyLong_Type.tp_as_number->nb_add(v, w);
+}
+
+Py_LOCAL_INLINE(PyObject *)
+int_compare(PyObject *v, PyObject *w, int op)
+{
+	long a, b;
+	int res;
+
+	if (!MEDIUM_INT(v) || !MEDIUM_INT(w))
+		return PyLong_Type.tp_richcompare(v, w, op);
+	a = MEDIUM_VALUE(v);
+	b = MEDIUM_VALUE(w);
+	switch (op) {
+	case Py_LT: res = a < b; break;
+	case Py_LE: res = a <= b; break;
+	case Py_EQ: res = a == b; break;
+	case Py_NE: res = a != b; break;
+	case Py_GT: res = a > b; break;
+	default: res = a >= b; break;
+	}
+	v = res ? Py_True : Py_False;
+	Py_INCREF(v);
+	return v;
+}
+
+Py_LOCAL_INLINE(PyObject *)
+float_compare(PyObject *v, PyObject *w, int op)
+{
+	double a = PyFloat_AS_DOUBLE(v);
+	double b = PyFloat_AS_DOUBLE(w);
+	int res;
+
+	switch (op) {
+	case Py_LT: res = a < b; break;
+	case Py_LE: res = a <= b; break;
+	case Py_EQ: res = a == b; break;
+	case Py_NE: res = a != b; break;
+	case Py_GT: res = a > b; break;
+	default: res = a >= b; break;
+	}
+	v = res ? Py_True : Py_False;
+	Py_INCREF(v);
+	return v;
+}
+
+/* True if func is a Python function that call_exact_function() can call
+   with n positional arguments: no defaults, keywords, cells or varargs. */
+Py_LOCAL_INLINE(int)
+exact_python_call(PyObject *func, int n)
+{
+	PyCodeObject *co;
+
+	if (!PyFunction_Check(func) || PyFunction_GET_DEFAULTS(func) != NULL)
+		return 0;
+	co = (PyCodeObject *)PyFunction_GET_CODE(func);
+	return co->co_argcount == n && co->co_kwonlyargcount == 0 &&
+	    co->co_flags == (CO_OPTIMIZED | CO_NEWLOCALS | CO_NOFREE);
+}
+
+
 /* Interpreter main loop */
 
 PyObject *
@@ -309,9 +503,6 @@ PyEval_EvalFrame(PyFrameObject *f) {
 PyObject *
 PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 {
-#ifdef DXPAIRS
-	int lastopcode = 0;
-#endif
 	register PyObject **stack_pointer;  /* Next free slot in value stack */
 	register unsigned char *next_instr;
 	register int opcode;	/* Current opcode */
@@ -327,6 +518,10 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 	PyObject *retval = NULL;	/* Return value */
 	PyState *pystate = PyState_Get();
 	PyCodeObject *co;
+#if USE_COMPUTED_GOTOS
+/* Import the static jump table */
+#include "opcode_targets.h"
+#endif
 
 	/* when tracing we set things up so that
 
@@ -337,6 +532,11 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
            time it is tested. */
 	int instr_ub = -1, instr_lb = 0, instr_prev = -1;
 
+	/* co's per-instruction counts in pystate->dxp, and the epoch of
+	   the profile they were looked up in */
+	long *dxp_counts = NULL;
+	unsigned long dxp_seen = 0;
+
 	unsigned char *first_instr;
 	PyObject *names;
 	PyObject *consts;
@@ -399,6 +599,8 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 #define NEXTOP()	(*next_instr++)
 #define NEXTARG()	(next_instr += 2, (next_instr[-1]<<8) + next_instr[-2])
 #define PEEKARG()	((next_instr[2]<<8) + next_instr[1])
+/* Skip the instruction a superinstruction absorbed, yielding its argument */
+#define NEXTINSTRARG()	(next_instr += 3, (next_instr[-1]<<8) + next_instr[-2])
 #define JUMPTO(x)	(next_instr = first_instr + (x))
 #define JUMPBY(x)	(next_instr += (x))
 
@@ -417,20 +619,86 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 	A successful prediction saves a trip through the eval-loop including
 	its two unpredictable branches, the HAS_ARG test and the switch-case.
 
-        If collecting opcode statistics, turn off prediction so that
-	statistics are accurately maintained (the predictions bypass
-	the opcode frequency counter updates).
+	While sys.setdxp() is collecting opcode statistics, predictions
+	are not taken, so that the statistics are accurately maintained
+	(the predictions bypass the opcode frequency counter updates).
+
+	With computed gotos every opcode already ends in its own indirect
+	jump, which is what a prediction would buy, so they are off there
+	too.
 */
 
-#ifdef DYNAMIC_EXECUTION_PROFILE
+#if USE_COMPUTED_GOTOS
 #define PREDICT(op)		if (0) goto PRED_##op
 #else
-#define PREDICT(op)		if (*next_instr == op) goto PRED_##op
+#define PREDICT(op) \
+	if (*next_instr == op && !pystate->instr_hooks) goto PRED_##op
 #endif
 
 #define PREDICTED(op)		PRED_##op: next_instr++
 #define PREDICTED_WITH_ARG(op)	PRED_##op: oparg = PEEKARG(); next_instr += 3
 
+/* Opcode dispatch.  An opcode that succeeds ends with DISPATCH().  With
+   computed gotos that jumps to the next opcode's TARGET() label, which
+   fetches its own argument; while a trace function is set or opcodes are
+   being counted it goes back around the loop instead, so that both still
+   see every instruction.
+   Otherwise DISPATCH() is just a trip around the loop to the switch.
+   Opcodes sharing one body use TARGET_WITH_IMPL() for all but the last,
+   so that each still gets its own entry in opcode_targets[]. */
+
+#if USE_COMPUTED_GOTOS
+#define TARGET(op) \
+	TARGET_##op: \
+	opcode = op; \
+	if (HAS_ARG(op)) \
+		oparg = NEXTARG(); \
+	case op:
+#define TARGET_WITH_IMPL(op, impl) \
+	TARGET_##op: \
+	opcode = op; \
+	if (HAS_ARG(op)) \
+		oparg = NEXTARG(); \
+	case op: \
+	goto impl;
+#define DISPATCH() \
+	{ \
+		if (!pystate->instr_hooks) { \
+			f->f_lasti = INSTR_OFFSET(); \
+			goto *opcode_targets[*next_instr++]; \
+		} \
+		continue; \
+	}
+#else
+#define TARGET(op)	case op:
+#define TARGET_WITH_IMPL(op, impl)	case op: goto impl;
+#define DISPATCH()	continue
+#endif
+
+/* Rewrite the current instruction as op, which takes an argument exactly
+   when the current opcode does.  Only the opcodes quicken_code() puts in
+   a quickened copy may do this; co_code is read-only. */
+
+#define QUICKEN(op)	(next_instr[HAS_ARG(op) ? -3 : -1] = (op))
+
+/* Safepoints.  PyState_Tick() is where a thread lets the world stop and
+   hands back objects another thread is waiting to own, so the gap between
+   ticks bounds how long other threads wait on this one.  Ticking before
+   every instruction made it the largest single cost in the loop, so it is
+   only done where control can come back around: on entry to a frame
+   (which covers recursion and resuming a generator) and on the backward
+   jumps that close a loop.  The peephole optimizer never makes a relative
+   jump go backward, so JUMP_ABSOLUTE and CONTINUE_LOOP are the only ones.
+   Blocking calls don't need a tick; PyState_Suspend() already lets the
+   world stop around them. */
+
+#define SAFEPOINT() \
+	if (PyState_Tick()) { \
+		assert(PyErr_Occurred()); \
+		why = WHY_EXCEPTION; \
+		goto on_error; \
+	}
+
 /* Stack manipulation macros */
 
 /* The stack can grow at most MAXINT deep, as co_nlocals and
@@ -533,7 +801,7 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 	consts = co->co_consts;
 	fastlocals = f->f_localsplus;
 	freevars = f->f_localsplus + co->co_nlocals;
-	first_instr = (unsigned char*) PyString_AS_STRING(co->co_code);
+	first_instr = quicken_code(co);
 	/* An explanation is in order for the next line.
 
 	   f->f_lasti now refers to the index of the last instruction
@@ -573,6 +841,11 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 		goto on_error;
 	}
 
+	/* Check for asynchronous events on the way in, unless we're at the
+	 * last opcode before a try-finally block. */
+	if (*next_instr != SETUP_FINALLY)
+		SAFEPOINT();
+
 	for (;;) {
 #ifdef WITH_TSC
 		if (inst1 == 0) {
@@ -594,15 +867,6 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 		assert(stack_pointer >= f->f_valuestack); /* else underflow */
 		assert(STACK_LEVEL() <= co->co_stacksize);  /* else overflow */
 
-		/* Check for asynchronous events, unless we're at the
-		 * last opcode before a try-finally block. */
-		if (*next_instr != SETUP_FINALLY && PyState_Tick()) {
-			assert(PyErr_Occurred());
-			why = WHY_EXCEPTION;
-			goto on_error;
-		}
-
-	fast_next_opcode:
 		f->f_lasti = INSTR_OFFSET();
 
 		/* line-by-line tracing support */
@@ -636,14 +900,9 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 		if (HAS_ARG(opcode))
 			oparg = NEXTARG();
 	  dispatch_opcode:
-#ifdef DYNAMIC_EXECUTION_PROFILE
-#error bleh
-#ifdef DXPAIRS
-		dxpairs[lastopcode][opcode]++;
-		lastopcode = opcode;
-#endif
-		dxp[opcode]++;
-#endif
+		if (pystate->dxp != NULL)
+			dxp_count(pystate->dxp, co, f->f_lasti, opcode,
+				  &dxp_counts, &dxp_seen);
 
 #ifdef LLTRACE
 #error bleh lltrace
@@ -673,56 +932,119 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 
 		/* case STOP_CODE: this is an error! */
 
-		case NOP:
-			goto fast_next_opcode;
+		TARGET(NOP)
+			DISPATCH();
 
-		case LOAD_FAST:
+		TARGET(LOAD_FAST)
+		_load_fast:
 			x = GETLOCAL(oparg);
 			if (x != NULL) {
 				Py_INCREF_PS(x);
 				PUSH(x);
-				goto fast_next_opcode;
+				DISPATCH();
 			}
 			format_exc_check_arg(PyExc_UnboundLocalError,
 				UNBOUNDLOCAL_ERROR_MSG,
 				PyTuple_GetItem(co->co_varnames, oparg));
 			break;
 
-		case LOAD_CONST:
+		/* Superinstructions (see fuse_superinstructions() in
+		   peephole.c).  Each does the work of its first instruction
+		   and then of the one after it, fetching that one's argument
+		   with NEXTINSTRARG(). */
+
+		TARGET(LOAD_FAST__LOAD_FAST)
+			x = GETLOCAL(oparg);
+			if (x != NULL) {
+				Py_INCREF_PS(x);
+				PUSH(x);
+				oparg = NEXTINSTRARG();
+				goto _load_fast;
+			}
+			format_exc_check_arg(PyExc_UnboundLocalError,
+				UNBOUNDLOCAL_ERROR_MSG,
+				PyTuple_GetItem(co->co_varnames, oparg));
+			break;
+
+		TARGET(LOAD_FAST__LOAD_CONST)
+			x = GETLOCAL(oparg);
+			if (x != NULL) {
+				Py_INCREF_PS(x);
+				PUSH(x);
+				x = GETITEM(consts, NEXTINSTRARG());
+				Py_INCREF_PS(x);
+				PUSH(x);
+				DISPATCH();
+			}
+			format_exc_check_arg(PyExc_UnboundLocalError,
+				UNBOUNDLOCAL_ERROR_MSG,
+				PyTuple_GetItem(co->co_varnames, oparg));
+			break;
+
+		TARGET(LOAD_FAST__LOAD_ATTR)
+			/* The local's reference is borrowed for the lookup
+			   instead of being pushed and popped again. */
+			v = GETLOCAL(oparg);
+			if (v != NULL) {
+				w = GETITEM(names, NEXTINSTRARG());
+				x = PyObject_GetAttr(v, w);
+				PUSH(x);
+				if (x != NULL) DISPATCH();
+				break;
+			}
+			format_exc_check_arg(PyExc_UnboundLocalError,
+				UNBOUNDLOCAL_ERROR_MSG,
+				PyTuple_GetItem(co->co_varnames, oparg));
+			break;
+
+		TARGET(LOAD_CONST)
 			x = GETITEM(consts, oparg);
 			Py_INCREF_PS(x);
 			PUSH(x);
-			goto fast_next_opcode;
+			DISPATCH();
+
+		TARGET(LOAD_CONST__RETURN_VALUE)
+			retval = GETITEM(consts, oparg);
+			Py_INCREF_PS(retval);
+			next_instr++;
+			why = WHY_RETURN;
+			goto fast_block_end;
 
 		PREDICTED_WITH_ARG(STORE_FAST);
-		case STORE_FAST:
+		TARGET(STORE_FAST)
+			v = POP();
+			SETLOCAL(oparg, v);
+			DISPATCH();
+
+		TARGET(STORE_FAST__LOAD_FAST)
 			v = POP();
 			SETLOCAL(oparg, v);
-			goto fast_next_opcode;
+			oparg = NEXTINSTRARG();
+			goto _load_fast;
 
 		PREDICTED(POP_TOP);
-		case POP_TOP:
+		TARGET(POP_TOP)
 			v = POP();
 			Py_DECREF_PS(v);
-			goto fast_next_opcode;
+			DISPATCH();
 
-		case ROT_TWO:
+		TARGET(ROT_TWO)
 			v = TOP();
 			w = SECOND();
 			SET_TOP(w);
 			SET_SECOND(v);
-			goto fast_next_opcode;
+			DISPATCH();
 
-		case ROT_THREE:
+		TARGET(ROT_THREE)
 			v = TOP();
 			w = SECOND();
 			x = THIRD();
 			SET_TOP(w);
 			SET_SECOND(x);
 			SET_THIRD(v);
-			goto fast_next_opcode;
+			DISPATCH();
 
-		case ROT_FOUR:
+		TARGET(ROT_FOUR)
 			u = TOP();
 			v = SECOND();
 			w = THIRD();
@@ -731,15 +1053,15 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			SET_SECOND(w);
 			SET_THIRD(x);
 			SET_FOURTH(u);
-			goto fast_next_opcode;
+			DISPATCH();
 
-		case DUP_TOP:
+		TARGET(DUP_TOP)
 			v = TOP();
 			Py_INCREF_PS(v);
 			PUSH(v);
-			goto fast_next_opcode;
+			DISPATCH();
 
-		case DUP_TOPX:
+		TARGET(DUP_TOPX)
 			if (oparg == 2) {
 				x = TOP();
 				Py_INCREF_PS(x);
@@ -748,7 +1070,7 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 				STACKADJ(2);
 				SET_TOP(x);
 				SET_SECOND(w);
-				goto fast_next_opcode;
+				DISPATCH();
 			} else if (oparg == 3) {
 				x = TOP();
 				Py_INCREF_PS(x);
@@ -760,105 +1082,148 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 				SET_TOP(x);
 				SET_SECOND(w);
 				SET_THIRD(v);
-				goto fast_next_opcode;
+				DISPATCH();
 			}
 			Py_FatalError("invalid argument to DUP_TOPX"
 				      " (bytecode corruption?)");
 			break;
 
-		case UNARY_POSITIVE:
+		TARGET(UNARY_POSITIVE)
 			v = TOP();
 			x = PyNumber_Positive(v);
 			Py_DECREF_PS(v);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case UNARY_NEGATIVE:
+		TARGET(UNARY_NEGATIVE)
 			v = TOP();
 			x = PyNumber_Negative(v);
 			Py_DECREF_PS(v);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case UNARY_NOT:
+		TARGET(UNARY_NOT)
 			v = TOP();
 			err = PyObject_IsTrue(v);
 			Py_DECREF_PS(v);
 			if (err == 0) {
 				Py_INCREF_PS(Py_True);
 				SET_TOP(Py_True);
-				continue;
+				DISPATCH();
 			}
 			else if (err > 0) {
 				Py_INCREF_PS(Py_False);
 				SET_TOP(Py_False);
 				err = 0;
-				continue;
+				DISPATCH();
 			}
 			STACKADJ(-1);
 			break;
 
-		case UNARY_INVERT:
+		TARGET(UNARY_INVERT)
 			v = TOP();
 			x = PyNumber_Invert(v);
 			Py_DECREF_PS(v);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case BINARY_POWER:
+		TARGET(BINARY_POWER)
 			w = POP();
 			v = TOP();
 			x = PyNumber_Power(v, w, Py_None);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case BINARY_MULTIPLY:
+		TARGET(BINARY_MULTIPLY)
 			w = POP();
 			v = TOP();
 			x = PyNumber_Multiply(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case BINARY_TRUE_DIVIDE:
+		TARGET(BINARY_TRUE_DIVIDE)
 			w = POP();
 			v = TOP();
 			x = PyNumber_TrueDivide(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case BINARY_FLOOR_DIVIDE:
+		TARGET(BINARY_FLOOR_DIVIDE)
 			w = POP();
 			v = TOP();
 			x = PyNumber_FloorDivide(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case BINARY_MODULO:
+		TARGET(BINARY_MODULO)
 			w = POP();
 			v = TOP();
 			x = PyNumber_Remainder(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case BINARY_ADD:
+		TARGET(BINARY_ADD_ADAPTIVE)
+			w = TOP();
+			v = SECOND();
+			if (PyLong_CheckExact(v) && PyLong_CheckExact(w))
+				QUICKEN(BINARY_ADD_INT);
+			else if (PyUnicode_CheckExact(v) &&
+				 PyUnicode_CheckExact(w))
+				QUICKEN(BINARY_ADD_UNICODE);
+			else
+				QUICKEN(BINARY_ADD);
+			goto _binary_add;
+
+		TARGET(BINARY_ADD_INT)
+			w = TOP();
+			v = SECOND();
+			if (!PyLong_CheckExact(v) || !PyLong_CheckExact(w)) {
+				QUICKEN(BINARY_ADD);
+				goto _binary_add;
+			}
+			STACKADJ(-1);
+			x = int_add(v, w);
+			Py_DECREF_PS(v);
+			Py_DECREF_PS(w);
+			SET_TOP(x);
+			if (x != NULL) DISPATCH();
+			break;
+
+		TARGET(BINARY_ADD_UNICODE)
+			w = TOP();
+			v = SECOND();
+			if (!PyUnicode_CheckExact(v) || !PyUnicode_CheckExact(w)) {
+				QUICKEN(BINARY_ADD);
+				goto _binary_add;
+			}
+			STACKADJ(-1);
+			x = unicode_concatenate(v, w, f, next_instr);
+			/* unicode_concatenate consumed the ref to v */
+			Py_DECREF_PS(w);
+			SET_TOP(x);
+			if (x != NULL) DISPATCH();
+			break;
+
+		TARGET(BINARY_ADD)
+		_binary_add:
 			w = POP();
 			v = TOP();
 			if (PyUnicode_CheckExact(v) &&
@@ -874,80 +1239,80 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 		  skip_decref_vx:
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case BINARY_SUBTRACT:
+		TARGET(BINARY_SUBTRACT)
 			w = POP();
 			v = TOP();
 			x = PyNumber_Subtract(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case BINARY_SUBSCR:
+		TARGET(BINARY_SUBSCR)
 			w = POP();
 			v = TOP();
 			x = PyObject_GetItem(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case BINARY_LSHIFT:
+		TARGET(BINARY_LSHIFT)
 			w = POP();
 			v = TOP();
 			x = PyNumber_Lshift(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case BINARY_RSHIFT:
+		TARGET(BINARY_RSHIFT)
 			w = POP();
 			v = TOP();
 			x = PyNumber_Rshift(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case BINARY_AND:
+		TARGET(BINARY_AND)
 			w = POP();
 			v = TOP();
 			x = PyNumber_And(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case BINARY_XOR:
+		TARGET(BINARY_XOR)
 			w = POP();
 			v = TOP();
 			x = PyNumber_Xor(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case BINARY_OR:
+		TARGET(BINARY_OR)
 			w = POP();
 			v = TOP();
 			x = PyNumber_Or(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case LIST_APPEND:
+		TARGET(LIST_APPEND)
 			w = POP();
 			v = POP();
 			err = PyList_Append(v, w);
@@ -955,11 +1320,11 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			Py_DECREF_PS(w);
 			if (err == 0) {
 				PREDICT(JUMP_ABSOLUTE);
-				continue;
+				DISPATCH();
 			}
 			break;
 
-		case SET_ADD:
+		TARGET(SET_ADD)
 			w = POP();
 			v = POP();
 			err = PySet_Add(v, w);
@@ -967,61 +1332,104 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			Py_DECREF_PS(w);
 			if (err == 0) {
 				PREDICT(JUMP_ABSOLUTE);
-				continue;
+				DISPATCH();
 			}
 			break;
 
-		case INPLACE_POWER:
+		TARGET(INPLACE_POWER)
 			w = POP();
 			v = TOP();
 			x = PyNumber_InPlacePower(v, w, Py_None);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case INPLACE_MULTIPLY:
+		TARGET(INPLACE_MULTIPLY)
 			w = POP();
 			v = TOP();
 			x = PyNumber_InPlaceMultiply(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case INPLACE_TRUE_DIVIDE:
+		TARGET(INPLACE_TRUE_DIVIDE)
 			w = POP();
 			v = TOP();
 			x = PyNumber_InPlaceTrueDivide(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case INPLACE_FLOOR_DIVIDE:
+		TARGET(INPLACE_FLOOR_DIVIDE)
 			w = POP();
 			v = TOP();
 			x = PyNumber_InPlaceFloorDivide(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case INPLACE_MODULO:
+		TARGET(INPLACE_MODULO)
 			w = POP();
 			v = TOP();
 			x = PyNumber_InPlaceRemainder(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case INPLACE_ADD:
+		TARGET(INPLACE_ADD_ADAPTIVE)
+			w = TOP();
+			v = SECOND();
+			if (PyLong_CheckExact(v) && PyLong_CheckExact(w))
+				QUICKEN(INPLACE_ADD_INT);
+			else if (PyUnicode_CheckExact(v) &&
+				 PyUnicode_CheckExact(w))
+				QUICKEN(INPLACE_ADD_UNICODE);
+			else
+				QUICKEN(INPLACE_ADD);
+			goto _inplace_add;
+
+		TARGET(INPLACE_ADD_INT)
+			w = TOP();
+			v = SECOND();
+			if (!PyLong_CheckExact(v) || !PyLong_CheckExact(w)) {
+				QUICKEN(INPLACE_ADD);
+				goto _inplace_add;
+			}
+			STACKADJ(-1);
+			x = int_add(v, w);
+			Py_DECREF_PS(v);
+			Py_DECREF_PS(w);
+			SET_TOP(x);
+			if (x != NULL) DISPATCH();
+			break;
+
+		TARGET(INPLACE_ADD_UNICODE)
+			w = TOP();
+			v = SECOND();
+			if (!PyUnicode_CheckExact(v) || !PyUnicode_CheckExact(w)) {
+				QUICKEN(INPLACE_ADD);
+				goto _inplace_add;
+			}
+			STACKADJ(-1);
+			x = unicode_concatenate(v, w, f, next_instr);
+			/* unicode_concatenate consumed the ref to v */
+			Py_DECREF_PS(w);
+			SET_TOP(x);
+			if (x != NULL) DISPATCH();
+			break;
+
+		TARGET(INPLACE_ADD)
+		_inplace_add:
 			w = POP();
 			v = TOP();
 			if (PyUnicode_CheckExact(v) &&
@@ -1037,70 +1445,70 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 		  skip_decref_v:
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case INPLACE_SUBTRACT:
+		TARGET(INPLACE_SUBTRACT)
 			w = POP();
 			v = TOP();
 			x = PyNumber_InPlaceSubtract(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case INPLACE_LSHIFT:
+		TARGET(INPLACE_LSHIFT)
 			w = POP();
 			v = TOP();
 			x = PyNumber_InPlaceLshift(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case INPLACE_RSHIFT:
+		TARGET(INPLACE_RSHIFT)
 			w = POP();
 			v = TOP();
 			x = PyNumber_InPlaceRshift(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case INPLACE_AND:
+		TARGET(INPLACE_AND)
 			w = POP();
 			v = TOP();
 			x = PyNumber_InPlaceAnd(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case INPLACE_XOR:
+		TARGET(INPLACE_XOR)
 			w = POP();
 			v = TOP();
 			x = PyNumber_InPlaceXor(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case INPLACE_OR:
+		TARGET(INPLACE_OR)
 			w = POP();
 			v = TOP();
 			x = PyNumber_InPlaceOr(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case STORE_SUBSCR:
+		TARGET(STORE_SUBSCR)
 			w = TOP();
 			v = SECOND();
 			u = THIRD();
@@ -1110,10 +1518,10 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			Py_DECREF_PS(u);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
-			if (err == 0) continue;
+			if (err == 0) DISPATCH();
 			break;
 
-		case DELETE_SUBSCR:
+		TARGET(DELETE_SUBSCR)
 			w = TOP();
 			v = SECOND();
 			STACKADJ(-2);
@@ -1121,10 +1529,10 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			err = PyObject_DelItem(v, w);
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(w);
-			if (err == 0) continue;
+			if (err == 0) DISPATCH();
 			break;
 
-		case PRINT_EXPR:
+		TARGET(PRINT_EXPR)
 			v = POP();
 			w = PySys_GetObject("displayhook");
 			if (w == NULL) {
@@ -1151,7 +1559,7 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 #ifdef CASE_TOO_BIG
 		default: switch (opcode) {
 #endif
-		case RAISE_VARARGS:
+		TARGET(RAISE_VARARGS)
 			v = w = NULL;
 			switch (oparg) {
 			case 2:
@@ -1169,25 +1577,25 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			}
 			break;
 
-		case STORE_LOCALS:
+		TARGET(STORE_LOCALS)
 			x = POP();
 			v = f->f_locals;
 			Py_XDECREF_PS(v);
 			f->f_locals = x;
-			continue;
+			DISPATCH();
 
-		case RETURN_VALUE:
+		TARGET(RETURN_VALUE)
 			retval = POP();
 			why = WHY_RETURN;
 			goto fast_block_end;
 
-		case YIELD_VALUE:
+		TARGET(YIELD_VALUE)
 			retval = POP();
 			f->f_stacktop = stack_pointer;
 			why = WHY_YIELD;
 			goto fast_yield;
 
-		case POP_BLOCK:
+		TARGET(POP_BLOCK)
 			{
 				PyTryBlock *b = PyFrame_BlockPop(f);
 				while (STACK_LEVEL() > b->b_level) {
@@ -1195,10 +1603,10 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 					Py_DECREF_PS(v);
 				}
 			}
-			continue;
+			DISPATCH();
 
 		PREDICTED(END_FINALLY);
-		case END_FINALLY:
+		TARGET(END_FINALLY)
 			v = POP();
 			if (PyLong_Check(v)) {
 				why = (enum why_code) PyLong_AS_LONG(v);
@@ -1222,7 +1630,7 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			Py_DECREF_PS(v);
 			break;
 
-		case LOAD_BUILD_CLASS:
+		TARGET(LOAD_BUILD_CLASS)
 			if (PyDict_GetItemStringEx(f->f_builtins,
 					"__build_class__", &x) < 0)
 				break;
@@ -1235,7 +1643,7 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			PUSH(x);
 			break;
 
-		case STORE_NAME:
+		TARGET(STORE_NAME)
 			w = GETITEM(names, oparg);
 			v = POP();
 			if ((x = f->f_locals) != NULL) {
@@ -1244,14 +1652,14 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 				else
 					err = PyObject_SetItem(x, w, v);
 				Py_DECREF_PS(v);
-				if (err == 0) continue;
+				if (err == 0) DISPATCH();
 				break;
 			}
 			PyErr_Format(PyExc_SystemError,
 				     "no locals found when storing %R", w);
 			break;
 
-		case DELETE_NAME:
+		TARGET(DELETE_NAME)
 			w = GETITEM(names, oparg);
 			if ((x = f->f_locals) != NULL) {
 				if ((err = PyObject_DelItem(x, w)) != 0)
@@ -1265,7 +1673,7 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			break;
 
 		PREDICTED_WITH_ARG(UNPACK_SEQUENCE);
-		case UNPACK_SEQUENCE:
+		TARGET(UNPACK_SEQUENCE)
 			v = POP();
 			if (PyTuple_CheckExact(v) &&
 			    PyTuple_GET_SIZE(v) == oparg) {
@@ -1277,7 +1685,7 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 					PUSH(w);
 				}
 				Py_DECREF_PS(v);
-				continue;
+				DISPATCH();
 			} else if (PyList_CheckExact(v) &&
 				   PyList_GET_SIZE(v) == oparg) {
 				PyObject **items = \
@@ -1297,7 +1705,7 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			Py_DECREF_PS(v);
 			break;
 
-		case UNPACK_EX:
+		TARGET(UNPACK_EX)
 		{
 			int totalargs = 1 + (oparg & 0xFF) + (oparg >> 8);
 			v = POP();
@@ -1312,7 +1720,7 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			break;
 		}
 
-		case STORE_ATTR:
+		TARGET(STORE_ATTR)
 			w = GETITEM(names, oparg);
 			v = TOP();
 			u = SECOND();
@@ -1320,10 +1728,10 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			err = PyObject_SetAttr(v, w, u); /* v.w = u */
 			Py_DECREF_PS(v);
 			Py_DECREF_PS(u);
-			if (err == 0) continue;
+			if (err == 0) DISPATCH();
 			break;
 
-		case DELETE_ATTR:
+		TARGET(DELETE_ATTR)
 			w = GETITEM(names, oparg);
 			v = POP();
 			err = PyObject_SetAttr(v, w, (PyObject *)NULL);
@@ -1331,22 +1739,22 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			Py_DECREF_PS(v);
 			break;
 
-		case STORE_GLOBAL:
+		TARGET(STORE_GLOBAL)
 			w = GETITEM(names, oparg);
 			v = POP();
 			err = PyDict_SetItem(f->f_globals, w, v);
 			Py_DECREF_PS(v);
-			if (err == 0) continue;
+			if (err == 0) DISPATCH();
 			break;
 
-		case DELETE_GLOBAL:
+		TARGET(DELETE_GLOBAL)
 			w = GETITEM(names, oparg);
 			if ((err = PyDict_DelItem(f->f_globals, w)) != 0)
 				format_exc_check_arg(
 				    PyExc_NameError, GLOBAL_NAME_ERROR_MSG, w);
 			break;
 
-		case LOAD_NAME:
+		TARGET(LOAD_NAME)
 			w = GETITEM(names, oparg);
 			if ((v = f->f_locals) == NULL) {
 				PyErr_Format(PyExc_SystemError,
@@ -1380,9 +1788,9 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 				}
 			}
 			PUSH(x);
-			continue;
+			DISPATCH();
 
-		case LOAD_GLOBAL:
+		TARGET(LOAD_GLOBAL)
 			w = GETITEM(names, oparg);
 			if (PyUnicode_CheckExact(w)) {
 				/* Inline the PyDict_GetItem() calls.
@@ -1408,7 +1816,7 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 						Py_INCREF_PS(x);
 						_pydictlock_release(d, &lockstate);
 						PUSH(x);
-						continue;
+						DISPATCH();
 					}
 					_pydictlock_release(d, &lockstate);
 
@@ -1426,7 +1834,7 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 						Py_INCREF_PS(x);
 						_pydictlock_release(d, &lockstate);
 						PUSH(x);
-						continue;
+						DISPATCH();
 					}
 					_pydictlock_release(d, &lockstate);
 					goto load_global_error;
@@ -1447,13 +1855,13 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 				}
 			}
 			PUSH(x);
-			continue;
+			DISPATCH();
 
-		case DELETE_FAST:
+		TARGET(DELETE_FAST)
 			x = GETLOCAL(oparg);
 			if (x != NULL) {
 				SETLOCAL(oparg, NULL);
-				continue;
+				DISPATCH();
 			}
 			format_exc_check_arg(
 				PyExc_UnboundLocalError,
@@ -1462,19 +1870,19 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 				);
 			break;
 
-		case LOAD_CLOSURE:
+		TARGET(LOAD_CLOSURE)
 			x = freevars[oparg];
 			Py_INCREF_PS(x);
 			PUSH(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case LOAD_DEREF:
+		TARGET(LOAD_DEREF)
 			x = freevars[oparg];
 			w = PyCell_Get(x);
 			if (w != NULL) {
 				PUSH(w);
-				continue;
+				DISPATCH();
 			}
 			err = -1;
 			/* Don't stomp existing exception */
@@ -1495,14 +1903,14 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			}
 			break;
 
-		case STORE_DEREF:
+		TARGET(STORE_DEREF)
 			w = POP();
 			x = freevars[oparg];
 			PyCell_Set(x, w);
 			Py_DECREF_PS(w);
-			continue;
+			DISPATCH();
 
-		case BUILD_TUPLE:
+		TARGET(BUILD_TUPLE)
 			x = PyTuple_New(oparg);
 			if (x != NULL) {
 				for (; --oparg >= 0;) {
@@ -1510,11 +1918,11 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 					PyTuple_SET_ITEM(x, oparg, w);
 				}
 				PUSH(x);
-				continue;
+				DISPATCH();
 			}
 			break;
 
-		case BUILD_LIST:
+		TARGET(BUILD_LIST)
 			x =  PyList_New(oparg);
 			if (x != NULL) {
 				for (; --oparg >= 0;) {
@@ -1522,11 +1930,11 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 					PyList_SET_ITEM(x, oparg, w);
 				}
 				PUSH(x);
-				continue;
+				DISPATCH();
 			}
 			break;
 
-		case BUILD_SET:
+		TARGET(BUILD_SET)
 			x = PySet_New(NULL);
 			if (x != NULL) {
 				for (; --oparg >= 0;) {
@@ -1540,17 +1948,17 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 					break;
 				}
 				PUSH(x);
-				continue;
+				DISPATCH();
 			}
 			break;
 
-		case BUILD_MAP:
+		TARGET(BUILD_MAP)
 			x = _PyDict_NewPresized((Py_ssize_t)oparg);
 			PUSH(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case STORE_MAP:
+		TARGET(STORE_MAP)
 			w = TOP();     /* key */
 			u = SECOND();  /* value */
 			v = THIRD();   /* dict */
@@ -1559,19 +1967,64 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			err = PyDict_SetItem(v, w, u);  /* v[w] = u */
 			Py_DECREF_PS(u);
 			Py_DECREF_PS(w);
-			if (err == 0) continue;
+			if (err == 0) DISPATCH();
 			break;
 
-		case LOAD_ATTR:
+		TARGET(LOAD_ATTR)
 			w = GETITEM(names, oparg);
 			v = TOP();
 			x = PyObject_GetAttr(v, w);
 			Py_DECREF_PS(v);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case COMPARE_OP:
+		TARGET(COMPARE_OP_ADAPTIVE)
+			w = TOP();
+			v = SECOND();
+			if (PyLong_CheckExact(v) && PyLong_CheckExact(w))
+				QUICKEN(COMPARE_OP_INT);
+			else if (PyFloat_CheckExact(v) && PyFloat_CheckExact(w))
+				QUICKEN(COMPARE_OP_FLOAT);
+			else
+				QUICKEN(COMPARE_OP);
+			goto _compare_op;
+
+		TARGET(COMPARE_OP_INT)
+			w = TOP();
+			v = SECOND();
+			if (!PyLong_CheckExact(v) || !PyLong_CheckExact(w)) {
+				QUICKEN(COMPARE_OP);
+				goto _compare_op;
+			}
+			STACKADJ(-1);
+			x = int_compare(v, w, oparg);
+			Py_DECREF_PS(v);
+			Py_DECREF_PS(w);
+			SET_TOP(x);
+			if (x == NULL) break;
+			PREDICT(JUMP_IF_FALSE);
+			PREDICT(JUMP_IF_TRUE);
+			DISPATCH();
+
+		TARGET(COMPARE_OP_FLOAT)
+			w = TOP();
+			v = SECOND();
+			if (!PyFloat_CheckExact(v) || !PyFloat_CheckExact(w)) {
+				QUICKEN(COMPARE_OP);
+				goto _compare_op;
+			}
+			STACKADJ(-1);
+			x = float_compare(v, w, oparg);
+			Py_DECREF_PS(v);
+			Py_DECREF_PS(w);
+			SET_TOP(x);
+			PREDICT(JUMP_IF_FALSE);
+			PREDICT(JUMP_IF_TRUE);
+			DISPATCH();
+
+		TARGET(COMPARE_OP)
+		_compare_op:
 			w = POP();
 			v = TOP();
 			x = cmp_outcome(oparg, v, w);
@@ -1581,9 +2034,26 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			if (x == NULL) break;
 			PREDICT(JUMP_IF_FALSE);
 			PREDICT(JUMP_IF_TRUE);
-			continue;
+			DISPATCH();
+
+		TARGET(COMPARE_OP__JUMP_IF_FALSE)
+			w = POP();
+			v = TOP();
+			/* Quickening only rewrites plain COMPARE_OPs, so this
+			   has its own fast path for ints */
+			if (oparg <= PyCmp_GE &&
+			    PyLong_CheckExact(v) && PyLong_CheckExact(w))
+				x = int_compare(v, w, oparg);
+			else
+				x = cmp_outcome(oparg, v, w);
+			Py_DECREF_PS(v);
+			Py_DECREF_PS(w);
+			SET_TOP(x);
+			if (x == NULL) break;
+			oparg = NEXTINSTRARG();
+			goto _jump_if_false;
 
-		case IMPORT_NAME:
+		TARGET(IMPORT_NAME)
 			w = GETITEM(names, oparg);
 			if (PyDict_GetItemStringEx(f->f_builtins,
 					"__import__", &x) < 0)
@@ -1625,10 +2095,10 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			READ_TIMESTAMP(intr1);
 			Py_DECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case IMPORT_STAR:
+		TARGET(IMPORT_STAR)
 			v = POP();
 			PyFrame_FastToLocals(f);
 			if ((x = f->f_locals) == NULL) {
@@ -1641,33 +2111,34 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			READ_TIMESTAMP(intr1);
 			PyFrame_LocalsToFast(f, 0);
 			Py_DECREF_PS(v);
-			if (err == 0) continue;
+			if (err == 0) DISPATCH();
 			break;
 
-		case IMPORT_FROM:
+		TARGET(IMPORT_FROM)
 			w = GETITEM(names, oparg);
 			v = TOP();
 			READ_TIMESTAMP(intr0);
 			x = import_from(v, w);
 			READ_TIMESTAMP(intr1);
 			PUSH(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case JUMP_FORWARD:
+		TARGET(JUMP_FORWARD)
 			JUMPBY(oparg);
-			goto fast_next_opcode;
+			DISPATCH();
 
 		PREDICTED_WITH_ARG(JUMP_IF_FALSE);
-		case JUMP_IF_FALSE:
+		TARGET(JUMP_IF_FALSE)
+		_jump_if_false:
 			w = TOP();
 			if (w == Py_True) {
 				PREDICT(POP_TOP);
-				goto fast_next_opcode;
+				DISPATCH();
 			}
 			if (w == Py_False) {
 				JUMPBY(oparg);
-				goto fast_next_opcode;
+				DISPATCH();
 			}
 			err = PyObject_IsTrue(w);
 			if (err > 0)
@@ -1676,18 +2147,38 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 				JUMPBY(oparg);
 			else
 				break;
-			continue;
+			DISPATCH();
+
+		TARGET(JUMP_IF_FALSE__POP_TOP)
+			/* The POP_TOP is only run when the jump isn't taken;
+			   the one at the jump target runs on its own */
+			w = TOP();
+			if (w == Py_True)
+				err = 1;
+			else if (w == Py_False)
+				err = 0;
+			else if ((err = PyObject_IsTrue(w)) < 0)
+				break;
+			if (err == 0) {
+				JUMPBY(oparg);
+				DISPATCH();
+			}
+			err = 0;
+			next_instr++;
+			STACKADJ(-1);
+			Py_DECREF_PS(w);
+			DISPATCH();
 
 		PREDICTED_WITH_ARG(JUMP_IF_TRUE);
-		case JUMP_IF_TRUE:
+		TARGET(JUMP_IF_TRUE)
 			w = TOP();
 			if (w == Py_False) {
 				PREDICT(POP_TOP);
-				goto fast_next_opcode;
+				DISPATCH();
 			}
 			if (w == Py_True) {
 				JUMPBY(oparg);
-				goto fast_next_opcode;
+				DISPATCH();
 			}
 			err = PyObject_IsTrue(w);
 			if (err > 0) {
@@ -1698,25 +2189,16 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 				;
 			else
 				break;
-			continue;
+			DISPATCH();
 
 		PREDICTED_WITH_ARG(JUMP_ABSOLUTE);
-		case JUMP_ABSOLUTE:
+		TARGET(JUMP_ABSOLUTE)
 			JUMPTO(oparg);
-#if FAST_LOOPS
-			/* Enabling this path speeds-up all while and for-loops by bypassing
-                           the per-loop checks for signals.  By default, this should be turned-off
-                           because it prevents detection of a control-break in tight loops like
-                           "while 1: pass".  Compile with this option turned-on when you need
-                           the speed-up and do not need break checking inside tight loops (ones
-                           that contain only instructions ending with goto fast_next_opcode). 
-                        */
-			goto fast_next_opcode;
-#else
-			continue;
-#endif
+			/* A loop back-edge: see SAFEPOINT() */
+			SAFEPOINT();
+			DISPATCH();
 
-		case GET_ITER:
+		TARGET(GET_ITER)
 			/* before: [obj]; after [getiter(obj)] */
 			v = TOP();
 			x = PyObject_GetIter(v);
@@ -1724,13 +2206,13 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			if (x != NULL) {
 				SET_TOP(x);
 				PREDICT(FOR_ITER);
-				continue;
+				DISPATCH();
 			}
 			STACKADJ(-1);
 			break;
 
 		PREDICTED_WITH_ARG(FOR_ITER);
-		case FOR_ITER:
+		TARGET(FOR_ITER)
 			/* before: [iter]; after: [iter, iter()] *or* [] */
 			v = TOP();
 			extern PyTypeObject PyFakeRange_Type;
@@ -1742,7 +2224,7 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 				PUSH(x);
 				PREDICT(STORE_FAST);
 				PREDICT(UNPACK_SEQUENCE);
-				continue;
+				DISPATCH();
 			}
 			if (PyErr_Occurred()) {
 				if (!PyErr_ExceptionMatches(
@@ -1754,13 +2236,14 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
  			x = v = POP();
 			Py_DECREF_PS(v);
 			JUMPBY(oparg);
-			continue;
+			DISPATCH();
 
-		case BREAK_LOOP:
+		TARGET(BREAK_LOOP)
 			why = WHY_BREAK;
 			goto fast_block_end;
 
-		case CONTINUE_LOOP:
+		TARGET(CONTINUE_LOOP)
+			SAFEPOINT();
 			retval = PyLong_FromLong(oparg);
 			if (!retval) {
 				x = NULL;
@@ -1769,9 +2252,10 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			why = WHY_CONTINUE;
 			goto fast_block_end;
 
-		case SETUP_LOOP:
-		case SETUP_EXCEPT:
-		case SETUP_FINALLY:
+		TARGET_WITH_IMPL(SETUP_LOOP, _setup_finally)
+		TARGET_WITH_IMPL(SETUP_EXCEPT, _setup_finally)
+		TARGET(SETUP_FINALLY)
+		_setup_finally:
 			/* NOTE: If you add any new block-setup opcodes that
 		           are not try/except/finally handlers, you may need
 		           to update the PyGen_NeedsFinalizing() function.
@@ -1779,9 +2263,9 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 
 			PyFrame_BlockSetup(f, opcode, INSTR_OFFSET() + oparg,
 					   STACK_LEVEL());
-			continue;
+			DISPATCH();
 
-		case WITH_CLEANUP:
+		TARGET(WITH_CLEANUP)
 		{
 			/* At the top of the stack are 1-3 values indicating
 			   how/why we entered the finally clause:
@@ -1841,7 +2325,7 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			x = PyObject_CallFunctionObjArgs(exit_func, u, v, w,
 							 NULL);
 			if (x == NULL) {
-				Py_DECREF(exit_func);
+				Py_DECREF_PS(exit_func);
 				break; /* Go to error exit */
 			}
 			if (u != Py_None && PyObject_IsTrue(x)) {
@@ -1856,13 +2340,40 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 				/* The stack was rearranged to remove EXIT
 				   above. Let END_FINALLY do its thing */
 			}
-			Py_DECREF(x);
-			Py_DECREF(exit_func);
+			Py_DECREF_PS(x);
+			Py_DECREF_PS(exit_func);
 			PREDICT(END_FINALLY);
 			break;
 		}
 
-		case CALL_FUNCTION:
+		TARGET(CALL_FUNCTION_ADAPTIVE)
+			if (exact_python_call(stack_pointer[-oparg - 1], oparg))
+				QUICKEN(CALL_FUNCTION_PY);
+			else
+				QUICKEN(CALL_FUNCTION);
+			goto _call_function;
+
+		TARGET(CALL_FUNCTION_PY)
+		{
+			PyObject **pfunc = stack_pointer - oparg - 1;
+			if (!exact_python_call(*pfunc, oparg)) {
+				QUICKEN(CALL_FUNCTION);
+				goto _call_function;
+			}
+			x = call_exact_function(pystate, *pfunc, pfunc + 1,
+						oparg);
+			while (stack_pointer > pfunc) {
+				w = POP();
+				Py_DECREF_PS(w);
+			}
+			PUSH(x);
+			if (x != NULL)
+				DISPATCH();
+			break;
+		}
+
+		TARGET(CALL_FUNCTION)
+		_call_function:
 		{
 			PyObject **sp;
 			PCALL(PCALL_ALL);
@@ -1875,13 +2386,14 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			stack_pointer = sp;
 			PUSH(x);
 			if (x != NULL)
-				continue;
+				DISPATCH();
 			break;
 		}
 
-		case CALL_FUNCTION_VAR:
-		case CALL_FUNCTION_KW:
-		case CALL_FUNCTION_VAR_KW:
+		TARGET_WITH_IMPL(CALL_FUNCTION_VAR, _call_function_var_kw)
+		TARGET_WITH_IMPL(CALL_FUNCTION_KW, _call_function_var_kw)
+		TARGET(CALL_FUNCTION_VAR_KW)
+		_call_function_var_kw:
 		{
 		    int na = oparg & 0xff;
 		    int nk = (oparg>>8) & 0xff;
@@ -1921,12 +2433,13 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 		    }
 		    PUSH(x);
 		    if (x != NULL)
-			    continue;
+			    DISPATCH();
 		    break;
 		}
 
-		case MAKE_CLOSURE:		
-		case MAKE_FUNCTION:
+		TARGET_WITH_IMPL(MAKE_CLOSURE, _make_function)
+		TARGET(MAKE_FUNCTION)
+		_make_function:
 		{
 		    int posdefaults = oparg & 0xff;
 		    int kwdefaults = (oparg>>8) & 0xff;
@@ -2004,7 +2517,7 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			break;
 		}
 
-		case BUILD_SLICE:
+		TARGET(BUILD_SLICE)
 			if (oparg == 3)
 				w = POP();
 			else
@@ -2016,14 +2529,18 @@ PyEval_EvalFrameEx(PyFrameObject *f, int throwflag)
 			Py_DECREF_PS(v);
 			Py_XDECREF_PS(w);
 			SET_TOP(x);
-			if (x != NULL) continue;
+			if (x != NULL) DISPATCH();
 			break;
 
-		case EXTENDED_ARG:
+		TARGET(EXTENDED_ARG)
 			opcode = NEXTOP();
 			oparg = oparg<<16 | NEXTARG();
 			goto dispatch_opcode;
 
+#if USE_COMPUTED_GOTOS
+		_unknown_opcode:
+			opcode = next_instr[-1];
+#endif
 		default:
 			fprintf(stderr,
 				"XXX lineno: %d, opcode: %d\n",
@@ -2983,6 +3500,7 @@ PyEval_SetTrace(Py_tracefunc func, PyObject *arg)
 	/* Flag that tracing or profiling is turned on */
 	pystate->use_tracing = ((func != NULL)
 			       || (pystate->c_profilefunc != NULL));
+	pystate->instr_hooks = func != NULL || pystate->dxp != NULL;
 }
 
 PyObject *
@@ -3266,38 +3784,8 @@ fast_function(PyState *pystate, PyObject *func, PyObject ***pp_stack, int n, int
 
 	PCALL(PCALL_FUNCTION);
 	PCALL(PCALL_FAST_FUNCTION);
-	if (argdefs == NULL && co->co_argcount == n &&
-	    co->co_kwonlyargcount == 0 && nk==0 &&
-	    co->co_flags == (CO_OPTIMIZED | CO_NEWLOCALS | CO_NOFREE)) {
-		PyFrameObject *f;
-		PyObject *retval = NULL;
-		PyObject **fastlocals, **stack;
-		int i;
-
-		PCALL(PCALL_FASTER_FUNCTION);
-		assert(globals != NULL);
-		/* XXX Perhaps we should create a specialized
-		   PyFrame_New() that doesn't take locals, but does
-		   take builtins without sanity checking them.
-		*/
-		assert(pystate != NULL);
-		f = PyFrame_New(pystate, co, globals, NULL);
-		if (f == NULL)
-			return NULL;
-
-		fastlocals = f->f_localsplus;
-		stack = (*pp_stack) - n;
-
-		for (i = 0; i < n; i++) {
-			Py_INCREF_PS(*stack);
-			fastlocals[i] = *stack++;
-		}
-		retval = PyEval_EvalFrameEx(f,0);
-		++pystate->recursion_depth;
-		Py_DECREF_PS(f);
-		--pystate->recursion_depth;
-		return retval;
-	}
+	if (nk == 0 && exact_python_call(func, n))
+		return call_exact_function(pystate, func, (*pp_stack) - n, n);
 	if (argdefs != NULL) {
 		d = &PyTuple_GET_ITEM(argdefs, 0);
 		nd = Py_SIZE(argdefs);
@@ -3308,6 +3796,43 @@ fast_function(PyState *pystate, PyObject *func, PyObject ***pp_stack, int n, int
 				 PyFunction_GET_CLOSURE(func));
 }
 
+/* Calls func with the n positional arguments at stack, for which
+   exact_python_call(func, n) must hold: the arguments go straight into
+   the new frame's locals. */
+static PyObject *
+call_exact_function(PyState *pystate, PyObject *func, PyObject **stack, int n)
+{
+	PyCodeObject *co = (PyCodeObject *)PyFunction_GET_CODE(func);
+	PyObject *globals = PyFunction_GET_GLOBALS(func);
+	PyFrameObject *f;
+	PyObject *retval = NULL;
+	PyObject **fastlocals;
+	int i;
+
+	PCALL(PCALL_FASTER_FUNCTION);
+	assert(globals != NULL);
+	/* XXX Perhaps we should create a specialized
+	   PyFrame_New() that doesn't take locals, but does
+	   take builtins without sanity checking them.
+	*/
+	assert(pystate != NULL);
+	f = PyFrame_New(pystate, co, globals, NULL);
+	if (f == NULL)
+		return NULL;
+
+	fastlocals = f->f_localsplus;
+
+	for (i = 0; i < n; i++) {
+		Py_INCREF_PS(*stack);
+		fastlocals[i] = *stack++;
+	}
+	retval = PyEval_EvalFrameEx(f,0);
+	++pystate->recursion_depth;
+	Py_DECREF_PS(f);
+	--pystate->recursion_depth;
+	return retval;
+}
+
 static PyObject *
 update_keyword_args(PyObject *orig_kwdict, int nk, PyObject ***pp_stack,
                     PyObject *func)
@@ -3763,51 +4288,355 @@ unicode_concatenate(PyObject *v, PyObject *w,
 	else {
 		/* When in-place resizing is not an option. */
 		w = PyUnicode_Concat(v, w);
-                Py_DECREF(v);
+                Py_DECREF_PS(v);
 		return w;
 	}
 }
 
-#ifdef DYNAMIC_EXECUTION_PROFILE
+#define DXP_HASH(co) ((size_t)(co) >> 4)
 
-static PyObject *
-getarray(long a[256])
+static PyDXProfile *
+dxp_new(void)
 {
-	int i;
-	PyObject *l = PyList_New(256);
-	if (l == NULL) return NULL;
-	for (i = 0; i < 256; i++) {
-		PyObject *x = PyLong_FromLong(a[i]);
-		if (x == NULL) {
-			Py_DECREF(l);
-			return NULL;
+	PyDXProfile *p = _PyThreadTables_New(&dxp_tables, sizeof(PyDXProfile));
+	if (p != NULL) {
+		p->epoch = ++dxp_epoch;
+		_PyHashTable_Init(&p->codes, sizeof(PyDXCode));
+	}
+	return p;
+}
+
+/* Drops p's references, so call it with the world running.  They are
+   dropped asynchronously, as an exiting thread frees its profile. */
+static void
+dxp_free(_PyThreadTable *t)
+{
+	PyDXProfile *p = (PyDXProfile *)t;
+	PyDXCode *c;
+	Py_ssize_t i;
+
+	for (i = 0; i < p->codes.size; i++) {
+		c = (PyDXCode *)_PyHashTable_ENTRY(&p->codes, i);
+		if (c->head.used) {
+			Py_DECREF_ASYNC(c->code);
+			free(c->counts);
+		}
+	}
+	_PyHashTable_Clear(&p->codes);
+	free(p);
+}
+
+static int
+dxp_match(_PyHashEntry *entry, void *co)
+{
+	return ((PyDXCode *)entry)->code == co;
+}
+
+/* Returns co's counts in p, adding them if need be, or NULL if out of
+   memory.  Only called by the thread that owns p. */
+static long *
+dxp_code_counts(PyDXProfile *p, PyCodeObject *co)
+{
+	PyDXCode *slot;
+	Py_ssize_t len = PyString_GET_SIZE(co->co_code);
+	long *counts;
+
+	slot = (PyDXCode *)_PyHashTable_Lookup(&p->codes, DXP_HASH(co),
+					       dxp_match, co);
+	if (slot == NULL)
+		return NULL;
+	if (slot->head.used)
+		return slot->counts;
+	counts = calloc(len ? len : 1, sizeof(long));
+	if (counts == NULL)
+		return NULL;
+	Py_INCREF(co);
+	slot->code = co;
+	slot->counts = counts;
+	slot->len = len;
+	_PyHashTable_Use(&p->codes, &slot->head, DXP_HASH(co));
+	return counts;
+}
+
+static void
+dxp_count(PyDXProfile *p, PyCodeObject *co, int offset, int opcode,
+	  long **counts, unsigned long *epoch)
+{
+	p->pairs[p->lastopcode][opcode]++;
+	p->pairs[256][opcode]++;
+	p->lastopcode = opcode;
+	if (*epoch != p->epoch) {
+		*counts = dxp_code_counts(p, co);
+		*epoch = p->epoch;
+	}
+	if (*counts != NULL)
+		(*counts)[offset]++;
+}
+
+static void
+dxp_add_pairs(PyDXProfile *dst, PyDXProfile *src)
+{
+	int i, j;
+
+	for (i = 0; i < 257; i++)
+		for (j = 0; j < 256; j++)
+			dst->pairs[i][j] += src->pairs[i][j];
+}
+
+/* Adds a retiring profile's counts into the retired one.  Code objects
+   the retired one has no counts for yet are moved over, references and
+   all; the retiring one keeps the rest, so that dxp_free() drops its
+   references to them.  If the retired one can't grow, the retiring one
+   keeps those too and their counts are lost. */
+static void
+dxp_absorb(_PyThreadTable *retired, _PyThreadTable *retiring)
+{
+	PyDXProfile *dst = (PyDXProfile *)retired;
+	PyDXProfile *src = (PyDXProfile *)retiring;
+	Py_ssize_t i, j;
+
+	dxp_add_pairs(dst, src);
+	for (i = 0; i < src->codes.size; i++) {
+		PyDXCode *from = (PyDXCode *)_PyHashTable_ENTRY(&src->codes, i);
+		PyDXCode *to;
+
+		if (!from->head.used)
+			continue;
+		to = (PyDXCode *)_PyHashTable_Lookup(&dst->codes,
+			from->head.hash, dxp_match, from->code);
+		if (to == NULL)
+			continue;
+		if (to->head.used) {
+			for (j = 0; j < from->len; j++)
+				to->counts[j] += from->counts[j];
+		} else {
+			*to = *from;
+			_PyHashTable_Use(&dst->codes, &to->head,
+					 from->head.hash);
+			/* Leaves src only fit for dxp_free() */
+			from->head.used = 0;
+		}
+	}
+}
+
+/* Adds copies of src's counts into the profile dst, which takes
+   references to the code objects.  Returns -1 if out of memory. */
+static int
+dxp_copy(_PyThreadTable *t, void *dst)
+{
+	PyDXProfile *src = (PyDXProfile *)t;
+	Py_ssize_t i, j;
+
+	dxp_add_pairs(dst, src);
+	for (i = 0; i < src->codes.size; i++) {
+		PyDXCode *from = (PyDXCode *)_PyHashTable_ENTRY(&src->codes, i);
+		long *counts;
+
+		if (!from->head.used)
+			continue;
+		counts = dxp_code_counts(dst, from->code);
+		if (counts == NULL)
+			return -1;
+		for (j = 0; j < from->len; j++)
+			counts[j] += from->counts[j];
+	}
+	return 0;
+}
+
+/* Adds up the counts of every thread, living or gone.  Returns NULL with
+   an exception set if out of memory. */
+static PyDXProfile *
+dxp_total(void)
+{
+	PyDXProfile *total;
+	int err;
+
+	PyState_StopTheWorld();
+	total = dxp_new();
+	err = total == NULL;
+	if (!err)
+		err = _PyThreadTables_Visit(&dxp_tables, dxp_copy, total);
+	PyState_StartTheWorld();
+
+	if (err) {
+		if (total != NULL)
+			dxp_free(&total->head);
+		PyErr_NoMemory();
+		return NULL;
+	}
+	return total;
+}
+
+/* Turns the counting on, starting every count afresh, or off, keeping
+   the counts for PyEval_GetDXProfile().  Returns -1 with MemoryError set
+   if there's no room for the profiles. */
+int
+PyEval_SetDXProfile(int on)
+{
+	_PyThreadTable *fresh = NULL, *old = NULL, *next;
+	PyDXProfile *p;
+	PyState *t;
+	int err = 0;
+
+	PyState_StopTheWorld();
+	if (on) {
+		/* All or nothing, so allocate before changing anything */
+		p = dxp_new();
+		err = p == NULL;
+		if (!err) {
+			p->head.next = fresh;
+			fresh = &p->head;
+		}
+		for (t = _PyState_Head(); !err && t != NULL; t = t->next) {
+			if (t->deleted)
+				continue;
+			p = dxp_new();
+			err = p == NULL;
+			if (!err) {
+				p->head.next = fresh;
+				fresh = &p->head;
+			}
+		}
+	}
+	if (!err) {
+		/* Take every live profile, and with on the retired one too */
+		old = _PyThreadTables_Take(&dxp_tables, on);
+		if (on) {
+			next = fresh->next;
+			_PyThreadTables_Add(&dxp_tables, fresh);
+			fresh = next;
+			for (t = _PyState_Head(); t != NULL; t = t->next) {
+				if (t->deleted)
+					continue;
+				t->dxp = (PyDXProfile *)fresh;
+				fresh = fresh->next;
+			}
+		}
+		for (t = _PyState_Head(); t != NULL; t = t->next)
+			t->instr_hooks = t->dxp != NULL || t->c_tracefunc != NULL;
+		dxp_enabled = on;
+	}
+	PyState_StartTheWorld();
+
+	_PyThreadTables_FreeList(&dxp_tables, fresh);
+	if (on)
+		_PyThreadTables_FreeList(&dxp_tables, old);
+	else {
+		/* Added into the retired one, and freed */
+		for (; old != NULL; old = next) {
+			next = old->next;
+			_PyThreadTables_Add(&dxp_tables, old);
+		}
+	}
+	if (err) {
+		PyErr_NoMemory();
+		return -1;
+	}
+	return 0;
+}
+
+/* Returns a list of 257 lists of 256 counts: [i][j] is how often opcode j
+   was dispatched right after opcode i, and [256][j] how often opcode j
+   was dispatched at all. */
+PyObject *
+PyEval_GetDXProfile(void)
+{
+	PyDXProfile *total = dxp_total();
+	PyObject *l = NULL, *row, *x;
+	int i, j;
+
+	if (total == NULL)
+		return NULL;
+	l = PyList_New(257);
+	for (i = 0; l != NULL && i < 257; i++) {
+		row = PyList_New(256);
+		if (row == NULL)
+			goto error;
+		PyList_SET_ITEM(l, i, row);
+		for (j = 0; j < 256; j++) {
+			x = PyLong_FromLong(total->pairs[i][j]);
+			if (x == NULL)
+				goto error;
+			PyList_SET_ITEM(row, j, x);
 		}
-		PyList_SetItem(l, i, x);
 	}
-	for (i = 0; i < 256; i++)
-		a[i] = 0;
+	dxp_free(&total->head);
 	return l;
+
+  error:
+	Py_XDECREF(l);
+	dxp_free(&total->head);
+	return NULL;
 }
 
+/* Returns a dict mapping each code object that ran to a list of how often
+   each of its instructions did, indexed by offset. */
 PyObject *
-_Py_GetDXProfile(PyObject *self, PyObject *args)
+PyEval_GetDXProfileCodes(void)
 {
-#ifndef DXPAIRS
-	return getarray(dxp);
-#else
-	int i;
-	PyObject *l = PyList_New(257);
-	if (l == NULL) return NULL;
-	for (i = 0; i < 257; i++) {
-		PyObject *x = getarray(dxpairs[i]);
-		if (x == NULL) {
+	PyDXProfile *total = dxp_total();
+	PyObject *d, *l, *x;
+	Py_ssize_t i, j;
+
+	if (total == NULL)
+		return NULL;
+	d = PyDict_New();
+	for (i = 0; d != NULL && i < total->codes.size; i++) {
+		PyDXCode *c = (PyDXCode *)_PyHashTable_ENTRY(&total->codes, i);
+		if (!c->head.used)
+			continue;
+		l = PyList_New(c->len);
+		if (l == NULL)
+			goto error;
+		for (j = 0; j < c->len; j++) {
+			x = PyLong_FromLong(c->counts[j]);
+			if (x == NULL) {
+				Py_DECREF(l);
+				goto error;
+			}
+			PyList_SET_ITEM(l, j, x);
+		}
+		if (PyDict_SetItem(d, (PyObject *)c->code, l) < 0) {
 			Py_DECREF(l);
-			return NULL;
+			goto error;
 		}
-		PyList_SetItem(l, i, x);
+		Py_DECREF(l);
 	}
-	return l;
-#endif
+	dxp_free(&total->head);
+	return d;
+
+  error:
+	Py_DECREF(d);
+	dxp_free(&total->head);
+	return NULL;
 }
 
-#endif
+void
+_PyEval_DXProfileInit(void)
+{
+	if (_PyThreadTables_Init(&dxp_tables, offsetof(PyState, dxp),
+				 dxp_absorb, dxp_free) < 0)
+		Py_FatalError("Failed to allocate opcode counters");
+}
+
+/* Called by _PyState_Bind() with world_lock held, so that a new thread
+   is either seen by PyEval_SetDXProfile() or sees what it did.  Out of
+   memory, the thread just isn't counted. */
+void
+_PyEval_DXProfileBind(PyState *pystate)
+{
+	if (dxp_enabled) {
+		pystate->dxp = dxp_new();
+		pystate->instr_hooks = pystate->dxp != NULL;
+	}
+}
+
+/* Called by an exiting thread, which still owns its objects */
+void
+_PyEval_DXProfileRetire(PyState *pystate)
+{
+	if (pystate->dxp != NULL) {
+		pystate->instr_hooks = pystate->c_tracefunc != NULL;
+		_PyThreadTables_Retire(&dxp_tables, pystate);
+	}
+}
@@ -87,8 +87,9 @@ extern time_t PyOS_GetLastModificationTime(char *, FILE *);
 		      3100 (merge from 2.6a0, see 62151)
 		      3102 (__file__ points to source file)
        Python 3.0a4: 3110 (WITH_CLEANUP optimization).
+		      3120 (superinstructions)
 */
-#define MAGIC (3110 | ((long)'\r'<<16) | ((long)'\n'<<24))
+#define MAGIC (3120 | ((long)'\r'<<16) | ((long)'\n'<<24))
 
 /* Magic word as global; note that _PyImport_Init() can change the
    value of this global to accommodate for alterations of how the
@@ -255,6 +256,7 @@ _PyImport_Fini(void)
 	extensions = NULL;
 	PyMem_DEL(_PyImport_Filetab);
 	_PyImport_Filetab = NULL;
+	_PyImport_FiniSharedImage();
 }
 
 
@@ -792,7 +794,10 @@ read_compiled_module(char *cpathname, FILE *fp)
 {
 	PyObject *co;
 
-	co = PyMarshal_ReadLastObjectFromFile(fp);
+	if (Py_LazyCodeFlag)
+		co = PyMarshal_ReadLazyObjectFromFile(fp);
+	else
+		co = PyMarshal_ReadLastObjectFromFile(fp);
 	if (co == NULL)
 		return NULL;
 	if (!PyCode_Check(co)) {
@@ -2499,6 +2504,17 @@ import_submodule(PyObject *mod, char *subname, char *fullname)
 			Py_INCREF(Py_None);
 			return Py_None;
 		}
+		/* Only if it's the file the image was made from, so the
+		   image never shadows a module earlier on sys.path */
+		if (mod == Py_None && fdp->type == PY_SOURCE &&
+		    loader == NULL) {
+			m = _PyImport_FindSharedImage(fullname, buf);
+			if (m != NULL) {
+				if (fp)
+					fclose(fp);
+				return m;
+			}
+		}
 		m = load_module(fullname, fp, buf, fdp->type, loader);
 		Py_XDECREF(loader);
 		if (fp)
@@ -0,0 +1,420 @@
+/* Lock contention profiler */
+
+#include "Python.h"
+#include "code.h"
+#include "frameobject.h"
+#include "pylockprof.h"
+#include "pythreadtable.h"
+
+#ifdef HAVE_SYS_TIMERFD_H
+#include <time.h>
+#else
+#include <sys/time.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Each thread counts the locks it waited for and held in a table of its
+ * own (see pythreadtable.h), keyed on the lock and the call site.
+ *
+ * A call site is the address of a code object and a line number.  The
+ * table can't hold a reference to the code, so a copy of its filename
+ * and name is kept alongside, both for reporting and to tell it from a
+ * new code object that happens to get the same address. */
+
+typedef struct {
+    Py_ssize_t count;
+    PY_LONG_LONG total;
+    PY_LONG_LONG max;
+    Py_ssize_t hist[PyLockProf_BUCKETS];
+} PyLockTimes;
+
+typedef struct {
+    _PyHashEntry head;
+    int kind;
+    const char *name;
+    void *lock;
+    PyCodeObject *code;         /* Compared, never dereferenced */
+    Py_ssize_t line;
+    Py_UNICODE *filename;       /* One malloc()ed block with funcname */
+    Py_UNICODE *funcname;
+    Py_ssize_t filename_len;
+    Py_ssize_t funcname_len;
+    Py_ssize_t acquired;
+    PyLockTimes wait;           /* Contended acquisitions only */
+    PyLockTimes hold;
+} PyLockSite;
+
+typedef struct _PyLockProfTable {
+    _PyThreadTable head;
+    _PyHashTable sites;         /* Of PyLockSite */
+} PyLockProfTable;
+
+int _PyLockProf_Enabled;
+
+static _PyThreadTables lockprof_tables;
+
+PY_LONG_LONG
+_PyLockProf_Now(void)
+{
+#ifdef HAVE_SYS_TIMERFD_H
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (PY_LONG_LONG)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (PY_LONG_LONG)tv.tv_sec * 1000000000 + tv.tv_usec * 1000;
+#endif
+}
+
+static void
+table_free(_PyThreadTable *t)
+{
+    PyLockProfTable *table = (PyLockProfTable *)t;
+    PyLockSite *site;
+    Py_ssize_t i;
+
+    for (i = 0; i < table->sites.size; i++) {
+        site = (PyLockSite *)_PyHashTable_ENTRY(&table->sites, i);
+        free(site->filename);
+    }
+    _PyHashTable_Clear(&table->sites);
+    free(table);
+}
+
+static int
+site_match(_PyHashEntry *entry, void *k)
+{
+    PyLockSite *site = (PyLockSite *)entry;
+    PyLockSite *key = k;
+
+    return site->kind == key->kind &&
+        site->name == key->name && site->lock == key->lock &&
+        site->code == key->code && site->line == key->line &&
+        site->filename_len == key->filename_len &&
+        site->funcname_len == key->funcname_len &&
+        (key->filename_len == 0 || memcmp(site->filename, key->filename,
+            key->filename_len * sizeof(Py_UNICODE)) == 0) &&
+        (key->funcname_len == 0 || memcmp(site->funcname, key->funcname,
+            key->funcname_len * sizeof(Py_UNICODE)) == 0);
+}
+
+/* Returns key's site in table, adding it with a copy of key's names if
+ * it's new, or NULL if out of memory.  Until then the key's names may
+ * point anywhere, such as into a live code object. */
+static PyLockSite *
+table_lookup(PyLockProfTable *table, PyLockSite *key)
+{
+    PyLockSite *site;
+    size_t len = key->filename_len + key->funcname_len;
+
+    site = (PyLockSite *)_PyHashTable_Lookup(&table->sites,
+        key->head.hash, site_match, key);
+    if (site == NULL)
+        return NULL;
+    if (!site->head.used) {
+        *site = *key;
+        site->acquired = 0;
+        memset(&site->wait, 0, sizeof(PyLockTimes));
+        memset(&site->hold, 0, sizeof(PyLockTimes));
+        site->filename = malloc((len ? len : 1) * sizeof(Py_UNICODE));
+        if (site->filename == NULL) {
+            memset(site, 0, sizeof(PyLockSite));
+            return NULL;
+        }
+        site->funcname = site->filename + key->filename_len;
+        if (key->filename_len)
+            memcpy(site->filename, key->filename,
+                key->filename_len * sizeof(Py_UNICODE));
+        if (key->funcname_len)
+            memcpy(site->funcname, key->funcname,
+                key->funcname_len * sizeof(Py_UNICODE));
+        _PyHashTable_Use(&table->sites, &site->head, key->head.hash);
+    }
+    return site;
+}
+
+static void
+times_add(PyLockTimes *times, PY_LONG_LONG t)
+{
+    int bucket = 0;
+
+    if (t < 0)
+        t = 0;
+    times->count++;
+    times->total += t;
+    if (t > times->max)
+        times->max = t;
+    while (bucket < PyLockProf_BUCKETS - 1 && (t >> (bucket + 1)) != 0)
+        bucket++;
+    times->hist[bucket]++;
+}
+
+/* Returns a copy of table, or NULL if out of memory */
+static PyLockProfTable *
+table_copy(PyLockProfTable *table)
+{
+    PyLockProfTable *copy = calloc(1, sizeof(PyLockProfTable));
+    PyLockSite *from, *site;
+    Py_ssize_t i;
+
+    if (copy == NULL)
+        return NULL;
+    copy->head.thread = table->head.thread;
+    _PyHashTable_Init(&copy->sites, sizeof(PyLockSite));
+    for (i = 0; i < table->sites.size; i++) {
+        from = (PyLockSite *)_PyHashTable_ENTRY(&table->sites, i);
+        if (!from->head.used)
+            continue;
+        site = table_lookup(copy, from);
+        if (site == NULL) {
+            table_free(&copy->head);
+            return NULL;
+        }
+        site->acquired = from->acquired;
+        site->wait = from->wait;
+        site->hold = from->hold;
+    }
+    return copy;
+}
+
+/* Finds the current thread's site for lock, or NULL if out of memory */
+static PyLockSite *
+lockprof_site(int kind, const char *name, void *lock)
+{
+    PyState *pystate = PyState_Get();
+    PyLockProfTable *table = pystate->lockprof;
+    PyFrameObject *f = pystate->frame;
+    PyLockSite key;
+
+    if (table == NULL) {
+        table = _PyThreadTables_New(&lockprof_tables,
+            sizeof(PyLockProfTable));
+        if (table == NULL)
+            return NULL;
+        _PyHashTable_Init(&table->sites, sizeof(PyLockSite));
+        pystate->lockprof = table;
+    }
+
+    key.kind = kind;
+    key.name = name;
+    key.lock = lock;
+    key.code = NULL;
+    key.line = 0;
+    key.filename = NULL;
+    key.funcname = NULL;
+    key.filename_len = 0;
+    key.funcname_len = 0;
+    if (f != NULL) {
+        PyCodeObject *co = f->f_code;
+        key.code = co;
+        key.line = PyCode_Addr2Line(co, f->f_lasti);
+        if (PyUnicode_Check(co->co_filename)) {
+            key.filename = PyUnicode_AS_UNICODE(co->co_filename);
+            key.filename_len = PyUnicode_GET_SIZE(co->co_filename);
+        }
+        if (PyUnicode_Check(co->co_name)) {
+            key.funcname = PyUnicode_AS_UNICODE(co->co_name);
+            key.funcname_len = PyUnicode_GET_SIZE(co->co_name);
+        }
+    }
+    key.head.hash = ((size_t)lock >> 4) ^
+        ((size_t)key.code >> 4) * 1000003 ^ (size_t)key.line ^
+        (size_t)kind << 24;
+
+    return table_lookup(table, &key);
+}
+
+PY_LONG_LONG
+_PyLockProf_Acquired(int kind, const char *name, void *lock,
+    PY_LONG_LONG waited_since)
+{
+    PY_LONG_LONG now = _PyLockProf_Now();
+    PyLockSite *site = lockprof_site(kind, name, lock);
+
+    /* Out of memory the times are simply lost */
+    if (site != NULL) {
+        site->acquired++;
+        if (waited_since != 0)
+            times_add(&site->wait, now - waited_since);
+    }
+    return now;
+}
+
+void
+_PyLockProf_Released(int kind, const char *name, void *lock,
+    PY_LONG_LONG acquired)
+{
+    PyLockSite *site;
+
+    if (acquired == 0)
+        return;
+    site = lockprof_site(kind, name, lock);
+    if (site != NULL)
+        times_add(&site->hold, _PyLockProf_Now() - acquired);
+}
+
+void
+_PyLockProf_Retire(PyState *pystate)
+{
+    _PyThreadTables_Retire(&lockprof_tables, pystate);
+}
+
+void
+PyLockProf_Start(void)
+{
+    /* The tables hold no references, so they can be freed right here */
+    PyState_StopTheWorld();
+    _PyThreadTables_FreeList(&lockprof_tables,
+        _PyThreadTables_Take(&lockprof_tables, 1));
+    _PyLockProf_Enabled = 1;
+    PyState_StartTheWorld();
+}
+
+void
+PyLockProf_Stop(void)
+{
+    _PyLockProf_Enabled = 0;
+}
+
+static const char *
+kind_name(int kind)
+{
+    switch (kind) {
+    case PyLockProf_CRITICAL:
+        return "critical";
+    case PyLockProf_MONITORSPACE:
+        return "monitorspace";
+    case PyLockProf_REFOWNER:
+        return "refowner";
+    case PyLockProf_WORLD:
+        return "world";
+    case PyLockProf_GC:
+        return "gc";
+    default:
+        return "unknown";
+    }
+}
+
+static PyObject *
+hist_to_tuple(PyLockTimes *times)
+{
+    PyObject *result;
+    int n = PyLockProf_BUCKETS, i;
+
+    /* Trailing empty buckets are left off */
+    while (n > 0 && times->hist[n - 1] == 0)
+        n--;
+    result = PyTuple_New(n);
+    if (result == NULL)
+        return NULL;
+    for (i = 0; i < n; i++) {
+        PyObject *count = PyLong_FromSsize_t(times->hist[i]);
+        if (count == NULL) {
+            Py_DECREF(result);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(result, i, count);
+    }
+    return result;
+}
+
+static PyObject *
+site_to_dict(long thread, PyLockSite *site)
+{
+    PyObject *where;
+
+    if (site->code == NULL) {
+        Py_INCREF(Py_None);
+        where = Py_None;
+    } else
+        where = Py_BuildValue("(u#u#n)",
+            site->filename, (int)site->filename_len,
+            site->funcname, (int)site->funcname_len, site->line);
+    if (where == NULL)
+        return NULL;
+
+    return Py_BuildValue("{s:l,s:s,s:s,s:N,s:N,"
+            "s:n,s:n,s:d,s:d,s:N,s:n,s:d,s:d,s:N}",
+        "thread", thread,
+        "kind", kind_name(site->kind),
+        "name", site->name ? site->name : kind_name(site->kind),
+        "lock", PyLong_FromVoidPtr(site->lock),
+        "site", where,
+        "acquired", site->acquired,
+        "contended", site->wait.count,
+        "wait", site->wait.total / 1e9,
+        "wait_max", site->wait.max / 1e9,
+        "wait_hist", hist_to_tuple(&site->wait),
+        "held", site->hold.count,
+        "hold", site->hold.total / 1e9,
+        "hold_max", site->hold.max / 1e9,
+        "hold_hist", hist_to_tuple(&site->hold));
+}
+
+/* Adds a copy of table to the list at *copies */
+static int
+collect_copy(_PyThreadTable *table, void *copies)
+{
+    PyLockProfTable *copy = table_copy((PyLockProfTable *)table);
+
+    if (copy == NULL)
+        return -1;
+    copy->head.next = *(_PyThreadTable **)copies;
+    *(_PyThreadTable **)copies = &copy->head;
+    return 0;
+}
+
+PyObject *
+PyLockProf_GetStats(void)
+{
+    _PyThreadTable *copies = NULL, *t;
+    PyLockProfTable *table;
+    PyLockSite *site;
+    PyObject *result, *item;
+    Py_ssize_t i;
+    int err;
+
+    /* Copy with the world stopped; build the list once it's running */
+    PyState_StopTheWorld();
+    err = _PyThreadTables_Visit(&lockprof_tables, collect_copy, &copies);
+    PyState_StartTheWorld();
+
+    result = err ? PyErr_NoMemory() : PyList_New(0);
+    for (t = copies; result != NULL && t != NULL; t = t->next) {
+        table = (PyLockProfTable *)t;
+        for (i = 0; i < table->sites.size; i++) {
+            site = (PyLockSite *)_PyHashTable_ENTRY(&table->sites, i);
+            if (!site->head.used)
+                continue;
+            item = site_to_dict(t->thread, site);
+            if (item == NULL || PyList_Append(result, item) < 0) {
+                Py_XDECREF(item);
+                Py_CLEAR(result);
+                break;
+            }
+            Py_DECREF(item);
+        }
+    }
+    _PyThreadTables_FreeList(&lockprof_tables, copies);
+    return result;
+}
+
+void
+_PyLockProf_Init(void)
+{
+    if (_PyThreadTables_Init(&lockprof_tables, offsetof(PyState, lockprof),
+            NULL, table_free) < 0)
+        Py_FatalError("Failed to allocate lock profiler");
+}
+
+
+#ifdef __cplusplus
+}
+#endif
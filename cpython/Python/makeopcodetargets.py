@@ -0,0 +1,57 @@
+#! /usr/bin/env python
+"""Generate C code for the jump table of the threaded code interpreter
+(for compilers supporting computed gotos or "labels-as-values", such as gcc).
+"""
+
+import os
+import re
+import sys
+
+
+def read_opcodes(path):
+    """Returns (name, value) for every opcode #defined in Include/opcode.h.
+
+    The C header rather than Lib/opcode.py is the authority here: the
+    table must only name labels that ceval.c actually defines.
+    """
+    opcodes = []
+    f = open(path)
+    try:
+        for line in f:
+            m = re.match(r"#define\s+([A-Z_]+)\s+(\d+)", line)
+            if m and m.group(1) not in ("HAVE_ARGUMENT", "STOP_CODE"):
+                opcodes.append((m.group(1), int(m.group(2))))
+    finally:
+        f.close()
+    return opcodes
+
+
+def write_contents(f):
+    """Write C code contents to the target file object.
+    """
+    header = os.path.join(os.path.dirname(os.path.dirname(
+        os.path.abspath(__file__))), "Include", "opcode.h")
+    targets = ['_unknown_opcode'] * 256
+    for opname, op in read_opcodes(header):
+        targets[op] = "TARGET_%s" % opname
+    f.write("static void *opcode_targets[256] = {\n")
+    f.write(",\n".join(["\t&&%s" % s for s in targets]))
+    f.write("\n};\n")
+
+
+def main():
+    if len(sys.argv) >= 3:
+        sys.exit("Too many arguments")
+    if len(sys.argv) == 2:
+        target = sys.argv[1]
+    else:
+        target = "Python/opcode_targets.h"
+    f = open(target, "w")
+    try:
+        write_contents(f)
+    finally:
+        f.close()
+
+
+if __name__ == "__main__":
+    main()
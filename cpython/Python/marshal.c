@@ -11,6 +11,11 @@
 #include "code.h"
 #include "marshal.h"
 
+#if defined(HAVE_FSTAT) && !defined(MS_WINDOWS)
+#include <sys/mman.h>
+#define HAVE_LAZY_MMAP
+#endif
+
 /* High water mark to determine when the marshalled object is dangerously deep
  * and risks coring the interpreter.  When the object stack gets this deep,
  * raise an exception instead of continuing.
@@ -55,8 +60,34 @@ typedef struct {
 	char *end;
 	PyObject *strings; /* dict on marshal, list on unmarshal */
 	int version;
+	/* When unmarshalling lazily, the data str..end points into, and
+	   whether code objects are to be left unread */
+	struct _PyMarshalMap *map;
+	int lazy;
+	struct r_cached *cache;
 } WFILE;
 
+/* When unmarshalling from a map, the short strings read last, by hash,
+   so that the same ones (names, file names) are only decoded once */
+#define UNICODE_CACHE_SIZE 256		/* a power of 2 */
+#define UNICODE_CACHE_MAX 64		/* the longest cached, in bytes */
+
+struct r_cached {
+	char *s;
+	Py_ssize_t n;
+	PyObject *v;
+};
+
+/* Marshal data that lazily unmarshalled code objects are read from when
+   they're first needed.  Each holds a reference. */
+typedef struct _PyMarshalMap {
+	AO_t refcnt;
+	char *base;
+	Py_ssize_t size;
+	PyObject *owner;	/* the string base points into, or NULL if base
+				   was mmapped */
+} PyMarshalMap;
+
 #define w_byte(c, p) if (((p)->fp)) putc((c), (p)->fp); \
 		      else if ((p)->ptr != (p)->end) *(p)->ptr++ = (c); \
 			   else w_more(c, p)
@@ -320,6 +351,12 @@ w_object(PyObject *v, WFILE *p)
 	}
 	else if (PyCode_Check(v)) {
 		PyCodeObject *co = (PyCodeObject *)v;
+		if (PyCode_Load(co) < 0) {
+			PyErr_Clear();
+			p->depth--;
+			p->error = 1;
+			return;
+		}
 		w_byte(TYPE_CODE, p);
 		w_long(co->co_argcount, p);
 		w_long(co->co_kwonlyargcount, p);
@@ -477,6 +514,294 @@ r_long64(RFILE *p)
 #endif
 }
 
+/* Skips n bytes, for r_skip() */
+static int
+r_skip_string(RFILE *p, long n)
+{
+	if (n < 0 || n > INT_MAX) {
+		PyErr_SetString(PyExc_ValueError, "bad marshal data");
+		return -1;
+	}
+	if (p->end - p->ptr < n) {
+		PyErr_SetString(PyExc_EOFError,
+				"EOF read where object expected");
+		return -1;
+	}
+	p->ptr += n;
+	return 0;
+}
+
+/* Decodes the n bytes of UTF-8 at p->ptr, or returns the string decoded
+   from the same bytes last time, from p->cache */
+static PyObject *
+r_cached_unicode(RFILE *p, Py_ssize_t n)
+{
+	size_t h = (size_t)n;
+	Py_ssize_t i;
+	struct r_cached *c;
+
+	for (i = 0; i < n; i++)
+		h = (h * 1000003) ^ (unsigned char)p->ptr[i];
+	c = &p->cache[h & (UNICODE_CACHE_SIZE - 1)];
+	if (c->v == NULL || c->n != n || memcmp(c->s, p->ptr, n) != 0) {
+		PyObject *v = PyUnicode_DecodeUTF8(p->ptr, n, NULL);
+		if (v == NULL)
+			return NULL;
+		Py_XDECREF(c->v);
+		c->s = p->ptr;
+		c->n = n;
+		c->v = v;
+	}
+	Py_INCREF(c->v);
+	return c->v;
+}
+
+/* Skips over an object without building it, for lazily unmarshalled code
+   objects.  Only works on strings (p->fp == NULL).  Returns -1 with an
+   exception set if the data is bad, else 0. */
+static int
+r_skip(RFILE *p)
+{
+	long i, n;
+	int type = rs_byte(p);
+	int err = 0;
+
+	p->depth++;
+
+	if (p->depth > MAX_MARSHAL_STACK_DEPTH) {
+		p->depth--;
+		PyErr_SetString(PyExc_ValueError, "recursion limit exceeded");
+		return -1;
+	}
+
+	switch (type) {
+
+	case EOF:
+		PyErr_SetString(PyExc_EOFError,
+				"EOF read where object expected");
+		err = -1;
+		break;
+
+	case TYPE_NULL:
+	case TYPE_NONE:
+	case TYPE_STOPITER:
+	case TYPE_ELLIPSIS:
+	case TYPE_FALSE:
+	case TYPE_TRUE:
+		break;
+
+	case TYPE_INT:
+		err = r_skip_string(p, 4);
+		break;
+
+	case TYPE_INT64:
+	case TYPE_BINARY_FLOAT:
+		err = r_skip_string(p, 8);
+		break;
+
+	case TYPE_BINARY_COMPLEX:
+		err = r_skip_string(p, 16);
+		break;
+
+	case TYPE_LONG:
+		n = r_long(p);
+		if (n < -INT_MAX || n > INT_MAX)
+			n = -1;
+		err = r_skip_string(p, n < 0 ? -2 * n : 2 * n);
+		break;
+
+	case TYPE_FLOAT:
+		err = r_skip_string(p, rs_byte(p));
+		break;
+
+	case TYPE_COMPLEX:
+		err = r_skip_string(p, rs_byte(p));
+		if (err == 0)
+			err = r_skip_string(p, rs_byte(p));
+		break;
+
+	case TYPE_STRING:
+	case TYPE_UNICODE:
+		err = r_skip_string(p, r_long(p));
+		break;
+
+	case TYPE_TUPLE:
+	case TYPE_LIST:
+	case TYPE_SET:
+	case TYPE_FROZENSET:
+		n = r_long(p);
+		if (n < 0 || n > INT_MAX) {
+			PyErr_SetString(PyExc_ValueError, "bad marshal data");
+			err = -1;
+			break;
+		}
+		for (i = 0; i < n && err == 0; i++)
+			err = r_skip(p);
+		break;
+
+	case TYPE_DICT:
+		/* Keys and values until a NULL key */
+		while (err == 0) {
+			if (p->ptr < p->end && *p->ptr == TYPE_NULL) {
+				p->ptr++;
+				break;
+			}
+			err = r_skip(p);
+			if (err == 0)
+				err = r_skip(p);
+		}
+		break;
+
+	case TYPE_CODE:
+		/* argcount, kwonlyargcount, nlocals, stacksize and flags,
+		   code up to name, firstlineno and lnotab */
+		err = r_skip_string(p, 5 * 4);
+		for (i = 0; i < 8 && err == 0; i++)
+			err = r_skip(p);
+		if (err == 0)
+			err = r_skip_string(p, 4);
+		if (err == 0)
+			err = r_skip(p);
+		break;
+
+	default:
+		PyErr_SetString(PyExc_ValueError, "bad marshal data");
+		err = -1;
+		break;
+
+	}
+	p->depth--;
+	return err;
+}
+
+static PyObject *r_object(RFILE *p);
+
+/* Skips a code object's co_consts, but reads the docstring, if there is
+   one, for PyFunction_New() */
+static int
+r_skip_consts(RFILE *p, PyObject **doc)
+{
+	long i, n;
+
+	if (rs_byte(p) != TYPE_TUPLE) {
+		PyErr_SetString(PyExc_ValueError, "bad marshal data");
+		return -1;
+	}
+	n = r_long(p);
+	if (n < 0 || n > INT_MAX) {
+		PyErr_SetString(PyExc_ValueError, "bad marshal data");
+		return -1;
+	}
+	for (i = 0; i < n; i++) {
+		if (i == 0 && p->ptr < p->end && *p->ptr == TYPE_UNICODE) {
+			*doc = r_object(p);
+			if (*doc == NULL)
+				return -1;
+		}
+		else if (r_skip(p) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static void
+map_release(PyMarshalMap *map)
+{
+	if (AO_fetch_and_sub1_full(&map->refcnt) != 1)
+		return;
+	if (map->owner != NULL)
+		Py_DECREF(map->owner);
+#ifdef HAVE_LAZY_MMAP
+	else
+		munmap(map->base, map->size);
+#endif
+	PyMem_FREE(map);
+}
+
+void
+_PyMarshal_FreeLazyCode(PyCodeLazy *lazy)
+{
+	Py_XDECREF(lazy->doc);
+	map_release(lazy->map);
+	PyMem_FREE(lazy);
+}
+
+/* Reads a code object nested in another, leaving co_code, co_consts,
+   co_names and co_lnotab to be read from p->map when it's first needed.
+   Unread, they're skipped over, which is much quicker than building
+   them. */
+static PyObject *
+r_lazy_code(RFILE *p)
+{
+	int argcount;
+	int kwonlyargcount;
+	int nlocals;
+	int stacksize;
+	int flags;
+	PyObject *varnames = NULL;
+	PyObject *freevars = NULL;
+	PyObject *cellvars = NULL;
+	PyObject *filename = NULL;
+	PyObject *name = NULL;
+	int firstlineno;
+	PyCodeLazy *lazy;
+	PyObject *v = NULL;
+
+	lazy = PyMem_NEW(PyCodeLazy, 1);
+	if (lazy == NULL)
+		return PyErr_NoMemory();
+	AO_fetch_and_add1_full(&p->map->refcnt);
+	lazy->map = p->map;
+	lazy->doc = NULL;
+
+	/* XXX ignore long->int overflows for now */
+	argcount = (int)r_long(p);
+	kwonlyargcount = (int)r_long(p);
+	nlocals = (int)r_long(p);
+	stacksize = (int)r_long(p);
+	flags = (int)r_long(p);
+	lazy->code = p->ptr - p->map->base;
+	if (r_skip(p) < 0 || r_skip_consts(p, &lazy->doc) < 0 ||
+	    r_skip(p) < 0)
+		goto code_error;
+	varnames = r_object(p);
+	if (varnames == NULL)
+		goto code_error;
+	freevars = r_object(p);
+	if (freevars == NULL)
+		goto code_error;
+	cellvars = r_object(p);
+	if (cellvars == NULL)
+		goto code_error;
+	filename = r_object(p);
+	if (filename == NULL)
+		goto code_error;
+	name = r_object(p);
+	if (name == NULL)
+		goto code_error;
+	firstlineno = (int)r_long(p);
+	lazy->lnotab = p->ptr - p->map->base;
+	if (r_skip(p) < 0)
+		goto code_error;
+
+	v = (PyObject *) _PyCode_NewLazy(
+			argcount, kwonlyargcount,
+			nlocals, stacksize, flags,
+			varnames, freevars, cellvars, filename, name,
+			firstlineno, lazy);
+	lazy = NULL;
+
+  code_error:
+	if (lazy != NULL)
+		_PyMarshal_FreeLazyCode(lazy);
+	Py_XDECREF(varnames);
+	Py_XDECREF(freevars);
+	Py_XDECREF(cellvars);
+	Py_XDECREF(filename);
+	Py_XDECREF(name);
+	return v;
+}
+
 static PyObject *
 r_object(RFILE *p)
 {
@@ -708,6 +1033,22 @@ r_object(RFILE *p)
 			retval = NULL;
 			break;
 		}
+		if (p->fp == NULL) {
+			/* Decode straight from the data */
+			if (p->end - p->ptr < n) {
+				PyErr_SetString(PyExc_EOFError,
+					"EOF read where object expected");
+				retval = NULL;
+				break;
+			}
+			if (p->cache != NULL && n <= UNICODE_CACHE_MAX)
+				retval = r_cached_unicode(p, n);
+			else
+				retval = PyUnicode_DecodeUTF8(p->ptr, n,
+							      NULL);
+			p->ptr += n;
+			break;
+		}
 		buffer = PyMem_NEW(char, n);
 		if (buffer == NULL) {
 			retval = PyErr_NoMemory();
@@ -839,6 +1180,10 @@ r_object(RFILE *p)
 		break;
 
 	case TYPE_CODE:
+		if (p->lazy) {
+			retval = r_lazy_code(p);
+			break;
+		}
 		{
 			int argcount;
 			int kwonlyargcount;
@@ -864,6 +1209,9 @@ r_object(RFILE *p)
 			nlocals = (int)r_long(p);
 			stacksize = (int)r_long(p);
 			flags = (int)r_long(p);
+			/* The code objects nested in this one are left
+			   unread, if reading lazily */
+			p->lazy = p->map != NULL;
 			code = r_object(p);
 			if (code == NULL)
 				goto code_error;
@@ -901,6 +1249,7 @@ r_object(RFILE *p)
 					firstlineno, lnotab);
 
 		  code_error:
+			p->lazy = 0;
 			Py_XDECREF(code);
 			Py_XDECREF(consts);
 			Py_XDECREF(names);
@@ -910,8 +1259,6 @@ r_object(RFILE *p)
 			Py_XDECREF(filename);
 			Py_XDECREF(name);
 			Py_XDECREF(lnotab);
-
-			return v;
 		}
 		retval = v;
 		break;
@@ -1034,6 +1381,9 @@ PyMarshal_ReadObjectFromFile(FILE *fp)
 	rf.strings = PyList_New(0);
 	rf.depth = 0;
 	rf.ptr = rf.end = NULL;
+	rf.map = NULL;
+	rf.lazy = 0;
+	rf.cache = NULL;
 	result = r_object(&rf);
 	Py_DECREF(rf.strings);
 	return result;
@@ -1049,11 +1399,185 @@ PyMarshal_ReadObjectFromString(char *str, Py_ssize_t len)
 	rf.end = str + len;
 	rf.strings = PyList_New(0);
 	rf.depth = 0;
+	rf.map = NULL;
+	rf.lazy = 0;
+	rf.cache = NULL;
 	result = r_object(&rf);
 	Py_DECREF(rf.strings);
 	return result;
 }
 
+static PyMarshalMap *
+map_new(char *base, Py_ssize_t size, PyObject *owner)
+{
+	PyMarshalMap *map = PyMem_NEW(PyMarshalMap, 1);
+	if (map == NULL) {
+		PyErr_NoMemory();
+		return NULL;
+	}
+	map->refcnt = 1;
+	map->base = base;
+	map->size = size;
+	Py_XINCREF(owner);
+	map->owner = owner;
+	return map;
+}
+
+/* Reads the object at offset in map, leaving the code objects nested in
+   it unread, or all of them if lazy, and drops the reference to map */
+static PyObject *
+read_mapped(PyMarshalMap *map, Py_ssize_t offset, int lazy)
+{
+	RFILE rf;
+	PyObject *result;
+	rf.fp = NULL;
+	rf.ptr = map->base + offset;
+	rf.end = map->base + map->size;
+	rf.strings = PyList_New(0);
+	rf.depth = 0;
+	rf.map = map;
+	rf.lazy = lazy;
+	rf.cache = PyMem_NEW(struct r_cached, UNICODE_CACHE_SIZE);
+	if (rf.cache != NULL)
+		memset(rf.cache, 0, UNICODE_CACHE_SIZE * sizeof(*rf.cache));
+	result = read_object(&rf);
+	Py_XDECREF(rf.strings);
+	if (rf.cache != NULL) {
+		int i;
+		for (i = 0; i < UNICODE_CACHE_SIZE; i++)
+			Py_XDECREF(rf.cache[i].v);
+		PyMem_DEL(rf.cache);
+	}
+	map_release(map);
+	return result;
+}
+
+PyObject *
+PyMarshal_ReadLazyObjectFromFile(FILE *fp)
+{
+#ifdef HAVE_LAZY_MMAP
+	off_t filesize;
+	long pos;
+	void *base;
+	PyMarshalMap *map;
+
+	filesize = getfilesize(fp);
+	pos = ftell(fp);
+	if (filesize <= 0 || filesize > PY_SSIZE_T_MAX ||
+	    pos < 0 || pos > filesize)
+		return PyMarshal_ReadLastObjectFromFile(fp);
+	base = mmap(NULL, (size_t)filesize, PROT_READ, MAP_PRIVATE,
+		    fileno(fp), 0);
+	if (base == MAP_FAILED)
+		return PyMarshal_ReadLastObjectFromFile(fp);
+	map = map_new((char *)base, (Py_ssize_t)filesize, NULL);
+	if (map == NULL) {
+		munmap(base, (size_t)filesize);
+		return NULL;
+	}
+	return read_mapped(map, (Py_ssize_t)pos, 0);
+#else
+	return PyMarshal_ReadLastObjectFromFile(fp);
+#endif
+}
+
+PyMarshalMap *
+_PyMarshal_MapFile(FILE *fp)
+{
+#ifdef HAVE_FSTAT
+	off_t filesize;
+	PyObject *copy;
+	PyMarshalMap *map;
+
+	filesize = getfilesize(fp);
+	if (filesize < 0 || filesize > PY_SSIZE_T_MAX) {
+		PyErr_SetString(PyExc_IOError, "can't get the file's size");
+		return NULL;
+	}
+#ifdef HAVE_LAZY_MMAP
+	if (filesize > 0) {
+		void *base = mmap(NULL, (size_t)filesize, PROT_READ,
+				  MAP_PRIVATE, fileno(fp), 0);
+		if (base != MAP_FAILED) {
+			map = map_new((char *)base, (Py_ssize_t)filesize,
+				      NULL);
+			if (map == NULL)
+				munmap(base, (size_t)filesize);
+			return map;
+		}
+	}
+#endif
+	/* Else a copy of it */
+	copy = PyString_FromStringAndSize(NULL, (Py_ssize_t)filesize);
+	if (copy == NULL)
+		return NULL;
+	if (fseek(fp, 0, SEEK_SET) != 0 ||
+	    fread(PyString_AS_STRING(copy), 1, (size_t)filesize, fp) !=
+	    (size_t)filesize) {
+		Py_DECREF(copy);
+		PyErr_SetString(PyExc_IOError, "can't read the file");
+		return NULL;
+	}
+	map = map_new(PyString_AS_STRING(copy), (Py_ssize_t)filesize, copy);
+	Py_DECREF(copy);
+	return map;
+#else
+	PyErr_SetString(PyExc_IOError, "can't get the file's size");
+	return NULL;
+#endif
+}
+
+PyObject *
+_PyMarshal_ReadMapped(PyMarshalMap *map, Py_ssize_t offset)
+{
+	if (offset < 0 || offset >= map->size) {
+		PyErr_SetString(PyExc_EOFError,
+				"EOF read where object expected");
+		return NULL;
+	}
+	AO_fetch_and_add1_full(&map->refcnt);
+	return read_mapped(map, offset, 1);
+}
+
+void
+_PyMarshal_ReleaseMap(PyMarshalMap *map)
+{
+	map_release(map);
+}
+
+int
+_PyMarshal_ReadLazyCode(PyCodeLazy *lazy, PyObject **code,
+			PyObject **consts, PyObject **names,
+			PyObject **lnotab)
+{
+	PyMarshalMap *map = lazy->map;
+	RFILE rf;
+
+	*code = *consts = *names = *lnotab = NULL;
+	rf.fp = NULL;
+	rf.ptr = map->base + lazy->code;
+	rf.end = map->base + map->size;
+	rf.strings = NULL;
+	rf.depth = 0;
+	rf.map = map;
+	rf.lazy = 1;
+	rf.cache = NULL;
+	if ((*code = read_object(&rf)) == NULL ||
+	    (*consts = read_object(&rf)) == NULL ||
+	    (*names = read_object(&rf)) == NULL)
+		goto error;
+	rf.ptr = map->base + lazy->lnotab;
+	if ((*lnotab = read_object(&rf)) == NULL)
+		goto error;
+	return 0;
+
+  error:
+	Py_CLEAR(*code);
+	Py_CLEAR(*consts);
+	Py_CLEAR(*names);
+	return -1;
+}
+
 PyObject *
 PyMarshal_WriteObjectToString(PyObject *x, int version)
 {
@@ -1147,6 +1671,9 @@ marshal_load(PyObject *self, PyObject *f)
 	}
 	rf.strings = PyList_New(0);
 	rf.depth = 0;
+	rf.map = NULL;
+	rf.lazy = 0;
+	rf.cache = NULL;
 	result = read_object(&rf);
 	Py_DECREF(rf.strings);
 	Py_DECREF(data);
@@ -1170,13 +1697,29 @@ marshal_loads(PyObject *self, PyObject *args)
 	char *s;
 	Py_ssize_t n;
 	PyObject* result;
-	if (!PyArg_ParseTuple(args, "s#:loads", &s, &n))
+	int lazy = 0;
+	if (!PyArg_ParseTuple(args, "s#|i:loads", &s, &n, &lazy))
 		return NULL;
+	if (lazy) {
+		/* Lazily read code objects outlive s, so read from a copy */
+		PyMarshalMap *map;
+		PyObject *copy = PyString_FromStringAndSize(s, n);
+		if (copy == NULL)
+			return NULL;
+		map = map_new(PyString_AS_STRING(copy), n, copy);
+		Py_DECREF(copy);
+		if (map == NULL)
+			return NULL;
+		return read_mapped(map, 0, 0);
+	}
 	rf.fp = NULL;
 	rf.ptr = s;
 	rf.end = s + n;
 	rf.strings = PyList_New(0);
 	rf.depth = 0;
+	rf.map = NULL;
+	rf.lazy = 0;
+	rf.cache = NULL;
 	result = read_object(&rf);
 	Py_DECREF(rf.strings);
 	return result;
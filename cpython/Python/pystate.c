@@ -4,6 +4,9 @@
 #include "Python.h"
 #include "monitorobject.h"
 #include "cancelobject.h"
+#include "pysampler.h"
+#include "pylockprof.h"
+#include "pyallocprof.h"
 
 /* --------------------------------------------------------------------------
 CAUTION
@@ -31,6 +34,8 @@ static PyThread_type_lock *world_lock;
 static PyThread_type_lock *world_wakeup_lock;
 static PyLinkedList world_wakeup_list;
 static AO_t world_sleep;
+/* When the lock profiler saw the world stopped; under world_lock */
+static PY_LONG_LONG world_prof_acquired;
 
 /* This hook exists so psyco can provide it's own frame objects */
 static struct _frame *threadstate_getframe(PyState *self);
@@ -106,6 +111,14 @@ _PyState_New(void)
     pystate->c_profileobj = NULL;
     pystate->c_traceobj = NULL;
 
+    pystate->instr_hooks = 0;
+    pystate->dxp = NULL;
+    pystate->sample_pending = 0;
+    pystate->samples = NULL;
+    pystate->lockprof = NULL;
+    pystate->alloc_countdown = 0;
+    pystate->allocprof = NULL;
+
     pystate->import_depth = 0;
     PyLinkedList_InitBase(&pystate->monitorspaces,
         offsetof(PyMonitorSpaceFrame, links));
@@ -127,6 +140,8 @@ _PyState_New(void)
 
     PyLinkedList_InitBase(&pystate->cancel_stack,
         offsetof(PyCancelObject, stack_links));
+    pystate->cancel_wakeup[0] = -1;
+    pystate->cancel_wakeup[1] = -1;
 
     pystate->critical_section = NULL;
 
@@ -141,9 +156,8 @@ _PyState_New(void)
     pystate->waitfor.abortfunc = NULL;
     PyLinkedList_InitNode(&pystate->waitfor.inspection_links);
 
-    PyLinkedList_InitNode(&pystate->condition_links);
-
-    pystate->cancel_crit = PyCritical_Allocate(PyCRITICAL_CANCEL);
+    pystate->cancel_crit = PyCritical_AllocateNamed(PyCRITICAL_CANCEL,
+        "cancel");
     //pystate->lockwait_cond = PyThread_cond_allocate();
     pystate->monitorspace_timeout = PyThread_timeout_allocate();
     pystate->waitfor.lock = PyThread_lock_allocate();
@@ -205,7 +219,6 @@ _PyState_Delete(PyState *pystate)
     assert(PyLinkedList_Detached(&pystate->monitorspace_waitinglinks));
     assert(pystate->waitfor.checking_deadlock == 0);
     assert(PyLinkedList_Detached(&pystate->waitfor.inspection_links));
-    assert(PyLinkedList_Detached(&pystate->condition_links));
     assert(!pystate->deleted);
 
     /* pystate was never bound, or the tracing GC has cleaned it up */
@@ -213,6 +226,10 @@ _PyState_Delete(PyState *pystate)
      * removed from the linked list */
     //fprintf(stderr, "Deleting pystate %p\n", pystate);
     PyCritical_Free(pystate->cancel_crit);
+    if (pystate->cancel_wakeup[0] >= 0)
+        close(pystate->cancel_wakeup[0]);
+    if (pystate->cancel_wakeup[1] != pystate->cancel_wakeup[0])
+        close(pystate->cancel_wakeup[1]);
     //PyThread_cond_free(pystate->lockwait_cond);
     PyThread_timeout_free(pystate->monitorspace_timeout);
     PyThread_lock_free(pystate->waitfor.lock);
@@ -246,6 +263,9 @@ _PyState_Bind(PyState *pystate)
     PyThread_lock_acquire(world_lock);
     pystate->next = pystate_head;
     pystate_head = pystate;
+    /* Under world_lock so that sys.setdxp() sees us either before or
+     * after we're on the list, never in between */
+    _PyEval_DXProfileBind(pystate);
     PyThread_lock_release(world_lock);
 }
 
@@ -260,8 +280,13 @@ _PyState_Terminate(PyState *pystate)
     assert(pystate->used);
     assert(!pystate->deleted);
 
+    _PyEval_DXProfileRetire(pystate);
+    _PySampler_Retire(pystate);
     _PyGC_Object_Cache_Flush();
     _PyGC_AsyncRefcount_Flush(pystate);
+    /* Last, as flushing may take PyGC_lock or promote objects */
+    _PyLockProf_Retire(pystate);
+    _PyAllocProf_Retire(pystate);
 
     /* Undo _Bind */
     AO_fetch_and_sub1_full(&thread_count);
@@ -296,6 +321,7 @@ _PyState_Clear(PyState *pystate)
 
     pystate->c_profilefunc = NULL;
     pystate->c_tracefunc = NULL;
+    pystate->instr_hooks = pystate->dxp != NULL;
     Py_CLEAR(pystate->c_profileobj);
     Py_CLEAR(pystate->c_traceobj);
 }
@@ -314,6 +340,18 @@ _PyState_Get(void)
     return pystate;
 }
 
+PyState *
+_PyState_Peek(void)
+{
+#ifdef HAVE_THREAD_LOCAL_VARIABLE
+    return _py_local_pystate;
+#else
+    if (autoTLSkey == NULL)
+        return NULL;
+    return PyThread_get_key_value(autoTLSkey);
+#endif
+}
+
 
 /* An extension mechanism to store arbitrary additional per-thread state.
    PyState_GetDict() returns a dictionary that can be used to hold such
@@ -448,6 +486,24 @@ _PyState_ExitPreallocated(PyState_EnterFrame *frame)
     }
 }
 
+void
+_PyState_Recycle(PyState_EnterFrame *frame)
+{
+    PyState *pystate = PyState_Get();
+
+    if (frame != pystate->enterframe || frame->prevframe != NULL)
+        Py_FatalError("_PyState_Recycle called with wrong frame");
+    if (pystate->suspended)
+        Py_FatalError("_PyState_Recycle called while suspended");
+
+    assert(PyLinkedList_Empty(&pystate->cancel_stack));
+    assert(PyLinkedList_Last(&pystate->monitorspaces) ==
+        &frame->monitorspaceframe);
+
+    Py_CLEAR(frame->monitorspaceframe.monitorspace);
+    _PyState_Clear(pystate);
+}
+
 
 void
 PyState_EnterImport(void)
@@ -473,6 +529,7 @@ PyState_StopTheWorld(void)
 {
     PyState *t;
     PyState *pystate = PyState_Get();
+    PY_LONG_LONG since = 0;
 
     //fprintf(stderr, "%p Stopping the world\n", pystate);
     assert(!pystate->suspended);
@@ -480,6 +537,8 @@ PyState_StopTheWorld(void)
         Py_FatalError("PyState_StopTheWorld cannot be called while in "
             "a critical section");
 
+    if (_PyLockProf_Enabled)
+        since = _PyLockProf_Now();
     PyState_Suspend();
     PyThread_lock_acquire(world_lock);
     AO_store_full(&world_sleep, 1);
@@ -492,6 +551,32 @@ PyState_StopTheWorld(void)
     }
 
     PyState_Resume();
+
+    world_prof_acquired = 0;
+    if (_PyLockProf_Enabled)
+        world_prof_acquired = _PyLockProf_Acquired(PyLockProf_WORLD,
+            "world", NULL, since);
+}
+
+PyState *
+_PyState_Head(void)
+{
+    return pystate_head;
+}
+
+void
+_PyState_RequestSamples(void)
+{
+    PyState *t;
+
+    /* world_lock keeps the tracing GC from freeing deleted PyStates
+     * while we walk past them */
+    PyThread_lock_acquire(world_lock);
+    for (t = pystate_head; t != NULL; t = t->next) {
+        if (!t->deleted)
+            AO_fetch_and_add1_full(&t->sample_pending);
+    }
+    PyThread_lock_release(world_lock);
 }
 
 void
@@ -501,6 +586,9 @@ PyState_StartTheWorld(void)
     PyState *pystate = PyState_Get();
 
     //fprintf(stderr, "%p Starting the world\n", pystate);
+    if (_PyLockProf_Enabled)
+        _PyLockProf_Released(PyLockProf_WORLD, "world", NULL,
+            world_prof_acquired);
     AO_store_full(&world_sleep, 0);
 
     t = pystate_head;
@@ -577,6 +665,12 @@ PyState_MaybeResume(void)
     pystate->enterframe->locked = 1;
     //fprintf(stderr, "%p Resumed\n", pystate);
 
+    /* Our stack hasn't changed since we blocked, so samples asked for
+     * meanwhile are best taken now rather than at our next tick */
+    if (pystate->critical_section == NULL &&
+            AO_load_acquire(&pystate->sample_pending))
+        _PySampler_Take(pystate);
+
     errno = err;
 }
 
@@ -615,6 +709,9 @@ PyState_Tick(void)
 #endif
     }
 
+    if (AO_load_acquire(&pystate->sample_pending))
+        _PySampler_Take(pystate);
+
 #if 0
     if (pystate->small_ticks > 0) {
         pystate->small_ticks--;
@@ -635,6 +732,12 @@ PyState_Tick(void)
 
 PyCritical *
 PyCritical_Allocate(Py_ssize_t depth)
+{
+    return PyCritical_AllocateNamed(depth, NULL);
+}
+
+PyCritical *
+PyCritical_AllocateNamed(Py_ssize_t depth, const char *name)
 {
     PyCritical *crit = malloc(sizeof(PyCritical));
     if (crit == NULL)
@@ -648,6 +751,8 @@ PyCritical_Allocate(Py_ssize_t depth)
 
     crit->depth = depth;
     crit->prev = NULL;
+    crit->name = name;
+    crit->prof_acquired = 0;
 
     return crit;
 }
@@ -663,6 +768,7 @@ void
 PyCritical_Enter(PyCritical *crit)
 {
     PyState *pystate = PyState_Get();
+    PY_LONG_LONG since = 0;
 
     assert(!pystate->suspended);
     assert(crit->lock != NULL);
@@ -673,6 +779,8 @@ PyCritical_Enter(PyCritical *crit)
             "critical section");
 
     if (!PyThread_lock_tryacquire(crit->lock)) {
+        if (_PyLockProf_Enabled)
+            since = _PyLockProf_Now();
         PyState_MaybeSuspend();
         PyThread_lock_acquire(crit->lock);
         PyState_MaybeResume();
@@ -681,6 +789,11 @@ PyCritical_Enter(PyCritical *crit)
     assert(crit->prev == NULL);
     crit->prev = pystate->critical_section;
     pystate->critical_section = crit;
+
+    crit->prof_acquired = 0;
+    if (_PyLockProf_Enabled)
+        crit->prof_acquired = _PyLockProf_Acquired(PyLockProf_CRITICAL,
+            crit->name, crit, since);
 }
 
 void
@@ -694,6 +807,10 @@ PyCritical_Exit(PyCritical *crit)
     if (pystate->critical_section != crit)
         Py_FatalError("PyCritical_Exit called with wrong critical section");
 
+    if (_PyLockProf_Enabled)
+        _PyLockProf_Released(PyLockProf_CRITICAL, crit->name, crit,
+            crit->prof_acquired);
+
     pystate->critical_section = crit->prev;
     crit->prev = NULL;
 
@@ -710,6 +827,8 @@ PyCritical_EnterDummy(PyCritical *crit, Py_ssize_t depth)
     crit->lock = NULL;
     crit->depth = depth;
     crit->prev = NULL;
+    crit->name = NULL;
+    crit->prof_acquired = 0;
 
     if (pystate->critical_section != NULL &&
                 pystate->critical_section->depth <= crit->depth)
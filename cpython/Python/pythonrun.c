@@ -55,6 +55,7 @@ extern grammar _PyParser_Grammar; /* From graminit.c */
 static void initfinalize(void);
 static void finifinalize(void);
 static void initmain(void);
+static void initsharedimage(void);
 static void initsite(void);
 static int initstdio(void);
 static void flush_io(void);
@@ -75,6 +76,16 @@ extern int _PyLong_Init(void);
 extern void PyLong_Fini(void);
 extern void _PyAbstract_Init(void);
 extern void _PyMonitor_Init(void);
+extern void _PyBranch_Init(void);
+extern void _PyReactor_Init(void);
+extern void _PyTimer_Init(void);
+extern void _PySampler_Init(void);
+extern void _PyLockProf_Init(void);
+extern void _PyAllocProf_Init(void);
+extern void _PyBranch_Fini(void);
+extern void _PyReactor_Fini(void);
+extern void _PyQueue_Init(void);
+extern void _PyBranch_InitExceptions(void);
 
 extern void _PyState_InitThreads(void);
 extern void _PyState_ClearThreads(void);
@@ -90,6 +101,7 @@ int Py_InspectFlag; /* Needed to determine whether to exit at SystemError */
 int Py_NoSiteFlag; /* Suppress 'import site' */
 int Py_BytesWarningFlag; /* Warn on str(bytes) and str(buffer) */
 int Py_DontWriteBytecodeFlag; /* Suppress writing bytecode files (*.py[co]) */
+int Py_LazyCodeFlag; /* Unmarshal code in .py[co] files as it's needed */
 int Py_UseClassExceptionsFlag = 1; /* Needed by bltinmodule.c: deprecated */
 int Py_FrozenFlag; /* Needed by getpath.c */
 int Py_IgnoreEnvironmentFlag; /* e.g. PYTHONPATH, PYTHONHOME */
@@ -201,6 +213,8 @@ Py_InitializeEx(int handle_sigint)
 		Py_OptimizeFlag = add_flag(Py_OptimizeFlag, p);
 	if ((p = Py_GETENV("PYTHONDONTWRITEBYTECODE")) && *p != '\0')
 		Py_DontWriteBytecodeFlag = add_flag(Py_DontWriteBytecodeFlag, p);
+	if ((p = Py_GETENV("PYTHONLAZYCODE")) && *p != '\0')
+		Py_LazyCodeFlag = add_flag(Py_LazyCodeFlag, p);
 
 	_PyGC_Init();
 
@@ -234,6 +248,13 @@ Py_InitializeEx(int handle_sigint)
 	_PyAbstract_Init();
 
 	_PyMonitor_Init();
+	_PyBranch_Init();
+	_PyReactor_Init();
+	_PyTimer_Init();
+	_PySampler_Init();
+	_PyLockProf_Init();
+	_PyAllocProf_Init();
+	_PyEval_DXProfileInit();
 
 	_Py_ReadyTypes();
 
@@ -246,6 +267,8 @@ Py_InitializeEx(int handle_sigint)
 
 	/* initialize builtin exceptions */
 	_PyExc_Init();
+	_PyQueue_Init();
+	_PyBranch_InitExceptions();
 
 	if (_PySys_Init())
 		Py_FatalError("Py_Initialize: can't initialize sys");
@@ -266,6 +289,10 @@ Py_InitializeEx(int handle_sigint)
 
 	_PyImportHooks_Init();
 
+	/* Before anything is imported, as its modules are built when they
+	   are */
+	initsharedimage();
+
 	_PySignal_Init();
 
 	initfinalize();
@@ -418,6 +445,12 @@ Py_Finalize(void)
 	/* Disable signal handling */
 	_PySignal_Fini();
 
+	/* Every branch is done by now; reap the idle worker threads */
+	_PyBranch_Fini();
+
+	/* And nobody is selecting on an fd; stop the reactor thread */
+	_PyReactor_Fini();
+
 	/* drop module references we saved */
 	Py_XDECREF(warnings_module);
 	warnings_module = NULL;
@@ -696,6 +729,15 @@ initmain(void)
 	}
 }
 
+/* Load the shared modules image, if PYTHONSHAREDIMAGE names one */
+
+static void
+initsharedimage(void)
+{
+	char *p = Py_GETENV("PYTHONSHAREDIMAGE");
+	_PyImport_LoadSharedImage(p != NULL && *p != '\0' ? p : NULL);
+}
+
 /* Import the site module (not into __main__ though) */
 
 static void
@@ -1528,7 +1570,10 @@ run_pyc_file(FILE *fp, const char *filename, PyObject *globals,
 		return NULL;
 	}
 	(void) PyMarshal_ReadLongFromFile(fp);
-	v = PyMarshal_ReadLastObjectFromFile(fp);
+	if (Py_LazyCodeFlag)
+		v = PyMarshal_ReadLazyObjectFromFile(fp);
+	else
+		v = PyMarshal_ReadLastObjectFromFile(fp);
 	fclose(fp);
 	if (v == NULL || !PyCode_Check(v)) {
 		Py_XDECREF(v);
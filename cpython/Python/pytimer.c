@@ -0,0 +1,369 @@
+/* Timer wheel */
+
+#include "Python.h"
+#include "pytimer.h"
+
+#ifdef HAVE_SYS_TIMERFD_H
+#include <sys/timerfd.h>
+#include <time.h>
+#else
+#include <sys/time.h>
+#endif
+#ifdef HAVE_PTHREAD_SIGMASK
+#include <signal.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Timers are kept in LEVELS rings of LEVEL_SIZE slots.  Level 0 has a
+ * slot per tick; each slot of level n covers a whole turn of level n-1,
+ * and is cascaded down into it when that turn begins.  Timers too far
+ * off for even the top level are parked in its furthest slot and get
+ * cascaded back into it until they're close enough.
+ *
+ * The timer thread only wakes at the first tick with a timer due or a
+ * slot to cascade, and runs every tick up to the current one; ticks
+ * with nothing to do are skipped a level at a time. */
+
+typedef unsigned PY_LONG_LONG tick_t;
+
+#define TICK_NS 1000000                 /* 1ms */
+#define TICKS_PER_SEC (1000000000 / TICK_NS)
+#define LEVEL_BITS 6
+#define LEVEL_SIZE (1 << LEVEL_BITS)
+#define LEVEL_MASK (LEVEL_SIZE - 1)
+#define LEVELS 4
+#define WHEEL_SPAN ((tick_t)1 << (LEVEL_BITS * LEVELS))
+/* Keeps ticks from overflowing; ~146 years */
+#define MAX_DELAY 4.6e9
+
+static PyThread_type_lock *wheel_lock;
+static PyLinkedList wheel[LEVELS][LEVEL_SIZE];
+static Py_ssize_t wheel_count[LEVELS];
+static tick_t wheel_now;        /* Every tick before this has been run */
+static tick_t wheel_armed;      /* When the timer thread will wake, or 0 */
+static int wheel_started;
+#ifdef HAVE_SYS_TIMERFD_H
+static int wheel_timerfd = -1;
+#else
+static PyThread_type_flag *wheel_rearm;
+#endif
+
+static tick_t
+wheel_gettick(void)
+{
+#ifdef HAVE_SYS_TIMERFD_H
+    /* Must be the clock the timerfd uses */
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (tick_t)ts.tv_sec * TICKS_PER_SEC + ts.tv_nsec / TICK_NS;
+#else
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (tick_t)tv.tv_sec * TICKS_PER_SEC +
+        tv.tv_usec / (TICK_NS / 1000);
+#endif
+}
+
+static int
+wheel_empty(void)
+{
+    int level;
+
+    for (level = 0; level < LEVELS; level++)
+        if (wheel_count[level])
+            return 0;
+    return 1;
+}
+
+/* All the remaining functions are called with wheel_lock held */
+
+static void
+wheel_insert(PyTimer *t)
+{
+    tick_t expires = t->expires, delta;
+    int level;
+
+    if (expires < wheel_now)
+        expires = wheel_now;
+    delta = expires - wheel_now;
+    if (delta >= WHEEL_SPAN) {
+        expires = wheel_now + WHEEL_SPAN - 1;
+        delta = WHEEL_SPAN - 1;
+    }
+
+    for (level = 0; level < LEVELS - 1; level++)
+        if (delta < ((tick_t)1 << (LEVEL_BITS * (level + 1))))
+            break;
+
+    t->level = level;
+    PyLinkedList_Append(
+        &wheel[level][(expires >> (LEVEL_BITS * level)) & LEVEL_MASK], t);
+    wheel_count[level]++;
+}
+
+static void
+wheel_remove(PyTimer *t)
+{
+    PyLinkedList_Remove(&t->links);
+    wheel_count[t->level]--;
+}
+
+static void
+wheel_cascade(int level, int index)
+{
+    PyLinkedList pending;
+    PyTimer *t;
+
+    PyLinkedList_InitBase(&pending, offsetof(PyTimer, links));
+    while ((t = PyLinkedList_First(&wheel[level][index])) != NULL) {
+        wheel_remove(t);
+        PyLinkedList_Append(&pending, t);
+    }
+    while ((t = PyLinkedList_First(&pending)) != NULL) {
+        PyLinkedList_Remove(&t->links);
+        wheel_insert(t);
+    }
+}
+
+/* Runs every tick up to and including until */
+static void
+wheel_run(tick_t until)
+{
+    PyTimer *t;
+    int level;
+
+    while (wheel_now <= until) {
+        int index = wheel_now & LEVEL_MASK;
+
+        /* At the start of each turn of a level, bring the next slot of
+         * the level above down into it */
+        for (level = 1; index == 0 && level < LEVELS; level++) {
+            index = (wheel_now >> (LEVEL_BITS * level)) & LEVEL_MASK;
+            wheel_cascade(level, index);
+        }
+
+        while ((t = PyLinkedList_First(
+                &wheel[0][wheel_now & LEVEL_MASK])) != NULL) {
+            wheel_remove(t);
+            t->expired = 1;
+            PyThread_flag_set(t->flag);
+        }
+        wheel_now++;
+
+        /* Skip to the next cascade of the lowest level in use */
+        for (level = 0; level < LEVELS && !wheel_count[level]; level++)
+            ;
+        if (level == LEVELS)
+            wheel_now = until + 1;
+        else if (level > 0) {
+            tick_t mask = ((tick_t)1 << (LEVEL_BITS * level)) - 1;
+            tick_t next = (wheel_now + mask) & ~mask;
+
+            wheel_now = next < until + 1 ? next : until + 1;
+        }
+    }
+}
+
+/* The first tick with a timer due or a slot to cascade, or 0 if none */
+static tick_t
+wheel_next(void)
+{
+    tick_t next = 0;
+    int level, i;
+
+    for (level = 0; level < LEVELS; level++) {
+        int shift = LEVEL_BITS * level;
+        tick_t base = wheel_now >> shift;
+
+        if (!wheel_count[level])
+            continue;
+        /* The current slot of a higher level was cascaded at the start
+         * of its turn, so anything in it is a whole turn away, unless
+         * that start is still to be run */
+        i = (wheel_now & (((tick_t)1 << shift) - 1)) ? 1 : 0;
+        for (; i <= LEVEL_SIZE; i++) {
+            if (!PyLinkedList_Empty(&wheel[level][(base + i) & LEVEL_MASK])) {
+                tick_t tick = (base + i) << shift;
+
+                if (next == 0 || tick < next)
+                    next = tick;
+                break;
+            }
+        }
+    }
+    return next;
+}
+
+static void
+wheel_arm(tick_t tick)
+{
+#ifdef HAVE_SYS_TIMERFD_H
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = tick / TICKS_PER_SEC;
+    its.it_value.tv_nsec = (tick % TICKS_PER_SEC) * TICK_NS;
+    /* A zero it_value disarms it */
+    if (timerfd_settime(wheel_timerfd, TFD_TIMER_ABSTIME, &its, NULL) < 0)
+        Py_FatalError("timerfd_settime() failed in timer wheel");
+#endif
+    wheel_armed = tick;
+}
+
+static void
+wheel_main(void *unused)
+{
+#ifdef HAVE_PTHREAD_SIGMASK
+    sigset_t mask;
+
+    /* Signals are for the main thread to handle */
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+#endif
+
+    while (1) {
+#ifdef HAVE_SYS_TIMERFD_H
+        uint64_t expirations;
+
+        if (read(wheel_timerfd, &expirations, sizeof(expirations)) < 0 &&
+                errno != EINTR && errno != EAGAIN)
+            Py_FatalError("Reading timerfd failed in timer wheel");
+#else
+        tick_t armed, now;
+
+        PyThread_lock_acquire(wheel_lock);
+        armed = wheel_armed;
+        PyThread_lock_release(wheel_lock);
+
+        now = wheel_gettick();
+        if (armed == 0)
+            PyThread_flag_wait(wheel_rearm);
+        else if (armed > now)
+            PyThread_flag_timedwait(wheel_rearm,
+                (double)(armed - now) / TICKS_PER_SEC);
+        PyThread_flag_clear(wheel_rearm);
+#endif
+
+        PyThread_lock_acquire(wheel_lock);
+        wheel_run(wheel_gettick());
+        wheel_arm(wheel_next());
+        PyThread_lock_release(wheel_lock);
+    }
+}
+
+static int
+wheel_start(void)
+{
+    if (wheel_started)
+        return 0;
+
+#ifdef HAVE_SYS_TIMERFD_H
+    wheel_timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (wheel_timerfd < 0) {
+        PyErr_SetFromErrno(PyExc_OSError);
+        return -1;
+    }
+#endif
+
+    if (PyThread_start_new_thread(NULL, wheel_main, NULL) < 0) {
+#ifdef HAVE_SYS_TIMERFD_H
+        close(wheel_timerfd);
+        wheel_timerfd = -1;
+#endif
+        PyErr_SetString(PyExc_RuntimeError, "can't start timer thread");
+        return -1;
+    }
+    wheel_started = 1;
+    return 0;
+}
+
+
+int
+PyTimer_Start(PyTimer *t, PyThread_type_flag *flag, double delay)
+{
+    tick_t now;
+
+    PyLinkedList_InitNode(&t->links);
+    t->flag = flag;
+    t->expired = 0;
+
+    PyThread_lock_acquire(wheel_lock);
+    if (wheel_start() < 0) {
+        PyThread_lock_release(wheel_lock);
+        return -1;
+    }
+
+    if (delay <= 0.0) {
+        t->expired = 1;
+        PyThread_flag_set(flag);
+        PyThread_lock_release(wheel_lock);
+        return 0;
+    }
+    if (delay > MAX_DELAY)
+        delay = MAX_DELAY;
+
+    now = wheel_gettick();
+    /* An idle wheel stops running, so catch it up before measuring
+     * from it */
+    if (wheel_empty())
+        wheel_now = now;
+    /* Round up, and allow for being partway through this tick, so we
+     * never expire early */
+    t->expires = now + (tick_t)(delay * TICKS_PER_SEC) + 2;
+    wheel_insert(t);
+
+    /* Waking at the expiry itself is enough, as the wheel catches up on
+     * any cascades it missed when it runs */
+    if (wheel_armed == 0 || t->expires < wheel_armed) {
+        wheel_arm(t->expires);
+#ifndef HAVE_SYS_TIMERFD_H
+        PyThread_flag_set(wheel_rearm);
+#endif
+    }
+    PyThread_lock_release(wheel_lock);
+    return 0;
+}
+
+int
+PyTimer_Stop(PyTimer *t)
+{
+    int expired;
+
+    PyThread_lock_acquire(wheel_lock);
+    if (!PyLinkedList_Detached(&t->links))
+        wheel_remove(t);
+    expired = t->expired;
+    PyThread_lock_release(wheel_lock);
+    return expired;
+}
+
+void
+_PyTimer_Init(void)
+{
+    int level, i;
+
+    for (level = 0; level < LEVELS; level++)
+        for (i = 0; i < LEVEL_SIZE; i++)
+            PyLinkedList_InitBase(&wheel[level][i],
+                offsetof(PyTimer, links));
+
+    wheel_lock = PyThread_lock_allocate();
+#ifndef HAVE_SYS_TIMERFD_H
+    wheel_rearm = PyThread_flag_allocate();
+    if (!wheel_rearm)
+        Py_FatalError("Failed to allocate timer wheel");
+#endif
+    if (!wheel_lock)
+        Py_FatalError("Failed to allocate timer wheel");
+}
+
+
+#ifdef __cplusplus
+}
+#endif
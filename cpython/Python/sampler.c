@@ -0,0 +1,349 @@
+/* Sampling profiler */
+
+#include "Python.h"
+#include "code.h"
+#include "frameobject.h"
+#include "pysampler.h"
+#include "pythreadtable.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Each thread counts the distinct stacks it has been sampled in, in a
+ * table of its own (see pythreadtable.h) hashed on the whole stack, which
+ * holds references to the code objects in its stacks. */
+
+/* Stacks are compared with memcmp(), so this must have no padding */
+typedef struct {
+    PyCodeObject *code;
+    Py_ssize_t line;
+} PySampleFrame;
+
+typedef struct {
+    _PyHashEntry head;
+    Py_ssize_t depth;
+    long count;
+    PySampleFrame *frames;      /* Innermost first */
+} PySampleStack;
+
+typedef struct _PySampleTable {
+    _PyThreadTable head;
+    _PyHashTable stacks;        /* Of PySampleStack */
+    PySampleFrame *scratch;     /* The stack being sampled */
+    Py_ssize_t scratch_size;
+} PySampleTable;
+
+static _PyThreadTables sampler_tables;
+static PyThread_type_lock *sampler_lock;
+/* Set to wake the timer thread when the interval changes */
+static PyThread_type_flag *sampler_wakeup;
+/* These two are protected by sampler_lock */
+static double sampler_interval;
+static int sampler_started;
+
+/* Drops table's references, so call it with the world running.  They're
+ * dropped asynchronously, as an exiting thread may be the one calling. */
+static void
+table_free(_PyThreadTable *t)
+{
+    PySampleTable *table = (PySampleTable *)t;
+    Py_ssize_t i, j;
+
+    for (i = 0; i < table->stacks.size; i++) {
+        PySampleStack *stack =
+            (PySampleStack *)_PyHashTable_ENTRY(&table->stacks, i);
+        for (j = 0; j < stack->depth; j++)
+            Py_DECREF_ASYNC(stack->frames[j].code);
+        free(stack->frames);
+    }
+    _PyHashTable_Clear(&table->stacks);
+    free(table->scratch);
+    free(table);
+}
+
+static int
+stack_match(_PyHashEntry *entry, void *key)
+{
+    PySampleStack *stack = (PySampleStack *)entry;
+    PySampleStack *k = key;
+
+    return stack->depth == k->depth && memcmp(stack->frames, k->frames,
+        k->depth * sizeof(PySampleFrame)) == 0;
+}
+
+/* Adds count samples of a stack to table, taking references to its code
+ * objects if it's new.  Returns -1 if out of memory. */
+static int
+table_add(PySampleTable *table, size_t hash, PySampleFrame *frames,
+    Py_ssize_t depth, long count)
+{
+    PySampleStack key, *stack;
+    Py_ssize_t i;
+
+    key.frames = frames;
+    key.depth = depth;
+    stack = (PySampleStack *)_PyHashTable_Lookup(&table->stacks, hash,
+        stack_match, &key);
+    if (stack == NULL)
+        return -1;
+    if (!stack->head.used) {
+        stack->frames = malloc(depth * sizeof(PySampleFrame));
+        if (stack->frames == NULL)
+            return -1;
+        memcpy(stack->frames, frames, depth * sizeof(PySampleFrame));
+        for (i = 0; i < depth; i++)
+            Py_INCREF(frames[i].code);
+        stack->depth = depth;
+        _PyHashTable_Use(&table->stacks, &stack->head, hash);
+    }
+    stack->count += count;
+    return 0;
+}
+
+/* Returns a copy of table, or NULL if out of memory */
+static PySampleTable *
+table_copy(PySampleTable *table)
+{
+    PySampleTable *copy = calloc(1, sizeof(PySampleTable));
+    Py_ssize_t i;
+
+    if (copy == NULL)
+        return NULL;
+    copy->head.thread = table->head.thread;
+    _PyHashTable_Init(&copy->stacks, sizeof(PySampleStack));
+    for (i = 0; i < table->stacks.size; i++) {
+        PySampleStack *stack =
+            (PySampleStack *)_PyHashTable_ENTRY(&table->stacks, i);
+        if (stack->head.used && table_add(copy, stack->head.hash,
+                stack->frames, stack->depth, stack->count) < 0) {
+            table_free(&copy->head);
+            return NULL;
+        }
+    }
+    return copy;
+}
+
+void
+_PySampler_Take(PyState *pystate)
+{
+    PySampleTable *table = pystate->samples;
+    PyFrameObject *f;
+    Py_ssize_t depth = 0;
+    size_t hash = 0;
+    AO_t count;
+
+    count = AO_load_acquire(&pystate->sample_pending);
+    AO_fetch_and_add_full(&pystate->sample_pending, (AO_t)-count);
+    if (count == 0 || pystate->frame == NULL)
+        return;
+
+    if (table == NULL) {
+        table = _PyThreadTables_New(&sampler_tables, sizeof(PySampleTable));
+        if (table == NULL)
+            return;
+        _PyHashTable_Init(&table->stacks, sizeof(PySampleStack));
+        pystate->samples = table;
+    }
+
+    for (f = pystate->frame; f != NULL; f = f->f_back) {
+        PySampleFrame *frame;
+
+        if (depth == table->scratch_size) {
+            Py_ssize_t size = depth ? depth * 2 : 32;
+            PySampleFrame *scratch = realloc(table->scratch,
+                size * sizeof(PySampleFrame));
+            if (scratch == NULL)
+                return;
+            table->scratch = scratch;
+            table->scratch_size = size;
+        }
+        frame = &table->scratch[depth++];
+        frame->code = f->f_code;
+        frame->line = PyCode_Addr2Line(f->f_code, f->f_lasti);
+        hash = (hash * 1000003) ^ ((size_t)frame->code >> 4) ^
+            (size_t)frame->line;
+    }
+
+    /* Out of memory the samples are simply lost */
+    table_add(table, hash, table->scratch, depth, (long)count);
+}
+
+void
+_PySampler_Retire(PyState *pystate)
+{
+    _PyThreadTables_Retire(&sampler_tables, pystate);
+}
+
+static void
+sampler_main(void *unused)
+{
+    double interval;
+
+    PyThread_lock_acquire(sampler_lock);
+    for (;;) {
+        interval = sampler_interval;
+        PyThread_flag_clear(sampler_wakeup);
+        PyThread_lock_release(sampler_lock);
+
+        if (interval <= 0.0)
+            PyThread_flag_wait(sampler_wakeup);
+        else if (!PyThread_flag_timedwait(sampler_wakeup, interval))
+            _PyState_RequestSamples();
+
+        PyThread_lock_acquire(sampler_lock);
+    }
+}
+
+/* Takes every table, living or retired, out of use */
+static _PyThreadTable *
+sampler_take_tables(void)
+{
+    _PyThreadTable *tables;
+    PyState *t;
+
+    PyState_StopTheWorld();
+    tables = _PyThreadTables_Take(&sampler_tables, 1);
+    for (t = _PyState_Head(); t != NULL; t = t->next)
+        AO_store_full(&t->sample_pending, 0);
+    PyState_StartTheWorld();
+    return tables;
+}
+
+int
+PySampler_Start(double interval)
+{
+    if (interval <= 0.0) {
+        PyErr_SetString(PyExc_ValueError,
+            "sampling interval must be positive");
+        return -1;
+    }
+
+    _PyThreadTables_FreeList(&sampler_tables, sampler_take_tables());
+
+    PyThread_lock_acquire(sampler_lock);
+    if (!sampler_started) {
+        if (PyThread_start_new_thread(NULL, sampler_main, NULL) < 0) {
+            PyThread_lock_release(sampler_lock);
+            PyErr_SetString(PyExc_RuntimeError,
+                "can't start sampler thread");
+            return -1;
+        }
+        sampler_started = 1;
+    }
+    sampler_interval = interval;
+    PyThread_flag_set(sampler_wakeup);
+    PyThread_lock_release(sampler_lock);
+    return 0;
+}
+
+void
+PySampler_Stop(void)
+{
+    PyThread_lock_acquire(sampler_lock);
+    sampler_interval = 0.0;
+    if (sampler_started)
+        PyThread_flag_set(sampler_wakeup);
+    PyThread_lock_release(sampler_lock);
+}
+
+double
+PySampler_GetInterval(void)
+{
+    double interval;
+
+    PyThread_lock_acquire(sampler_lock);
+    interval = sampler_interval;
+    PyThread_lock_release(sampler_lock);
+    return interval;
+}
+
+static PyObject *
+stack_to_tuple(PySampleStack *stack)
+{
+    PyObject *result = PyTuple_New(stack->depth);
+    Py_ssize_t i;
+
+    if (result == NULL)
+        return NULL;
+    for (i = 0; i < stack->depth; i++) {
+        PySampleFrame *frame = &stack->frames[stack->depth - 1 - i];
+        PyObject *item = Py_BuildValue("(On)", frame->code, frame->line);
+        if (item == NULL) {
+            Py_DECREF(result);
+            return NULL;
+        }
+        PyTuple_SET_ITEM(result, i, item);
+    }
+    return result;
+}
+
+/* Adds a copy of table to the list at *copies */
+static int
+collect_copy(_PyThreadTable *table, void *copies)
+{
+    PySampleTable *copy = table_copy((PySampleTable *)table);
+
+    if (copy == NULL)
+        return -1;
+    copy->head.next = *(_PyThreadTable **)copies;
+    *(_PyThreadTable **)copies = &copy->head;
+    return 0;
+}
+
+PyObject *
+PySampler_GetSamples(void)
+{
+    _PyThreadTable *copies = NULL, *t;
+    PySampleTable *table;
+    PySampleStack *entry;
+    PyObject *result, *stack, *item;
+    Py_ssize_t i;
+    int err;
+
+    /* Copy with the world stopped; build the list once it's running */
+    PyState_StopTheWorld();
+    err = _PyThreadTables_Visit(&sampler_tables, collect_copy, &copies);
+    PyState_StartTheWorld();
+
+    result = err ? PyErr_NoMemory() : PyList_New(0);
+    for (t = copies; result != NULL && t != NULL; t = t->next) {
+        table = (PySampleTable *)t;
+        for (i = 0; i < table->stacks.size; i++) {
+            entry = (PySampleStack *)_PyHashTable_ENTRY(&table->stacks, i);
+            if (!entry->head.used)
+                continue;
+            stack = stack_to_tuple(entry);
+            if (stack == NULL) {
+                Py_CLEAR(result);
+                break;
+            }
+            item = Py_BuildValue("(lNl)", t->thread, stack, entry->count);
+            if (item == NULL || PyList_Append(result, item) < 0) {
+                Py_XDECREF(item);
+                Py_CLEAR(result);
+                break;
+            }
+            Py_DECREF(item);
+        }
+    }
+    _PyThreadTables_FreeList(&sampler_tables, copies);
+    return result;
+}
+
+void
+_PySampler_Init(void)
+{
+    sampler_lock = PyThread_lock_allocate();
+    sampler_wakeup = PyThread_flag_allocate();
+    if (!sampler_lock || !sampler_wakeup ||
+            _PyThreadTables_Init(&sampler_tables, offsetof(PyState, samples),
+                NULL, table_free) < 0)
+        Py_FatalError("Failed to allocate sampler");
+}
+
+
+#ifdef __cplusplus
+}
+#endif
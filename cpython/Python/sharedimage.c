@@ -0,0 +1,611 @@
+/* Shared module images */
+
+#include "Python.h"
+#include "code.h"
+#include "marshal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* An image is written by Lib/sharedimage.py: "PYSI", the image version
+ * and the .pyc magic number, then a marshalled index of the modules in
+ * it, ((name, offset), ...), and at each offset in the file a marshalled
+ * tuple of that module's part,
+ *
+ *   (name, (path, mtime, size), records, items, fixups)
+ *
+ *   path...    the source file the module came from, which must be
+ *              unchanged, and be the file sys.path finds, for the rest
+ *              to be used
+ *   records    (record, ...), the objects in the module's namespace
+ *   items      ((key, record), ...), the namespace, without __builtins__
+ *   fixups     ((cell, record), ...), the cells to fill in at the end
+ *
+ * Each record is a tuple of a kind and its fields, and refers to other
+ * records by index, always to earlier ones.  Cells break the cycles that
+ * super() makes between a class and its methods: a cell's contents are
+ * set by a fixup once everything is built.  Objects from other modules,
+ * in the image or not, are found by importing them and getting them by
+ * name.
+ *
+ * The file is mapped into memory at startup and the index read, but a
+ * module's part is only read, and the module built from it, when it's
+ * first imported (see import_submodule()).  Code objects are left in the
+ * mapped file until they're first run, as with PYTHONLAZYCODE.  Shared
+ * modules only hold shareable objects, which are immutable or
+ * shareddict-backed, so building a namespace from the image gives what
+ * running the module would have, less any side effects outside it.
+ * Anything wrong with a module's part of the image and it's imported
+ * normally instead. */
+
+#define IMAGE_MAGIC     0x49535950L     /* "PYSI", little-endian */
+#define IMAGE_VERSION   1
+
+/* Record kinds, as in Lib/sharedimage.py */
+#define IMAGE_CONST     0       /* (kind, value) */
+#define IMAGE_IMPORT    1       /* (kind, name), another module */
+#define IMAGE_MODULE    2       /* (kind,), the module being built */
+#define IMAGE_ATTR      3       /* (kind, object, name) */
+#define IMAGE_TUPLE     4       /* (kind, (item, ...)) */
+#define IMAGE_FUNCTION  5       /* (kind, code, module, closure or None,
+                                    ((name, value), ...)) */
+#define IMAGE_CELL      6       /* (kind,) */
+#define IMAGE_CLASS     7       /* (kind, metaclass, name, bases,
+                                    ((key, value), ...)) */
+#define IMAGE_CALL      8       /* (kind, callable, args) */
+
+
+static PyObject *
+bad_image(void)
+{
+    PyErr_SetString(PyExc_ImportError, "bad shared image");
+    return NULL;
+}
+
+static struct _PyMarshalMap *map = NULL;
+static PyObject *image = NULL;         /* {name: offset of module's part} */
+static PyObject *building = NULL;      /* {name: True} while being built */
+
+/* Checks that the file a module came from hasn't changed, and that it's
+ * the one found on sys.path, at pathname */
+static int
+check_source(PyObject *source, const char *pathname)
+{
+    PyObject *path;
+    long mtime, size;
+    struct stat st, found;
+
+    if (!PyTuple_Check(source) || PyTuple_GET_SIZE(source) != 3 ||
+            !PyUnicode_Check(PyTuple_GET_ITEM(source, 0))) {
+        bad_image();
+        return -1;
+    }
+    path = PyTuple_GET_ITEM(source, 0);
+    mtime = PyLong_AsLong(PyTuple_GET_ITEM(source, 1));
+    size = PyLong_AsLong(PyTuple_GET_ITEM(source, 2));
+    if (PyErr_Occurred())
+        return -1;
+    if (stat(PyUnicode_AsString(path), &st) != 0 ||
+            (long)st.st_mtime != mtime || (long)st.st_size != size) {
+        PyErr_Format(PyExc_ImportError, "%U has changed", path);
+        return -1;
+    }
+    if (stat(pathname, &found) != 0 ||
+            found.st_dev != st.st_dev || found.st_ino != st.st_ino) {
+        PyErr_Format(PyExc_ImportError, "%s found first on sys.path",
+                     pathname);
+        return -1;
+    }
+    return 0;
+}
+
+/* Returns field i of rec as a reference to an earlier record, borrowed */
+static PyObject *
+ref(PyObject *rec, Py_ssize_t i, PyObject **objs, Py_ssize_t n)
+{
+    PyObject *v = PyTuple_GET_SIZE(rec) > i ? PyTuple_GET_ITEM(rec, i) : NULL;
+    Py_ssize_t index;
+
+    if (v == NULL || !PyLong_CheckExact(v))
+        return bad_image();
+    index = PyLong_AsSsize_t(v);
+    if (index < 0 || index >= n || objs[index] == NULL)
+        return bad_image();
+    return objs[index];
+}
+
+/* Returns a new tuple of the records a tuple of indexes refers to */
+static PyObject *
+ref_tuple(PyObject *indexes, PyObject **objs, Py_ssize_t n)
+{
+    PyObject *result;
+    Py_ssize_t i;
+
+    if (!PyTuple_Check(indexes))
+        return bad_image();
+    result = PyTuple_New(PyTuple_GET_SIZE(indexes));
+    if (result == NULL)
+        return NULL;
+    for (i = 0; i < PyTuple_GET_SIZE(indexes); i++) {
+        PyObject *v = ref(indexes, i, objs, n);
+        if (v == NULL) {
+            Py_DECREF(result);
+            return NULL;
+        }
+        Py_INCREF(v);
+        PyTuple_SET_ITEM(result, i, v);
+    }
+    return result;
+}
+
+/* Calls setitem(target, key, value) for a tuple of (key, record) */
+static int
+set_items(PyObject *target, PyObject *items, PyObject **objs, Py_ssize_t n,
+          int (*setitem)(PyObject *, PyObject *, PyObject *))
+{
+    Py_ssize_t i;
+
+    if (!PyTuple_Check(items)) {
+        bad_image();
+        return -1;
+    }
+    for (i = 0; i < PyTuple_GET_SIZE(items); i++) {
+        PyObject *item = PyTuple_GET_ITEM(items, i);
+        PyObject *value;
+
+        if (!PyTuple_Check(item) || PyTuple_GET_SIZE(item) != 2 ||
+                !PyUnicode_Check(PyTuple_GET_ITEM(item, 0))) {
+            bad_image();
+            return -1;
+        }
+        value = ref(item, 1, objs, n);
+        if (value == NULL ||
+                setitem(target, PyTuple_GET_ITEM(item, 0), value) < 0)
+            return -1;
+    }
+    return 0;
+}
+
+static PyObject *
+build_function(PyObject *rec, PyObject **objs, Py_ssize_t n)
+{
+    PyObject *code, *module, *func;
+    PyObject *closure = NULL;
+
+    if (PyTuple_GET_SIZE(rec) != 5 ||
+            !PyCode_Check(PyTuple_GET_ITEM(rec, 1)))
+        return bad_image();
+    code = PyTuple_GET_ITEM(rec, 1);
+    module = ref(rec, 2, objs, n);
+    if (module == NULL)
+        return NULL;
+    if (!PyModule_Check(module))
+        return bad_image();
+    func = PyFunction_New(code, PyModule_GetDict(module));
+    if (func == NULL)
+        return NULL;
+    if (PyTuple_GET_ITEM(rec, 3) != Py_None) {
+        closure = ref_tuple(PyTuple_GET_ITEM(rec, 3), objs, n);
+        if (closure == NULL || PyFunction_SetClosure(func, closure) < 0)
+            goto error;
+        Py_CLEAR(closure);
+    }
+    if (set_items(func, PyTuple_GET_ITEM(rec, 4), objs, n,
+                  PyObject_SetAttr) < 0)
+        goto error;
+    return func;
+
+  error:
+    Py_XDECREF(closure);
+    Py_DECREF(func);
+    return NULL;
+}
+
+static PyObject *
+build_class(PyObject *rec, PyObject **objs, Py_ssize_t n)
+{
+    PyObject *meta, *bases, *dict, *result;
+
+    if (PyTuple_GET_SIZE(rec) != 5 ||
+            !PyUnicode_Check(PyTuple_GET_ITEM(rec, 2)))
+        return bad_image();
+    meta = ref(rec, 1, objs, n);
+    bases = ref(rec, 3, objs, n);
+    if (meta == NULL || bases == NULL)
+        return NULL;
+    dict = PyDict_New();
+    if (dict == NULL)
+        return NULL;
+    if (set_items(dict, PyTuple_GET_ITEM(rec, 4), objs, n,
+                  PyDict_SetItem) < 0) {
+        Py_DECREF(dict);
+        return NULL;
+    }
+    result = PyObject_CallFunctionObjArgs(meta, PyTuple_GET_ITEM(rec, 2),
+                                          bases, dict, NULL);
+    Py_DECREF(dict);
+    return result;
+}
+
+/* Builds record i, given the earlier ones */
+static PyObject *
+build(PyObject *rec, PyObject **objs, Py_ssize_t i, PyObject *module)
+{
+    PyObject *v;
+
+    switch (PyLong_AsLong(PyTuple_GET_ITEM(rec, 0))) {
+
+    case IMAGE_CONST:
+        if (PyTuple_GET_SIZE(rec) != 2)
+            return bad_image();
+        v = PyTuple_GET_ITEM(rec, 1);
+        Py_INCREF(v);
+        return v;
+
+    case IMAGE_MODULE:
+        if (PyTuple_GET_SIZE(rec) != 1)
+            return bad_image();
+        Py_INCREF(module);
+        return module;
+
+    case IMAGE_ATTR:
+        if (PyTuple_GET_SIZE(rec) != 3 ||
+                !PyUnicode_Check(PyTuple_GET_ITEM(rec, 2)))
+            return bad_image();
+        v = ref(rec, 1, objs, i);
+        if (v == NULL)
+            return NULL;
+        return PyObject_GetAttr(v, PyTuple_GET_ITEM(rec, 2));
+
+    case IMAGE_TUPLE:
+        if (PyTuple_GET_SIZE(rec) != 2)
+            return bad_image();
+        return ref_tuple(PyTuple_GET_ITEM(rec, 1), objs, i);
+
+    case IMAGE_FUNCTION:
+        return build_function(rec, objs, i);
+
+    case IMAGE_CELL:
+        return PyCell_New(NULL);
+
+    case IMAGE_CLASS:
+        return build_class(rec, objs, i);
+
+    case IMAGE_CALL:
+        if (PyTuple_GET_SIZE(rec) != 3)
+            return bad_image();
+        v = ref(rec, 1, objs, i);
+        if (v == NULL || (rec = ref(rec, 2, objs, i)) == NULL)
+            return NULL;
+        if (!PyTuple_Check(rec))
+            return bad_image();
+        return PyObject_Call(v, rec, NULL);
+
+    default:
+        return bad_image();
+    }
+}
+
+/* Imports the module an IMPORT record names, which may be built from the
+   image in turn */
+static PyObject *
+import(PyObject *rec)
+{
+    PyObject *m;
+
+    if (PyTuple_GET_SIZE(rec) != 2 ||
+            !PyUnicode_Check(PyTuple_GET_ITEM(rec, 1)))
+        return bad_image();
+    m = PyImport_Import(PyTuple_GET_ITEM(rec, 1));
+    if (m == NULL)
+        return NULL;
+    Py_DECREF(m);
+    /* PyImport_Import() gives the package for a dotted name */
+    m = PyDict_GetItem(PyImport_GetModuleDict(), PyTuple_GET_ITEM(rec, 1));
+    if (m == NULL)
+        return PyErr_Format(PyExc_ImportError, "%U not in sys.modules",
+                            PyTuple_GET_ITEM(rec, 1));
+    Py_INCREF(m);
+    return m;
+}
+
+/* Builds a module from its part of the image and puts it in sys.modules,
+ * returning a new reference.  Its imports are done first, before it's in
+ * sys.modules, so if one of them imports it in turn, that import is done
+ * normally (see _PyImport_FindSharedImage()) and its result is returned,
+ * with *built left 0.  On failure, sys.modules is left without it. */
+static PyObject *
+build_module(PyObject *name, PyObject *entry, const char *pathname,
+             int *built)
+{
+    PyObject *sysmodules = PyImport_GetModuleDict();
+    PyObject *records, *items, *fixups;
+    PyObject *m = NULL;
+    PyObject **objs = NULL;
+    Py_ssize_t i, n = 0;
+
+    if (!PyTuple_Check(entry) || PyTuple_GET_SIZE(entry) != 5 ||
+            !PyUnicode_Check(PyTuple_GET_ITEM(entry, 0)) ||
+            PyUnicode_Compare(PyTuple_GET_ITEM(entry, 0), name) != 0 ||
+            !PyTuple_Check(PyTuple_GET_ITEM(entry, 2)) ||
+            !PyTuple_Check(PyTuple_GET_ITEM(entry, 3)) ||
+            !PyTuple_Check(PyTuple_GET_ITEM(entry, 4)))
+        return bad_image();
+    records = PyTuple_GET_ITEM(entry, 2);
+    items = PyTuple_GET_ITEM(entry, 3);
+    fixups = PyTuple_GET_ITEM(entry, 4);
+    if (check_source(PyTuple_GET_ITEM(entry, 1), pathname) < 0)
+        return NULL;
+
+    n = PyTuple_GET_SIZE(records);
+    objs = PyMem_NEW(PyObject *, n);
+    if (objs == NULL)
+        return PyErr_NoMemory();
+    memset(objs, 0, n * sizeof(PyObject *));
+    for (i = 0; i < n; i++) {
+        PyObject *rec = PyTuple_GET_ITEM(records, i);
+        if (!PyTuple_Check(rec) || PyTuple_GET_SIZE(rec) < 1 ||
+                !PyLong_CheckExact(PyTuple_GET_ITEM(rec, 0))) {
+            bad_image();
+            goto error;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        PyObject *rec = PyTuple_GET_ITEM(records, i);
+        if (PyLong_AsLong(PyTuple_GET_ITEM(rec, 0)) == IMAGE_IMPORT &&
+                (objs[i] = import(rec)) == NULL)
+            goto error;
+    }
+    m = PyDict_GetItem(sysmodules, name);
+    if (m != NULL) {
+        /* Imported normally by one of its imports */
+        Py_INCREF(m);
+        goto done;
+    }
+
+    m = PyModule_NewEx(PyUnicode_AsString(name), 1);
+    if (m == NULL)
+        goto error;
+    if (PyDict_SetItemString(PyModule_GetDict(m), "__builtins__",
+                             PyEval_GetBuiltins()) < 0 ||
+            PyDict_SetItem(sysmodules, name, m) < 0) {
+        Py_CLEAR(m);
+        goto error;
+    }
+    for (i = 0; i < n; i++) {
+        if (objs[i] == NULL) {
+            objs[i] = build(PyTuple_GET_ITEM(records, i), objs, i, m);
+            if (objs[i] == NULL)
+                goto error;
+        }
+    }
+    if (set_items(PyModule_GetDict(m), items, objs, n, PyObject_SetItem) < 0)
+        goto error;
+    for (i = 0; i < PyTuple_GET_SIZE(fixups); i++) {
+        PyObject *fixup = PyTuple_GET_ITEM(fixups, i);
+        PyObject *cell, *value;
+
+        if (!PyTuple_Check(fixup) || PyTuple_GET_SIZE(fixup) != 2) {
+            bad_image();
+            goto error;
+        }
+        cell = ref(fixup, 0, objs, n);
+        value = ref(fixup, 1, objs, n);
+        if (cell == NULL || value == NULL)
+            goto error;
+        if (!PyCell_Check(cell)) {
+            bad_image();
+            goto error;
+        }
+        PyCell_Set(cell, value);
+    }
+    *built = 1;
+
+  done:
+    for (i = 0; i < n; i++)
+        Py_XDECREF(objs[i]);
+    PyMem_DEL(objs);
+    return m;
+
+  error:
+    if (m != NULL) {
+        PyObject *exc, *val, *tb;
+        PyErr_Fetch(&exc, &val, &tb);
+        if (PyDict_GetItem(sysmodules, name) == m &&
+                PyDict_DelItem(sysmodules, name) < 0)
+            PyErr_Clear();
+        PyErr_Restore(exc, val, tb);
+        Py_DECREF(m);
+    }
+    for (i = 0; i < n; i++)
+        Py_XDECREF(objs[i]);
+    PyMem_DEL(objs);
+    return NULL;
+}
+
+/* Writes why what (a module, or the image) isn't used, for python -v */
+static void
+not_used(const char *what)
+{
+    PyObject *exc, *val, *tb, *msg;
+
+    PyErr_Fetch(&exc, &val, &tb);
+    PyErr_NormalizeException(&exc, &val, &tb);
+    msg = val != NULL ? PyObject_Str(val) : NULL;
+    PySys_WriteStderr("# shared image: %s not used: %s\n", what,
+                      msg != NULL && PyUnicode_Check(msg) ?
+                      PyUnicode_AsString(msg) : "?");
+    Py_XDECREF(msg);
+    Py_XDECREF(exc);
+    Py_XDECREF(val);
+    Py_XDECREF(tb);
+}
+
+/* Adds name to sys.shared_image, the modules built from the image */
+static void
+add_loaded(PyObject *name)
+{
+    PyObject *loaded = PySys_GetObject("shared_image");
+    PyObject *names, *extra;
+
+    if (loaded == NULL || !PyTuple_Check(loaded))
+        return;
+    extra = PyTuple_Pack(1, name);
+    if (extra == NULL) {
+        PyErr_Clear();
+        return;
+    }
+    names = PySequence_Concat(loaded, extra);
+    Py_DECREF(extra);
+    if (names == NULL || PySys_SetObject("shared_image", names) < 0)
+        PyErr_Clear();
+    Py_XDECREF(names);
+}
+
+/* Called by import_submodule() for a top-level module not yet imported,
+ * once sys.path has been searched and the module found in the source file
+ * pathname: returns it built from the image, as a new reference, or NULL
+ * (with no exception set) if it's to be imported normally.  It is, if it
+ * isn't in the image, it's being built already, pathname isn't the file
+ * it was made from, or anything else goes wrong; each module is only
+ * tried once. */
+PyObject *
+_PyImport_FindSharedImage(const char *fullname, const char *pathname)
+{
+    PyObject *name, *offset, *entry, *m;
+    int err, built = 0;
+
+    if (image == NULL || PyDict_GetItemString(image, fullname) == NULL)
+        return NULL;
+    name = PyUnicode_FromString(fullname);
+    if (name == NULL) {
+        PyErr_Clear();
+        return NULL;
+    }
+    offset = PyDict_GetItem(image, name);
+    if (offset == NULL || PyDict_GetItem(building, name) != NULL) {
+        Py_DECREF(name);
+        return NULL;
+    }
+    Py_INCREF(offset);
+    err = PyDict_DelItem(image, name);
+    if (err == 0)
+        err = PyDict_SetItem(building, name, Py_True);
+    if (err < 0) {
+        PyErr_Clear();
+        Py_DECREF(offset);
+        Py_DECREF(name);
+        return NULL;
+    }
+
+    entry = _PyMarshal_ReadMapped(map, PyLong_AsSsize_t(offset));
+    Py_DECREF(offset);
+    m = entry != NULL ? build_module(name, entry, pathname, &built) : NULL;
+    if (m == NULL) {
+        if (Py_VerboseFlag)
+            not_used(fullname);
+        PyErr_Clear();
+    }
+    else if (built) {
+        if (Py_VerboseFlag)
+            PySys_WriteStderr("import %s # from shared image\n", fullname);
+        add_loaded(name);
+    }
+    if (PyDict_DelItem(building, name) < 0)
+        PyErr_Clear();
+    Py_XDECREF(entry);
+    Py_DECREF(name);
+    return m;
+}
+
+/* Maps the image at path into memory and reads its index */
+static int
+read_image(const char *path)
+{
+    PyObject *index = NULL;
+    FILE *fp;
+    Py_ssize_t i;
+
+    fp = fopen(path, "rb");
+    if (fp == NULL) {
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)path);
+        return -1;
+    }
+    if (PyMarshal_ReadLongFromFile(fp) != IMAGE_MAGIC ||
+            PyMarshal_ReadLongFromFile(fp) != IMAGE_VERSION ||
+            PyMarshal_ReadLongFromFile(fp) != PyImport_GetMagicNumber())
+        PyErr_SetString(PyExc_ImportError, "bad magic number");
+    else
+        map = _PyMarshal_MapFile(fp);
+    fclose(fp);
+    if (map == NULL)
+        return -1;
+    index = _PyMarshal_ReadMapped(map, 3 * 4);
+    if (index == NULL)
+        goto error;
+    if (!PyTuple_Check(index))
+        goto bad;
+
+    image = PyDict_New();
+    building = PyDict_New();
+    if (image == NULL || building == NULL)
+        goto error;
+    for (i = 0; i < PyTuple_GET_SIZE(index); i++) {
+        PyObject *item = PyTuple_GET_ITEM(index, i);
+        if (!PyTuple_Check(item) || PyTuple_GET_SIZE(item) != 2 ||
+                !PyUnicode_Check(PyTuple_GET_ITEM(item, 0)) ||
+                !PyLong_CheckExact(PyTuple_GET_ITEM(item, 1)))
+            goto bad;
+        if (PyDict_SetItem(image, PyTuple_GET_ITEM(item, 0),
+                           PyTuple_GET_ITEM(item, 1)) < 0)
+            goto error;
+    }
+    if (Py_VerboseFlag)
+        PySys_WriteStderr("# %d modules in shared image %s\n",
+                          (int)PyTuple_GET_SIZE(index), path);
+    Py_DECREF(index);
+    return 0;
+
+  bad:
+    bad_image();
+  error:
+    Py_XDECREF(index);
+    _PyImport_FiniSharedImage();
+    return -1;
+}
+
+/* Reads the image at path, if any, leaving its modules to be built when
+   they're imported, and sets sys.shared_image to () */
+void
+_PyImport_LoadSharedImage(const char *path)
+{
+    PyObject *names;
+
+    if (path != NULL && read_image(path) < 0) {
+        if (Py_VerboseFlag)
+            not_used(path);
+        PyErr_Clear();
+    }
+    names = PyTuple_New(0);
+    if (names == NULL || PySys_SetObject("shared_image", names) < 0)
+        PyErr_Clear();
+    Py_XDECREF(names);
+}
+
+void
+_PyImport_FiniSharedImage(void)
+{
+    Py_CLEAR(image);
+    Py_CLEAR(building);
+    if (map != NULL) {
+        _PyMarshal_ReleaseMap(map);
+        map = NULL;
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
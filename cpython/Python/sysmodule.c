@@ -20,6 +20,10 @@ Data members:
 #include "frameobject.h"
 #include "eval.h"
 #include "monitorobject.h"
+#include "branchobject.h"
+#include "pysampler.h"
+#include "pylockprof.h"
+#include "pyallocprof.h"
 
 #include "osdefs.h"
 
@@ -503,6 +507,193 @@ processor's time-stamp counter."
 );
 #endif /* TSC */
 
+static PyObject *
+sys_setdxp(PyObject *self, PyObject *args)
+{
+	int on;
+
+	if (!PyArg_ParseTuple(args, "i:setdxp", &on))
+		return NULL;
+	if (PyEval_SetDXProfile(on) < 0)
+		return NULL;
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+PyDoc_STRVAR(setdxp_doc,
+"setdxp(bool)\n\
+\n\
+If true, start every thread counting the opcodes it executes, from zero.\n\
+If false, stop counting, keeping the counts for getdxp() and getdxpcodes()."
+);
+
+static PyObject *
+sys_getdxp(PyObject *self)
+{
+	return PyEval_GetDXProfile();
+}
+
+PyDoc_STRVAR(getdxp_doc,
+"getdxp() -> list of 257 lists of 256 counts\n\
+\n\
+Return the opcode counts of all threads since setdxp(True).  Item [i][j]\n\
+counts opcode j executed right after opcode i; item [256][j] counts\n\
+opcode j executed at all."
+);
+
+static PyObject *
+sys_getdxpcodes(PyObject *self)
+{
+	return PyEval_GetDXProfileCodes();
+}
+
+PyDoc_STRVAR(getdxpcodes_doc,
+"getdxpcodes() -> {code: list of counts}\n\
+\n\
+Return how often all threads executed each instruction of each code\n\
+object since setdxp(True), indexed by the instruction's offset."
+);
+
+static PyObject *
+sys_setsampling(PyObject *self, PyObject *args)
+{
+	double interval;
+
+	if (!PyArg_ParseTuple(args, "d:setsampling", &interval))
+		return NULL;
+	if (interval < 0.0) {
+		PyErr_SetString(PyExc_ValueError,
+				"sampling interval must not be negative");
+		return NULL;
+	}
+	if (interval == 0.0)
+		PySampler_Stop();
+	else if (PySampler_Start(interval) < 0)
+		return NULL;
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+PyDoc_STRVAR(setsampling_doc,
+"setsampling(interval)\n\
+\n\
+Sample the stack of every thread each interval seconds, throwing away\n\
+the samples already taken, or stop sampling if interval is 0.  The\n\
+samples are kept for getsamples()."
+);
+
+static PyObject *
+sys_getsampling(PyObject *self)
+{
+	return PyFloat_FromDouble(PySampler_GetInterval());
+}
+
+PyDoc_STRVAR(getsampling_doc,
+"getsampling() -> current sampling interval, or 0.0 if not sampling; see\n\
+setsampling()."
+);
+
+static PyObject *
+sys_getsamples(PyObject *self)
+{
+	return PySampler_GetSamples();
+}
+
+PyDoc_STRVAR(getsamples_doc,
+"getsamples() -> list of (thread, stack, count)\n\
+\n\
+Return the samples taken since setsampling() last started sampling.\n\
+Threads are numbered in the order they were first sampled, and each\n\
+stack is a tuple of (code, lineno), outermost first."
+);
+
+static PyObject *
+sys_setlockprofile(PyObject *self, PyObject *args)
+{
+	int on;
+
+	if (!PyArg_ParseTuple(args, "i:setlockprofile", &on))
+		return NULL;
+	if (on)
+		PyLockProf_Start();
+	else
+		PyLockProf_Stop();
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+PyDoc_STRVAR(setlockprofile_doc,
+"setlockprofile(bool)\n\
+\n\
+If true, start every thread timing the locks it waits for and holds,\n\
+from zero.  If false, stop timing, keeping the times for getlockprofile()."
+);
+
+static PyObject *
+sys_getlockprofile(PyObject *self)
+{
+	return PyLockProf_GetStats();
+}
+
+PyDoc_STRVAR(getlockprofile_doc,
+"getlockprofile() -> list of dicts\n\
+\n\
+Return the lock times counted since setlockprofile(True), one dict per\n\
+thread, lock and call site.  See the lockprofile module for the keys."
+);
+
+static PyObject *
+sys_setallocprofile(PyObject *self, PyObject *args)
+{
+	Py_ssize_t rate;
+	int nframes = 16;
+
+	if (!PyArg_ParseTuple(args, "n|i:setallocprofile", &rate, &nframes))
+		return NULL;
+	if (rate == 0)
+		PyAllocProf_Stop();
+	else if (PyAllocProf_Start(rate, nframes) < 0)
+		return NULL;
+	Py_INCREF(Py_None);
+	return Py_None;
+}
+
+PyDoc_STRVAR(setallocprofile_doc,
+"setallocprofile(rate[, nframes])\n\
+\n\
+Start every thread sampling an allocation about once per rate bytes it\n\
+allocates, recording up to nframes frames of traceback (default 16),\n\
+and forget the allocations sampled so far.  A rate of 0 stops sampling,\n\
+keeping the samples for getallocsamples()."
+);
+
+static PyObject *
+sys_getallocprofile(PyObject *self)
+{
+	return PyLong_FromSsize_t(PyAllocProf_GetRate());
+}
+
+PyDoc_STRVAR(getallocprofile_doc,
+"getallocprofile() -> rate\n\
+\n\
+Return the rate setallocprofile() is sampling at, or 0 if it isn't."
+);
+
+static PyObject *
+sys_getallocsamples(PyObject *self)
+{
+	return PyAllocProf_GetSamples();
+}
+
+PyDoc_STRVAR(getallocsamples_doc,
+"getallocsamples() -> list of (thread, type, size, weight, traceback)\n\
+\n\
+Return the allocations sampled since setallocprofile() last started that\n\
+haven't been freed yet.  type is the name of the object's type, or None\n\
+for other memory; weight is the bytes the sample stands for; and the\n\
+traceback is a tuple of (filename, funcname, lineno), outermost first."
+);
+
 static PyObject *
 sys_setrecursionlimit(PyObject *self, PyObject *args)
 {
@@ -576,6 +767,52 @@ PyDoc_STRVAR(getdeadlockdelay_doc,
 Return the current value of the deadlock delay.  Higher values may\n\
 reduce contention, improving performance.");
 
+static PyObject *
+sys_setbranchpoolsize(PyObject *self, PyObject *args)
+{
+    Py_ssize_t new_size;
+    if (!PyArg_ParseTuple(args, "n:setbranchpoolsize", &new_size))
+        return NULL;
+    if (new_size < 0) {
+        PyErr_SetString(PyExc_ValueError,
+            "branch pool size must be positive or zero");
+        return NULL;
+    }
+    PyBranch_SetPoolSize(new_size);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyDoc_STRVAR(setbranchpoolsize_doc,
+"setbranchpoolsize(n)\n\
+\n\
+Keep up to n idle threads around for reuse by branch.add() and\n\
+branch.addresult().  0 starts a new thread for every child.");
+
+static PyObject *
+sys_getbranchpoolsize(PyObject *self)
+{
+    return PyLong_FromSsize_t(PyBranch_GetPoolSize());
+}
+
+PyDoc_STRVAR(getbranchpoolsize_doc,
+"getbranchpoolsize()\n\
+\n\
+Return the number of idle threads kept for reuse by branches.");
+
+static PyObject *
+sys_getbranchpoolstats(PyObject *self)
+{
+    return PyBranch_GetPoolStats();
+}
+
+PyDoc_STRVAR(getbranchpoolstats_doc,
+"getbranchpoolstats() -> dict\n\
+\n\
+Return counters for the branch thread pool: threads started, children\n\
+run, children run on a reused thread, and the total and maximum time\n\
+(in seconds) a child waited between being added and starting.");
+
 #ifdef MS_WINDOWS
 PyDoc_STRVAR(getwindowsversion_doc,
 "getwindowsversion()\n\
@@ -810,11 +1047,6 @@ extern "C" {
 extern PyObject *_Py_GetObjects(PyObject *, PyObject *);
 #endif
 
-#ifdef DYNAMIC_EXECUTION_PROFILE
-/* Defined in ceval.c because it uses static globals if that file */
-extern PyObject *_Py_GetDXProfile(PyObject *,  PyObject *);
-#endif
-
 #ifdef __cplusplus
 }
 #endif
@@ -867,11 +1099,15 @@ static PyMethodDef sys_methods[] = {
 #ifdef COUNT_ALLOCS
 	{"getcounts",	(PyCFunction)sys_getcounts, METH_NOARGS},
 #endif
+	{"getbranchpoolsize", (PyCFunction)sys_getbranchpoolsize, METH_NOARGS,
+	 getbranchpoolsize_doc},
+	{"getbranchpoolstats", (PyCFunction)sys_getbranchpoolstats, METH_NOARGS,
+	 getbranchpoolstats_doc},
 	{"getdeadlockdelay", (PyCFunction)sys_getdeadlockdelay, METH_NOARGS,
 	 getdeadlockdelay_doc},
-#ifdef DYNAMIC_EXECUTION_PROFILE
-	{"getdxp",	_Py_GetDXProfile, METH_VARARGS},
-#endif
+	{"getdxp",	(PyCFunction)sys_getdxp, METH_NOARGS, getdxp_doc},
+	{"getdxpcodes",	(PyCFunction)sys_getdxpcodes, METH_NOARGS,
+	 getdxpcodes_doc},
 	{"getfilesystemencoding", (PyCFunction)sys_getfilesystemencoding,
 	 METH_NOARGS, getfilesystemencoding_doc},
 #ifdef Py_TRACE_REFS
@@ -899,13 +1135,31 @@ static PyMethodDef sys_methods[] = {
 	 setcheckinterval_doc},
 	{"getcheckinterval",	sys_getcheckinterval, METH_NOARGS,
 	 getcheckinterval_doc},
+	{"setbranchpoolsize", sys_setbranchpoolsize, METH_VARARGS,
+	 setbranchpoolsize_doc},
 	{"setdeadlockdelay", sys_setdeadlockdelay, METH_VARARGS,
 	 setdeadlockdelay_doc},
+	{"setdxp",	sys_setdxp, METH_VARARGS, setdxp_doc},
 #ifdef HAVE_DLOPEN
 	{"setdlopenflags", sys_setdlopenflags, METH_VARARGS,
 	 setdlopenflags_doc},
 #endif
 	{"setprofile",	sys_setprofile, METH_O, setprofile_doc},
+	{"setsampling",	sys_setsampling, METH_VARARGS, setsampling_doc},
+	{"getsampling",	(PyCFunction)sys_getsampling, METH_NOARGS,
+	 getsampling_doc},
+	{"getsamples",	(PyCFunction)sys_getsamples, METH_NOARGS,
+	 getsamples_doc},
+	{"setlockprofile", sys_setlockprofile, METH_VARARGS,
+	 setlockprofile_doc},
+	{"getlockprofile", (PyCFunction)sys_getlockprofile, METH_NOARGS,
+	 getlockprofile_doc},
+	{"setallocprofile", sys_setallocprofile, METH_VARARGS,
+	 setallocprofile_doc},
+	{"getallocprofile", (PyCFunction)sys_getallocprofile, METH_NOARGS,
+	 getallocprofile_doc},
+	{"getallocsamples", (PyCFunction)sys_getallocsamples, METH_NOARGS,
+	 getallocsamples_doc},
 	{"getprofile",	sys_getprofile, METH_NOARGS, getprofile_doc},
 	{"setrecursionlimit", sys_setrecursionlimit, METH_VARARGS,
 	 setrecursionlimit_doc},
@@ -1047,15 +1301,22 @@ displayhook() -- print an object to the screen, and save it in builtins._\n\
 excepthook() -- print an exception and its traceback to sys.stderr\n\
 exc_info() -- return thread-safe information about the current exception\n\
 exit() -- exit the interpreter by raising SystemExit\n\
+getallocsamples() -- return the sampled allocations still live\n\
 getdlopenflags() -- returns flags to be used for dlopen() calls\n\
+getdxp() -- return the opcode counts of all threads\n\
+getlockprofile() -- return the lock times of all threads\n\
 getprofile() -- get the global profiling function\n\
 getrefcount() -- return the reference count for an object (plus one :-)\n\
 getrecursionlimit() -- return the max recursion depth for the interpreter\n\
 gettrace() -- get the global debug tracing function\n\
+setallocprofile() -- sample the allocations of every thread\n\
 setcheckinterval() -- control how often the interpreter checks for events\n\
 setdlopenflags() -- set the flags to be used for dlopen() calls\n\
+setdxp() -- turn counting the opcodes each thread executes on or off\n\
+setlockprofile() -- turn timing the locks each thread waits for on or off\n\
 setprofile() -- set the global profiling function\n\
 setrecursionlimit() -- set the max recursion depth for the interpreter\n\
+setsampling() -- sample the stack of every thread periodically\n\
 settrace() -- set the global debug tracing function\n\
 "
 )
@@ -1165,6 +1426,7 @@ static PyStructSequence_Field flags_fields[] = {
 	{"interactive",		"-i"},
 	{"optimize",		"-O or -OO"},
 	{"dont_write_bytecode",	"-B"},
+	{"lazy_code",		"PYTHONLAZYCODE"},
 	/* {"no_user_site",	"-s"}, */
 	{"no_site",		"-S"},
 	{"ignore_environment",	"-E"},
@@ -1183,9 +1445,9 @@ static PyStructSequence_Desc flags_desc = {
 	flags__doc__,	/* doc */
 	flags_fields,	/* fields */
 #ifdef RISCOS
-	11
+	12
 #else
-	10
+	11
 #endif
 };
 
@@ -1208,6 +1470,7 @@ make_flags(void)
 	SetFlag(Py_InteractiveFlag);
 	SetFlag(Py_OptimizeFlag);
 	SetFlag(Py_DontWriteBytecodeFlag);
+	SetFlag(Py_LazyCodeFlag);
 	/* SetFlag(Py_NoUserSiteDirectory); */
 	SetFlag(Py_NoSiteFlag);
 	SetFlag(Py_IgnoreEnvironmentFlag);
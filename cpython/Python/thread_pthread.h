@@ -1009,3 +1009,35 @@ PyThread_flag_timedwait(PyThread_type_flag *flag, double delay)
 
     return value;
 }
+
+int
+PyThread_flag_timeoutwait(PyThread_type_flag *flag,
+			  PyThread_type_timeout *timeout)
+{
+	int status, value;
+
+	status = pthread_mutex_lock(&flag->mutex);
+	CHECK_STATUS_ABORT("pthread_mutex_lock");
+
+	if (flag->waiting)
+		Py_FatalError("Only one thread may wait on a flag");
+	flag->waiting = 1;
+
+	while (!flag->value) {
+		status = pthread_cond_timedwait(&flag->wakeup, &flag->mutex,
+						&timeout->abstime);
+		if (status == ETIMEDOUT) {
+			timeout->expired = 1;
+			break;
+		} else
+			CHECK_STATUS_ABORT("pthread_cond_wait");
+	}
+
+	value = flag->value;
+	flag->waiting = 0;
+
+	status = pthread_mutex_unlock(&flag->mutex);
+	CHECK_STATUS_ABORT("pthread_mutex_unlock");
+
+	return value;
+}
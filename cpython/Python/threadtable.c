@@ -0,0 +1,241 @@
+/* Per-thread tables, for the profilers (see pythreadtable.h) */
+
+#include "Python.h"
+#include "pythreadtable.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define TABLE_SLOT(tables, pystate) \
+	((_PyThreadTable **)((char *)(pystate) + (tables)->offset))
+
+int
+_PyThreadTables_Init(_PyThreadTables *tables, Py_ssize_t offset,
+		     void (*merge)(_PyThreadTable *, _PyThreadTable *),
+		     void (*free_table)(_PyThreadTable *))
+{
+	tables->lock = PyThread_lock_allocate();
+	if (tables->lock == NULL)
+		return -1;
+	tables->retired = NULL;
+	tables->threads = 0;
+	tables->offset = offset;
+	tables->merge = merge;
+	tables->free_table = free_table;
+	return 0;
+}
+
+void *
+_PyThreadTables_New(_PyThreadTables *tables, size_t size)
+{
+	_PyThreadTable *table = calloc(1, size);
+	if (table != NULL)
+		table->thread = AO_fetch_and_add1_full(&tables->threads) + 1;
+	return table;
+}
+
+void
+_PyThreadTables_Add(_PyThreadTables *tables, _PyThreadTable *table)
+{
+	PyThread_lock_acquire(tables->lock);
+	if (tables->merge != NULL && tables->retired != NULL) {
+		tables->merge(tables->retired, table);
+		PyThread_lock_release(tables->lock);
+		tables->free_table(table);
+		return;
+	}
+	table->next = tables->retired;
+	tables->retired = table;
+	PyThread_lock_release(tables->lock);
+}
+
+void
+_PyThreadTables_Retire(_PyThreadTables *tables, PyState *pystate)
+{
+	_PyThreadTable *table = *TABLE_SLOT(tables, pystate);
+
+	if (table != NULL) {
+		*TABLE_SLOT(tables, pystate) = NULL;
+		_PyThreadTables_Add(tables, table);
+	}
+}
+
+_PyThreadTable *
+_PyThreadTables_Take(_PyThreadTables *tables, int retired)
+{
+	_PyThreadTable *taken = NULL, *table;
+	PyState *t;
+
+	if (retired) {
+		PyThread_lock_acquire(tables->lock);
+		taken = tables->retired;
+		tables->retired = NULL;
+		PyThread_lock_release(tables->lock);
+	}
+	for (t = _PyState_Head(); t != NULL; t = t->next) {
+		table = *TABLE_SLOT(tables, t);
+		if (table != NULL) {
+			*TABLE_SLOT(tables, t) = NULL;
+			table->next = taken;
+			taken = table;
+		}
+	}
+	AO_store_full(&tables->threads, 0);
+	return taken;
+}
+
+int
+_PyThreadTables_Visit(_PyThreadTables *tables,
+		      int (*visit)(_PyThreadTable *, void *), void *arg)
+{
+	_PyThreadTable *table;
+	PyState *t;
+	int err;
+
+	/* visit may take references, so not under the lock */
+	PyThread_lock_acquire(tables->lock);
+	table = tables->retired;
+	PyThread_lock_release(tables->lock);
+	for (; table != NULL; table = table->next) {
+		err = visit(table, arg);
+		if (err)
+			return err;
+	}
+	for (t = _PyState_Head(); t != NULL; t = t->next) {
+		table = *TABLE_SLOT(tables, t);
+		if (table != NULL) {
+			err = visit(table, arg);
+			if (err)
+				return err;
+		}
+	}
+	return 0;
+}
+
+_PyThreadTable *
+_PyThreadTables_Prune(_PyThreadTables *tables,
+		      int (*drop)(_PyThreadTable *))
+{
+	_PyThreadTable **p, *table, *dropped = NULL;
+
+	PyThread_lock_acquire(tables->lock);
+	p = &tables->retired;
+	while ((table = *p) != NULL) {
+		if (drop(table)) {
+			*p = table->next;
+			table->next = dropped;
+			dropped = table;
+		} else
+			p = &table->next;
+	}
+	PyThread_lock_release(tables->lock);
+	return dropped;
+}
+
+void
+_PyThreadTables_FreeList(_PyThreadTables *tables, _PyThreadTable *table)
+{
+	_PyThreadTable *next;
+
+	while (table != NULL) {
+		next = table->next;
+		tables->free_table(table);
+		table = next;
+	}
+}
+
+
+void
+_PyHashTable_Init(_PyHashTable *table, Py_ssize_t entry_size)
+{
+	table->used = 0;
+	table->size = 0;
+	table->entry_size = entry_size;
+	table->entries = NULL;
+}
+
+void
+_PyHashTable_Clear(_PyHashTable *table)
+{
+	free(table->entries);
+	table->entries = NULL;
+	table->used = 0;
+	table->size = 0;
+}
+
+/* Returns the first free entry for hash, which the table must have */
+static _PyHashEntry *
+free_slot(_PyHashTable *table, size_t hash)
+{
+	size_t mask = table->size - 1;
+	size_t i = hash & mask;
+	_PyHashEntry *entry;
+
+	while ((entry = _PyHashTable_ENTRY(table, i))->used)
+		i = (i + 1) & mask;
+	return entry;
+}
+
+/* Makes room for one more entry, keeping the table at most half full.
+ * Returns -1 if out of memory. */
+static int
+table_reserve(_PyHashTable *table)
+{
+	char *old = table->entries;
+	Py_ssize_t i, oldsize = table->size;
+	Py_ssize_t size = oldsize ? oldsize : 64;
+	_PyHashEntry *entry;
+
+	while ((table->used + 1) * 2 > size)
+		size *= 2;
+	if (size == oldsize)
+		return 0;
+	table->entries = calloc(size, table->entry_size);
+	if (table->entries == NULL) {
+		table->entries = old;
+		return -1;
+	}
+	table->size = size;
+	/* The old entries are all different, so need no matching */
+	for (i = 0; i < oldsize; i++) {
+		entry = (_PyHashEntry *)(old + i * table->entry_size);
+		if (entry->used)
+			memcpy(free_slot(table, entry->hash), entry,
+			       table->entry_size);
+	}
+	free(old);
+	return 0;
+}
+
+_PyHashEntry *
+_PyHashTable_Lookup(_PyHashTable *table, size_t hash,
+		    _PyHashTable_Match match, void *key)
+{
+	size_t mask;
+	size_t i;
+	_PyHashEntry *entry;
+
+	if (table_reserve(table) < 0)
+		return NULL;
+	mask = table->size - 1;
+	for (i = hash & mask; ; i = (i + 1) & mask) {
+		entry = _PyHashTable_ENTRY(table, i);
+		if (!entry->used || (entry->hash == hash && match(entry, key)))
+			return entry;
+	}
+}
+
+void
+_PyHashTable_Use(_PyHashTable *table, _PyHashEntry *entry, size_t hash)
+{
+	entry->hash = hash;
+	entry->used = 1;
+	table->used++;
+}
+
+
+#ifdef __cplusplus
+}
+#endif
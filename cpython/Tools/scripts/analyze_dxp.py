@@ -0,0 +1,102 @@
+#! /usr/bin/env python
+
+"""
+Report on the opcode counts gathered while sys.setdxp() is on.
+
+Usage: analyze_dxp.py [-n count] script [args...]
+
+Runs script with counting turned on, then prints the most common opcodes,
+the most common pairs of opcodes and the hottest lines of code.  From
+Python, start counting with sys.setdxp(True) and hand sys.getdxp() and
+sys.getdxpcodes() to the functions below.
+"""
+
+import dis
+import opcode
+import sys
+
+
+def common_instructions(profile):
+    """Returns (opname, count) for each opcode executed, most common first."""
+    result = [(opcode.opname[op], count)
+              for op, count in enumerate(profile[256]) if count > 0]
+    result.sort(key=lambda item: item[1], reverse=True)
+    return result
+
+
+def common_pairs(profile):
+    """Returns ((opname, opname), count) for each pair of opcodes executed
+    one after the other, most common first."""
+    result = [((opcode.opname[first], opcode.opname[second]), count)
+              for first, row in enumerate(profile[:256])
+              for second, count in enumerate(row) if count > 0]
+    result.sort(key=lambda item: item[1], reverse=True)
+    return result
+
+
+def hot_lines(codes, n=20):
+    """Returns the n lines that executed the most instructions, as
+    (count, filename, lineno, code name), most first."""
+    lines = {}
+    for code, counts in codes.items():
+        starts = list(dis.findlinestarts(code))
+        for i, (offset, lineno) in enumerate(starts):
+            if i + 1 < len(starts):
+                end = starts[i + 1][0]
+            else:
+                end = len(counts)
+            count = sum(counts[offset:end])
+            if count > 0:
+                key = (code.co_filename, lineno, code.co_name)
+                lines[key] = lines.get(key, 0) + count
+    result = [(count,) + key for key, count in lines.items()]
+    result.sort(reverse=True)
+    return result[:n]
+
+
+def report(profile, codes, n=20, file=None):
+    total = sum(profile[256]) or 1
+    print("Most common opcodes:", file=file)
+    for name, count in common_instructions(profile)[:n]:
+        print("%10d %5.1f%%  %s" % (count, 100.0 * count / total, name),
+              file=file)
+    print(file=file)
+    print("Most common pairs:", file=file)
+    for (first, second), count in common_pairs(profile)[:n]:
+        print("%10d %5.1f%%  %s, %s" %
+              (count, 100.0 * count / total, first, second), file=file)
+    print(file=file)
+    print("Hottest lines:", file=file)
+    for count, filename, lineno, name in hot_lines(codes, n):
+        print("%10d %5.1f%%  %s:%d (%s)" %
+              (count, 100.0 * count / total, filename, lineno, name),
+              file=file)
+
+
+def main():
+    import getopt
+    try:
+        opts, args = getopt.getopt(sys.argv[1:], "n:")
+    except getopt.error as msg:
+        sys.exit(msg)
+    if not args:
+        sys.exit(__doc__.strip())
+    n = 20
+    for opt, value in opts:
+        if opt == "-n":
+            n = int(value)
+
+    sys.argv = args
+    filename = args[0]
+    source = open(filename).read()
+    code = compile(source, filename, "exec")
+    sys.setdxp(True)
+    try:
+        exec(code, {"__name__": "__main__", "__file__": filename})
+    finally:
+        sys.setdxp(False)
+        report(sys.getdxp(), sys.getdxpcodes(), n)
+
+
+if __name__ == "__main__":
+    main()
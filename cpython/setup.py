@@ -626,15 +626,18 @@ class PyBuildExt(build_ext):
         else:
             missing.append('_hashlib')
 
-        if openssl_ver < 0x00908000:
-            # OpenSSL doesn't do these until 0.9.8 so we'll bring our own hash
-            exts.append( Extension('_sha256', ['sha256module.c']) )
-            exts.append( Extension('_sha512', ['sha512module.c']) )
-
-        if openssl_ver < 0x00907000:
-            # no openssl at all, use our own md5 and sha1
-            exts.append( Extension('_md5', ['md5module.c']) )
-            exts.append( Extension('_sha1', ['sha1module.c']) )
+        # Our own hashes are built even with OpenSSL, which has nothing like
+        # the multi-buffer hashing behind hashlib.hash_many() and tree.
+        # Otherwise they're only used where OpenSSL lacks the algorithm:
+        # sha224 to sha512 before 0.9.8, and everything without OpenSSL.
+        exts.append( Extension('_sha256', ['sha256module.c'],
+                               depends = ['hashmany.h', 'workerpool.h']) )
+        exts.append( Extension('_sha512', ['sha512module.c'],
+                               depends = ['hashmany.h', 'workerpool.h']) )
+        exts.append( Extension('_md5', ['md5module.c'],
+                               depends = ['hashmany.h', 'workerpool.h']) )
+        exts.append( Extension('_sha1', ['sha1module.c'],
+                               depends = ['hashmany.h', 'workerpool.h']) )
 
         # Modules that provide persistent dictionary-like semantics.  You will
         # probably want to arrange for at least one of them to be available on
@@ -1025,7 +1028,8 @@ class PyBuildExt(build_ext):
                         zlib_extra_link_args = ()
                     exts.append( Extension('zlib', ['zlibmodule.c'],
                                            libraries = ['z'],
-                                           extra_link_args = zlib_extra_link_args))
+                                           extra_link_args = zlib_extra_link_args,
+                                           depends = ['workerpool.h']))
                     have_zlib = True
                 else:
                     missing.append('zlib')
@@ -1057,7 +1061,8 @@ class PyBuildExt(build_ext):
                 bz2_extra_link_args = ()
             exts.append( Extension('bz2', ['bz2module.c'],
                                    libraries = ['bz2'],
-                                   extra_link_args = bz2_extra_link_args) )
+                                   extra_link_args = bz2_extra_link_args,
+                                   depends = ['workerpool.h']) )
         else:
             missing.append('bz2')
 
@@ -1112,6 +1117,7 @@ class PyBuildExt(build_ext):
 
         # _fileio -- supposedly cross platform
         exts.append(Extension('_fileio', ['_fileio.c']))
+        exts.append(Extension('_bufferedio', ['_bufferedio.c']))
 
         # Platform-specific libraries
         if platform in ('linux2', 'freebsd4', 'freebsd5', 'freebsd6',